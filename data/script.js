@@ -3,8 +3,12 @@ class PharmAssistApp {
     constructor() {
         this.currentUser = null;
         this.prescriptions = [];
+        this.history = [];
+        this.historyCursor = null;
+        this.historyPageSize = 20;
         this.notifications = [];
         this.patients = [];
+        this.medications = [];
         this.currentPage = 'prescriptionOrder';
         this.isMobileMenuOpen = false;
         this.maxMedications = 3; // Increased limit
@@ -80,15 +84,17 @@ class PharmAssistApp {
         await Promise.all([
             this.fetchPrescriptions(),
             this.fetchNotifications(),
-            this.fetchPatients()
+            this.fetchPatients(),
+            this.fetchMedications()
         ]);
         this.updateNotificationBadges();
         this.loadInitialData();
     }
 
+    // Active orders only; history is paged separately by loadPrescriptionHistory()
     async fetchPrescriptions() {
         try {
-            const res = await fetch('/api/prescriptions', { credentials: 'include' });
+            const res = await fetch('/api/prescriptions?status=pending,processing,dispensing,ready', { credentials: 'include' });
             const result = await res.json();
             if (result.success && Array.isArray(result.data)) {
                 this.prescriptions = result.data;
@@ -128,6 +134,28 @@ class PharmAssistApp {
         }
     }
 
+    // Medications the dispenser has a cabinet for
+    async fetchMedications() {
+        try {
+            const res = await fetch('/api/medications', { credentials: 'include' });
+            const result = await res.json();
+            this.medications = result.success && Array.isArray(result.data) ? result.data : [];
+        } catch {
+            this.medications = [];
+        }
+        this.populateMedicationSelects(document);
+    }
+
+    // Fills the medication selects under root, keeping each one's placeholder and choice
+    populateMedicationSelects(root) {
+        root.querySelectorAll('select[name="medicationName"]').forEach(select => {
+            const selected = select.value;
+            select.length = 1;
+            this.medications.forEach(med => select.add(new Option(med.name, med.name)));
+            select.value = selected;
+        });
+    }
+
     // Initialize event listeners
     initializeEventListeners() {
         // Prescription form
@@ -191,15 +219,6 @@ class PharmAssistApp {
                     <label class="form-label">Medication Name *</label>
                     <select name="medicationName" class="form-input" required>
                         <option value="">Select Medication</option>
-                        <option value="Medicine 1">Medicine 1</option>
-                        <option value="Medicine 2">Medicine 2</option>
-                        <option value="Medicine 3">Medicine 3</option>
-                        <option value="Medicine 4">Medicine 4</option>
-                        <option value="Medicine 5">Medicine 5</option>
-                        <option value="Medicine 6">Medicine 6</option>
-                        <option value="Medicine 7">Medicine 7</option>
-                        <option value="Medicine 8">Medicine 8</option>
-                        <option value="Medicine 9">Medicine 9</option>
                     </select>
                 </div>
                 <div class="form-col">
@@ -236,6 +255,7 @@ class PharmAssistApp {
         `;
 
         container.appendChild(medDiv);
+        this.populateMedicationSelects(medDiv);
 
         // Add event listener to remove button
         const removeBtn = medDiv.querySelector('.remove-medication-btn');
@@ -471,8 +491,9 @@ class PharmAssistApp {
     }
 
     generatePrescriptionId() {
+        // Only active orders are loaded, so a count would repeat IDs; use the clock instead
         const year = new Date().getFullYear();
-        const orderNumber = String(this.prescriptions.length + 1).padStart(3, '0');
+        const orderNumber = Date.now().toString(36).toUpperCase();
         return `RX-${year}-${orderNumber}`;
     }
 
@@ -493,20 +514,47 @@ class PharmAssistApp {
         container.innerHTML = activePrescriptions.map(rx => this.createPrescriptionCard(rx, true)).join('');
     }
 
-    loadPrescriptionHistory() {
-        const completedPrescriptions = this.prescriptions.filter(rx => 
-            ['dispensed', 'partially-dispensed', 'cancelled'].includes(rx.status)
-        );
-
+    // History is filtered and paged on the device; pass loadMore to append the next page
+    async loadPrescriptionHistory(loadMore = false) {
         const container = document.getElementById('historyOrdersList');
         if (!container) return;
 
-        if (completedPrescriptions.length === 0) {
-            container.innerHTML = this.createEmptyState('📚', 'No Prescription History', 'Completed prescriptions will appear here once they are dispensed.');
+        const dateFilter = document.getElementById('historyDateFilter')?.value;
+        const statusFilter = document.getElementById('historyStatusFilter')?.value;
+        const params = new URLSearchParams({
+            status: statusFilter || 'dispensed,partially-dispensed,cancelled,failed',
+            limit: this.historyPageSize
+        });
+        if (dateFilter) {
+            params.set('from', dateFilter);
+            params.set('to', dateFilter);
+        }
+        if (loadMore && this.historyCursor !== null) {
+            params.set('cursor', this.historyCursor);
+        }
+
+        try {
+            const res = await fetch(`/api/prescriptions?${params}`, { credentials: 'include' });
+            const result = await res.json();
+            const page = result.success && Array.isArray(result.data) ? result.data : [];
+            this.history = loadMore ? this.history.concat(page) : page;
+            this.historyCursor = result.nextCursor ?? null;
+        } catch {
+            if (!loadMore) this.history = [];
+            this.historyCursor = null;
+        }
+
+        if (this.history.length === 0) {
+            container.innerHTML = (dateFilter || statusFilter)
+                ? this.createEmptyState('🔍', 'No Results Found', 'No prescriptions match your current filters.')
+                : this.createEmptyState('📚', 'No Prescription History', 'Completed prescriptions will appear here once they are dispensed.');
             return;
         }
 
-        container.innerHTML = completedPrescriptions.map(rx => this.createPrescriptionCard(rx, false)).join('');
+        container.innerHTML = this.history.map(rx => this.createPrescriptionCard(rx, false)).join('');
+        if (this.historyCursor !== null) {
+            container.innerHTML += `<button class="btn btn-sm btn-secondary" onclick="app.loadPrescriptionHistory(true)">Load More</button>`;
+        }
     }
 
     loadNotifications() {
@@ -703,7 +751,8 @@ class PharmAssistApp {
             'ready': 'Ready for Collection',
             'dispensed': 'Dispensed',
             'partially-dispensed': 'Partially Dispensed',
-            'cancelled': 'Cancelled'
+            'cancelled': 'Cancelled',
+            'failed': 'Not Dispensed'
         };
         return statusNames[status] || status;
     }
@@ -736,9 +785,20 @@ class PharmAssistApp {
     async cancelPrescription(prescriptionId) {
         if (confirm('Are you sure you want to cancel this prescription order?')) {
             try {
-                await fetch(`/api/prescriptions/${prescriptionId}/cancel`, { method: 'POST', credentials: 'include' });
+                const res = await fetch(`/api/prescriptions/${prescriptionId}/cancel`, { method: 'POST', credentials: 'include' });
+                const result = await res.json().catch(() => ({}));
+                if (res.status === 202) {
+                    // Accepted: the dispenser side decides, give it a moment
+                    await new Promise(resolve => setTimeout(resolve, 500));
+                }
                 await this.fetchPrescriptions();
-                this.showNotification('Prescription cancelled.', 'warning');
+                if (res.ok && this.prescriptions.some(p => p.id === prescriptionId)) {
+                    this.showNotification('Too late to cancel, the order is already with the dispenser.', 'error');
+                } else if (res.ok) {
+                    this.showNotification('Prescription cancelled.', 'warning');
+                } else {
+                    this.showNotification(result.message || 'Failed to cancel prescription.', 'error');
+                }
                 this.refreshCurrentPage();
             } catch {
                 this.showNotification('Failed to cancel prescription.', 'error');
@@ -747,7 +807,8 @@ class PharmAssistApp {
     }
 
     viewRelatedOrder(orderId) {
-        const prescription = this.prescriptions.find(rx => rx.id === orderId);
+        const prescription = this.prescriptions.find(rx => rx.id === orderId)
+            || this.history.find(rx => rx.id === orderId);
         if (prescription) {
             if (['pending', 'processing', 'dispensing', 'ready'].includes(prescription.status)) {
                 this.showPage('activePrescriptions');
@@ -826,29 +887,8 @@ class PharmAssistApp {
 
     // Filtering methods
     filterHistory() {
-        const dateFilter = document.getElementById('historyDateFilter').value;
-        const statusFilter = document.getElementById('historyStatusFilter').value;
-        
-        let filtered = this.prescriptions.filter(rx => 
-            ['dispensed', 'partially-dispensed', 'cancelled'].includes(rx.status)
-        );
-        
-        if (dateFilter) {
-            filtered = filtered.filter(rx => rx.date === dateFilter);
-        }
-        
-        if (statusFilter) {
-            filtered = filtered.filter(rx => rx.status === statusFilter);
-        }
-        
-        const container = document.getElementById('historyOrdersList');
-        if (container) {
-            if (filtered.length === 0) {
-                container.innerHTML = this.createEmptyState('🔍', 'No Results Found', 'No prescriptions match your current filters.');
-            } else {
-                container.innerHTML = filtered.map(rx => this.createPrescriptionCard(rx, false)).join('');
-            }
-        }
+        this.historyCursor = null;
+        this.loadPrescriptionHistory();
     }
 
     // Utility methods
@@ -94,9 +94,34 @@ void AccelStepper::setCurrentPosition(long position)
     _speed = 0.0;
 }
 
+// Largest fixed point step size: leaves Equation 13 room to grow it fourfold
+#define FIXED_STEP_LIMIT 536870912.0 // 2^29
+
+// Microseconds to fixed point with the given fraction bits, or 0 if out of range
+static uint32_t toFixedStep(float us, uint8_t shift)
+{
+    double q = us * (double)(1UL << shift);
+    return (q >= 1.0 && q < FIXED_STEP_LIMIT) ? (uint32_t)q : 0;
+}
+
+// Picks as many fraction bits (up to 16) as _c0 allows, then rescales
+void AccelStepper::updateFixedPoint()
+{
+    _fixedShift = 16;
+    while (_fixedShift > 0 && _c0 * (double)(1UL << _fixedShift) >= FIXED_STEP_LIMIT)
+	_fixedShift--;
+    _fixedUnit = 1.0f / (1UL << _fixedShift);
+    _c0q = toFixedStep(_c0, _fixedShift);
+    _cnq = toFixedStep(_cn, _fixedShift);
+    _cminq = toFixedStep(_cmin, _fixedShift);
+}
+
 // Subclasses can override
 unsigned long AccelStepper::computeNewSpeed()
 {
+    if (_fixedPoint && _c0q && _cminq)
+	return computeNewSpeedFixed();
+
     long distanceTo = distanceToGo(); // +ve is clockwise from curent location
 
     long stepsToStop = (long)((_speed * _speed) / (2.0 * _acceleration)); // Equation 16
@@ -178,6 +203,77 @@ unsigned long AccelStepper::computeNewSpeed()
     return _stepInterval;
 }
 
+// Same decisions as computeNewSpeed(), with the step size in fixed point and
+// no double precision arithmetic
+unsigned long AccelStepper::computeNewSpeedFixed()
+{
+    long distanceTo = distanceToGo(); // +ve is clockwise from curent location
+
+    long stepsToStop = (long)((_speed * _speed) / (2.0f * _acceleration)); // Equation 16, single precision
+
+    if (distanceTo == 0 && stepsToStop <= 1)
+    {
+	// We are at the target and its time to stop
+	_stepInterval = 0;
+	_speed = 0.0;
+	_n = 0;
+	return _stepInterval;
+    }
+
+    if (distanceTo > 0)
+    {
+	if (_n > 0)
+	{
+	    if ((stepsToStop >= distanceTo) || _direction == DIRECTION_CCW)
+		_n = -stepsToStop; // Start deceleration
+	}
+	else if (_n < 0)
+	{
+	    if ((stepsToStop < distanceTo) && _direction == DIRECTION_CW)
+		_n = -_n; // Start accceleration
+	}
+    }
+    else if (distanceTo < 0)
+    {
+	if (_n > 0)
+	{
+	    if ((stepsToStop >= -distanceTo) || _direction == DIRECTION_CW)
+		_n = -stepsToStop; // Start deceleration
+	}
+	else if (_n < 0)
+	{
+	    if ((stepsToStop < -distanceTo) && _direction == DIRECTION_CCW)
+		_n = -_n; // Start accceleration
+	}
+    }
+
+    if (_n == 0)
+    {
+	// First step from stopped
+	_cnq = _c0q;
+	_direction = (distanceTo > 0) ? DIRECTION_CW : DIRECTION_CCW;
+    }
+    else
+    {
+	// Equation 13, rounded. Works for accel (n is +ve) and decel (n is -ve).
+	uint32_t divisor = (_n > 0) ? 4 * _n + 1 : -4 * _n - 1;
+	uint32_t change = (2 * _cnq + divisor / 2) / divisor;
+	if (_n > 0)
+	    _cnq -= change;
+	else
+	    _cnq += change;
+	if (_cnq < _cminq)
+	    _cnq = _cminq;
+    }
+    _n++;
+    _stepInterval = _cnq >> _fixedShift;
+    _cn = _cnq * _fixedUnit; // Keeps computeNewSpeed() able to take over
+    _speed = 1000000.0f / _cn;
+    if (_direction == DIRECTION_CCW)
+	_speed = -_speed;
+    return _stepInterval;
+}
+
 // Run the motor to implement speed and acceleration in order to proceed to the target position
 // You must call this at least once per step, preferably in your main loop
 // If the motor is in the desired position, the cost is very small
@@ -214,6 +310,12 @@ AccelStepper::AccelStepper(uint8_t interface, uint8_t pin1, uint8_t pin2, uint8_
     _cn = 0.0;
     _cmin = 1.0;
     _direction = DIRECTION_CCW;
+    _fixedPoint = false;
+    _fixedShift = 0;
+    _fixedUnit = 1.0;
+    _c0q = 0;
+    _cnq = 0;
+    _cminq = 0;
 
     int i;
     for (i = 0; i < 4; i++)
@@ -251,6 +353,12 @@ AccelStepper::AccelStepper(void (*forward)(), void (*backward)())
     _cn = 0.0;
     _cmin = 1.0;
     _direction = DIRECTION_CCW;
+    _fixedPoint = false;
+    _fixedShift = 0;
+    _fixedUnit = 1.0;
+    _c0q = 0;
+    _cnq = 0;
+    _cminq = 0;
 
     int i;
     for (i = 0; i < 4; i++)
@@ -268,6 +376,7 @@ void AccelStepper::setMaxSpeed(float speed)
     {
 	_maxSpeed = speed;
 	_cmin = 1000000.0 / speed;
+	updateFixedPoint();
 	// Recompute _n from current speed and adjust speed if accelerating or cruising
 	if (_n > 0)
 	{
@@ -294,6 +403,7 @@ void AccelStepper::setAcceleration(float acceleration)
 	_n = _n * (_acceleration / acceleration);
 	// New c0 per Equation 7, with correction per Equation 15
 	_c0 = 0.676 * sqrt(2.0 / acceleration) * 1000000.0; // Equation 15
+	updateFixedPoint();
 	_acceleration = acceleration;
 	computeNewSpeed();
     }
@@ -304,6 +414,18 @@ float   AccelStepper::acceleration()
     return _acceleration;
 }
 
+void AccelStepper::setFixedPoint(bool enable)
+{
+    // Both calculations keep _cn current, so a move in progress carries on smoothly
+    _fixedPoint = enable;
+    updateFixedPoint();
+}
+
+bool AccelStepper::fixedPoint()
+{
+    return _fixedPoint;
+}
+
 void AccelStepper::setSpeed(float speed)
 {
     if (speed == _speed)
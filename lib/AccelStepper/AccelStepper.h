@@ -554,6 +554,19 @@ public:
     /// \return true if the speed is not zero or not at the target position
     bool    isRunning();
 
+    /// Selects integer arithmetic for the per-step speed calculation in run().
+    /// The float calculation does several double precision multiplies and divides per step,
+    /// which the ESP32 FPU cannot do in hardware. The fixed point version keeps step sizes as
+    /// integers, in 1/65536 microsecond units or as fine as the acceleration allows, and needs
+    /// one integer divide and two single precision divides per step. Step times match the float
+    /// calculation to within a small fraction of the move time.
+    /// Settings too extreme for 32 bit fixed point silently use the float calculation.
+    /// \param[in] enable true to use fixed point, false (the default) for the float calculation
+    void    setFixedPoint(bool enable = true);
+
+    /// \return true if setFixedPoint() has selected the integer speed calculation
+    bool    fixedPoint();
+
     /// Virtual destructor to prevent warnings during delete
     virtual ~AccelStepper() {};
 protected:
@@ -577,6 +590,13 @@ protected:
     /// \return the new step interval
     virtual unsigned long  computeNewSpeed();
 
+    /// The fixed point version of computeNewSpeed(), used when setFixedPoint() is enabled
+    /// \return the new step interval
+    unsigned long  computeNewSpeedFixed();
+
+    /// Rescales the fixed point step sizes after _c0, _cn or _cmin change
+    void           updateFixedPoint();
+
     /// Low level function to set the motor output pins
     /// bit 0 of the mask corresponds to _pin[0]
     /// bit 1 of the mask corresponds to _pin[1]
@@ -656,6 +676,12 @@ protected:
     /// 0 means the motor is currently stopped with _speed == 0
     unsigned long  _stepInterval;
 
+    /// MultiStepper steps follower axes directly and sets their target
+    friend class MultiStepper;
+
+    /// StepTimer uses the speed calculations to plan steps for a timer interrupt
+    friend class StepTimer;
+
 private:
     /// Number of pins on the stepper motor. Permits 2 or 4. 2 pins is a
     /// bipolar, and 4 pins is a unipolar.
@@ -724,6 +750,19 @@ private:
     /// Min step size in microseconds based on maxSpeed
     float _cmin; // at max speed
 
+    /// Use computeNewSpeedFixed()
+    bool     _fixedPoint;
+
+    /// Fraction bits in the fixed point step sizes, and the microseconds per unit
+    uint8_t  _fixedShift;
+    float    _fixedUnit;
+
+    /// _c0, _cn and _cmin in fixed point, for computeNewSpeedFixed().
+    /// 0 means out of fixed point range
+    uint32_t _c0q;
+    uint32_t _cnq;
+    uint32_t _cminq;
+
 };
 
 /// @example Random.pde
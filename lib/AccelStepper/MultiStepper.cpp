@@ -0,0 +1,152 @@
+// MultiStepper.cpp
+
+#include "MultiStepper.h"
+#include "AccelStepper.h"
+
+MultiStepper::MultiStepper()
+    : _num_steppers(0),
+      _leader(-1),
+      _leaderStart(0),
+      _leaderSteps(0),
+      _leaderDistance(0),
+      _leaderMaxSpeed(0.0),
+      _leaderAcceleration(0.0)
+{
+}
+
+boolean MultiStepper::addStepper(AccelStepper& stepper)
+{
+    if (_num_steppers >= MULTISTEPPER_MAX_STEPPERS)
+	return false; // No room for more
+    _steppers[_num_steppers++] = &stepper;
+    return true;
+}
+
+void MultiStepper::moveTo(long absolute[])
+{
+    if (_leader >= 0)
+	finish();
+
+    // The stepper with the longest move leads
+    uint8_t i;
+    long longest = 0;
+    for (i = 0; i < _num_steppers; i++)
+    {
+	long thisDistance = absolute[i] - _steppers[i]->currentPosition();
+	_distance[i] = labs(thisDistance);
+	_direction[i] = thisDistance >= 0 ? 1 : -1;
+	_error[i] = 0;
+	if (_distance[i] > longest)
+	{
+	    longest = _distance[i];
+	    _leader = i;
+	}
+    }
+    if (_leader < 0)
+	return; // Already there
+
+    // Scale the leader so no follower exceeds its own limits. A follower moving
+    // d steps while the leader moves D runs at d/D of the leader's speed and
+    // acceleration.
+    AccelStepper* leader = _steppers[_leader];
+    _leaderMaxSpeed = leader->maxSpeed();
+    _leaderAcceleration = leader->acceleration();
+    float maxSpeed = _leaderMaxSpeed;
+    float acceleration = _leaderAcceleration;
+    for (i = 0; i < _num_steppers; i++)
+    {
+	if (i == _leader || _distance[i] == 0)
+	    continue;
+	float ratio = (float)longest / (float)_distance[i];
+	maxSpeed = min(maxSpeed, _steppers[i]->maxSpeed() * ratio);
+	acceleration = min(acceleration, _steppers[i]->acceleration() * ratio);
+    }
+
+    _leaderStart = leader->currentPosition();
+    _leaderSteps = 0;
+    _leaderDistance = longest;
+    leader->setMaxSpeed(maxSpeed);
+    leader->setAcceleration(acceleration);
+    leader->moveTo(absolute[_leader]);
+
+    // Followers are stepped directly, never through their own run()
+    for (i = 0; i < _num_steppers; i++)
+	if (i != _leader)
+	    _steppers[i]->_targetPos = absolute[i];
+}
+
+boolean MultiStepper::run()
+{
+    if (_leader < 0)
+	return false;
+
+    AccelStepper* leader = _steppers[_leader];
+    boolean running = leader->run();
+
+    // Bresenham: each leader step advances every follower by distance/longest
+    long leaderSteps = labs(leader->currentPosition() - _leaderStart);
+    while (_leaderSteps < leaderSteps)
+    {
+	_leaderSteps++;
+	for (uint8_t i = 0; i < _num_steppers; i++)
+	{
+	    if (i == _leader || _distance[i] == 0)
+		continue;
+	    _error[i] += _distance[i];
+	    if (2 * _error[i] >= _leaderDistance)
+	    {
+		_error[i] -= _leaderDistance;
+		if (_direction[i] > 0)
+		    _steppers[i]->stepForward();
+		else
+		    _steppers[i]->stepBackward();
+	    }
+	}
+    }
+
+    if (!running)
+    {
+	finish();
+	return false;
+    }
+    return true;
+}
+
+// Blocks until all steppers reach their target position and are stopped
+void MultiStepper::runToPosition()
+{
+    while (run())
+	YIELD; // Let system housekeeping occur
+}
+
+void MultiStepper::stop()
+{
+    if (_leader < 0)
+	return;
+
+    AccelStepper* leader = _steppers[_leader];
+    long target = leader->targetPosition();
+    leader->stop();
+    // Never let the stopping distance carry the leader past the original
+    // target, or the followers would overshoot theirs too
+    if (labs(leader->targetPosition() - _leaderStart) > _leaderDistance)
+	leader->moveTo(target);
+}
+
+boolean MultiStepper::isRunning()
+{
+    return _leader >= 0;
+}
+
+void MultiStepper::finish()
+{
+    AccelStepper* leader = _steppers[_leader];
+    leader->setMaxSpeed(_leaderMaxSpeed);
+    leader->setAcceleration(_leaderAcceleration);
+
+    // After stop() the followers end short of their targets
+    for (uint8_t i = 0; i < _num_steppers; i++)
+	if (i != _leader)
+	    _steppers[i]->_targetPos = _steppers[i]->currentPosition();
+    _leader = -1;
+}
@@ -0,0 +1,110 @@
+// MultiStepper.h
+
+#ifndef MultiStepper_h
+#define MultiStepper_h
+
+#include <stdlib.h>
+#if ARDUINO >= 100
+#include <Arduino.h>
+#else
+#include <WProgram.h>
+#include <wiring.h>
+#endif
+
+#define MULTISTEPPER_MAX_STEPPERS 10
+
+class AccelStepper;
+
+/////////////////////////////////////////////////////////////////////
+/// \class MultiStepper MultiStepper.h <MultiStepper.h>
+/// \brief Operate multiple AccelSteppers in a co-ordinated fashion
+///
+/// This class can manage multiple AccelSteppers (up to MULTISTEPPER_MAX_STEPPERS = 10),
+/// and cause them all to move
+/// to selected positions so that they all start and arrive at their
+/// target position at the same time, travelling along a straight line. Suitable for X-Y flatbeds etc.
+///
+/// Unlike the constant speed MultiStepper of AccelStepper 1.48, moves accelerate and decelerate.
+/// The stepper with the longest distance to travel (the leader) runs the usual AccelStepper
+/// trapezoidal profile. Its speed and acceleration are scaled down where needed so that no other
+/// stepper exceeds its own maxSpeed() or acceleration(). The other steppers follow the leader
+/// with a Bresenham line, taking their steps in proportion, so every axis shares the same
+/// profile shape and there is no dog-leg at the end of the shorter axis.
+///
+/// Each stepper keeps the maxSpeed() and acceleration() set by the caller; the scaled values are
+/// only applied to the leader for the duration of a move.
+class MultiStepper
+{
+public:
+    /// Constructor
+    MultiStepper();
+
+    /// Add a stepper to the set of managed steppers
+    /// There is an upper limit of MULTISTEPPER_MAX_STEPPERS = 10 to the number of steppers that can be managed
+    /// \param[in] stepper Reference to a stepper to add to the managed list
+    /// \return true if successful. false if the number of managed steppers would exceed MULTISTEPPER_MAX_STEPPERS
+    boolean addStepper(AccelStepper& stepper);
+
+    /// Set the target positions of all managed steppers
+    /// according to a coordinate array.
+    /// New speeds and accelerations will be computed for each stepper so they will all arrive at their
+    /// respective targets at very close to the same time.
+    /// Do not call while a move is still running.
+    /// \param[in] absolute An array of desired absolute stepper positions. absolute[0] will be used to set
+    /// the absolute position of the first stepper added by addStepper() etc. The array must be at least as long as
+    /// the number of steppers that have been added by addStepper, else results are undefined.
+    void moveTo(long absolute[]);
+
+    /// Calls run() on the leading stepper and steps the others in proportion.
+    /// You must call this at least once per step of the leading stepper,
+    /// preferably in your main loop.
+    /// \return true if any stepper is still running to its target position.
+    boolean run();
+
+    /// Runs all managed steppers until they achieve their target position.
+    /// Blocks until all that position is achieved. If you dont
+    /// want blocking consider using run() instead.
+    void    runToPosition();
+
+    /// Decelerates all managed steppers to a stop as quickly as the leader's
+    /// scaled acceleration allows, staying on the same straight line.
+    void    stop();
+
+    /// \return true while a move started by moveTo() has not finished
+    boolean isRunning();
+
+private:
+    /// Finishes a move: restores the leader's limits and settles the followers' targets
+    void    finish();
+
+    /// Array of pointers to the steppers we are controlling.
+    /// Fills from 0 onwards
+    AccelStepper* _steppers[MULTISTEPPER_MAX_STEPPERS];
+
+    /// Number of steppers we are controlling and the number
+    /// of steppers in _steppers[]
+    uint8_t       _num_steppers;
+
+    /// Index of the stepper with the longest move, or -1 when idle
+    int8_t        _leader;
+
+    /// Leader position when the move started, to count its steps
+    long          _leaderStart;
+
+    /// Leader steps already handed to the followers
+    long          _leaderSteps;
+
+    /// Total leader steps of the move (absolute)
+    long          _leaderDistance;
+
+    /// Per stepper: absolute distance and direction of this move, and Bresenham error term
+    long          _distance[MULTISTEPPER_MAX_STEPPERS];
+    int8_t        _direction[MULTISTEPPER_MAX_STEPPERS];
+    long          _error[MULTISTEPPER_MAX_STEPPERS];
+
+    /// The leader's own limits, restored by finish()
+    float         _leaderMaxSpeed;
+    float         _leaderAcceleration;
+};
+
+#endif
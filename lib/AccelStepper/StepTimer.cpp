@@ -0,0 +1,190 @@
+// StepTimer.cpp
+
+#include "StepTimer.h"
+
+#if defined(ARDUINO_ARCH_ESP32)
+
+#include <esp_arduino_version.h>
+#include <esp_rom_sys.h>
+#include <soc/gpio_struct.h>
+
+StepTimer* StepTimer::_instances[STEP_TIMER_MAX] = {0};
+
+// digitalWrite() is not guaranteed to be in IRAM; write the GPIO registers directly
+static inline void IRAM_ATTR writePin(uint8_t pin, bool high)
+{
+    if (pin < 32)
+    {
+	if (high)
+	    GPIO.out_w1ts = 1u << pin;
+	else
+	    GPIO.out_w1tc = 1u << pin;
+    }
+    else
+    {
+	if (high)
+	    GPIO.out1_w1ts.val = 1u << (pin - 32);
+	else
+	    GPIO.out1_w1tc.val = 1u << (pin - 32);
+    }
+}
+
+StepTimer::StepTimer(AccelStepper& stepper)
+    : _stepper(stepper),
+      _timer(NULL),
+      _stepPin(0),
+      _dirPin(0),
+      _stepInverted(false),
+      _dirInverted(false),
+      _pulseWidth(1)
+{
+}
+
+template <uint8_t N> void IRAM_ATTR StepTimer::isr()
+{
+    _instances[N]->onAlarm();
+}
+
+void IRAM_ATTR StepTimer::isrArg(void* arg)
+{
+    ((StepTimer*)arg)->onAlarm();
+}
+
+boolean StepTimer::begin(uint8_t timerNumber)
+{
+    if (timerNumber >= STEP_TIMER_MAX || _instances[timerNumber] || _timer)
+	return false;
+    if (_stepper._interface != AccelStepper::DRIVER)
+	return false;
+
+    _stepPin = _stepper._pin[0];
+    _dirPin = _stepper._pin[1];
+    _stepInverted = _stepper._pinInverted[0];
+    _dirInverted = _stepper._pinInverted[1];
+    _pulseWidth = _stepper._minPulseWidth;
+    _engine.setCurrentPosition(_stepper.currentPosition());
+
+    // 1 tick per microsecond, the same unit as AccelStepper's step intervals
+#if ESP_ARDUINO_VERSION_MAJOR >= 3
+    _timer = timerBegin(1000000);
+    if (!_timer)
+	return false;
+    timerAttachInterruptArg(_timer, isrArg, this);
+#else
+    static void (*const trampolines[STEP_TIMER_MAX])() = {isr<0>, isr<1>, isr<2>, isr<3>};
+    _timer = timerBegin(timerNumber, 80, true);
+    if (!_timer)
+	return false;
+    timerAttachInterrupt(_timer, trampolines[timerNumber], true);
+#endif
+    _instances[timerNumber] = this;
+    return true;
+}
+
+// Arms a one-shot alarm at an absolute tick. The counter is 64 bits and
+// never reset, so only the low 32 bits need to be reconciled.
+void IRAM_ATTR StepTimer::arm(uint32_t alarm)
+{
+    uint64_t now = timerRead(_timer);
+    int32_t ahead = (int32_t)(alarm - (uint32_t)now);
+    if (ahead < STEP_TIMER_MIN_TICKS)
+    {
+	alarm = _engine.late((uint32_t)now, STEP_TIMER_MIN_TICKS);
+	ahead = STEP_TIMER_MIN_TICKS;
+    }
+#if ESP_ARDUINO_VERSION_MAJOR >= 3
+    timerAlarm(_timer, now + ahead, false, 0);
+#else
+    timerAlarmWrite(_timer, now + ahead, false);
+    timerAlarmEnable(_timer);
+#endif
+}
+
+void IRAM_ATTR StepTimer::onAlarm()
+{
+    StepPulse pulse;
+    uint32_t next;
+    bool more = _engine.onAlarm(pulse, next);
+
+    if (pulse.directionChanged)
+    {
+	writePin(_dirPin, pulse.forward ^ _dirInverted);
+	esp_rom_delay_us(STEP_TIMER_DIR_SETUP_US);
+    }
+    writePin(_stepPin, !_stepInverted);
+    esp_rom_delay_us(_pulseWidth);
+    writePin(_stepPin, _stepInverted);
+
+    if (more)
+	arm(next);
+}
+
+void StepTimer::fill()
+{
+    if (!_timer)
+	return;
+
+    // AccelStepper keeps the wait before its next step in _stepInterval and
+    // recomputes it after every step; replay that without touching the pins
+    while (_stepper._stepInterval && _engine.queue.space() > 0)
+    {
+	bool forward = _stepper._direction == AccelStepper::DIRECTION_CW;
+	_engine.queue.push(_stepper._stepInterval, forward);
+	if (forward)
+	    _stepper._currentPos += 1;
+	else
+	    _stepper._currentPos -= 1;
+	_stepper.computeNewSpeed();
+    }
+    _engine.setPlanning(_stepper._stepInterval != 0);
+
+    // The interrupt only stops itself once the queue is empty, so when it is
+    // not running nothing else touches the consumer side
+    uint32_t first;
+    if (!_engine.isRunning() && _engine.start((uint32_t)timerRead(_timer), first))
+	arm(first);
+}
+
+void StepTimer::moveTo(long absolute)
+{
+    _stepper.moveTo(absolute);
+    fill();
+}
+
+void StepTimer::move(long relative)
+{
+    _stepper.move(relative);
+    fill();
+}
+
+void StepTimer::stop()
+{
+    _stepper.stop();
+    fill();
+}
+
+boolean StepTimer::isRunning()
+{
+    return _engine.isRunning() || _engine.queue.count() > 0 || _stepper._stepInterval != 0;
+}
+
+long StepTimer::currentPosition()
+{
+    return _engine.currentPosition();
+}
+
+void StepTimer::setCurrentPosition(long position)
+{
+    if (_engine.isRunning())
+	return;
+    _engine.queue.clear();
+    _stepper.setCurrentPosition(position);
+    _engine.setCurrentPosition(position);
+}
+
+uint32_t StepTimer::underruns()
+{
+    return _engine.underrunCount();
+}
+
+#endif
@@ -0,0 +1,85 @@
+// StepTimer.h
+
+#ifndef StepTimer_h
+#define StepTimer_h
+
+#if defined(ARDUINO_ARCH_ESP32)
+
+#include "AccelStepper.h"
+#include "Step_Queue.h"
+
+#define STEP_TIMER_MAX 4              // one hardware timer per stepper
+#define STEP_TIMER_MIN_TICKS 4        // us; closest an alarm can be armed from inside the interrupt
+#define STEP_TIMER_DIR_SETUP_US 1     // DIR to STEP setup time (A4988 200 ns, DRV8825 650 ns)
+
+/////////////////////////////////////////////////////////////////////
+/// \class StepTimer StepTimer.h <StepTimer.h>
+/// \brief Hardware timer step generation for an AccelStepper (ESP32 only)
+///
+/// Instead of calling run() as often as possible, the AccelStepper is used
+/// as a planner: fill() asks it for the next step intervals, exactly as run()
+/// would compute them, and queues them in a StepQueue. A hardware timer
+/// interrupt then pulses the STEP pin at those intervals, so the step rate
+/// and jitter no longer depend on web, serial or SD work in loop().
+///
+/// Only AccelStepper::DRIVER steppers are supported. The stepper's own
+/// currentPosition() runs ahead of the motor by up to STEP_QUEUE_SIZE steps;
+/// use StepTimer::currentPosition() for the position on the pins. moveTo()
+/// and stop() take effect after the steps already queued.
+///
+/// fill() must be called at least once per STEP_QUEUE_SIZE steps' worth of
+/// time (about 50 ms at 5000 steps/s with the default queue). If it is late
+/// the motor pauses rather than losing steps, and underruns() counts it.
+class StepTimer
+{
+public:
+    /// \param[in] stepper A DRIVER stepper whose maxSpeed and acceleration are already set
+    StepTimer(AccelStepper& stepper);
+
+    /// Claims hardware timer timerNumber (0 to 3) and attaches the interrupt.
+    /// \return false if the timer is taken or the stepper is not a DRIVER
+    boolean begin(uint8_t timerNumber);
+
+    /// Same as AccelStepper::moveTo() / move(), followed by fill()
+    void    moveTo(long absolute);
+    void    move(long relative);
+
+    /// Decelerates to a stop using the stepper's acceleration
+    void    stop();
+
+    /// Plans ahead and tops up the step queue, starting the timer if it is idle
+    void    fill();
+
+    /// \return true while steps are queued or still being planned
+    boolean isRunning();
+
+    /// Position of the steps actually sent to the driver
+    long    currentPosition();
+
+    /// Resets both the motor and the planner position. Only while stopped.
+    void    setCurrentPosition(long position);
+
+    /// Number of times the queue ran dry mid-move
+    uint32_t underruns();
+
+private:
+    void    onAlarm();
+    void    arm(uint32_t alarm);
+
+    template <uint8_t N> static void isr();
+    static void isrArg(void* arg);
+    static StepTimer* _instances[STEP_TIMER_MAX];
+
+    AccelStepper&    _stepper;
+    hw_timer_t*      _timer;
+    StepPulseEngine  _engine;
+    uint8_t          _stepPin;
+    uint8_t          _dirPin;
+    bool             _stepInverted;
+    bool             _dirInverted;
+    unsigned int     _pulseWidth;
+};
+
+#endif
+
+#endif
@@ -0,0 +1,81 @@
+#include "Asset_Cache.h"
+#include <rom/crc.h>
+
+// Global instance
+AssetCache Assets;
+
+AssetCache::AssetCache() : storage(nullptr), entryCount(0), lock(nullptr) {}
+
+void AssetCache::begin(StorageManager& storageManager) {
+  storage = &storageManager;
+  if (!lock) lock = xSemaphoreCreateMutex();
+  clear();
+}
+
+void AssetCache::clear() {
+  if (lock) xSemaphoreTake(lock, portMAX_DELAY);
+  for (uint8_t i = 0; i < entryCount; i++) entries[i].path = "";
+  entryCount = 0;
+  if (lock) xSemaphoreGive(lock);
+}
+
+bool AssetCache::describe(const String& path, AssetVariant& variant) {
+  variant.present = false;
+  variant.size = 0;
+  variant.etag[0] = '\0';
+
+  if (!storage->exists(path)) return false;
+  File file = storage->open(path, "r");
+  if (!file) return false;
+
+  uint8_t buffer[512];
+  uint32_t crc = 0;
+  uint32_t size = 0;
+  size_t n;
+  while ((n = file.read(buffer, sizeof(buffer))) > 0) {
+    crc = crc32_le(crc, buffer, n);
+    size += n;
+  }
+  file.close();
+
+  variant.present = true;
+  variant.size = size;
+  snprintf(variant.etag, sizeof(variant.etag), "\"%08x-%x\"", (unsigned)crc, (unsigned)size);
+  return true;
+}
+
+const AssetInfo* AssetCache::lookup(const String& path) {
+  if (!storage || !storage->isInitialized()) return nullptr;
+
+  xSemaphoreTake(lock, portMAX_DELAY);
+  for (uint8_t i = 0; i < entryCount; i++) {
+    if (entries[i].path == path) {
+      bool found = entries[i].plain.present || entries[i].gzip.present;
+      xSemaphoreGive(lock);
+      return found ? &entries[i] : nullptr;
+    }
+  }
+
+  if (entryCount >= ASSET_CACHE_MAX_ENTRIES) {
+    xSemaphoreGive(lock);
+    Serial.println("AssetCache: Table full, not caching " + path);
+    return nullptr;
+  }
+
+  AssetInfo& info = entries[entryCount];
+  describe(path, info.plain);
+  describe(path + ".gz", info.gzip);
+  info.path = path;
+  entryCount++;
+  xSemaphoreGive(lock);
+
+  if (!info.plain.present && !info.gzip.present) {
+    Serial.printf("AssetCache: %s not found\n", path.c_str());
+    return nullptr;
+  }
+
+  Serial.printf("AssetCache: %s plain %s (%u bytes), gzip %s (%u bytes)\n", path.c_str(),
+                info.plain.present ? info.plain.etag : "-", (unsigned)info.plain.size,
+                info.gzip.present ? info.gzip.etag : "-", (unsigned)info.gzip.size);
+  return &info;
+}
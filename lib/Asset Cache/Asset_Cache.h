@@ -0,0 +1,56 @@
+#ifndef ASSET_CACHE_H
+#define ASSET_CACHE_H
+
+#include <Arduino.h>
+#include "Storage_Manager.h"
+
+// Metadata cache for static web assets.
+//
+// For each asset the first request records whether a pre-gzipped "<path>.gz"
+// exists (see scripts/gzip_assets.py) and derives a strong ETag from the CRC32
+// and size of each variant. Later requests are answered from this table, so a
+// conditional request that ends in 304 Not Modified touches no file at all.
+// A missing asset is remembered too (both variants absent), so requests for
+// it, /favicon.ico on every page load for one, do not probe storage again.
+// Assets are assumed not to change while the device is running; clear()
+// forgets everything.
+
+#define ASSET_CACHE_MAX_ENTRIES 16
+
+struct AssetVariant {
+  bool present;
+  uint32_t size;
+  char etag[24];              // quoted, e.g. "\"1a2b3c4d-5e6f\""
+};
+
+struct AssetInfo {
+  String path;                // as requested, e.g. "/styles.css"
+  AssetVariant plain;
+  AssetVariant gzip;          // path + ".gz"
+};
+
+class AssetCache {
+private:
+  StorageManager* storage;
+  AssetInfo entries[ASSET_CACHE_MAX_ENTRIES];
+  uint8_t entryCount;
+  SemaphoreHandle_t lock;
+
+  bool describe(const String& path, AssetVariant& variant);
+
+public:
+  AssetCache();
+
+  void begin(StorageManager& storageManager);
+  void clear();
+
+  // Returns cached metadata for path, probing storage on first use.
+  // Returns nullptr when neither variant exists or the table is full.
+  // Paths are cached either way, so only pass the fixed set the routes serve.
+  const AssetInfo* lookup(const String& path);
+};
+
+// Global instance
+extern AssetCache Assets;
+
+#endif
@@ -0,0 +1,211 @@
+#include "Async_Log.h"
+#include "Storage_Manager.h"
+
+AsyncLog Log;
+
+#define LOG_BATCH_SIZE 512          // bytes handed to Serial and the file per write
+
+static inline uint32_t atomicLoad(const uint32_t* value) {
+  return __atomic_load_n(value, __ATOMIC_RELAXED);
+}
+
+static inline void atomicAdd(uint32_t* value, uint32_t n) {
+  __atomic_fetch_add(value, n, __ATOMIC_RELAXED);
+}
+
+AsyncLog::AsyncLog()
+  : enqueuePos(0), dequeuePos(0), level(LOG_LEVEL), droppedReported(0), out(nullptr), task(nullptr),
+    fileStorage(nullptr), fileLimit(0) {
+  memset(&stats, 0, sizeof(stats));
+  for (uint32_t i = 0; i < LOG_RING_SIZE; i++) ring[i].sequence = i;
+}
+
+bool AsyncLog::begin(Print& output, bool startTask) {
+  out = &output;
+  if (!startTask || task) return true;
+  if (xTaskCreate(taskMain, "log", LOG_TASK_STACK, this, LOG_TASK_PRIORITY, &task) != pdPASS) {
+    task = nullptr;
+    output.println("AsyncLog: Failed to start the log task, lines will be written by flush() only");
+    return false;
+  }
+  return true;
+}
+
+void AsyncLog::taskMain(void* arg) {
+  AsyncLog* self = (AsyncLog*)arg;
+  for (;;) {
+    ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(LOG_TASK_PERIOD));
+    self->drain();
+  }
+}
+
+void AsyncLog::write(uint8_t messageLevel, LogSite& site, const char* format, ...) {
+  if (messageLevel > level) return;
+
+  // The window and count are updated without a lock; two tasks racing at a
+  // window boundary can let a line or two more through, which is harmless
+  uint32_t now = millis();
+  uint32_t start = atomicLoad(&site.windowStart);
+  if (now - start >= LOG_RATE_WINDOW &&
+      __atomic_compare_exchange_n(&site.windowStart, &start, now, false, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+    __atomic_store_n(&site.count, 0, __ATOMIC_RELAXED);
+  }
+  if (__atomic_fetch_add(&site.count, 1, __ATOMIC_RELAXED) >= LOG_RATE_BURST) {
+    atomicAdd(&site.suppressed, 1);
+    atomicAdd(&stats.suppressed, 1);
+    return;
+  }
+
+  uint32_t skipped = __atomic_exchange_n(&site.suppressed, 0, __ATOMIC_RELAXED);
+  va_list args;
+  va_start(args, format);
+  bool queued = push(messageLevel, skipped, format, args);
+  va_end(args);
+  if (!queued) {
+    if (skipped > 0) atomicAdd(&site.suppressed, skipped);
+    return;
+  }
+  if (task) xTaskNotifyGive(task);
+}
+
+// Bounded multi-producer ring. Each slot's sequence says which ring position
+// it is free for: a producer claims position pos by moving enqueuePos on only
+// if the slot's sequence equals pos, fills the slot, then publishes it by
+// setting the sequence to pos + 1. The drain task reads a slot once its
+// sequence is dequeuePos + 1 and hands it back as pos + LOG_RING_SIZE.
+bool AsyncLog::push(uint8_t messageLevel, uint32_t skipped, const char* format, va_list args) {
+  uint32_t pos = atomicLoad(&enqueuePos);
+  LogRecord* record;
+  for (;;) {
+    record = &ring[pos & (LOG_RING_SIZE - 1)];
+    uint32_t sequence = __atomic_load_n(&record->sequence, __ATOMIC_ACQUIRE);
+    int32_t diff = (int32_t)(sequence - pos);
+    if (diff == 0) {
+      if (__atomic_compare_exchange_n(&enqueuePos, &pos, pos + 1, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) break;
+    } else if (diff < 0) {
+      atomicAdd(&stats.dropped, 1);
+      return false;
+    } else {
+      pos = atomicLoad(&enqueuePos);
+    }
+  }
+
+  record->millis = millis();
+  record->level = messageLevel;
+  vsnprintf(record->text, sizeof(record->text), format, args);
+  if (skipped > 0) {
+    size_t length = strlen(record->text);
+    snprintf(record->text + length, sizeof(record->text) - length, " (%lu more suppressed)",
+             (unsigned long)skipped);
+  }
+  __atomic_store_n(&record->sequence, pos + 1, __ATOMIC_RELEASE);
+  return true;
+}
+
+const char* AsyncLog::levelName(uint8_t messageLevel) {
+  static const char* const names[] = {"NONE", "ERROR", "WARN", "INFO", "DEBUG"};
+  return messageLevel <= LOG_LEVEL_DEBUG ? names[messageLevel] : "?";
+}
+
+size_t AsyncLog::formatLine(const LogRecord& record, char* line, size_t size) {
+  int n = snprintf(line, size, "[%lu.%03lu %c] %s\n", (unsigned long)(record.millis / 1000),
+                   (unsigned long)(record.millis % 1000), levelName(record.level)[0], record.text);
+  if (n < 0) return 0;
+  if ((size_t)n >= size) {
+    // Cut messages still end their line
+    n = size - 1;
+    line[n - 1] = '\n';
+  }
+  return n;
+}
+
+size_t AsyncLog::drain() {
+  if (!out) return 0;
+  char batch[LOG_BATCH_SIZE];
+  size_t batchLength = 0;
+  size_t lines = 0;
+
+  uint32_t dropped = atomicLoad(&stats.dropped);
+  if (dropped != droppedReported) {
+    batchLength = snprintf(batch, sizeof(batch), "[%lu.%03lu W] %lu log lines dropped, ring full\n",
+                           (unsigned long)(millis() / 1000), (unsigned long)(millis() % 1000),
+                           (unsigned long)(dropped - droppedReported));
+    droppedReported = dropped;
+  }
+
+  for (;;) {
+    uint32_t pos = dequeuePos;
+    LogRecord& record = ring[pos & (LOG_RING_SIZE - 1)];
+    bool ready = __atomic_load_n(&record.sequence, __ATOMIC_ACQUIRE) == pos + 1;
+    if (ready && sizeof(batch) - batchLength >= LOG_LINE_SIZE + 24) {
+      batchLength += formatLine(record, batch + batchLength, sizeof(batch) - batchLength);
+      // Slot is free for the producer one lap ahead
+      __atomic_store_n(&record.sequence, pos + LOG_RING_SIZE, __ATOMIC_RELEASE);
+      __atomic_store_n(&dequeuePos, pos + 1, __ATOMIC_RELAXED);
+      lines++;
+      continue;
+    }
+    if (batchLength == 0) break;
+    out->write((const uint8_t*)batch, batchLength);     // blocks this task only
+    appendToFile(batch, batchLength);
+    batchLength = 0;
+  }
+
+  atomicAdd(&stats.written, lines);
+  return lines;
+}
+
+void AsyncLog::flush() {
+  if (!task) {
+    drain();
+    return;
+  }
+  xTaskNotifyGive(task);
+  while (pending() > 0) vTaskDelay(1);
+}
+
+bool AsyncLog::mirrorToFile(StorageManager& storage, const String& path, uint32_t maxBytes) {
+  if (task) return false;
+  if (maxBytes == 0 || !storage.isInitialized()) {
+    fileStorage = nullptr;
+    return maxBytes == 0;
+  }
+  filePath = path;
+  fileLimit = maxBytes;
+  stats.fileBytes = storage.exists(path) ? storage.getFileSize(path) : 0;
+  fileStorage = &storage;
+  return true;
+}
+
+void AsyncLog::appendToFile(const char* data, size_t length) {
+  if (!fileStorage) return;
+  if (stats.fileBytes + length > fileLimit) {
+    String previous = filePath + ".1";
+    fileStorage->remove(previous);
+    fileStorage->rename(filePath, previous);
+    stats.fileBytes = 0;
+  }
+
+  File file = fileStorage->open(filePath, FILE_APPEND);
+  if (!file) {
+    // Printing here rather than logging, the failure would only come back round
+    if (out) out->println("AsyncLog: Failed to open " + filePath + ", file logging stopped");
+    fileStorage = nullptr;
+    return;
+  }
+  stats.fileBytes += file.write((const uint8_t*)data, length);
+  file.close();
+}
+
+size_t AsyncLog::pending() {
+  return atomicLoad(&enqueuePos) - atomicLoad(&dequeuePos);
+}
+
+LogStats AsyncLog::getStats() {
+  LogStats copy;
+  copy.written = atomicLoad(&stats.written);
+  copy.dropped = atomicLoad(&stats.dropped);
+  copy.suppressed = atomicLoad(&stats.suppressed);
+  copy.fileBytes = stats.fileBytes;
+  return copy;
+}
@@ -0,0 +1,145 @@
+#ifndef ASYNC_LOG_H
+#define ASYNC_LOG_H
+
+#include <Arduino.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+
+// Deferred logging for code that must not wait on the UART.
+//
+// LOGE/LOGW/LOGI/LOGD format the message into a slot of a lock-free ring
+// and return; a low-priority task writes the slots out to Serial (and,
+// optionally, to a rotating file on SD). At 115200 baud a 60 character
+// line takes over 5 ms to print, which used to be spent inside web
+// handlers on the async TCP task.
+//
+// - Levels above LOG_LEVEL are compiled out, arguments included. Build with
+//   -DLOG_LEVEL=4 to get the per-request debug trace back.
+// - Every call site lets LOG_RATE_BURST lines through per LOG_RATE_WINDOW ms;
+//   the rest are counted and the count is added to the next line that gets
+//   through.
+// - Any task may log. When the ring is full the line is dropped and counted,
+//   the caller never blocks.
+// - Until begin() starts the task lines are only queued.
+
+#define LOG_LEVEL_NONE 0
+#define LOG_LEVEL_ERROR 1
+#define LOG_LEVEL_WARN 2
+#define LOG_LEVEL_INFO 3
+#define LOG_LEVEL_DEBUG 4
+
+#ifndef LOG_LEVEL
+#define LOG_LEVEL LOG_LEVEL_INFO
+#endif
+
+#ifndef LOG_RING_SIZE
+#define LOG_RING_SIZE 32            // lines, power of two
+#endif
+#ifndef LOG_LINE_SIZE
+#define LOG_LINE_SIZE 120           // longer messages are cut
+#endif
+#define LOG_RATE_WINDOW 1000        // ms
+#define LOG_RATE_BURST 10           // lines per call site per window
+#define LOG_TASK_STACK 3072
+#define LOG_TASK_PRIORITY 1         // above idle, below everything else
+#define LOG_TASK_PERIOD 50          // ms between drains when nothing wakes the task
+
+static_assert((LOG_RING_SIZE & (LOG_RING_SIZE - 1)) == 0, "LOG_RING_SIZE must be a power of two");
+
+class StorageManager;
+
+// Per call site rate limit state; lives in a static inside each LOGx() expansion
+struct LogSite {
+  uint32_t windowStart;
+  uint32_t count;
+  uint32_t suppressed;
+};
+
+struct LogRecord {
+  uint32_t sequence;                // ring position this slot is ready for (see push())
+  uint32_t millis;
+  uint8_t level;
+  char text[LOG_LINE_SIZE];
+};
+
+struct LogStats {
+  uint32_t written;
+  uint32_t dropped;                 // ring full
+  uint32_t suppressed;              // rate limited
+  uint32_t fileBytes;               // size of the current log file
+};
+
+class AsyncLog {
+private:
+  LogRecord ring[LOG_RING_SIZE];
+  uint32_t enqueuePos;              // shared by producers, claimed with compare-and-swap
+  uint32_t dequeuePos;              // drain side only
+  uint8_t level;
+  LogStats stats;
+  uint32_t droppedReported;
+  Print* out;
+  TaskHandle_t task;
+
+  StorageManager* fileStorage;
+  String filePath;
+  uint32_t fileLimit;
+
+  static void taskMain(void* arg);
+  bool push(uint8_t level, uint32_t skipped, const char* format, va_list args);
+  size_t formatLine(const LogRecord& record, char* line, size_t size);
+  void appendToFile(const char* data, size_t length);
+
+public:
+  AsyncLog();
+
+  // Starts the drain task writing to out; with startTask false the caller drains
+  bool begin(Print& output, bool startTask = true);
+
+  // Called through the LOGx() macros
+  void write(uint8_t level, LogSite& site, const char* format, ...) __attribute__((format(printf, 4, 5)));
+
+  // Writes out everything queued so far; returns lines written. Drain task only
+  // once begin() has started it, use flush() elsewhere.
+  size_t drain();
+  // Waits until the drain task has caught up (or drains directly without one)
+  void flush();
+
+  // Also appends output to path, moving it to path + ".1" once it passes
+  // maxBytes. Call before begin(); the file belongs to the drain task after.
+  bool mirrorToFile(StorageManager& storage, const String& path, uint32_t maxBytes);
+  bool mirroring() { return fileStorage != nullptr; }
+
+  // Runtime threshold, can only go below the compiled LOG_LEVEL
+  void setLevel(uint8_t newLevel) { level = newLevel > LOG_LEVEL ? LOG_LEVEL : newLevel; }
+  uint8_t getLevel() { return level; }
+  static const char* levelName(uint8_t level);
+
+  size_t pending();
+  LogStats getStats();
+};
+
+#if LOG_LEVEL >= LOG_LEVEL_ERROR
+#define LOGE(...) do { static LogSite logSite; Log.write(LOG_LEVEL_ERROR, logSite, __VA_ARGS__); } while (0)
+#else
+#define LOGE(...) do {} while (0)
+#endif
+#if LOG_LEVEL >= LOG_LEVEL_WARN
+#define LOGW(...) do { static LogSite logSite; Log.write(LOG_LEVEL_WARN, logSite, __VA_ARGS__); } while (0)
+#else
+#define LOGW(...) do {} while (0)
+#endif
+#if LOG_LEVEL >= LOG_LEVEL_INFO
+#define LOGI(...) do { static LogSite logSite; Log.write(LOG_LEVEL_INFO, logSite, __VA_ARGS__); } while (0)
+#else
+#define LOGI(...) do {} while (0)
+#endif
+#if LOG_LEVEL >= LOG_LEVEL_DEBUG
+#define LOGD(...) do { static LogSite logSite; Log.write(LOG_LEVEL_DEBUG, logSite, __VA_ARGS__); } while (0)
+#else
+#define LOGD(...) do {} while (0)
+#endif
+
+// Global instance
+extern AsyncLog Log;
+
+#endif
@@ -0,0 +1,249 @@
+#include "Axis_Calibration.h"
+#include <string.h>
+
+AxisCalibration::AxisCalibration(AccelStepper& stepper, uint8_t minPin, uint8_t maxPin, bool activeLow)
+  : stepper(stepper), config(), minPin(minPin), maxPin(maxPin), activeLow(activeLow), minHit(false),
+    maxHit(false), state(AXIS_CAL_IDLE), findMax(false), verifying(false), expectedMax(0), homed(false),
+    maxPos(0), releaseTiming(false), releasedSince(0), releasePos(0), failure(nullptr) {}
+
+void IRAM_ATTR AxisCalibration::onEndStop(void* hit) {
+  *(volatile bool*)hit = true;
+}
+
+void AxisCalibration::begin(const AxisCalibrationConfig& newConfig) {
+  config = newConfig;
+  int edge = activeLow ? FALLING : RISING;
+  pinMode(minPin, INPUT);
+  attachInterruptArg(digitalPinToInterrupt(minPin), onEndStop, (void*)&minHit, edge);
+  if (maxPin != AXIS_NO_END_STOP) {
+    pinMode(maxPin, INPUT);
+    attachInterruptArg(digitalPinToInterrupt(maxPin), onEndStop, (void*)&maxHit, edge);
+  }
+}
+
+bool AxisCalibration::pressed(uint8_t pin) const {
+  return pin != AXIS_NO_END_STOP && (digitalRead(pin) == HIGH) != activeLow;
+}
+
+// Stops dead, without a deceleration ramp: the carriage is against a switch
+void AxisCalibration::halt() {
+  stepper.setCurrentPosition(stepper.currentPosition());
+}
+
+void AxisCalibration::approach(long distance, volatile bool& hit) {
+  hit = false;
+  stepper.setMaxSpeed(config.fastSpeed);
+  stepper.setAcceleration(config.fastAcceleration);
+  stepper.move(distance);
+}
+
+void AxisCalibration::retract(long direction) {
+  halt();
+  releaseTiming = false;
+  stepper.setMaxSpeed(config.slowSpeed);
+  stepper.setAcceleration(config.slowAcceleration);
+  stepper.move(direction * config.maxRelease);
+}
+
+// True once the switch has read open for AXIS_RELEASE_DEBOUNCE_US; releasePos
+// is where it first opened
+bool AxisCalibration::released(uint8_t pin, unsigned long now) {
+  if (pressed(pin)) {
+    releaseTiming = false;
+    return false;
+  }
+  if (!releaseTiming) {
+    releaseTiming = true;
+    releasedSince = now;
+    releasePos = stepper.currentPosition();
+  }
+  return now - releasedSince >= AXIS_RELEASE_DEBOUNCE_US;
+}
+
+void AxisCalibration::finish(AxisCalibrationState result, const char* reason) {
+  halt();
+  stepper.setMaxSpeed(config.runSpeed);
+  stepper.setAcceleration(config.runAcceleration);
+  state = result;
+  failure = reason;
+}
+
+bool AxisCalibration::start(bool wantMax) {
+  if (busy()) return false;
+  findMax = wantMax && maxPin != AXIS_NO_END_STOP;
+  verifying = false;
+  homed = false;
+  maxPos = 0;
+  failure = nullptr;
+  approach(-config.maxTravel, minHit);
+  state = AXIS_CAL_SEEK_MIN;
+  return true;
+}
+
+bool AxisCalibration::startVerify(long storedMax) {
+  if (!start(true)) return false;
+  verifying = findMax;
+  expectedMax = storedMax;
+  return true;
+}
+
+void AxisCalibration::cancel() {
+  if (busy()) finish(AXIS_CAL_IDLE, "cancelled");
+}
+
+bool AxisCalibration::update() {
+  unsigned long now = micros();
+
+  switch (state) {
+    case AXIS_CAL_SEEK_MIN:
+      if (minHit || pressed(minPin)) {
+        retract(1);
+        state = AXIS_CAL_RELEASE_MIN;
+        return true;
+      }
+      if (stepper.distanceToGo() == 0) {
+        finish(AXIS_CAL_FAILED, "min end stop not reached");
+        return false;
+      }
+      break;
+
+    case AXIS_CAL_RELEASE_MIN:
+      if (released(minPin, now)) {
+        halt();
+        stepper.setCurrentPosition(stepper.currentPosition() - releasePos);
+        homed = true;
+        if (!findMax) {
+          finish(AXIS_CAL_DONE);
+          return false;
+        }
+        // Verifying, the switch must turn up within tolerance of the stored max
+        if (verifying) {
+          approach(expectedMax + config.verifyTolerance - stepper.currentPosition(), maxHit);
+        } else {
+          approach(config.maxTravel, maxHit);
+        }
+        state = AXIS_CAL_SEEK_MAX;
+        return true;
+      }
+      if (stepper.distanceToGo() == 0) {
+        finish(AXIS_CAL_FAILED, "min end stop stuck closed");
+        return false;
+      }
+      break;
+
+    case AXIS_CAL_SEEK_MAX:
+      if (maxHit || pressed(maxPin)) {
+        retract(-1);
+        state = AXIS_CAL_RELEASE_MAX;
+        return true;
+      }
+      if (stepper.distanceToGo() == 0) {
+        finish(AXIS_CAL_FAILED, verifying ? "max travel changed" : "max end stop not reached");
+        return false;
+      }
+      break;
+
+    case AXIS_CAL_RELEASE_MAX:
+      if (released(maxPin, now)) {
+        maxPos = releasePos;
+        if (verifying && labs(maxPos - expectedMax) > config.verifyTolerance) {
+          finish(AXIS_CAL_FAILED, "max travel changed");
+        } else {
+          finish(AXIS_CAL_DONE);
+        }
+        return false;
+      }
+      if (stepper.distanceToGo() == 0) {
+        finish(AXIS_CAL_FAILED, "max end stop stuck closed");
+        return false;
+      }
+      break;
+
+    default:
+      return false;
+  }
+
+  stepper.run();
+  return true;
+}
+
+const char* AxisCalibration::stateName() const {
+  switch (state) {
+    case AXIS_CAL_IDLE: return "idle";
+    case AXIS_CAL_SEEK_MIN: return "seeking min";
+    case AXIS_CAL_RELEASE_MIN: return "releasing min";
+    case AXIS_CAL_SEEK_MAX: return "seeking max";
+    case AXIS_CAL_RELEASE_MAX: return "releasing max";
+    case AXIS_CAL_DONE: return "done";
+    case AXIS_CAL_FAILED: return "failed";
+  }
+  return "unknown";
+}
+
+GantryCalibration::GantryCalibration() : count(0), result(GANTRY_NOT_CALIBRATED), verifying(false) {
+  memset(axes, 0, sizeof(axes));
+  memset(maxPos, 0, sizeof(maxPos));
+}
+
+bool GantryCalibration::begin(AxisCalibration* const* newAxes, size_t newCount) {
+  if (newCount > GANTRY_MAX_AXES) return false;
+  for (size_t i = 0; i < newCount; i++) axes[i] = newAxes[i];
+  count = newCount;
+  return true;
+}
+
+void GantryCalibration::startFull() {
+  verifying = false;
+  for (size_t i = 0; i < count; i++) axes[i]->start(true);
+}
+
+void GantryCalibration::start(const long* storedMax, size_t verifyAxis) {
+  for (size_t i = 0; i < count; i++) axes[i]->cancel();
+  result = GANTRY_BUSY;
+  if (!storedMax || verifyAxis >= count) {
+    startFull();
+    return;
+  }
+
+  verifying = true;
+  for (size_t i = 0; i < count; i++) {
+    maxPos[i] = storedMax[i];
+    if (i == verifyAxis) {
+      axes[i]->startVerify(storedMax[i]);
+    } else {
+      axes[i]->start(false);
+    }
+  }
+}
+
+bool GantryCalibration::update() {
+  if (result != GANTRY_BUSY) return false;
+
+  bool busy = false;
+  for (size_t i = 0; i < count; i++) {
+    if (axes[i]->update()) busy = true;
+  }
+  if (busy) return true;
+
+  bool ok = true;
+  for (size_t i = 0; i < count; i++) {
+    if (axes[i]->getState() != AXIS_CAL_DONE) ok = false;
+  }
+
+  if (verifying) {
+    if (ok) {
+      result = GANTRY_VERIFIED;
+      return false;
+    }
+    startFull();
+    return true;
+  }
+
+  if (!ok) {
+    result = GANTRY_FAILED;
+    return false;
+  }
+  for (size_t i = 0; i < count; i++) maxPos[i] = axes[i]->maxPosition();
+  result = GANTRY_CALIBRATED;
+  return false;
+}
@@ -0,0 +1,163 @@
+#ifndef AXIS_CALIBRATION_H
+#define AXIS_CALIBRATION_H
+
+#include <Arduino.h>
+#include "AccelStepper.h"
+
+// Non-blocking homing and max-travel discovery for one gantry axis.
+//
+// homing() and moveToMax() in the old dispenser sketch spun in while loops
+// polling the end stops, so nothing else ran until the gantry had found both
+// ends. AxisCalibration does the same search as a state machine: start() it,
+// then call update() from the motion task as often as run() would be called.
+// Each call steps the motor at most once and returns straight away, and
+// several axes can calibrate side by side.
+//
+// Each end is found in two passes:
+//   1. fast approach at fastSpeed until the switch closes, then an instant stop
+//   2. slow retract at slowSpeed until the switch opens again
+// The point where the switch opens is the reference: position 0 at the min
+// end, maxPosition() at the max end. Only the slow pass decides the result,
+// so the fast pass can run near full speed without losing accuracy.
+//
+// End stops are read HIGH when pressed (as on the dispenser) unless
+// activeLow is set. begin() attaches an edge interrupt to each switch that
+// latches the press, so a switch that is passed over between two update()
+// calls still stops the axis. The level is read again in update() to confirm
+// and to watch for the release.
+//
+// With a max travel already known (Calibration_Store.h keeps it on SD),
+// startVerify() homes and then checks the max end stop: the approach is cut
+// off at verifyTolerance past the stored max, and the switch must open within
+// verifyTolerance of it. Otherwise the axis fails and a full start(true) is
+// needed. GantryCalibration runs that decision for a whole gantry at boot:
+// every axis homes, only one (pick the shortest) travels to its max end
+// stop, and every axis is calibrated fully only if that check fails.
+
+#define AXIS_NO_END_STOP 0xFF
+#ifndef AXIS_RELEASE_DEBOUNCE_US
+#define AXIS_RELEASE_DEBOUNCE_US 2000   // switch must read open this long
+#endif
+#ifndef GANTRY_MAX_AXES
+#define GANTRY_MAX_AXES 4
+#endif
+
+enum AxisCalibrationState : uint8_t {
+  AXIS_CAL_IDLE,
+  AXIS_CAL_SEEK_MIN,         // fast, towards the min end stop
+  AXIS_CAL_RELEASE_MIN,      // slow, back off until it opens
+  AXIS_CAL_SEEK_MAX,
+  AXIS_CAL_RELEASE_MAX,
+  AXIS_CAL_DONE,
+  AXIS_CAL_FAILED
+};
+
+struct AxisCalibrationConfig {
+  float fastSpeed;           // steps/s for the approach
+  float fastAcceleration;
+  float slowSpeed;           // steps/s for the retract
+  float slowAcceleration;
+  long maxTravel;            // steps; an approach longer than this fails
+  long maxRelease;           // steps; a switch still closed after this is stuck
+  float runSpeed;            // restored when calibration ends
+  float runAcceleration;
+  long verifyTolerance;      // steps the max end stop may have moved before verify fails
+};
+
+class AxisCalibration {
+private:
+  AccelStepper& stepper;
+  AxisCalibrationConfig config;
+  uint8_t minPin;
+  uint8_t maxPin;
+  bool activeLow;
+  volatile bool minHit;
+  volatile bool maxHit;
+  AxisCalibrationState state;
+  bool findMax;
+  bool verifying;
+  long expectedMax;
+  bool homed;
+  long maxPos;
+  bool releaseTiming;
+  unsigned long releasedSince;
+  long releasePos;
+  const char* failure;
+
+  static void onEndStop(void* hit);
+  bool pressed(uint8_t pin) const;
+  void halt();
+  void approach(long distance, volatile bool& hit);
+  void retract(long direction);
+  bool released(uint8_t pin, unsigned long now);
+  void finish(AxisCalibrationState result, const char* reason = nullptr);
+
+public:
+  AxisCalibration(AccelStepper& stepper, uint8_t minPin, uint8_t maxPin = AXIS_NO_END_STOP,
+                  bool activeLow = false);
+
+  // Sets the end stop pins to inputs and attaches their interrupts
+  void begin(const AxisCalibrationConfig& config);
+
+  // Starts homing, followed by the max travel search if findMax is set and
+  // the axis has a max end stop. Returns false while already calibrating.
+  bool start(bool findMax);
+
+  // Homes, then checks that the max end stop is still at expectedMax
+  // (within verifyTolerance). Returns false while already calibrating.
+  bool startVerify(long expectedMax);
+
+  // Abandons calibration with the motor stopped where it is
+  void cancel();
+
+  // Advances the state machine; steps the motor at most once.
+  // Returns true while calibration is in progress.
+  bool update();
+
+  AxisCalibrationState getState() const { return state; }
+  const char* stateName() const;
+  bool busy() const { return state != AXIS_CAL_IDLE && state != AXIS_CAL_DONE && state != AXIS_CAL_FAILED; }
+  bool isHomed() const { return homed; }
+  long maxPosition() const { return maxPos; }   // 0 until found
+  const char* failureReason() const { return failure; }
+};
+
+enum GantryCalibrationResult : uint8_t {
+  GANTRY_NOT_CALIBRATED,
+  GANTRY_BUSY,
+  GANTRY_VERIFIED,           // stored calibration checked out
+  GANTRY_CALIBRATED,         // full calibration ran; store the new values
+  GANTRY_FAILED
+};
+
+// Boot-time calibration of several axes that move at the same time
+class GantryCalibration {
+private:
+  AxisCalibration* axes[GANTRY_MAX_AXES];
+  size_t count;
+  long maxPos[GANTRY_MAX_AXES];
+  GantryCalibrationResult result;
+  bool verifying;
+
+  void startFull();
+
+public:
+  GantryCalibration();
+
+  // Axes must already have had begin() called. Returns false if there are
+  // more than GANTRY_MAX_AXES.
+  bool begin(AxisCalibration* const* axes, size_t count);
+
+  // With storedMax (one value per axis), homes every axis and verifies
+  // verifyAxis against its stored max; anything wrong falls back to a full
+  // calibration. Without it, calibrates every axis fully.
+  void start(const long* storedMax = nullptr, size_t verifyAxis = 0);
+
+  // Call from the motion task; returns true while any axis is moving
+  bool update();
+
+  GantryCalibrationResult getResult() const { return result; }
+  long maxPosition(size_t axis) const { return axis < count ? maxPos[axis] : 0; }
+};
+
+#endif
@@ -0,0 +1,241 @@
+#include "Cabinet_Map.h"
+#include <ctype.h>
+#include <stdlib.h>
+#include <string.h>
+
+static_assert(CABINET_MAX_SLOTS <= 255 && CABINET_MAX_DRUGS <= 255, "slot and drug numbers are stored in a uint8_t");
+
+#define CABINET_MAX_LINE 128
+
+// The dispenser as cabinetNumber() laid it out. The top row sits 100 steps
+// further up, and cabinet 8 100 steps to the left of its column.
+static const char DEFAULT_MAP[] =
+  "grid 3 3\n"
+  "origin 2000 1800\n"
+  "pitch 5500 7600\n"
+  "offset 7 0 100\n"
+  "offset 8 -100 100\n"
+  "offset 9 0 100\n"
+  "drug 1 1 Medicine 1\n"
+  "drug 2 2 Medicine 2\n"
+  "drug 3 3 Medicine 3\n"
+  "drug 4 4 Medicine 4\n"
+  "drug 5 5 Medicine 5\n"
+  "drug 6 6 Medicine 6\n"
+  "drug 7 7 Medicine 7\n"
+  "drug 8 8 Medicine 8\n"
+  "drug 9 9 Medicine 9\n";
+
+// Global instance
+CabinetMap Cabinets;
+
+// Next whitespace-separated word of a line, NUL-terminated in place
+static char* nextWord(char*& p) {
+  while (*p == ' ' || *p == '\t') p++;
+  if (!*p) return nullptr;
+  char* word = p;
+  while (*p && *p != ' ' && *p != '\t') p++;
+  if (*p) *p++ = '\0';
+  return word;
+}
+
+static bool parseNumber(const char* word, long min, long max, long& value) {
+  if (!word) return false;
+  char* end;
+  value = strtol(word, &end, 10);
+  return end != word && *end == '\0' && value >= min && value <= max;
+}
+
+CabinetMap::CabinetMap() {
+  clear();
+  badLine = 0;
+}
+
+void CabinetMap::clear() {
+  columns = 0;
+  rows = 0;
+  originX = 0;
+  originY = 0;
+  pitchX = 0;
+  pitchY = 0;
+  memset(slots, 0, sizeof(slots));
+  memset(drugs, 0, sizeof(drugs));
+  highestDrug = 0;
+}
+
+void CabinetMap::loadDefault() {
+  parse(DEFAULT_MAP, sizeof(DEFAULT_MAP) - 1);
+}
+
+bool CabinetMap::assign(uint8_t drug, uint8_t slot) {
+  if (slots[slot].drug) return false;    // one drug per slot
+  slots[slot].drug = drug;
+  slots[slot].next = 0;
+  if (drugs[drug].first) {
+    slots[drugs[drug].last].next = slot;
+  } else {
+    drugs[drug].first = slot;
+  }
+  drugs[drug].last = slot;
+  if (drug > highestDrug) highestDrug = drug;
+  return true;
+}
+
+bool CabinetMap::parseLine(char* line) {
+  char* hash = strchr(line, '#');
+  if (hash) *hash = '\0';
+  char* p = line;
+  char* directive = nextWord(p);
+  if (!directive) return true;
+
+  long a, b, c;
+  if (strcmp(directive, "grid") == 0) {
+    if (columns) return false;
+    if (!parseNumber(nextWord(p), 1, CABINET_MAX_SLOTS, a) || !parseNumber(nextWord(p), 1, CABINET_MAX_SLOTS, b)) {
+      return false;
+    }
+    if (a * b > CABINET_MAX_SLOTS) return false;
+    columns = (uint8_t)a;
+    rows = (uint8_t)b;
+    for (size_t slot = 1; slot <= slotCount(); slot++) slots[slot].stock = CABINET_STOCK_UNKNOWN;
+  } else if (strcmp(directive, "origin") == 0 || strcmp(directive, "pitch") == 0) {
+    if (!parseNumber(nextWord(p), -1000000, 1000000, a) || !parseNumber(nextWord(p), -1000000, 1000000, b)) {
+      return false;
+    }
+    if (directive[0] == 'o') {
+      originX = a;
+      originY = b;
+    } else {
+      pitchX = a;
+      pitchY = b;
+    }
+  } else if (strcmp(directive, "offset") == 0) {
+    if (!parseNumber(nextWord(p), 1, slotCount(), a) || !parseNumber(nextWord(p), -1000000, 1000000, b) ||
+        !parseNumber(nextWord(p), -1000000, 1000000, c)) {
+      return false;
+    }
+    slots[a].dx = b;
+    slots[a].dy = c;
+  } else if (strcmp(directive, "stock") == 0) {
+    if (!parseNumber(nextWord(p), 1, slotCount(), a) || !parseNumber(nextWord(p), 0, CABINET_STOCK_UNKNOWN - 1, b)) {
+      return false;
+    }
+    slots[a].stock = (uint16_t)b;
+  } else if (strcmp(directive, "drug") == 0) {
+    if (!parseNumber(nextWord(p), 1, CABINET_MAX_DRUGS, a) || drugs[a].name[0]) return false;
+    char* list = nextWord(p);
+    if (!list) return false;
+    char* slotWord = list;
+    while (slotWord) {
+      char* comma = strchr(slotWord, ',');
+      if (comma) *comma = '\0';
+      if (!parseNumber(slotWord, 1, slotCount(), b) || !assign((uint8_t)a, (uint8_t)b)) return false;
+      slotWord = comma ? comma + 1 : nullptr;
+    }
+    // The rest of the line is the name
+    while (*p == ' ' || *p == '\t') p++;
+    size_t length = strlen(p);
+    while (length > 0 && (p[length - 1] == ' ' || p[length - 1] == '\t')) length--;
+    if (length == 0) return false;
+    if (length >= CABINET_NAME_SIZE) length = CABINET_NAME_SIZE - 1;
+    memcpy(drugs[a].name, p, length);
+    drugs[a].name[length] = '\0';
+  } else {
+    return false;
+  }
+  return true;
+}
+
+bool CabinetMap::parse(const char* text, size_t length) {
+  // Built aside so a bad file leaves the current map in place
+  static CabinetMap staging;
+  staging.clear();
+
+  char line[CABINET_MAX_LINE];
+  size_t lineNumber = 0;
+  size_t i = 0;
+  while (i < length) {
+    size_t start = i;
+    while (i < length && text[i] != '\n') i++;
+    size_t lineLength = i - start;
+    if (lineLength > 0 && text[start + lineLength - 1] == '\r') lineLength--;
+    i++;
+    lineNumber++;
+
+    if (lineLength >= sizeof(line)) {
+      badLine = lineNumber;
+      return false;
+    }
+    memcpy(line, text + start, lineLength);
+    line[lineLength] = '\0';
+    if (!staging.parseLine(line)) {
+      badLine = lineNumber;
+      return false;
+    }
+  }
+
+  if (!staging.columns) {
+    badLine = lineNumber + 1;    // no grid line at all
+    return false;
+  }
+  *this = staging;
+  badLine = 0;
+  return true;
+}
+
+bool CabinetMap::slotPosition(uint8_t slot, MotionPoint& position) const {
+  if (slot == 0 || slot > slotCount()) return false;
+  uint8_t index = slot - 1;
+  position.x = originX + (long)(index % columns) * pitchX + slots[slot].dx;
+  position.y = originY + (long)(index / columns) * pitchY + slots[slot].dy;
+  return true;
+}
+
+const char* CabinetMap::drugName(uint8_t drug) const {
+  if (drug == 0 || drug > CABINET_MAX_DRUGS || !drugs[drug].name[0]) return nullptr;
+  return drugs[drug].name;
+}
+
+uint8_t CabinetMap::drugByName(const char* name) const {
+  for (uint8_t drug = 1; drug <= highestDrug; drug++) {
+    const char* a = drugs[drug].name;
+    const char* b = name;
+    while (*a && tolower((unsigned char)*a) == tolower((unsigned char)*b)) {
+      a++;
+      b++;
+    }
+    if (drugs[drug].name[0] && *a == '\0' && *b == '\0') return drug;
+  }
+  return 0;
+}
+
+void CabinetMap::setStock(uint8_t slot, uint16_t count) {
+  if (slot > 0 && slot <= slotCount()) slots[slot].stock = count;
+}
+
+bool CabinetMap::takeStock(uint8_t slot, uint16_t quantity) {
+  if (slot == 0 || slot > slotCount()) return false;
+  uint16_t& count = slots[slot].stock;
+  if (count == CABINET_STOCK_UNKNOWN) return true;
+  if (count < quantity) return false;
+  count -= quantity;
+  return true;
+}
+
+uint8_t CabinetMap::pickSlot(uint8_t drug, uint16_t quantity, const MotionPoint& from,
+                             const MotionPlanner& planner) const {
+  uint8_t best = 0;
+  float bestTime = 0.0f;
+  for (uint8_t slot = firstSlot(drug); slot; slot = slots[slot].next) {
+    uint16_t count = slots[slot].stock;
+    if (count != CABINET_STOCK_UNKNOWN && count < quantity) continue;
+    MotionPoint position;
+    slotPosition(slot, position);
+    float time = planner.moveTime(from, position);
+    if (!best || time < bestTime) {
+      best = slot;
+      bestTime = time;
+    }
+  }
+  return best;
+}
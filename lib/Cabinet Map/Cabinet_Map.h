@@ -0,0 +1,112 @@
+#ifndef CABINET_MAP_H
+#define CABINET_MAP_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "Motion_Planner.h"
+
+// Where each medication is kept, loaded from a text file instead of the
+// cabinetNumber() if-chain and the fixed nine-entry medicationList.
+//
+// Slots form a grid of columns x rows numbered row by row from 1, slot 1
+// being at the origin, the way cabinetNumber() counted the 3x3 dispenser.
+// Each slot sits at origin + (column * pitchX, row * pitchY) plus its own
+// offset, for cabinets that are not quite on the grid. A medication (drug id
+// as sent in DISPENSE orders, 1..CABINET_MAX_DRUGS) may be stocked in several
+// slots; firstSlot()/nextSlot() walk them without searching, and pickSlot()
+// chooses the one with stock that the gantry reaches soonest.
+//
+// File format (CABINET_MAP_PATH), one directive per line, # starts a comment:
+//   grid <columns> <rows>
+//   origin <x> <y>                  steps, position of slot 1
+//   pitch <x> <y>                   steps between neighbouring slots
+//   offset <slot> <dx> <dy>         nudges one slot off the grid
+//   drug <id> <slot>[,<slot>...] <name>
+//   stock <slot> <count>            slots without a stock line are never empty
+//
+// Nothing here depends on Arduino; test/test_cabinet_map runs it on the host.
+
+#define CABINET_MAP_PATH "/cabinets.txt"
+#ifndef CABINET_MAX_SLOTS
+#define CABINET_MAX_SLOTS 64
+#endif
+#ifndef CABINET_MAX_DRUGS
+#define CABINET_MAX_DRUGS 64
+#endif
+#define CABINET_NAME_SIZE 32
+#define CABINET_STOCK_UNKNOWN 0xFFFF
+
+struct CabinetSlot {
+  int32_t dx;           // offset from the grid position
+  int32_t dy;
+  uint16_t stock;       // CABINET_STOCK_UNKNOWN if not tracked
+  uint8_t drug;         // 0 = empty slot
+  uint8_t next;         // next slot holding the same drug, 0 = last
+};
+
+struct CabinetDrug {
+  char name[CABINET_NAME_SIZE];
+  uint8_t first;        // 0 = not stocked anywhere
+  uint8_t last;
+};
+
+class CabinetMap {
+private:
+  uint8_t columns;
+  uint8_t rows;
+  int32_t originX;
+  int32_t originY;
+  int32_t pitchX;
+  int32_t pitchY;
+  CabinetSlot slots[CABINET_MAX_SLOTS + 1];    // indexed by slot number, [0] unused
+  CabinetDrug drugs[CABINET_MAX_DRUGS + 1];    // indexed by drug id, [0] unused
+  uint8_t highestDrug;
+  size_t badLine;
+
+  void clear();
+  bool parseLine(char* line);
+  bool assign(uint8_t drug, uint8_t slot);
+
+public:
+  CabinetMap();
+
+  // The original dispenser: 3x3 cabinets, Medicine 1-9 in cabinets 1-9
+  void loadDefault();
+
+  // Replaces the map with the one in text. On a malformed line the current
+  // map is kept and errorLine() tells which line (counting from 1).
+  bool parse(const char* text, size_t length);
+  size_t errorLine() const { return badLine; }
+
+  uint8_t gridColumns() const { return columns; }
+  uint8_t gridRows() const { return rows; }
+  uint8_t slotCount() const { return columns * rows; }
+  uint8_t maxDrug() const { return highestDrug; }
+
+  // Gantry coordinates of a slot; false if there is no such slot
+  bool slotPosition(uint8_t slot, MotionPoint& position) const;
+  uint8_t drugAt(uint8_t slot) const { return slot <= slotCount() ? slots[slot].drug : 0; }
+
+  // Slots holding a drug: firstSlot(), then nextSlot() until it returns 0
+  uint8_t firstSlot(uint8_t drug) const { return drug <= CABINET_MAX_DRUGS ? drugs[drug].first : 0; }
+  uint8_t nextSlot(uint8_t slot) const { return slot <= slotCount() ? slots[slot].next : 0; }
+
+  // nullptr for an unknown drug id
+  const char* drugName(uint8_t drug) const;
+  // Case-insensitive; 0 if no drug has that name
+  uint8_t drugByName(const char* name) const;
+
+  uint16_t stock(uint8_t slot) const { return slot <= slotCount() ? slots[slot].stock : 0; }
+  void setStock(uint8_t slot, uint16_t count);
+  // Removes quantity from a tracked slot; false if it does not hold that many
+  bool takeStock(uint8_t slot, uint16_t quantity);
+
+  // The slot of drug holding at least quantity that the gantry reaches
+  // soonest from `from`, or 0 if none has enough
+  uint8_t pickSlot(uint8_t drug, uint16_t quantity, const MotionPoint& from, const MotionPlanner& planner) const;
+};
+
+// Global instance
+extern CabinetMap Cabinets;
+
+#endif
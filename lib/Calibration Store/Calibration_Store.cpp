@@ -0,0 +1,111 @@
+#include "Calibration_Store.h"
+#include <rom/crc.h>
+
+#define CALIBRATION_RECORD_MAGIC 0x43414C42   // "CALB"
+#define CALIBRATION_RECORD_VERSION 1
+
+// Global instance
+CalibrationStore Calibration;
+
+CalibrationStore::CalibrationStore() : storage(nullptr) {}
+
+uint32_t CalibrationStore::recordCrc(const CalibrationRecord& record) {
+  CalibrationRecord copy = record;
+  copy.crc = 0;
+  return crc32_le(0, (const uint8_t*)&copy, sizeof(copy));
+}
+
+bool CalibrationStore::begin(StorageManager& storageManager, const String& filePath) {
+  storage = &storageManager;
+  path = filePath;
+  if (!storage->isInitialized()) {
+    Serial.println("CalibrationStore: Storage not initialized, the gantry will calibrate fully on every boot");
+    return false;
+  }
+  return true;
+}
+
+bool CalibrationStore::readRecord(const String& file, CalibrationData& data) {
+  if (!storage->exists(file)) return false;
+  File in = storage->open(file, "r");
+  if (!in) return false;
+
+  CalibrationRecord record;
+  size_t length = in.read((uint8_t*)&record, sizeof(record));
+  in.close();
+  if (length != sizeof(record) || record.magic != CALIBRATION_RECORD_MAGIC ||
+      record.version != CALIBRATION_RECORD_VERSION || record.size != sizeof(record) ||
+      record.crc != recordCrc(record) || record.data.cabinetCount > CALIBRATION_MAX_CABINETS) {
+    return false;
+  }
+  data = record.data;
+  return true;
+}
+
+bool CalibrationStore::load(CalibrationData& data) {
+  if (!storage || !storage->isInitialized()) return false;
+
+  if (readRecord(path, data)) return true;
+
+  // A reset between removing the old file and renaming the new one in save()
+  String temp = path + ".tmp";
+  if (readRecord(temp, data)) {
+    storage->remove(path);
+    storage->rename(temp, path);
+    storage->invalidate(path);
+    Serial.println("CalibrationStore: Recovered calibration from " + temp);
+    return true;
+  }
+
+  if (storage->exists(path)) {
+    Serial.println("CalibrationStore: " + path + " is corrupt or from an older version, ignoring it");
+  }
+  return false;
+}
+
+bool CalibrationStore::save(const CalibrationData& data) {
+  if (!storage || !storage->isInitialized()) return false;
+
+  CalibrationRecord record;
+  memset(&record, 0, sizeof(record));
+  record.magic = CALIBRATION_RECORD_MAGIC;
+  record.version = CALIBRATION_RECORD_VERSION;
+  record.size = sizeof(record);
+  record.data = data;
+  record.crc = recordCrc(record);
+
+  String temp = path + ".tmp";
+  File out = storage->open(temp, "w");
+  if (!out) {
+    Serial.println("CalibrationStore: Failed to create " + temp);
+    return false;
+  }
+  size_t written = out.write((const uint8_t*)&record, sizeof(record));
+  out.close();
+  storage->invalidate(temp);
+
+  // Read it back before it replaces the good copy
+  CalibrationData check;
+  if (written != sizeof(record) || !readRecord(temp, check)) {
+    Serial.println("CalibrationStore: Failed to write " + temp);
+    storage->remove(temp);
+    return false;
+  }
+
+  if (storage->exists(path) && !storage->remove(path)) {
+    Serial.println("CalibrationStore: Failed to replace " + path);
+    return false;
+  }
+  bool renamed = storage->rename(temp, path);
+  storage->invalidate(path);
+  if (!renamed) Serial.println("CalibrationStore: Failed to rename " + temp + " to " + path);
+  return renamed;
+}
+
+bool CalibrationStore::clear() {
+  if (!storage || !storage->isInitialized()) return false;
+  storage->remove(path + ".tmp");
+  bool removed = !storage->exists(path) || storage->remove(path);
+  storage->invalidate(path);
+  return removed;
+}
@@ -0,0 +1,73 @@
+#ifndef CALIBRATION_STORE_H
+#define CALIBRATION_STORE_H
+
+#include <Arduino.h>
+#include "Storage_Manager.h"
+
+// Gantry calibration kept on SD so a boot does not have to rediscover it.
+//
+// moveToMax() used to find xMax/yMax (and from them row/column) on every
+// start, which meant a full traverse of each axis before the first dispense.
+// The values found by a full calibration are saved here together with the
+// cabinet coordinates. At the next boot GantryCalibration (Axis_Calibration.h)
+// only homes and checks one end stop against the stored travel; a full
+// calibration runs, and is saved again, only when that check fails or the
+// file is missing, corrupt or from an older layout version.
+//
+// The file is one fixed-size record with a CRC32. save() writes a temporary
+// file and renames it over the old one, so a reset mid-write leaves either
+// the old or the new record, never half of each.
+
+#define CALIBRATION_DEFAULT_PATH "/calibration.dat"
+#define CALIBRATION_AXES 3              // X, Y, Z
+#ifndef CALIBRATION_MAX_CABINETS
+#define CALIBRATION_MAX_CABINETS 16
+#endif
+
+struct CabinetPosition {
+  int32_t x;
+  int32_t y;
+};
+
+struct CalibrationData {
+  int32_t axisMax[CALIBRATION_AXES];    // steps from home to where the max end stop opens; 0 = none
+  int32_t row;                          // cabinet pitch along Y
+  int32_t column;                       // cabinet pitch along X
+  uint8_t cabinetCount;
+  CabinetPosition cabinets[CALIBRATION_MAX_CABINETS];   // cabinet n is cabinets[n - 1]
+};
+
+// On-disk layout
+struct CalibrationRecord {
+  uint32_t magic;
+  uint16_t version;
+  uint16_t size;              // sizeof(CalibrationRecord), catches a changed CALIBRATION_MAX_CABINETS
+  uint32_t crc;               // CRC32 of the record with this field zeroed
+  CalibrationData data;
+};
+
+class CalibrationStore {
+private:
+  StorageManager* storage;
+  String path;
+
+  static uint32_t recordCrc(const CalibrationRecord& record);
+  bool readRecord(const String& file, CalibrationData& data);
+
+public:
+  CalibrationStore();
+
+  bool begin(StorageManager& storageManager, const String& filePath = CALIBRATION_DEFAULT_PATH);
+
+  // False when there is no usable calibration; data is left untouched
+  bool load(CalibrationData& data);
+  bool save(const CalibrationData& data);
+
+  // Forces a full calibration at the next boot
+  bool clear();
+};
+
+// Global instance
+extern CalibrationStore Calibration;
+
+#endif
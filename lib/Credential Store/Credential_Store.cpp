@@ -0,0 +1,328 @@
+#include "Credential_Store.h"
+#include "Async_Log.h"
+#include <rom/crc.h>
+#include <esp_system.h>
+#include <mbedtls/md.h>
+#include <mbedtls/pkcs5.h>
+
+#define USER_RECORD_MAGIC 0x55535242   // "USRB"
+#define USER_RECORD_VERSION 1
+
+static_assert(sizeof(UserRecord) == USER_STORE_RECORD_SIZE, "UserRecord must fill exactly one record slot");
+
+// Global instance
+CredentialStore Users;
+
+CredentialStore::CredentialStore()
+  : storage(nullptr), initialized(false), persistent(false), lock(nullptr),
+    hashIterations(USER_STORE_PBKDF2_ITERATIONS), recordSlots(0) {
+  memset(usernameTable, 0, sizeof(usernameTable));
+  memset(emailTable, 0, sizeof(emailTable));
+}
+
+// FNV-1a over the lowercased key, so the email table can match case-insensitively
+uint32_t CredentialStore::hashKey(const String& key) {
+  uint32_t hash = 2166136261u;
+  for (size_t i = 0; i < key.length(); i++) {
+    hash ^= (uint8_t)tolower((unsigned char)key[i]);
+    hash *= 16777619u;
+  }
+  return hash;
+}
+
+uint32_t CredentialStore::recordCrc(const UserRecord& record) {
+  UserRecord copy = record;
+  copy.crc = 0;
+  return crc32_le(0, (const uint8_t*)&copy, sizeof(copy));
+}
+
+void CredentialStore::copyField(char* dest, size_t size, const String& value) {
+  size_t len = value.length();
+  if (len >= size) len = size - 1;
+  memcpy(dest, value.c_str(), len);
+  memset(dest + len, 0, size - len);
+}
+
+bool CredentialStore::derive(const String& password, const uint8_t* salt, uint32_t iterations, uint8_t* out) {
+  mbedtls_md_context_t ctx;
+  mbedtls_md_init(&ctx);
+  int ret = mbedtls_md_setup(&ctx, mbedtls_md_info_from_type(MBEDTLS_MD_SHA256), 1);
+  if (ret == 0) {
+    ret = mbedtls_pkcs5_pbkdf2_hmac(&ctx, (const unsigned char*)password.c_str(), password.length(),
+                                    salt, USER_STORE_SALT_SIZE, iterations, USER_STORE_HASH_SIZE, out);
+  }
+  mbedtls_md_free(&ctx);
+  return ret == 0;
+}
+
+bool CredentialStore::begin(StorageManager& storageManager, const String& filePath) {
+  end();
+
+  storage = &storageManager;
+  path = filePath;
+  if (!lock) lock = xSemaphoreCreateMutex();
+  accounts.reserve(USER_STORE_CAPACITY);
+
+  if (!storage->isInitialized()) {
+    Serial.println("CredentialStore: Storage not initialized, accounts will not persist");
+    initialized = true;
+    return false;
+  }
+
+  if (!storage->exists(path)) {
+    File created = storage->open(path, "w");
+    if (!created) {
+      Serial.println("CredentialStore: Failed to create " + path + ", accounts will not persist");
+      initialized = true;
+      return false;
+    }
+    created.close();
+  }
+
+  dataFile = storage->open(path, "r+");
+  if (!dataFile) {
+    Serial.println("CredentialStore: Failed to open " + path + ", accounts will not persist");
+    initialized = true;
+    return false;
+  }
+
+  persistent = true;
+  replay();
+  initialized = true;
+
+  Serial.printf("CredentialStore: %u accounts loaded from %s\n", (unsigned)accounts.size(), path.c_str());
+  return true;
+}
+
+void CredentialStore::end() {
+  if (dataFile) dataFile.close();
+  accounts.clear();
+  memset(usernameTable, 0, sizeof(usernameTable));
+  memset(emailTable, 0, sizeof(emailTable));
+  recordSlots = 0;
+  persistent = false;
+  initialized = false;
+}
+
+void CredentialStore::replay() {
+  size_t fileRecords = dataFile.size() / USER_STORE_RECORD_SIZE;
+  recordSlots = fileRecords;
+  UserRecord record;
+  dataFile.seek(0);
+  for (size_t i = 0; i < fileRecords; i++) {
+    if (accounts.size() >= USER_STORE_CAPACITY) {
+      Serial.printf("CredentialStore: Capacity reached, %u accounts not loaded\n", (unsigned)(fileRecords - i));
+      break;
+    }
+    if (dataFile.read((uint8_t*)&record, sizeof(record)) != sizeof(record)) break;
+    if (record.magic != USER_RECORD_MAGIC || record.version != USER_RECORD_VERSION || record.crc != recordCrc(record)) {
+      // Rehashing rewrites records in place, so a torn write can be anywhere.
+      // Skip it; the slot stays as it is and new accounts go after the end.
+      Serial.printf("CredentialStore: Invalid record %u, skipped\n", (unsigned)i);
+      continue;
+    }
+
+    Account account;
+    account.user.id = record.id;
+    account.user.username = record.username;
+    account.user.fullName = record.fullName;
+    account.user.email = record.email;
+    account.user.license = record.license;
+    account.user.department = record.department;
+    account.iterations = record.iterations;
+    memcpy(account.salt, record.salt, sizeof(account.salt));
+    memcpy(account.hash, record.hash, sizeof(account.hash));
+    account.slot = i;
+    accounts.push_back(account);
+    indexAccount(accounts.size() - 1);
+  }
+}
+
+void CredentialStore::indexAccount(uint16_t index) {
+  const User& user = accounts[index].user;
+
+  uint32_t pos = hashKey(user.username) % USER_STORE_TABLE_SIZE;
+  while (usernameTable[pos] != 0) pos = (pos + 1) % USER_STORE_TABLE_SIZE;
+  usernameTable[pos] = index + 1;
+
+  if (user.email.isEmpty()) return;
+  pos = hashKey(user.email) % USER_STORE_TABLE_SIZE;
+  while (emailTable[pos] != 0) pos = (pos + 1) % USER_STORE_TABLE_SIZE;
+  emailTable[pos] = index + 1;
+}
+
+// Usernames match exactly, emails case-insensitively
+uint16_t CredentialStore::lookup(const String& key, bool byEmail) {
+  if (key.isEmpty()) return USER_STORE_NO_USER;
+  const uint16_t* table = byEmail ? emailTable : usernameTable;
+  for (uint32_t pos = hashKey(key) % USER_STORE_TABLE_SIZE; table[pos] != 0; pos = (pos + 1) % USER_STORE_TABLE_SIZE) {
+    uint16_t index = table[pos] - 1;
+    const User& user = accounts[index].user;
+    if (byEmail ? user.email.equalsIgnoreCase(key) : user.username == key) return index;
+  }
+  return USER_STORE_NO_USER;
+}
+
+bool CredentialStore::writeAccountLocked(uint16_t index) {
+  if (!persistent) return true;
+
+  const Account& account = accounts[index];
+  UserRecord record;
+  memset(&record, 0, sizeof(record));
+  record.magic = USER_RECORD_MAGIC;
+  record.version = USER_RECORD_VERSION;
+  record.iterations = account.iterations;
+  record.id = account.user.id;
+  copyField(record.username, sizeof(record.username), account.user.username);
+  copyField(record.fullName, sizeof(record.fullName), account.user.fullName);
+  copyField(record.email, sizeof(record.email), account.user.email);
+  copyField(record.license, sizeof(record.license), account.user.license);
+  copyField(record.department, sizeof(record.department), account.user.department);
+  memcpy(record.salt, account.salt, sizeof(record.salt));
+  memcpy(record.hash, account.hash, sizeof(record.hash));
+  record.crc = recordCrc(record);
+
+  uint32_t offset = (uint32_t)account.slot * USER_STORE_RECORD_SIZE;
+  storage->invalidate(path, offset, sizeof(record));
+  if (!dataFile.seek(offset)) return false;
+  size_t written = dataFile.write((const uint8_t*)&record, sizeof(record));
+  dataFile.flush();
+  return written == sizeof(record);
+}
+
+// Hashing runs outside the lock so a slow login does not block lookups
+const User* CredentialStore::verify(uint16_t index, const String& password) {
+  if (index == USER_STORE_NO_USER) {
+    // Take as long as a wrong password would, so the time does not tell
+    // which usernames exist
+    static const uint8_t dummySalt[USER_STORE_SALT_SIZE] = {};
+    uint8_t dummy[USER_STORE_HASH_SIZE];
+    derive(password, dummySalt, hashIterations, dummy);
+    return nullptr;
+  }
+
+  xSemaphoreTake(lock, portMAX_DELAY);
+  Account& account = accounts[index];
+  uint32_t iterations = account.iterations;
+  uint8_t salt[USER_STORE_SALT_SIZE];
+  uint8_t expected[USER_STORE_HASH_SIZE];
+  memcpy(salt, account.salt, sizeof(salt));
+  memcpy(expected, account.hash, sizeof(expected));
+  uint32_t target = hashIterations;
+  xSemaphoreGive(lock);
+
+  uint8_t actual[USER_STORE_HASH_SIZE];
+  if (!derive(password, salt, iterations, actual)) return nullptr;
+
+  // Constant-time compare
+  uint8_t diff = 0;
+  for (size_t i = 0; i < sizeof(actual); i++) diff |= actual[i] ^ expected[i];
+  if (diff != 0) return nullptr;
+
+  if (iterations != target) {
+    // Re-hash at the current cost with a fresh salt while we know the password
+    uint8_t newSalt[USER_STORE_SALT_SIZE];
+    uint8_t newHash[USER_STORE_HASH_SIZE];
+    esp_fill_random(newSalt, sizeof(newSalt));
+    if (derive(password, newSalt, target, newHash)) {
+      xSemaphoreTake(lock, portMAX_DELAY);
+      memcpy(account.salt, newSalt, sizeof(newSalt));
+      memcpy(account.hash, newHash, sizeof(newHash));
+      account.iterations = target;
+      if (!writeAccountLocked(index)) {
+        LOGW("CredentialStore: Failed to save rehashed account %s", account.user.username.c_str());
+      }
+      xSemaphoreGive(lock);
+    }
+  }
+  return &account.user;
+}
+
+const User* CredentialStore::authenticate(const String& username, const String& password) {
+  if (!initialized) return nullptr;
+  xSemaphoreTake(lock, portMAX_DELAY);
+  uint16_t index = lookup(username, false);
+  xSemaphoreGive(lock);
+  return verify(index, password);
+}
+
+const User* CredentialStore::authenticateEmail(const String& email, const String& password) {
+  if (!initialized) return nullptr;
+  xSemaphoreTake(lock, portMAX_DELAY);
+  uint16_t index = lookup(email, true);
+  xSemaphoreGive(lock);
+  return verify(index, password);
+}
+
+bool CredentialStore::add(const User& user, const String& password) {
+  if (!initialized || user.username.isEmpty()) return false;
+  // The record would truncate these and the account could not log in after a reboot
+  if (user.username.length() >= USER_STORE_USERNAME_SIZE || user.email.length() >= USER_STORE_EMAIL_SIZE) {
+    return false;
+  }
+
+  Account account;
+  account.user = user;
+  account.iterations = hashIterations;
+  esp_fill_random(account.salt, sizeof(account.salt));
+  if (!derive(password, account.salt, account.iterations, account.hash)) return false;
+
+  xSemaphoreTake(lock, portMAX_DELAY);
+  bool taken = lookup(user.username, false) != USER_STORE_NO_USER ||
+               lookup(user.email, true) != USER_STORE_NO_USER;
+  if (taken || accounts.size() >= USER_STORE_CAPACITY) {
+    xSemaphoreGive(lock);
+    return false;
+  }
+
+  if (account.user.id == 0) {
+    int maxId = 0;
+    for (const Account& a : accounts) maxId = max(maxId, a.user.id);
+    account.user.id = maxId + 1;
+  }
+  account.slot = recordSlots;
+  accounts.push_back(account);
+  uint16_t index = accounts.size() - 1;
+
+  bool success = writeAccountLocked(index);
+  if (success) {
+    if (persistent) recordSlots++;
+    indexAccount(index);
+  } else {
+    accounts.pop_back();
+    LOGW("CredentialStore: Failed to write account %s", user.username.c_str());
+  }
+  xSemaphoreGive(lock);
+  return success;
+}
+
+const User* CredentialStore::find(const String& username) {
+  if (!initialized) return nullptr;
+  xSemaphoreTake(lock, portMAX_DELAY);
+  uint16_t index = lookup(username, false);
+  xSemaphoreGive(lock);
+  return index == USER_STORE_NO_USER ? nullptr : &accounts[index].user;
+}
+
+const User* CredentialStore::findByEmail(const String& email) {
+  if (!initialized) return nullptr;
+  xSemaphoreTake(lock, portMAX_DELAY);
+  uint16_t index = lookup(email, true);
+  xSemaphoreGive(lock);
+  return index == USER_STORE_NO_USER ? nullptr : &accounts[index].user;
+}
+
+void CredentialStore::setIterations(uint32_t iterations) {
+  if (iterations < USER_STORE_MIN_ITERATIONS) iterations = USER_STORE_MIN_ITERATIONS;
+  if (lock) xSemaphoreTake(lock, portMAX_DELAY);
+  hashIterations = iterations;
+  if (lock) xSemaphoreGive(lock);
+}
+
+unsigned long CredentialStore::measureHashMillis() {
+  uint8_t salt[USER_STORE_SALT_SIZE] = {0};
+  uint8_t out[USER_STORE_HASH_SIZE];
+  unsigned long start = millis();
+  derive("benchmark", salt, hashIterations, out);
+  return millis() - start;
+}
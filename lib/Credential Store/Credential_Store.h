@@ -0,0 +1,139 @@
+#ifndef CREDENTIAL_STORE_H
+#define CREDENTIAL_STORE_H
+
+#include <Arduino.h>
+#include <vector>
+#include "Storage_Manager.h"
+
+// Persistent user accounts with salted password hashes.
+//
+// Passwords are never stored; each account keeps a random 16-byte salt and a
+// PBKDF2-HMAC-SHA256 digest computed through mbedTLS (which uses the ESP32
+// SHA accelerator). Accounts live in fixed 256-byte records in an
+// append-only file (rehashing rewrites a record in place; a record that
+// fails its CRC at boot is skipped and its slot never reused) and are
+// indexed in RAM by username and by email, so
+// lookups do not depend on the number of accounts; the hash is the only
+// deliberate cost of a login.
+//
+// The PBKDF2 iteration count is stored per account. Lowering or raising it
+// with setIterations() takes effect for new accounts immediately and for
+// existing ones on their next successful login, when the hash is redone.
+
+#define USER_STORE_DEFAULT_PATH "/users.dat"
+#define USER_STORE_RECORD_SIZE 256
+#define USER_STORE_SALT_SIZE 16
+#define USER_STORE_HASH_SIZE 32
+#define USER_STORE_NO_USER 0xFFFF
+#define USER_STORE_USERNAME_SIZE 32         // username and email are keys, so
+#define USER_STORE_EMAIL_SIZE 48            // longer ones are refused, not cut
+
+#ifndef USER_STORE_CAPACITY
+#define USER_STORE_CAPACITY 256
+#endif
+#ifndef USER_STORE_PBKDF2_ITERATIONS
+#define USER_STORE_PBKDF2_ITERATIONS 2048   // ~50 ms per login with the SHA accelerator
+#endif
+#define USER_STORE_MIN_ITERATIONS 1000
+#define USER_STORE_TABLE_SIZE (USER_STORE_CAPACITY * 2)  // index tables stay at most half full
+
+struct User {
+  int id;
+  String username;
+  String fullName;
+  String email;
+  String license;
+  String department;
+};
+
+// On-disk record layout. Strings are NUL-terminated and truncated to fit.
+struct UserRecord {
+  uint32_t magic;
+  uint16_t version;
+  uint16_t reserved;
+  uint32_t crc;               // CRC32 of the record with this field zeroed
+  uint32_t iterations;
+  int32_t id;
+  char username[USER_STORE_USERNAME_SIZE];
+  char fullName[48];
+  char email[USER_STORE_EMAIL_SIZE];
+  char license[16];
+  char department[32];
+  uint8_t salt[USER_STORE_SALT_SIZE];
+  uint8_t hash[USER_STORE_HASH_SIZE];
+  uint8_t padding[12];
+};
+
+class CredentialStore {
+private:
+  struct Account {
+    User user;
+    uint32_t iterations;
+    uint8_t salt[USER_STORE_SALT_SIZE];
+    uint8_t hash[USER_STORE_HASH_SIZE];
+    uint16_t slot;            // record number in the file
+  };
+
+  StorageManager* storage;
+  File dataFile;
+  String path;
+  bool initialized;
+  bool persistent;            // false when running from RAM only (no storage)
+  SemaphoreHandle_t lock;
+  uint32_t hashIterations;
+  uint16_t recordSlots;       // records in the file, skipped ones included; the next add goes here
+
+  std::vector<Account> accounts;   // reserved to USER_STORE_CAPACITY, so User pointers stay valid
+  uint16_t usernameTable[USER_STORE_TABLE_SIZE];   // account index + 1, 0 = empty
+  uint16_t emailTable[USER_STORE_TABLE_SIZE];
+
+  static uint32_t hashKey(const String& key);
+  static uint32_t recordCrc(const UserRecord& record);
+  static void copyField(char* dest, size_t size, const String& value);
+  static bool derive(const String& password, const uint8_t* salt, uint32_t iterations, uint8_t* out);
+
+  uint16_t lookup(const String& key, bool byEmail);
+  void indexAccount(uint16_t index);
+  bool writeAccountLocked(uint16_t index);
+  void replay();
+  const User* verify(uint16_t index, const String& password);
+
+public:
+  CredentialStore();
+
+  // Opens (or creates) the credential file and indexes it. Without mounted
+  // storage the store still works, but accounts only last until reboot.
+  bool begin(StorageManager& storageManager, const String& filePath = USER_STORE_DEFAULT_PATH);
+  void end();
+
+  // Returns the account on success, nullptr on unknown user or wrong password
+  const User* authenticate(const String& username, const String& password);
+  const User* authenticateEmail(const String& email, const String& password);
+
+  // Adds an account; fails if the username or email is taken or does not fit
+  // its record field, or the store is full. user.id = 0 assigns the next free id.
+  bool add(const User& user, const String& password);
+
+  const User* find(const String& username);
+  const User* findByEmail(const String& email);
+  bool exists(const String& username) { return find(username) != nullptr; }
+
+  // Iteration, e.g. for (size_t i = 0; i < Users.count(); i++) Users.at(i)
+  size_t count() { return accounts.size(); }
+  const User& at(size_t index) { return accounts[index].user; }
+
+  // Hash cost for new hashes; existing accounts are rehashed on next login
+  uint32_t iterations() { return hashIterations; }
+  void setIterations(uint32_t iterations);
+  // Time of one password hash at the current cost, for tuning
+  unsigned long measureHashMillis();
+
+  bool isInitialized() { return initialized; }
+  bool isPersistent() { return persistent; }
+  size_t indexBytes() { return sizeof(usernameTable) + sizeof(emailTable) + accounts.capacity() * sizeof(Account); }
+};
+
+// Global instance
+extern CredentialStore Users;
+
+#endif
@@ -0,0 +1,176 @@
+#include "Dispense_Batch.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static const char DISPENSE_PREFIX[] = "DISPENSE:";
+static const char BATCH_PREFIX[] = "BATCH:";
+
+size_t appendDispenseOrder(const DispenseOrder& order, char* out, size_t length, size_t outSize) {
+  if (length >= outSize) return 0;
+
+  int n = snprintf(out + length, outSize - length, "%lu|", (unsigned long)order.job);
+  if (n < 0 || (size_t)n >= outSize - length) return 0;
+  length += n;
+
+  for (size_t i = 0; i < sizeof(order.prescriptionId) && order.prescriptionId[i]; i++) {
+    if (length + 1 >= outSize) return 0;
+    char c = order.prescriptionId[i];
+    out[length++] = (c == '|' || c == ';' || c == ',') ? '-' : c;
+  }
+  if (length + 1 >= outSize) return 0;
+  out[length++] = '|';
+
+  for (uint8_t i = 0; i < order.count && i < DISPENSE_MAX_ITEMS; i++) {
+    n = snprintf(out + length, outSize - length, "%sM%u:%u", i ? "," : "", order.medication[i], order.quantity[i]);
+    if (n < 0 || (size_t)n >= outSize - length) return 0;
+    length += n;
+  }
+  out[length] = '\0';
+  return length;
+}
+
+size_t formatDispenseBatch(const DispenseOrder* orders, size_t count, char* out, size_t outSize) {
+  if (count == 0 || count > DISPENSE_BATCH_MAX_ORDERS) return 0;
+
+  const char* prefix = count == 1 ? DISPENSE_PREFIX : BATCH_PREFIX;
+  size_t length = strlen(prefix);
+  if (length >= outSize) return 0;
+  memcpy(out, prefix, length + 1);
+
+  for (size_t i = 0; i < count; i++) {
+    if (i > 0) {
+      if (length + 1 >= outSize) return 0;
+      out[length++] = ';';
+    }
+    length = appendDispenseOrder(orders[i], out, length, outSize);
+    if (length == 0) return 0;
+  }
+  return length;
+}
+
+// Parses one "<job>|<rxId>|M<med>:<qty>,..." ending at end
+static bool parseOrder(const char* p, const char* end, DispenseOrder& order) {
+  memset(&order, 0, sizeof(order));
+
+  char* next;
+  order.job = (uint32_t)strtoul(p, &next, 10);
+  if (next == p || next >= end || *next != '|' || order.job == 0) return false;
+  p = next + 1;
+
+  const char* bar = (const char*)memchr(p, '|', end - p);
+  if (!bar) return false;
+  size_t idLength = bar - p;
+  if (idLength >= sizeof(order.prescriptionId)) idLength = sizeof(order.prescriptionId) - 1;
+  memcpy(order.prescriptionId, p, idLength);
+  p = bar + 1;
+
+  while (p < end) {
+    if (order.count == DISPENSE_MAX_ITEMS || *p != 'M') return false;
+    unsigned long medication = strtoul(p + 1, &next, 10);
+    if (next == p + 1 || next >= end || *next != ':' || medication > 255) return false;
+    p = next + 1;
+    unsigned long quantity = strtoul(p, &next, 10);
+    if (next == p || next > end || quantity > 255) return false;
+    order.medication[order.count] = (uint8_t)medication;
+    order.quantity[order.count] = (uint8_t)quantity;
+    order.count++;
+    p = next;
+    if (p < end) {
+      if (*p != ',') return false;
+      p++;
+    }
+  }
+  return order.count > 0;
+}
+
+bool parseDispenseBatch(const char* line, size_t length, DispenseBatch& batch) {
+  batch.orderCount = 0;
+  batch.pickCount = 0;
+  if (!line) return false;
+
+  const char* end = line + length;
+  const char* p;
+  bool single;
+  if (length > sizeof(DISPENSE_PREFIX) - 1 && memcmp(line, DISPENSE_PREFIX, sizeof(DISPENSE_PREFIX) - 1) == 0) {
+    p = line + sizeof(DISPENSE_PREFIX) - 1;
+    single = true;
+  } else if (length > sizeof(BATCH_PREFIX) - 1 && memcmp(line, BATCH_PREFIX, sizeof(BATCH_PREFIX) - 1) == 0) {
+    p = line + sizeof(BATCH_PREFIX) - 1;
+    single = false;
+  } else {
+    return false;
+  }
+
+  while (p < end) {
+    const char* orderEnd = single ? end : (const char*)memchr(p, ';', end - p);
+    if (!orderEnd) orderEnd = end;
+    if (batch.orderCount == DISPENSE_BATCH_MAX_ORDERS) return false;
+    if (!parseOrder(p, orderEnd, batch.orders[batch.orderCount])) return false;
+    batch.orderCount++;
+    p = orderEnd < end ? orderEnd + 1 : end;
+  }
+  if (batch.orderCount == 0) return false;
+
+  mergeDispenseBatch(batch);
+  return true;
+}
+
+void mergeDispenseBatch(DispenseBatch& batch) {
+  batch.pickCount = 0;
+  memset(batch.remaining, 0, sizeof(batch.remaining));
+  memset(batch.dispensed, 0, sizeof(batch.dispensed));
+
+  for (uint8_t o = 0; o < batch.orderCount; o++) {
+    const DispenseOrder& order = batch.orders[o];
+    for (uint8_t i = 0; i < order.count; i++) {
+      uint8_t cabinet = order.medication[i];
+      if (cabinet == 0) continue;
+
+      // Insertion keeps the picks sorted by cabinet
+      size_t at = 0;
+      while (at < batch.pickCount && batch.picks[at].cabinet < cabinet) at++;
+      DispensePick* pick = &batch.picks[at];
+      if (at == batch.pickCount || pick->cabinet != cabinet) {
+        memmove(pick + 1, pick, (batch.pickCount - at) * sizeof(DispensePick));
+        pick->cabinet = cabinet;
+        pick->quantity = 0;
+        pick->orders = 0;
+        batch.pickCount++;
+      }
+
+      unsigned quantity = pick->quantity + order.quantity[i];
+      pick->quantity = quantity > 255 ? 255 : (uint8_t)quantity;
+      if (!(pick->orders & (1u << o))) {
+        pick->orders |= (uint8_t)(1u << o);
+        batch.remaining[o]++;
+      }
+    }
+  }
+}
+
+uint8_t completeDispensePick(DispenseBatch& batch, size_t pick) {
+  if (pick >= batch.pickCount) return 0;
+  DispensePick& done = batch.picks[pick];
+  uint8_t finished = 0;
+
+  for (uint8_t o = 0; o < batch.orderCount; o++) {
+    if (!(done.orders & (1u << o))) continue;
+    const DispenseOrder& order = batch.orders[o];
+    for (uint8_t i = 0; i < order.count; i++) {
+      if (order.medication[i] == done.cabinet) batch.dispensed[o]++;
+    }
+    if (--batch.remaining[o] == 0) finished |= (uint8_t)(1u << o);
+  }
+  done.orders = 0;   // completing the same pick twice is a no-op
+  return finished;
+}
+
+size_t formatDispenseResult(const DispenseBatch& batch, uint8_t order, char* out, size_t outSize) {
+  if (order >= batch.orderCount) return 0;
+  const DispenseOrder& o = batch.orders[order];
+  int n = batch.dispensed[order] >= o.count
+            ? snprintf(out, outSize, "DONE:%lu", (unsigned long)o.job)
+            : snprintf(out, outSize, "FAIL:%lu:%u", (unsigned long)o.job, batch.dispensed[order]);
+  return (n < 0 || (size_t)n >= outSize) ? 0 : n;
+}
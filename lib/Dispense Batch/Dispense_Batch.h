@@ -0,0 +1,81 @@
+#ifndef DISPENSE_BATCH_H
+#define DISPENSE_BATCH_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Dispense order wire format, shared by the web ESP32 (DispenseQueue) and
+// the dispenser.
+//
+//   DISPENSE:<job>|<rxId>|M<med>:<qty>,M<med>:<qty>...     one order
+//   BATCH:<order>;<order>;...                              several orders,
+//                                                          each "<job>|<rxId>|M..."
+//
+// A batch lets the dispenser merge the orders into one pick list, visiting
+// each cabinet once per batch instead of once per order. Progress is still
+// reported per job (ACK/PROGRESS/DONE/FAIL), so the web side retries and
+// tracks each order exactly as for a single DISPENSE.
+//
+// Nothing here depends on Arduino, so the dispenser firmware and the native
+// test environment can use it as is.
+
+#define DISPENSE_MAX_ITEMS 3             // medications per order
+#define DISPENSE_RX_ID_SIZE 24
+#define DISPENSE_BATCH_MAX_ORDERS 8
+#define DISPENSE_BATCH_MAX_LINE 240      // stays under the ESPReader line buffer
+#define DISPENSE_MAX_PICKS (DISPENSE_BATCH_MAX_ORDERS * DISPENSE_MAX_ITEMS)
+
+struct DispenseOrder {
+  uint32_t job;
+  char prescriptionId[DISPENSE_RX_ID_SIZE];
+  uint8_t count;
+  uint8_t medication[DISPENSE_MAX_ITEMS];   // medication id (Cabinet_Map.h), 0 = unknown
+  uint8_t quantity[DISPENSE_MAX_ITEMS];
+};
+
+// One stop of the dispensing pass
+struct DispensePick {
+  uint8_t cabinet;
+  uint8_t quantity;     // summed over every order taking from this cabinet
+  uint8_t orders;       // bit i set: batch order i takes from this cabinet
+};
+
+struct DispenseBatch {
+  DispenseOrder orders[DISPENSE_BATCH_MAX_ORDERS];
+  uint8_t orderCount;
+  DispensePick picks[DISPENSE_MAX_PICKS];
+  uint8_t pickCount;
+  uint8_t remaining[DISPENSE_BATCH_MAX_ORDERS];   // picks an order still waits on
+  uint8_t dispensed[DISPENSE_BATCH_MAX_ORDERS];   // medications done per order
+};
+
+// Appends "<job>|<rxId>|M..." to out (NUL-terminated) and returns the new
+// length, or 0 if it does not fit in outSize. Separator characters in the
+// prescription id are replaced so the line always parses back.
+size_t appendDispenseOrder(const DispenseOrder& order, char* out, size_t length, size_t outSize);
+
+// Writes a DISPENSE: line for one order or a BATCH: line for several;
+// returns the length or 0 if the line would exceed outSize
+size_t formatDispenseBatch(const DispenseOrder* orders, size_t count, char* out, size_t outSize);
+
+// Parses a DISPENSE: or BATCH: line into batch.orders and merges them into
+// batch.picks (see mergeDispenseBatch). Returns false for anything else or
+// for a malformed order.
+bool parseDispenseBatch(const char* line, size_t length, DispenseBatch& batch);
+
+// Combines the orders' medications into one pick per cabinet, in cabinet
+// order, and resets the per-order progress counters. Unknown cabinets (0)
+// get no pick and are never counted as dispensed, so an order made only of
+// them has nothing remaining and is answered straight away, as a FAIL.
+void mergeDispenseBatch(DispenseBatch& batch);
+
+// Marks a pick as dispensed and returns the orders it finished, as a mask
+// of order indices
+uint8_t completeDispensePick(DispenseBatch& batch, size_t pick);
+
+// Writes the reply for a finished order: DONE:<job> if every medication was
+// dispensed, FAIL:<job>:<dispensed> otherwise. Returns the length, or 0 if
+// it does not fit in outSize.
+size_t formatDispenseResult(const DispenseBatch& batch, uint8_t order, char* out, size_t outSize);
+
+#endif
@@ -0,0 +1,454 @@
+#include "Dispense_Queue.h"
+#include "Async_Log.h"
+#include <rom/crc.h>
+#include <esp_system.h>
+
+#define DISPENSE_RECORD_MAGIC 0x44535051   // "DSPQ"
+#define DISPENSE_RECORD_VERSION 2
+
+static_assert(sizeof(DispenseRecord) == DISPENSE_RECORD_SIZE, "DispenseRecord must fill exactly one slot");
+
+// Global instance
+DispenseQueue DispenseJobs;
+
+DispenseQueue::DispenseQueue()
+  : storage(nullptr), comm(nullptr), initialized(false), persistent(false), lock(nullptr),
+    callback(nullptr), nextId(1) {
+  memset(jobs, 0, sizeof(jobs));
+}
+
+uint32_t DispenseQueue::recordCrc(const DispenseRecord& record) {
+  DispenseRecord copy = record;
+  copy.crc = 0;
+  return crc32_le(0, (const uint8_t*)&copy, sizeof(copy));
+}
+
+bool DispenseQueue::isOpen(DispenseState state) {
+  return state == DISPENSE_QUEUED || state == DISPENSE_SENT || state == DISPENSE_ACCEPTED;
+}
+
+const char* DispenseQueue::stateName(DispenseState state) {
+  switch (state) {
+    case DISPENSE_QUEUED: return "queued";
+    case DISPENSE_SENT: return "sent";
+    case DISPENSE_ACCEPTED: return "accepted";
+    case DISPENSE_DONE: return "done";
+    case DISPENSE_FAILED: return "failed";
+    case DISPENSE_CANCELLED: return "cancelled";
+    default: return "empty";
+  }
+}
+
+bool DispenseQueue::begin(StorageManager& storageManager, ESPrxtxESP& link, const String& filePath) {
+  end();
+
+  storage = &storageManager;
+  comm = &link;
+  path = filePath;
+  if (!lock) lock = xSemaphoreCreateMutex();
+  initialized = true;
+
+  // The dispenser answers a job id it has seen before from its own state, so
+  // ids must not start over after a reset. Start somewhere random in the
+  // lower half (wrapping is then decades away); replay() moves past any
+  // reloaded job.
+  nextId = (esp_random() >> 1) | 1;
+
+  if (!storage->isInitialized()) {
+    Serial.println("DispenseQueue: Storage not initialized, jobs will not survive a reset");
+    return false;
+  }
+
+  if (!storage->exists(path)) {
+    File created = storage->open(path, "w");
+    if (!created) {
+      Serial.println("DispenseQueue: Failed to create " + path + ", jobs will not survive a reset");
+      return false;
+    }
+    created.close();
+  }
+
+  dataFile = storage->open(path, "r+");
+  if (!dataFile) {
+    Serial.println("DispenseQueue: Failed to open " + path + ", jobs will not survive a reset");
+    return false;
+  }
+
+  // Slots are rewritten in place, so the file always holds every slot
+  if (dataFile.size() < DISPENSE_QUEUE_CAPACITY * DISPENSE_RECORD_SIZE) {
+    uint8_t zero[DISPENSE_RECORD_SIZE] = {0};
+    dataFile.seek(dataFile.size() - dataFile.size() % DISPENSE_RECORD_SIZE);
+    while (dataFile.size() < DISPENSE_QUEUE_CAPACITY * DISPENSE_RECORD_SIZE) {
+      if (dataFile.write(zero, sizeof(zero)) != sizeof(zero)) break;
+    }
+    dataFile.flush();
+    storage->invalidate(path);
+  }
+
+  persistent = true;
+  replay();
+
+  Serial.printf("DispenseQueue: %u unfinished jobs reloaded from %s\n", (unsigned)pending(), path.c_str());
+  return true;
+}
+
+void DispenseQueue::end() {
+  if (dataFile) dataFile.close();
+  memset(jobs, 0, sizeof(jobs));
+  persistent = false;
+  initialized = false;
+}
+
+void DispenseQueue::replay() {
+  DispenseRecord record;
+  dataFile.seek(0);
+  for (size_t slot = 0; slot < DISPENSE_QUEUE_CAPACITY; slot++) {
+    if (dataFile.read((uint8_t*)&record, sizeof(record)) != sizeof(record)) break;
+    // Version 1 records are the same without prescriptionRecord
+    if (record.magic != DISPENSE_RECORD_MAGIC || record.version < 1 || record.version > DISPENSE_RECORD_VERSION ||
+        record.crc != recordCrc(record) || record.id == 0) {
+      continue;
+    }
+
+    DispenseJob& job = jobs[slot];
+    job.id = record.id;
+    memcpy(job.prescriptionId, record.prescriptionId, sizeof(job.prescriptionId));
+    job.prescriptionId[sizeof(job.prescriptionId) - 1] = '\0';
+    job.prescriptionRecord = record.version >= 2 ? record.prescriptionRecord : DISPENSE_NO_RECORD;
+    job.count = min<uint8_t>(record.count, DISPENSE_MAX_ITEMS);
+    memcpy(job.medication, record.medication, sizeof(job.medication));
+    memcpy(job.quantity, record.quantity, sizeof(job.quantity));
+    job.dispensed = record.dispensed;
+    job.state = (DispenseState)record.state;
+    // Whatever was in flight is sent again; the dispenser answers repeats from its own state
+    if (isOpen(job.state)) job.state = DISPENSE_QUEUED;
+    job.attempts = 0;
+    job.queuedAt = 0;
+    job.lastSentAt = 0;
+    job.lastHeardAt = 0;
+
+    if (job.id >= nextId) nextId = job.id + 1;
+  }
+}
+
+bool DispenseQueue::writeJobLocked(const DispenseJob& job) {
+  if (!persistent) return true;
+
+  DispenseRecord record;
+  memset(&record, 0, sizeof(record));
+  record.magic = DISPENSE_RECORD_MAGIC;
+  record.version = DISPENSE_RECORD_VERSION;
+  // SENT is not worth an SD write; after a reset it is resent like QUEUED
+  record.state = job.state == DISPENSE_SENT ? DISPENSE_QUEUED : job.state;
+  record.count = job.count;
+  record.id = job.id;
+  memcpy(record.prescriptionId, job.prescriptionId, sizeof(record.prescriptionId));
+  record.prescriptionRecord = job.prescriptionRecord;
+  memcpy(record.medication, job.medication, sizeof(record.medication));
+  memcpy(record.quantity, job.quantity, sizeof(record.quantity));
+  record.dispensed = job.dispensed;
+  record.crc = recordCrc(record);
+
+  uint32_t offset = (&job - jobs) * DISPENSE_RECORD_SIZE;
+  storage->invalidate(path, offset, sizeof(record));
+  if (!dataFile.seek(offset)) return false;
+  size_t written = dataFile.write((const uint8_t*)&record, sizeof(record));
+  dataFile.flush();
+  return written == sizeof(record);
+}
+
+DispenseJob* DispenseQueue::findLocked(uint32_t id) {
+  if (id == 0) return nullptr;
+  for (DispenseJob& job : jobs) {
+    if (job.id == id && job.state != DISPENSE_EMPTY) return &job;
+  }
+  return nullptr;
+}
+
+// An empty slot, else the oldest finished job's; nullptr if all are open
+DispenseJob* DispenseQueue::freeSlotLocked() {
+  DispenseJob* oldest = nullptr;
+  for (DispenseJob& job : jobs) {
+    if (job.state == DISPENSE_EMPTY) return &job;
+    if (isOpen(job.state)) continue;
+    if (!oldest || job.id < oldest->id) oldest = &job;
+  }
+  return oldest;
+}
+
+void DispenseQueue::notify(const DispenseJob& job) {
+  if (callback) callback(job);
+}
+
+uint32_t DispenseQueue::enqueue(const String& prescriptionId, uint16_t prescriptionRecord, const int medications[],
+                                const int quantities[], size_t count) {
+  if (!initialized || count == 0) return 0;
+  if (count > DISPENSE_MAX_ITEMS) count = DISPENSE_MAX_ITEMS;
+
+  xSemaphoreTake(lock, portMAX_DELAY);
+  DispenseJob* slot = freeSlotLocked();
+  if (!slot) {
+    xSemaphoreGive(lock);
+    return 0;
+  }
+
+  DispenseJob& job = *slot;
+  memset(&job, 0, sizeof(job));
+  job.id = nextId;
+  size_t len = min<size_t>(prescriptionId.length(), sizeof(job.prescriptionId) - 1);
+  memcpy(job.prescriptionId, prescriptionId.c_str(), len);
+  job.prescriptionRecord = prescriptionRecord;
+  job.count = count;
+  for (size_t i = 0; i < count; i++) {
+    job.medication[i] = (uint8_t)constrain(medications[i], 0, 255);
+    job.quantity[i] = (uint8_t)constrain(quantities[i], 0, 255);
+  }
+  job.state = DISPENSE_QUEUED;
+  job.queuedAt = millis();
+
+  if (!writeJobLocked(job)) {
+    LOGW("DispenseQueue: Failed to save job %u", (unsigned)job.id);
+  }
+  uint32_t id = nextId++;
+  xSemaphoreGive(lock);
+  return id;
+}
+
+DispenseState DispenseQueue::cancel(uint16_t prescriptionRecord) {
+  if (!initialized) return DISPENSE_EMPTY;
+  DispenseJob* found = nullptr;
+
+  // The newest job for the record is the one that counts
+  xSemaphoreTake(lock, portMAX_DELAY);
+  for (DispenseJob& job : jobs) {
+    if (job.state == DISPENSE_EMPTY || job.prescriptionRecord != prescriptionRecord) continue;
+    if (!found || job.id > found->id) found = &job;
+  }
+  DispenseState state = found ? found->state : DISPENSE_EMPTY;
+  if (state == DISPENSE_QUEUED) {
+    found->state = state = DISPENSE_CANCELLED;
+    if (!writeJobLocked(*found)) LOGW("DispenseQueue: Failed to save job %u", (unsigned)found->id);
+  }
+  xSemaphoreGive(lock);
+  return state;
+}
+
+// Sends the jobs in list order, packing as many as fit into each line.
+// Returns how many were handed to the TX queue; stops at the first refusal.
+size_t DispenseQueue::transmitLocked(DispenseJob* const* list, size_t count, uint32_t now) {
+  DispenseOrder orders[DISPENSE_BATCH_MAX_ORDERS];
+  char line[DISPENSE_BATCH_MAX_LINE + 1];
+  size_t sent = 0;
+
+  while (sent < count) {
+    size_t n = 0;
+    while (sent + n < count && n < DISPENSE_BATCH_MAX_ORDERS) {
+      const DispenseJob& job = *list[sent + n];
+      DispenseOrder& order = orders[n];
+      order.job = job.id;
+      memcpy(order.prescriptionId, job.prescriptionId, sizeof(order.prescriptionId));
+      order.count = job.count;
+      memcpy(order.medication, job.medication, sizeof(order.medication));
+      memcpy(order.quantity, job.quantity, sizeof(order.quantity));
+      if (formatDispenseBatch(orders, n + 1, line, sizeof(line)) == 0) break;
+      n++;
+    }
+    if (n == 0 || formatDispenseBatch(orders, n, line, sizeof(line)) == 0) break;
+    if (comm->sendAsync(line) == ESP_TX_FAILED) break;
+
+    for (size_t i = 0; i < n; i++) {
+      list[sent + i]->attempts++;
+      list[sent + i]->lastSentAt = now;
+    }
+    sent += n;
+  }
+  return sent;
+}
+
+uint32_t DispenseQueue::resendDelay(uint8_t attempts) {
+  uint32_t backoff = DISPENSE_ACK_TIMEOUT << min<uint8_t>(attempts - 1, 4);
+  return backoff > DISPENSE_MAX_BACKOFF ? DISPENSE_MAX_BACKOFF : backoff;
+}
+
+void DispenseQueue::update(uint32_t now) {
+  if (!initialized || !comm) return;
+
+  DispenseJob* list[DISPENSE_QUEUE_CAPACITY];
+  DispenseJob failed[4];                // more than this wait for the next call
+  size_t count = 0;
+  size_t failedCount = 0;
+  size_t inFlight = 0;
+
+  xSemaphoreTake(lock, portMAX_DELAY);
+
+  // Retransmit overdue jobs
+  for (DispenseJob& job : jobs) {
+    if (job.state == DISPENSE_SENT) {
+      inFlight++;
+      if (now - job.lastSentAt >= resendDelay(job.attempts)) list[count++] = &job;
+    } else if (job.state == DISPENSE_ACCEPTED) {
+      if (now - job.lastHeardAt < DISPENSE_DONE_TIMEOUT || now - job.lastSentAt < DISPENSE_DONE_TIMEOUT) {
+        inFlight++;
+      } else if (job.attempts >= DISPENSE_MAX_QUERIES && failedCount < sizeof(failed) / sizeof(failed[0])) {
+        // The dispenser took it but will not say how it ended; stop asking
+        // so the job frees its slot and the prescription is not left open
+        LOGW("DispenseQueue: Job %u unanswered after %u queries, giving up", (unsigned)job.id, job.attempts);
+        job.state = DISPENSE_FAILED;
+        if (!writeJobLocked(job)) LOGW("DispenseQueue: Failed to save job %u", (unsigned)job.id);
+        failed[failedCount++] = job;
+      } else {
+        inFlight++;
+        list[count++] = &job;
+      }
+    }
+  }
+  if (count > 0) {
+    size_t sent = transmitLocked(list, count, now);
+    LOGI("DispenseQueue: Resent %u of %u unanswered jobs", (unsigned)sent, (unsigned)count);
+  }
+
+  // Queued jobs, oldest first
+  count = 0;
+  for (DispenseJob& job : jobs) {
+    if (job.state != DISPENSE_QUEUED) continue;
+    size_t at = count++;
+    while (at > 0 && list[at - 1]->id > job.id) {
+      list[at] = list[at - 1];
+      at--;
+    }
+    list[at] = &job;
+  }
+
+  // Hold a lone job briefly so orders placed together share one pass,
+  // unless there is already enough to fill the window
+  size_t room = inFlight < DISPENSE_WINDOW ? DISPENSE_WINDOW - inFlight : 0;
+  if (count > room) count = room;
+  if (count > 0 && (count == room || now - list[0]->queuedAt >= DISPENSE_BATCH_HOLD)) {
+    size_t sent = transmitLocked(list, count, now);
+    for (size_t i = 0; i < sent; i++) list[i]->state = DISPENSE_SENT;
+  }
+  xSemaphoreGive(lock);
+
+  for (size_t i = 0; i < failedCount; i++) notify(failed[i]);
+}
+
+// Time left of a wait of length period that started elapsed ms ago
+static uint32_t remaining(uint32_t period, uint32_t elapsed) {
+  return elapsed >= period ? 0 : period - elapsed;
+}
+
+uint32_t DispenseQueue::nextDueIn(uint32_t now) {
+  if (!initialized || !comm) return UINT32_MAX;
+
+  uint32_t due = UINT32_MAX;
+  uint32_t hold = UINT32_MAX;
+  size_t inFlight = 0;
+  size_t queued = 0;
+
+  // Same checks as update(), but only working out when they next pass
+  xSemaphoreTake(lock, portMAX_DELAY);
+  for (const DispenseJob& job : jobs) {
+    if (job.state == DISPENSE_SENT) {
+      inFlight++;
+      due = min(due, remaining(resendDelay(job.attempts), now - job.lastSentAt));
+    } else if (job.state == DISPENSE_ACCEPTED) {
+      inFlight++;
+      due = min(due, max(remaining(DISPENSE_DONE_TIMEOUT, now - job.lastHeardAt),
+                         remaining(DISPENSE_DONE_TIMEOUT, now - job.lastSentAt)));
+    } else if (job.state == DISPENSE_QUEUED) {
+      queued++;
+      hold = min(hold, remaining(DISPENSE_BATCH_HOLD, now - job.queuedAt));
+    }
+  }
+  xSemaphoreGive(lock);
+
+  // With the window full, queued jobs wait for a reply rather than a timer
+  size_t room = inFlight < DISPENSE_WINDOW ? DISPENSE_WINDOW - inFlight : 0;
+  if (queued > 0 && room > 0) due = min(due, queued >= room ? 0 : hold);
+  return due;
+}
+
+// Parses "<id>" or "<id>:<n>" after a prefix
+static bool parseJobReply(const String& message, size_t prefixLength, uint32_t& id, int& value) {
+  const char* p = message.c_str() + prefixLength;
+  char* end;
+  unsigned long parsed = strtoul(p, &end, 10);
+  if (end == p) return false;
+  id = (uint32_t)parsed;
+  value = -1;
+  if (*end == ':') value = atoi(end + 1);
+  return true;
+}
+
+bool DispenseQueue::handleMessage(const String& message) {
+  if (!initialized || !comm) return false;
+
+  uint32_t id;
+  int value = -1;
+  DispenseState newState;
+  if (comm->isAck(message, id)) {
+    newState = DISPENSE_ACCEPTED;
+  } else if (message.startsWith("PROGRESS:") && parseJobReply(message, 9, id, value)) {
+    newState = DISPENSE_ACCEPTED;
+  } else if (message.startsWith("DONE:") && parseJobReply(message, 5, id, value)) {
+    newState = DISPENSE_DONE;
+  } else if (message.startsWith("FAIL:") && parseJobReply(message, 5, id, value)) {
+    newState = DISPENSE_FAILED;
+  } else {
+    return false;
+  }
+
+  xSemaphoreTake(lock, portMAX_DELAY);
+  DispenseJob* job = findLocked(id);
+  if (!job || !isOpen(job->state)) {
+    // Late reply to a retransmission of a finished job
+    xSemaphoreGive(lock);
+    return true;
+  }
+
+  job->lastHeardAt = millis();
+  job->attempts = 0;
+  bool changed = job->state != newState;
+  if (value >= 0) {
+    uint8_t dispensed = (uint8_t)constrain(value, 0, job->count);
+    changed = changed || dispensed != job->dispensed;
+    job->dispensed = dispensed;
+  }
+  if (newState == DISPENSE_DONE) job->dispensed = job->count;
+  job->state = newState;
+
+  DispenseJob snapshot = *job;
+  if (changed && !writeJobLocked(*job)) {
+    LOGW("DispenseQueue: Failed to save job %u", (unsigned)job->id);
+  }
+  xSemaphoreGive(lock);
+
+  if (changed) notify(snapshot);
+  return true;
+}
+
+bool DispenseQueue::get(uint32_t id, DispenseJob& job) {
+  if (!initialized) return false;
+  xSemaphoreTake(lock, portMAX_DELAY);
+  DispenseJob* found = findLocked(id);
+  if (found) job = *found;
+  xSemaphoreGive(lock);
+  return found != nullptr;
+}
+
+bool DispenseQueue::copyAt(size_t slot, DispenseJob& job) {
+  if (!initialized || slot >= DISPENSE_QUEUE_CAPACITY) return false;
+  xSemaphoreTake(lock, portMAX_DELAY);
+  bool used = jobs[slot].state != DISPENSE_EMPTY;
+  if (used) job = jobs[slot];
+  xSemaphoreGive(lock);
+  return used;
+}
+
+size_t DispenseQueue::pending() {
+  size_t n = 0;
+  for (const DispenseJob& job : jobs) {
+    if (isOpen(job.state)) n++;
+  }
+  return n;
+}
@@ -0,0 +1,174 @@
+#ifndef DISPENSE_QUEUE_H
+#define DISPENSE_QUEUE_H
+
+#include <Arduino.h>
+#include "Storage_Manager.h"
+#include "ESPrxtxESP.h"
+#include "Dispense_Batch.h"
+
+// Reliable dispense job queue on the web ESP32.
+//
+// Every dispense order becomes a job with its own id. Jobs are kept in fixed
+// 64-byte slots of /dispense.dat and reloaded at boot, so an order survives
+// a reset; anything not finished is sent again. A new job takes an empty
+// slot, or else the slot of the oldest finished job.
+//
+// Text protocol over ESPrxtxESP:
+//   web -> dispenser   DISPENSE:<job>|<rxId>|M<med>:<qty>,M<med>:<qty>...
+//                      BATCH:<job>|<rxId>|M..;<job>|<rxId>|M..  (Dispense_Batch.h)
+//   dispenser -> web   ACK:<job>             accepted (see ESPrxtxESP::sendAck)
+//                      PROGRESS:<job>:<n>    n medications dispensed so far
+//                      DONE:<job>            finished
+//                      FAIL:<job>:<n>        gave up after n medications
+// A job is retransmitted with backoff until it is acknowledged, and again
+// if it goes quiet for too long after that; a job still unanswered after
+// DISPENSE_MAX_QUERIES such queries is given up as FAILED. The dispenser must therefore
+// treat a repeated job id as a status query: answer ACK (and DONE/FAIL if it
+// already finished) without dispensing again, so retries never duplicate an
+// order. Up to DISPENSE_WINDOW jobs are in flight at once so several doctors'
+// orders queue on the dispenser instead of waiting on each other's ACKs.
+//
+// Queued jobs are held for up to DISPENSE_BATCH_HOLD so that orders arriving
+// together (shift-change rounds) go out as one BATCH line; the dispenser then
+// serves them in a single pass through the cabinets. Retransmissions are
+// batched the same way.
+
+#define DISPENSE_DEFAULT_PATH "/dispense.dat"
+#define DISPENSE_RECORD_SIZE 64
+
+#ifndef DISPENSE_QUEUE_CAPACITY
+#define DISPENSE_QUEUE_CAPACITY 32
+#endif
+#ifndef DISPENSE_WINDOW
+#define DISPENSE_WINDOW DISPENSE_BATCH_MAX_ORDERS   // jobs sent but not finished
+#endif
+#ifndef DISPENSE_BATCH_HOLD
+#define DISPENSE_BATCH_HOLD 250             // ms a queued job may wait for company
+#endif
+#define DISPENSE_ACK_TIMEOUT 500            // ms before the first resend
+#define DISPENSE_MAX_BACKOFF 8000           // ms, cap for the doubling resend delay
+#define DISPENSE_DONE_TIMEOUT 120000        // ms of silence after ACK before asking again
+#define DISPENSE_MAX_QUERIES 5              // unanswered queries after ACK before giving up
+#define DISPENSE_NO_RECORD 0xFFFF           // job from before records were tracked
+
+enum DispenseState : uint8_t {
+  DISPENSE_EMPTY,
+  DISPENSE_QUEUED,        // waiting for a window slot
+  DISPENSE_SENT,          // sent, no ACK yet
+  DISPENSE_ACCEPTED,      // ACKed, dispenser is working on it
+  DISPENSE_DONE,
+  DISPENSE_FAILED,
+  DISPENSE_CANCELLED
+};
+
+struct DispenseJob {
+  uint32_t id;
+  char prescriptionId[DISPENSE_RX_ID_SIZE];
+  uint16_t prescriptionRecord;  // the caller's record number for the order, handed back as is
+  uint8_t count;
+  uint8_t medication[DISPENSE_MAX_ITEMS];
+  uint8_t quantity[DISPENSE_MAX_ITEMS];
+  uint8_t dispensed;      // medications reported done
+  DispenseState state;
+
+  // Not persisted
+  uint8_t attempts;       // sends since the last reply
+  uint32_t queuedAt;
+  uint32_t lastSentAt;
+  uint32_t lastHeardAt;
+};
+
+// On-disk slot layout
+struct DispenseRecord {
+  uint32_t magic;
+  uint16_t version;
+  uint8_t state;
+  uint8_t count;
+  uint32_t crc;               // CRC32 of the record with this field zeroed
+  uint32_t id;
+  char prescriptionId[DISPENSE_RX_ID_SIZE];
+  uint8_t medication[DISPENSE_MAX_ITEMS];
+  uint8_t quantity[DISPENSE_MAX_ITEMS];
+  uint8_t dispensed;
+  uint8_t reserved;
+  uint16_t prescriptionRecord;  // version 2 on
+  uint8_t padding[14];
+};
+
+// Called from update()/handleMessage() whenever a job changes state
+typedef void (*DispenseCallback)(const DispenseJob& job);
+
+class DispenseQueue {
+private:
+  StorageManager* storage;
+  ESPrxtxESP* comm;
+  File dataFile;
+  String path;
+  bool initialized;
+  bool persistent;
+  SemaphoreHandle_t lock;
+  DispenseCallback callback;
+  uint32_t nextId;
+
+  DispenseJob jobs[DISPENSE_QUEUE_CAPACITY];
+
+  static uint32_t recordCrc(const DispenseRecord& record);
+  static bool isOpen(DispenseState state);
+  static uint32_t resendDelay(uint8_t attempts);
+
+  DispenseJob* findLocked(uint32_t id);
+  DispenseJob* freeSlotLocked();
+  bool writeJobLocked(const DispenseJob& job);
+  size_t transmitLocked(DispenseJob* const* list, size_t count, uint32_t now);
+  void replay();
+  void notify(const DispenseJob& job);
+
+public:
+  DispenseQueue();
+
+  // Opens (or creates) the job file and reloads unfinished jobs. Without
+  // mounted storage the queue still works, but jobs are lost on reset.
+  bool begin(StorageManager& storageManager, ESPrxtxESP& link, const String& filePath = DISPENSE_DEFAULT_PATH);
+  void end();
+
+  void onStateChange(DispenseCallback cb) { callback = cb; }
+
+  // Queues an order and returns its job id, or 0 if every slot holds an
+  // unfinished job.
+  // medications/quantities hold count entries (at most DISPENSE_MAX_ITEMS).
+  // prescriptionRecord comes back in every DispenseJob for this order.
+  uint32_t enqueue(const String& prescriptionId, uint16_t prescriptionRecord, const int medications[],
+                   const int quantities[], size_t count);
+
+  // Drops the job for a prescription record if it has not been sent yet.
+  // Returns DISPENSE_CANCELLED if it was (or already had been),
+  // DISPENSE_EMPTY if there is no job for the record, otherwise the state
+  // of the job that is too far along to pull back.
+  DispenseState cancel(uint16_t prescriptionRecord);
+
+  // Consumes ACK/PROGRESS/DONE/FAIL replies; returns false for anything else
+  bool handleMessage(const String& message);
+
+  // Sends queued jobs and retransmits overdue ones; call from loop()
+  void update(uint32_t now);
+
+  // Milliseconds until update() has something to send, UINT32_MAX if only a
+  // reply from the dispenser can change anything. Lets the caller sleep
+  // instead of polling update().
+  uint32_t nextDueIn(uint32_t now);
+
+  bool get(uint32_t id, DispenseJob& job);
+  size_t capacity() { return DISPENSE_QUEUE_CAPACITY; }
+  bool copyAt(size_t slot, DispenseJob& job);   // false for an empty slot
+  size_t pending();                             // queued, sent or accepted
+
+  bool isInitialized() { return initialized; }
+  bool isPersistent() { return persistent; }
+
+  static const char* stateName(DispenseState state);
+};
+
+// Global instance
+extern DispenseQueue DispenseJobs;
+
+#endif
@@ -4,17 +4,226 @@
 #include <Arduino.h>
 #include <HardwareSerial.h>
 
+// Two transports share one UART:
+//   - text: a newline-terminated ASCII line, as before
+//   - frame: 0x00, COBS(type, seq, length, payload, CRC16), 0x00
+// COBS removes every 0x00 from the frame body, so a 0x00 always marks a frame
+// boundary and text lines (which never contain 0x00) can be mixed freely with
+// frames. The receiver checks length and CRC16-CCITT, so a corrupted frame is
+// dropped and counted instead of being misparsed. Sequence numbers let the
+// receiver count lost and repeated frames.
+// Lines are always written whole, so a 0x00 part way through a text line means
+// the line is noise or lost its end: the partial line is discarded, not
+// delivered, and its bytes are counted in ESPFrameStats::textDropped.
+
+#define ESP_FRAME_MAX_PAYLOAD 250
+#define ESP_FRAME_HEADER_SIZE 3     // type, seq, length
+#define ESP_FRAME_CRC_SIZE 2
+#define ESP_FRAME_RAW_MAX (ESP_FRAME_HEADER_SIZE + ESP_FRAME_MAX_PAYLOAD + ESP_FRAME_CRC_SIZE)
+#define ESP_FRAME_ENCODED_MAX (ESP_FRAME_RAW_MAX + ESP_FRAME_RAW_MAX / 254 + 1)
+#define ESP_FRAME_QUEUE_SIZE 4      // received frames held until read
+#define ESP_TEXT_MAX_LINE 256       // longer lines are truncated
+
+// Frame types below 0x10 are reserved for the library
+#define ESP_FRAME_TEXT 0x01         // payload is a text message, delivered through read()
+#define ESP_FRAME_USER 0x10
+
+struct ESPFrame {
+    uint8_t type;
+    uint8_t seq;
+    uint8_t length;
+    uint8_t payload[ESP_FRAME_MAX_PAYLOAD];
+};
+
+struct ESPFrameStats {
+    uint32_t received;
+    uint32_t crcErrors;         // bad CRC, bad length or broken COBS
+    uint32_t overruns;          // frame longer than ESP_FRAME_RAW_MAX
+    uint32_t sequenceGaps;      // frames missing between two received ones
+    uint32_t duplicates;        // same sequence number twice in a row
+    uint32_t textDropped;       // bytes of partial text lines cut off by a frame start
+};
+
+class ESPFrameCodec {
+public:
+    // CRC16-CCITT (poly 0x1021, init 0xFFFF)
+    static uint16_t crc16(const uint8_t* data, size_t length, uint16_t crc = 0xFFFF) {
+        for (size_t i = 0; i < length; i++) {
+            crc ^= (uint16_t)data[i] << 8;
+            for (int b = 0; b < 8; b++) {
+                crc = (crc & 0x8000) ? (uint16_t)((crc << 1) ^ 0x1021) : (uint16_t)(crc << 1);
+            }
+        }
+        return crc;
+    }
+
+    // COBS-encodes length bytes into out (at most length + length / 254 + 1
+    // bytes) and returns the encoded size. The output contains no 0x00.
+    static size_t cobsEncode(const uint8_t* in, size_t length, uint8_t* out) {
+        size_t codeIndex = 0;
+        size_t o = 1;
+        uint8_t code = 1;
+        for (size_t i = 0; i < length; i++) {
+            if (in[i] == 0) {
+                out[codeIndex] = code;
+                codeIndex = o++;
+                code = 1;
+            } else {
+                out[o++] = in[i];
+                if (++code == 0xFF) {
+                    out[codeIndex] = code;
+                    codeIndex = o++;
+                    code = 1;
+                }
+            }
+        }
+        out[codeIndex] = code;
+        return o;
+    }
+
+    // Builds a complete wire frame (both delimiters included) into out, which
+    // must hold ESP_FRAME_ENCODED_MAX + 2 bytes. Returns 0 if payload is too long.
+    static size_t encodeFrame(uint8_t type, uint8_t seq, const uint8_t* payload, size_t length, uint8_t* out) {
+        if (length > ESP_FRAME_MAX_PAYLOAD) return 0;
+        uint8_t raw[ESP_FRAME_RAW_MAX];
+        raw[0] = type;
+        raw[1] = seq;
+        raw[2] = (uint8_t)length;
+        if (length) memcpy(raw + ESP_FRAME_HEADER_SIZE, payload, length);
+        size_t rawLength = ESP_FRAME_HEADER_SIZE + length;
+        uint16_t crc = crc16(raw, rawLength);
+        raw[rawLength++] = (uint8_t)(crc & 0xFF);
+        raw[rawLength++] = (uint8_t)(crc >> 8);
+
+        out[0] = 0x00;
+        size_t n = 1 + cobsEncode(raw, rawLength, out + 1);
+        out[n++] = 0x00;
+        return n;
+    }
+};
+
 class ESPReader {
 private:
+    enum RxState : uint8_t { RX_TEXT, RX_FRAME, RX_SKIP };
+
     HardwareSerial* serial;
-    String buffer;
+
+    // Text lines
+    char line[ESP_TEXT_MAX_LINE];
+    size_t lineLength;
     bool dataAvailable;
-    
+
+    // Incremental COBS decoder
+    RxState state;
+    uint8_t raw[ESP_FRAME_RAW_MAX];
+    size_t rawLength;
+    uint8_t blockRemaining;     // data bytes left in the current COBS block
+    uint8_t blockCode;          // code byte of the current block, 0 = none yet
+
+    // Ring of decoded frames
+    ESPFrame frames[ESP_FRAME_QUEUE_SIZE];
+    uint8_t frameHead;
+    uint8_t frameCount;
+
+    ESPFrameStats stats;
+    bool haveSeq;
+    uint8_t lastSeq;
+
+    void startFrame() {
+        // Lines are written whole, so a frame start mid-line means the line was noise
+        stats.textDropped += lineLength;
+        lineLength = 0;
+        state = RX_FRAME;
+        rawLength = 0;
+        blockRemaining = 0;
+        blockCode = 0;
+    }
+
+    void finishFrame() {
+        // Two delimiters in a row: the first was the end of a frame we joined
+        // half way through, this one starts the next frame
+        if (blockCode == 0) return;
+        state = RX_TEXT;
+        if (blockRemaining != 0 || rawLength < ESP_FRAME_HEADER_SIZE + ESP_FRAME_CRC_SIZE ||
+            raw[2] != rawLength - ESP_FRAME_HEADER_SIZE - ESP_FRAME_CRC_SIZE) {
+            stats.crcErrors++;
+            return;
+        }
+        size_t bodyLength = rawLength - ESP_FRAME_CRC_SIZE;
+        uint16_t crc = (uint16_t)raw[bodyLength] | ((uint16_t)raw[bodyLength + 1] << 8);
+        if (ESPFrameCodec::crc16(raw, bodyLength) != crc) {
+            stats.crcErrors++;
+            return;
+        }
+
+        uint8_t seq = raw[1];
+        // Counted only; a repeat usually means the peer restarted
+        if (haveSeq) {
+            if (seq == lastSeq) stats.duplicates++;
+            else stats.sequenceGaps += (uint8_t)(seq - lastSeq - 1);
+        }
+        haveSeq = true;
+        lastSeq = seq;
+
+        ESPFrame& frame = frames[(frameHead + frameCount) % ESP_FRAME_QUEUE_SIZE];
+        frame.type = raw[0];
+        frame.seq = seq;
+        frame.length = raw[2];
+        memcpy(frame.payload, raw + ESP_FRAME_HEADER_SIZE, frame.length);
+        frameCount++;
+        stats.received++;
+    }
+
+    void frameByte(uint8_t b) {
+        if (blockRemaining == 0) {
+            // Code byte. The previous block ended in an implied zero unless it was full.
+            if (blockCode != 0 && blockCode != 0xFF) {
+                if (rawLength == sizeof(raw)) {
+                    state = RX_SKIP;
+                    stats.overruns++;
+                    return;
+                }
+                raw[rawLength++] = 0;
+            }
+            blockCode = b;
+            blockRemaining = b - 1;
+            return;
+        }
+        if (rawLength == sizeof(raw)) {
+            state = RX_SKIP;
+            stats.overruns++;
+            return;
+        }
+        raw[rawLength++] = b;
+        blockRemaining--;
+    }
+
+    void textByte(char c) {
+        if (c == '\n') {
+            dataAvailable = true;
+            return;
+        }
+        if (lineLength < sizeof(line) - 1) line[lineLength++] = c;
+    }
+
+    bool textFrameAvailable() {
+        return frameCount > 0 && frames[frameHead].type == ESP_FRAME_TEXT;
+    }
+
 public:
     ESPReader(HardwareSerial* hwSerial) {
         serial = hwSerial;
-        buffer = "";
+        lineLength = 0;
         dataAvailable = false;
+        state = RX_TEXT;
+        rawLength = 0;
+        blockRemaining = 0;
+        blockCode = 0;
+        frameHead = 0;
+        frameCount = 0;
+        memset(&stats, 0, sizeof(stats));
+        haveSeq = false;
+        lastSeq = 0;
     }
     
     void begin(long baudRate = 9600) {
@@ -25,26 +234,47 @@ public:
         // Don't delete HardwareSerial as it's not dynamically allocated
     }
     
+    // Stops at the end of a text line, or when the frame queue is full, so
+    // nothing is overwritten before it is read; the rest waits in the UART buffer
     void update() {
-        while (serial->available()) {
-            char c = serial->read();
-            if (c == '\n') {
-                dataAvailable = true;
-                return;
+        while (!dataAvailable && frameCount < ESP_FRAME_QUEUE_SIZE && serial->available()) {
+            uint8_t b = (uint8_t)serial->read();
+            if (b == 0x00) {
+                if (state == RX_FRAME) finishFrame();
+                else if (state == RX_SKIP) state = RX_TEXT;
+                else startFrame();
+                continue;
+            }
+            switch (state) {
+                case RX_TEXT: textByte((char)b); break;
+                case RX_FRAME: frameByte(b); break;
+                case RX_SKIP: break;
             }
-            buffer += c;
         }
     }
     
+    // Text messages, whether sent as lines or as ESP_FRAME_TEXT frames
     bool available() {
         update();
-        return dataAvailable;
+        return dataAvailable || textFrameAvailable();
     }
     
+    // Queued frames arrived before any complete line (update() stops at the
+    // end of a line), so text frames go first to keep messages in order
     String read() {
+        if (textFrameAvailable()) {
+            ESPFrame& frame = frames[frameHead];
+            String data;
+            data.reserve(frame.length);
+            for (uint8_t i = 0; i < frame.length; i++) data += (char)frame.payload[i];
+            frameHead = (frameHead + 1) % ESP_FRAME_QUEUE_SIZE;
+            frameCount--;
+            return data;
+        }
         if (dataAvailable) {
-            String data = buffer;
-            buffer = "";
+            line[lineLength] = '\0';
+            String data(line);
+            lineLength = 0;
             dataAvailable = false;
             return data;
         }
@@ -52,23 +282,157 @@ public:
     }
     
     String peek() {
-        return buffer;
+        line[lineLength] = '\0';
+        return String(line);
+    }
+
+    // Frames of any type, oldest first
+    bool frameAvailable() {
+        update();
+        return frameCount > 0;
+    }
+
+    bool readFrame(ESPFrame& frame) {
+        update();
+        if (frameCount == 0) return false;
+        const ESPFrame& head = frames[frameHead];
+        frame.type = head.type;
+        frame.seq = head.seq;
+        frame.length = head.length;
+        memcpy(frame.payload, head.payload, head.length);
+        frameHead = (frameHead + 1) % ESP_FRAME_QUEUE_SIZE;
+        frameCount--;
+        return true;
+    }
+
+    const ESPFrameStats& frameStats() {
+        return stats;
     }
     
     void flush() {
-        buffer = "";
+        lineLength = 0;
         dataAvailable = false;
+        state = RX_TEXT;
+        frameCount = 0;
         serial->flush();
     }
 };
 
+// Transmit queue used in non-blocking mode. Messages are copied once into the
+// ring and written out by a small FreeRTOS task, so the caller never waits
+// for the UART. Each queued message gets a handle, which is simply the queue
+// position of its last byte; 0 means it did not fit.
+#ifndef ESP_TX_BUFFER_SIZE
+#define ESP_TX_BUFFER_SIZE 2048
+#endif
+#define ESP_TX_TASK_STACK 2048
+#define ESP_TX_TASK_PRIORITY 2
+
+static_assert((ESP_TX_BUFFER_SIZE & (ESP_TX_BUFFER_SIZE - 1)) == 0, "ESP_TX_BUFFER_SIZE must be a power of two");
+
+typedef uint32_t ESPTxHandle;
+#define ESP_TX_FAILED 0
+
 class ESPSender {
 private:
     HardwareSerial* serial;
+    uint8_t nextSeq;
+    bool framedText;
+    bool nonBlocking;
+
+    uint8_t txBuffer[ESP_TX_BUFFER_SIZE];
+    volatile uint32_t txQueued;     // total bytes ever queued
+    volatile uint32_t txDrained;    // total bytes ever handed to the UART
+    uint32_t txDropped;             // messages refused because the ring was full
+    SemaphoreHandle_t txLock;
+    TaskHandle_t txTask;
+
+    static void txTaskMain(void* arg) {
+        ESPSender* self = (ESPSender*)arg;
+        for (;;) {
+            ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+            self->drain();
+        }
+    }
+
+    // Runs on the TX task. Producers only write to the free part of the ring,
+    // so the pending part can be written out without holding the lock.
+    void drain() {
+        for (;;) {
+            xSemaphoreTake(txLock, portMAX_DELAY);
+            uint32_t pending = txQueued - txDrained;
+            xSemaphoreGive(txLock);
+            if (pending == 0) return;
+            uint32_t start = txDrained & (ESP_TX_BUFFER_SIZE - 1);
+            uint32_t chunk = ESP_TX_BUFFER_SIZE - start;
+            if (chunk > pending) chunk = pending;
+            serial->write(txBuffer + start, chunk);   // blocks this task only
+            xSemaphoreTake(txLock, portMAX_DELAY);
+            txDrained += chunk;
+            xSemaphoreGive(txLock);
+        }
+    }
+
+    bool startTxTask() {
+        if (txTask) return true;
+        if (!txLock) txLock = xSemaphoreCreateMutex();
+        if (!txLock) return false;
+        return xTaskCreate(txTaskMain, "esp_tx", ESP_TX_TASK_STACK, this, ESP_TX_TASK_PRIORITY, &txTask) == pdPASS;
+    }
+
+    void copyIn(const uint8_t* data, size_t length) {
+        uint32_t start = txQueued & (ESP_TX_BUFFER_SIZE - 1);
+        size_t first = ESP_TX_BUFFER_SIZE - start;
+        if (first > length) first = length;
+        memcpy(txBuffer + start, data, first);
+        memcpy(txBuffer, data + first, length - first);
+        txQueued += length;
+    }
+
+    // Queues the message as a whole or not at all
+    ESPTxHandle enqueue(const uint8_t* data, size_t length, bool newline) {
+        size_t total = length + (newline ? 1 : 0);
+        if (!startTxTask()) return ESP_TX_FAILED;
+
+        xSemaphoreTake(txLock, portMAX_DELAY);
+        if (total > ESP_TX_BUFFER_SIZE - (txQueued - txDrained)) {
+            txDropped++;
+            xSemaphoreGive(txLock);
+            return ESP_TX_FAILED;
+        }
+        copyIn(data, length);
+        if (newline) copyIn((const uint8_t*)"\n", 1);
+        ESPTxHandle handle = txQueued;
+        xSemaphoreGive(txLock);
+
+        xTaskNotifyGive(txTask);
+        return handle;
+    }
+
+    // Keeps blocking writes behind anything still queued
+    void waitQueueEmpty() {
+        while (txTask && txQueued != txDrained) vTaskDelay(1);
+    }
+
+    size_t encodeFrame(uint8_t type, const uint8_t* payload, size_t length, uint8_t* wire) {
+        uint8_t seq;
+        if (txLock) xSemaphoreTake(txLock, portMAX_DELAY);
+        seq = nextSeq++;
+        if (txLock) xSemaphoreGive(txLock);
+        return ESPFrameCodec::encodeFrame(type, seq, payload, length, wire);
+    }
     
 public:
     ESPSender(HardwareSerial* hwSerial) {
         serial = hwSerial;
+        nextSeq = 0;
+        framedText = false;
+        nonBlocking = false;
+        txQueued = 0;
+        txDrained = 0;
+        txDropped = 0;
+        txLock = nullptr;
+        txTask = nullptr;
     }
     
     void begin(long baudRate = 9600) {
@@ -77,32 +441,114 @@ public:
     
     ~ESPSender() {
         // Don't delete HardwareSerial as it's not dynamically allocated
+        if (txTask) vTaskDelete(txTask);
+        if (txLock) vSemaphoreDelete(txLock);
     }
     
     void send(String message) {
-        serial->print(message);
-        serial->print('\n');
-        serial->flush();
+        send(message.c_str());
     }
     
     void send(const char* message) {
+        if (framedText) {
+            sendFrame(ESP_FRAME_TEXT, (const uint8_t*)message, strlen(message));
+            return;
+        }
+        if (nonBlocking) {
+            enqueue((const uint8_t*)message, strlen(message), true);
+            return;
+        }
+        waitQueueEmpty();
         serial->print(message);
         serial->print('\n');
         serial->flush();
     }
     
     void send(int value) {
+        if (framedText || nonBlocking) {
+            send(String(value));
+            return;
+        }
+        waitQueueEmpty();
         serial->print(value);
         serial->print('\n');
         serial->flush();
     }
     
     void send(float value) {
+        if (framedText || nonBlocking) {
+            send(String(value));
+            return;
+        }
+        waitQueueEmpty();
         serial->print(value);
         serial->print('\n');
         serial->flush();
     }
 
+
+    // Sends one frame in a single write; returns false if payload is too long
+    // (or, in non-blocking mode, if it did not fit in the queue)
+    bool sendFrame(uint8_t type, const uint8_t* payload, size_t length) {
+        if (nonBlocking) return sendFrameAsync(type, payload, length) != ESP_TX_FAILED;
+        uint8_t wire[ESP_FRAME_ENCODED_MAX + 2];
+        size_t n = encodeFrame(type, payload, length, wire);
+        if (n == 0) return false;
+        waitQueueEmpty();
+        return serial->write(wire, n) == n;
+    }
+
+    // Queue a message and return at once. Text is sent as a line, or as a
+    // text frame when framed text is enabled.
+    ESPTxHandle sendAsync(const char* message) {
+        if (framedText) return sendFrameAsync(ESP_FRAME_TEXT, (const uint8_t*)message, strlen(message));
+        return enqueue((const uint8_t*)message, strlen(message), true);
+    }
+
+    ESPTxHandle sendAsync(const String& message) {
+        return sendAsync(message.c_str());
+    }
+
+    ESPTxHandle sendFrameAsync(uint8_t type, const uint8_t* payload, size_t length) {
+        uint8_t wire[ESP_FRAME_ENCODED_MAX + 2];
+        size_t n = encodeFrame(type, payload, length, wire);
+        if (n == 0) return ESP_TX_FAILED;
+        return enqueue(wire, n, false);
+    }
+
+    // True once every byte of the message has been handed to the UART driver
+    bool isSent(ESPTxHandle handle) {
+        return handle != ESP_TX_FAILED && (int32_t)(txDrained - handle) >= 0;
+    }
+
+    bool waitSent(ESPTxHandle handle, unsigned long timeoutMs) {
+        if (handle == ESP_TX_FAILED) return false;
+        unsigned long start = millis();
+        while (!isSent(handle)) {
+            if (millis() - start >= timeoutMs) return false;
+            vTaskDelay(1);
+        }
+        return true;
+    }
+
+    // When enabled, send() and sendFrame() queue instead of waiting for the UART
+    void setNonBlocking(bool enabled) {
+        nonBlocking = enabled && startTxTask();
+    }
+
+    size_t txPending() {
+        return txQueued - txDrained;
+    }
+
+    uint32_t txDroppedCount() {
+        return txDropped;
+    }
+
+    // When enabled, text messages go out as ESP_FRAME_TEXT frames and gain
+    // CRC and sequence checks. Both ends understand both forms either way.
+    void setFramedText(bool enabled) {
+        framedText = enabled;
+    }
     
     bool isReady() {
         return serial != nullptr;
@@ -152,6 +598,18 @@ public:
     void flushReader() {
         reader->flush();
     }
+
+    bool frameAvailable() {
+        return reader->frameAvailable();
+    }
+
+    bool readFrame(ESPFrame& frame) {
+        return reader->readFrame(frame);
+    }
+
+    const ESPFrameStats& frameStats() {
+        return reader->frameStats();
+    }
     
     // Sender methods
     void send(String message) {
@@ -169,6 +627,46 @@ public:
     void send(float value) {
         sender->send(value);
     }
+
+    bool sendFrame(uint8_t type, const uint8_t* payload, size_t length) {
+        return sender->sendFrame(type, payload, length);
+    }
+
+    ESPTxHandle sendAsync(const String& message) {
+        return sender->sendAsync(message);
+    }
+
+    ESPTxHandle sendAsync(const char* message) {
+        return sender->sendAsync(message);
+    }
+
+    ESPTxHandle sendFrameAsync(uint8_t type, const uint8_t* payload, size_t length) {
+        return sender->sendFrameAsync(type, payload, length);
+    }
+
+    bool isSent(ESPTxHandle handle) {
+        return sender->isSent(handle);
+    }
+
+    bool waitSent(ESPTxHandle handle, unsigned long timeoutMs = 1000) {
+        return sender->waitSent(handle, timeoutMs);
+    }
+
+    void setNonBlocking(bool enabled) {
+        sender->setNonBlocking(enabled);
+    }
+
+    size_t txPending() {
+        return sender->txPending();
+    }
+
+    uint32_t txDropped() {
+        return sender->txDroppedCount();
+    }
+
+    void setFramedText(bool enabled) {
+        sender->setFramedText(enabled);
+    }
     
     bool isReady() {
         return sender->isReady();
@@ -213,6 +711,13 @@ public:
         send("ACK");
     }
     
+    // Acknowledges a numbered request, e.g. a dispense job
+    void sendAck(uint32_t id) {
+        char buffer[16];
+        snprintf(buffer, sizeof(buffer), "ACK:%lu", (unsigned long)id);
+        send(buffer);
+    }
+    
     bool isPing(String message) {
         message.toUpperCase();
         message.trim();
@@ -231,6 +736,17 @@ public:
         return message == "ACK";
     }
     
+    // Matches "ACK:<id>" and returns the id
+    bool isAck(const String& message, uint32_t& id) {
+        if (!message.startsWith("ACK:")) return false;
+        const char* digits = message.c_str() + 4;
+        char* end;
+        unsigned long parsed = strtoul(digits, &end, 10);
+        if (end == digits) return false;
+        id = (uint32_t)parsed;
+        return true;
+    }
+    
     // Auto-ping functionality
     void enableAutoPing(unsigned long intervalMs = 10000) {
         autoPingEnabled = true;
@@ -261,7 +777,7 @@ public:
         else if (isPong(message)) {
             return "PONG_RECEIVED";
         }
-        else if (isAck(message)) {
+        else if (isAck(message) || message.startsWith("ACK:")) {
             return "ACK_RECEIVED";
         }
         else if (message.startsWith("DISPENSE:")) {
@@ -0,0 +1,155 @@
+#include "Json_Stream.h"
+#include "Web_Metrics.h"
+#include <memory>
+
+// Room always kept free for closing quotes and braces
+#define JSON_STREAM_RESERVE 16
+
+void JsonStageBuffer::raw(const char* text) {
+  size_t len = strlen(text);
+  if (used + len >= JSON_STREAM_STAGE_SIZE) len = JSON_STREAM_STAGE_SIZE - 1 - used;
+  memcpy(data + used, text, len);
+  used += len;
+  data[used] = '\0';
+}
+
+void JsonStageBuffer::escaped(const char* text) {
+  const size_t limit = JSON_STREAM_STAGE_SIZE - JSON_STREAM_RESERVE;
+  for (const char* p = text; *p; p++) {
+    char c = *p;
+    char esc[7];
+    size_t len = 1;
+    esc[0] = c;
+    if (c == '"' || c == '\\') {
+      esc[0] = '\\'; esc[1] = c; len = 2;
+    } else if (c == '\n') {
+      esc[0] = '\\'; esc[1] = 'n'; len = 2;
+    } else if (c == '\r') {
+      esc[0] = '\\'; esc[1] = 'r'; len = 2;
+    } else if (c == '\t') {
+      esc[0] = '\\'; esc[1] = 't'; len = 2;
+    } else if ((uint8_t)c < 0x20) {
+      snprintf(esc, sizeof(esc), "\\u%04x", (uint8_t)c);
+      len = 6;
+    }
+    if (used + len > limit) break;  // truncate the value, keep the JSON valid
+    memcpy(data + used, esc, len);
+    used += len;
+  }
+  data[used] = '\0';
+}
+
+void JsonStageBuffer::key(const char* name) {
+  if (needsComma) raw(",");
+  raw("\"");
+  raw(name);
+  raw("\":");
+  needsComma = true;
+}
+
+void JsonStageBuffer::beginObject() {
+  raw("{");
+  needsComma = false;
+}
+
+void JsonStageBuffer::endObject() {
+  raw("}");
+  needsComma = true;
+}
+
+void JsonStageBuffer::endArray() {
+  raw("]");
+  needsComma = true;
+}
+
+void JsonStageBuffer::add(const char* name, const char* value) {
+  if (used + strlen(name) + 8 + JSON_STREAM_RESERVE > JSON_STREAM_STAGE_SIZE) return;
+  key(name);
+  raw("\"");
+  escaped(value ? value : "");
+  raw("\"");
+}
+
+void JsonStageBuffer::add(const char* name, bool value) {
+  if (used + strlen(name) + 10 + JSON_STREAM_RESERVE > JSON_STREAM_STAGE_SIZE) return;
+  key(name);
+  raw(value ? "true" : "false");
+}
+
+void JsonStageBuffer::add(const char* name, long value) {
+  if (used + strlen(name) + 16 + JSON_STREAM_RESERVE > JSON_STREAM_STAGE_SIZE) return;
+  char number[12];
+  snprintf(number, sizeof(number), "%ld", value);
+  key(name);
+  raw(number);
+}
+
+JsonArrayStream::JsonArrayStream(JsonArraySource* arraySource)
+  : source(arraySource), staged(0), state(STREAM_HEAD), first(true) {}
+
+JsonArrayStream::~JsonArrayStream() {
+  delete source;
+}
+
+// Loads the next piece of output into the stage; returns false when the stream is complete
+bool JsonArrayStream::stageNext() {
+  stage.clear();
+  staged = 0;
+
+  switch (state) {
+    case STREAM_HEAD:
+      stage.addRaw("{\"success\":true,\"data\":[");
+      state = STREAM_ITEMS;
+      return true;
+
+    case STREAM_ITEMS:
+      if (!first) stage.addRaw(",");
+      if (source->next(stage)) {
+        first = false;
+        return true;
+      }
+      stage.clear();
+      stage.endArray();
+      source->trailer(stage);
+      stage.addRaw("}");
+      state = STREAM_TAIL;
+      return true;
+
+    case STREAM_TAIL:
+      state = STREAM_DONE;
+      return false;
+
+    default:
+      return false;
+  }
+}
+
+size_t JsonArrayStream::fill(uint8_t* buffer, size_t maxLen) {
+  size_t written = 0;
+  while (written < maxLen) {
+    if (staged >= stage.length()) {
+      if (state == STREAM_DONE || !stageNext()) break;
+      continue;
+    }
+    size_t chunk = stage.length() - staged;
+    if (chunk > maxLen - written) chunk = maxLen - written;
+    memcpy(buffer + written, stage.c_str() + staged, chunk);
+    staged += chunk;
+    written += chunk;
+  }
+  return written;
+}
+
+void sendJsonArrayStream(AsyncWebServerRequest* request, JsonArraySource* source) {
+  std::shared_ptr<JsonArrayStream> stream = std::make_shared<JsonArrayStream>(source);
+  // Chunks are produced after the handler returns, so remember whose they are
+  uint8_t route = Metrics.currentRoute();
+  AsyncWebServerResponse* resp = request->beginChunkedResponse("application/json",
+    [stream, route](uint8_t* buffer, size_t maxLen, size_t index) -> size_t {
+      size_t n = stream->fill(buffer, maxLen);
+      Metrics.addResponseBytes(route, n);
+      return n;
+    });
+  Metrics.noteResponse(200, 0);
+  request->send(resp);
+}
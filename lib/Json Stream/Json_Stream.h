@@ -0,0 +1,81 @@
+#ifndef JSON_STREAM_H
+#define JSON_STREAM_H
+
+#include <Arduino.h>
+#include <ESPAsyncWebServer.h>
+
+// Streaming JSON for chunked HTTP responses.
+//
+// A JsonArrayStream emits {"success":true,"data":[ ... ]} one element at a
+// time into the buffer AsyncWebServer hands to a chunked response filler.
+// Each element is staged in a fixed buffer, so peak memory per response is
+// constant no matter how many elements the source produces.
+
+#define JSON_STREAM_STAGE_SIZE 1024
+
+// Fixed-capacity JSON writer. Values that would not fit are truncated so the
+// staged text always stays well-formed.
+class JsonStageBuffer {
+private:
+  char data[JSON_STREAM_STAGE_SIZE];
+  size_t used;
+  bool needsComma;
+
+  void raw(const char* text);
+  void escaped(const char* text);
+  void key(const char* name);
+
+public:
+  JsonStageBuffer() { clear(); }
+
+  void clear() { used = 0; needsComma = false; data[0] = '\0'; }
+  const char* c_str() const { return data; }
+  size_t length() const { return used; }
+
+  void beginObject();
+  void endObject();
+  void endArray();
+  void add(const char* name, const char* value);
+  void add(const char* name, const String& value) { add(name, value.c_str()); }
+  void add(const char* name, bool value);
+  void add(const char* name, long value);
+  void add(const char* name, int value) { add(name, (long)value); }
+  void add(const char* name, unsigned long value) { add(name, (long)value); }
+  void addRaw(const char* text) { raw(text); }
+};
+
+// Produces array elements for a JsonArrayStream
+class JsonArraySource {
+public:
+  virtual ~JsonArraySource() {}
+  // Writes the next element into out; returns false once exhausted
+  virtual bool next(JsonStageBuffer& out) = 0;
+  // Optional extra top-level fields written after the array, e.g. out.add("nextCursor", 12)
+  virtual void trailer(JsonStageBuffer& out) {}
+};
+
+class JsonArrayStream {
+private:
+  enum State { STREAM_HEAD, STREAM_ITEMS, STREAM_TAIL, STREAM_DONE };
+
+  JsonArraySource* source;
+  JsonStageBuffer stage;
+  size_t staged;      // bytes of stage already copied out
+  State state;
+  bool first;
+
+  bool stageNext();
+
+public:
+  // Takes ownership of source
+  JsonArrayStream(JsonArraySource* arraySource);
+  ~JsonArrayStream();
+
+  // AwsResponseFiller body: copies up to maxLen bytes, returns 0 when finished
+  size_t fill(uint8_t* buffer, size_t maxLen);
+};
+
+// Sends {"success":true,"data":[...]} as a chunked response; takes ownership of source
+void sendJsonArrayStream(AsyncWebServerRequest* request, JsonArraySource* source);
+
+#endif
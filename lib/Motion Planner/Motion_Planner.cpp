@@ -0,0 +1,175 @@
+#include "Motion_Planner.h"
+#include <math.h>
+#include <string.h>
+
+MotionPlanner::MotionPlanner(const AxisLimits& x, const AxisLimits& y) {
+  setLimits(x, y);
+}
+
+void MotionPlanner::setLimits(const AxisLimits& x, const AxisLimits& y) {
+  xAxis = x;
+  yAxis = y;
+}
+
+float MotionPlanner::axisTime(long distance, const AxisLimits& axis) {
+  if (distance == 0) return 0.0f;
+  if (axis.maxSpeed <= 0.0f || axis.acceleration <= 0.0f) return INFINITY;
+
+  float d = fabsf((float)distance);
+  float v = axis.maxSpeed;
+  float a = axis.acceleration;
+
+  // Ramping to full speed and back down takes v^2/a steps
+  if (d >= v * v / a) return d / v + v / a;
+  // Triangular profile: never reaches maxSpeed
+  return 2.0f * sqrtf(d / a);
+}
+
+float MotionPlanner::moveTime(const MotionPoint& from, const MotionPoint& to) const {
+  float tx = axisTime(to.x - from.x, xAxis);
+  float ty = axisTime(to.y - from.y, yAxis);
+  return tx > ty ? tx : ty;
+}
+
+float MotionPlanner::pathTime(const uint8_t* order, size_t count, bool toEnd) const {
+  float total = 0.0f;
+  size_t at = 0;
+  for (size_t i = 0; i < count; i++) {
+    total += cost[at][order[i] + 1];
+    at = order[i] + 1;
+  }
+  if (toEnd) total += cost[at][count + 1];
+  return total;
+}
+
+// Held-Karp: best[mask][j] is the fastest way from the start through the
+// stops in mask, finishing at stop j
+void MotionPlanner::solveExact(size_t count, bool toEnd, uint8_t* order) {
+  const uint32_t full = (1u << count) - 1;
+
+  for (uint32_t mask = 1; mask <= full; mask++) {
+    for (size_t j = 0; j < count; j++) {
+      if (!(mask & (1u << j))) continue;
+      uint32_t rest = mask & ~(1u << j);
+      if (rest == 0) {
+        best[mask][j] = cost[0][j + 1];
+        previous[mask][j] = (uint8_t)j;
+        continue;
+      }
+
+      float bestTime = INFINITY;
+      uint8_t bestFrom = 0;
+      for (size_t k = 0; k < count; k++) {
+        if (!(rest & (1u << k))) continue;
+        float t = best[rest][k] + cost[k + 1][j + 1];
+        if (t < bestTime) {
+          bestTime = t;
+          bestFrom = (uint8_t)k;
+        }
+      }
+      best[mask][j] = bestTime;
+      previous[mask][j] = bestFrom;
+    }
+  }
+
+  size_t last = 0;
+  float bestTime = INFINITY;
+  for (size_t j = 0; j < count; j++) {
+    float t = best[full][j] + (toEnd ? cost[j + 1][count + 1] : 0.0f);
+    if (t < bestTime) {
+      bestTime = t;
+      last = j;
+    }
+  }
+
+  // Walk the choices back from the last stop
+  uint32_t mask = full;
+  for (size_t i = count; i-- > 0;) {
+    order[i] = (uint8_t)last;
+    uint8_t from = previous[mask][last];
+    mask &= ~(1u << last);
+    last = from;
+  }
+}
+
+// Nearest neighbour, then 2-opt until no segment reversal helps
+void MotionPlanner::solveHeuristic(size_t count, bool toEnd, uint8_t* order) {
+  bool used[MOTION_PLANNER_MAX_STOPS] = {false};
+  size_t at = 0;
+  for (size_t i = 0; i < count; i++) {
+    size_t nearest = 0;
+    float nearestTime = INFINITY;
+    for (size_t j = 0; j < count; j++) {
+      if (!used[j] && cost[at][j + 1] < nearestTime) {
+        nearestTime = cost[at][j + 1];
+        nearest = j;
+      }
+    }
+    used[nearest] = true;
+    order[i] = (uint8_t)nearest;
+    at = nearest + 1;
+  }
+
+  // Point index of position p in the path: 0 = start, count + 1 = end
+  auto node = [&](size_t p) -> size_t { return p == 0 ? 0 : (p > count ? count + 1 : order[p - 1] + 1); };
+
+  const size_t maxPasses = 100;
+  bool improved = true;
+  for (size_t pass = 0; improved && pass < maxPasses; pass++) {
+    improved = false;
+    for (size_t i = 1; i < count; i++) {
+      for (size_t j = i + 1; j <= count; j++) {
+        // Reversing path positions i..j swaps the edges at both ends;
+        // move times are symmetric, so the edges inside do not change
+        bool tail = j < count || toEnd;
+        float before = cost[node(i - 1)][node(i)] + (tail ? cost[node(j)][node(j + 1)] : 0.0f);
+        float after = cost[node(i - 1)][node(j)] + (tail ? cost[node(i)][node(j + 1)] : 0.0f);
+        if (after < before - 1e-6f) {
+          for (size_t a = i - 1, b = j - 1; a < b; a++, b--) {
+            uint8_t swap = order[a];
+            order[a] = order[b];
+            order[b] = swap;
+          }
+          improved = true;
+        }
+      }
+    }
+  }
+}
+
+bool MotionPlanner::plan(const MotionPoint& start, const MotionPoint* stops, size_t count, MotionPlan& result,
+                         const MotionPoint* end) {
+  memset(&result, 0, sizeof(result));
+  if (count > MOTION_PLANNER_MAX_STOPS) return false;
+
+  const bool toEnd = end != nullptr;
+  for (size_t i = 0; i <= count + 1; i++) {
+    const MotionPoint& from = i == 0 ? start : (i <= count ? stops[i - 1] : (toEnd ? *end : start));
+    for (size_t j = 0; j <= i; j++) {
+      const MotionPoint& to = j == 0 ? start : (j <= count ? stops[j - 1] : (toEnd ? *end : start));
+      cost[i][j] = cost[j][i] = moveTime(from, to);
+    }
+  }
+
+  uint8_t given[MOTION_PLANNER_MAX_STOPS] = {};
+  for (size_t i = 0; i < count; i++) given[i] = (uint8_t)i;
+  result.count = count;
+  result.naiveSeconds = pathTime(given, count, toEnd);
+
+  result.exact = count <= MOTION_PLANNER_EXACT_MAX;
+  if (count == 0) {
+    // Nothing to order
+  } else if (result.exact) {
+    solveExact(count, toEnd, result.order);
+  } else {
+    solveHeuristic(count, toEnd, result.order);
+  }
+  result.predictedSeconds = pathTime(result.order, count, toEnd);
+
+  // The heuristic can lose to the given order on unlucky layouts
+  if (result.predictedSeconds > result.naiveSeconds) {
+    memcpy(result.order, given, count);
+    result.predictedSeconds = result.naiveSeconds;
+  }
+  return true;
+}
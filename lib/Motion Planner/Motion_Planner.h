@@ -0,0 +1,83 @@
+#ifndef MOTION_PLANNER_H
+#define MOTION_PLANNER_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Orders the cabinet visits of a dispense batch to minimise X/Y travel time.
+//
+// Moves are timed with AccelStepper's trapezoidal profile: each axis
+// accelerates at acceleration() up to maxSpeed(), cruises, then decelerates.
+// X and Y run at the same time (see goTo), so a move takes as long as its
+// slower axis. Travel cost is therefore time, not distance: with a fast X
+// and a slow Y, the plan prefers to finish a row before changing rows.
+//
+// Up to MOTION_PLANNER_EXACT_MAX stops are solved exactly (Held-Karp dynamic
+// programming); that covers a full 3x3 cabinet in one batch. Larger sets use
+// nearest neighbour followed by 2-opt, which is usually within a few percent
+// of optimal. Every plan also reports the travel time of visiting the stops
+// in the order given, so the gain can be logged.
+//
+// Nothing here depends on Arduino; test/test_motion_planner runs it on the
+// host.
+
+#ifndef MOTION_PLANNER_MAX_STOPS
+#define MOTION_PLANNER_MAX_STOPS 32
+#endif
+#ifndef MOTION_PLANNER_EXACT_MAX
+#define MOTION_PLANNER_EXACT_MAX 9
+#endif
+
+struct AxisLimits {
+  float maxSpeed;        // steps per second
+  float acceleration;    // steps per second per second
+};
+
+struct MotionPoint {
+  long x;
+  long y;
+};
+
+struct MotionPlan {
+  uint8_t order[MOTION_PLANNER_MAX_STOPS];   // indices into the stops given to plan()
+  size_t count;
+  float predictedSeconds;                    // travel time in planned order
+  float naiveSeconds;                        // travel time in the order given
+  bool exact;                                // false when the heuristic was used
+};
+
+class MotionPlanner {
+private:
+  AxisLimits xAxis;
+  AxisLimits yAxis;
+
+  // Scratch space, kept in the object so planning never touches the heap
+  // (about 27 KB with the defaults: make the planner a global, not a local).
+  // cost[i][j] is the move time between points: 0 is the start, 1..n the
+  // stops and n + 1 the end point.
+  float cost[MOTION_PLANNER_MAX_STOPS + 2][MOTION_PLANNER_MAX_STOPS + 2];
+  float best[1 << MOTION_PLANNER_EXACT_MAX][MOTION_PLANNER_EXACT_MAX];
+  uint8_t previous[1 << MOTION_PLANNER_EXACT_MAX][MOTION_PLANNER_EXACT_MAX];
+
+  float pathTime(const uint8_t* order, size_t count, bool toEnd) const;
+  void solveExact(size_t count, bool toEnd, uint8_t* order);
+  void solveHeuristic(size_t count, bool toEnd, uint8_t* order);
+
+public:
+  MotionPlanner(const AxisLimits& x, const AxisLimits& y);
+
+  // Call again after changing the steppers' speed or acceleration
+  void setLimits(const AxisLimits& x, const AxisLimits& y);
+
+  // Seconds for one axis to travel distance steps from rest to rest
+  static float axisTime(long distance, const AxisLimits& axis);
+  float moveTime(const MotionPoint& from, const MotionPoint& to) const;
+
+  // Plans a visit to every stop starting at start. With end set, the time
+  // to get there from the last stop counts too (e.g. returning home).
+  // Returns false if count exceeds MOTION_PLANNER_MAX_STOPS.
+  bool plan(const MotionPoint& start, const MotionPoint* stops, size_t count, MotionPlan& result,
+            const MotionPoint* end = nullptr);
+};
+
+#endif
@@ -0,0 +1,21 @@
+#include "Notification_List.h"
+
+bool NotificationListSource::next(JsonStageBuffer& out) {
+  while (index < list.size()) {
+    const Notification& n = list[index++];
+    if (n.assignedToUsername != username) continue;
+
+    out.beginObject();
+    out.add("id", n.id);
+    out.add("title", n.title);
+    out.add("content", n.content);
+    out.add("type", n.type);
+    out.add("time", n.time);
+    out.add("read", n.read);
+    out.add("actionRequired", n.actionRequired);
+    out.add("relatedOrderId", n.relatedOrderId);
+    out.endObject();
+    return true;
+  }
+  return false;
+}
@@ -0,0 +1,40 @@
+#ifndef NOTIFICATION_LIST_H
+#define NOTIFICATION_LIST_H
+
+#include <Arduino.h>
+#include <vector>
+#include "Json_Stream.h"
+
+// In-app notifications and the JSON source for GET /api/notifications.
+//
+// Each notification belongs to one user; the source walks the list once and
+// emits only that user's entries, so the response never holds more than one
+// staged element.
+
+// Notification structure - now linked to specific users
+struct Notification {
+  String id;
+  String title;
+  String content;
+  String type;
+  String time;
+  bool read;
+  bool actionRequired;
+  String relatedOrderId;
+  String assignedToUsername; // New field to link notification to specific user
+};
+
+class NotificationListSource : public JsonArraySource {
+private:
+  const std::vector<Notification>& list;
+  String username;
+  size_t index;
+
+public:
+  NotificationListSource(const std::vector<Notification>& notifications, const String& user)
+    : list(notifications), username(user), index(0) {}
+
+  bool next(JsonStageBuffer& out) override;
+};
+
+#endif
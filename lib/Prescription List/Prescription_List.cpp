@@ -0,0 +1,77 @@
+#include "Prescription_List.h"
+#include <ArduinoJson.h>
+
+PrescriptionListSource::PrescriptionListSource(uint16_t start, const PrescriptionQuery& filter, uint16_t limit)
+  : query(filter), remaining(limit), limited(limit > 0) {
+  recNo = Prescriptions.seekForUser(start, query);
+}
+
+bool PrescriptionListSource::next(JsonStageBuffer& out) {
+  while (recNo != RX_STORE_NO_RECORD) {
+    if (limited && remaining == 0) return false;
+    uint16_t current = recNo;
+    recNo = Prescriptions.seekForUser(Prescriptions.previousForUser(current), query);
+    if (!Prescriptions.readRecord(current, rx)) continue;
+    // The index only holds an MRN tag, so confirm against the record
+    if (!query.patientMRN.isEmpty() && strcmp(rx.patientMRN, query.patientMRN.c_str()) != 0) continue;
+    if (limited) remaining--;
+
+    out.beginObject();
+    out.add("id", rx.id);
+    out.add("patientName", rx.patientName);
+    out.add("patientMRN", rx.patientMRN);
+    out.add("ward", rx.ward);
+    out.add("bedNumber", rx.bedNumber);
+    out.add("status", rx.status);
+    out.add("date", rx.date);
+    out.add("prescribingPhysician", rx.prescribingPhysician);
+    // Only send first medication for summary
+    if (rx.medicationCount > 0) {
+      out.add("medicationName", rx.medications[0].medicationName);
+      out.add("strength", rx.medications[0].strength);
+      out.add("dosageForm", rx.medications[0].dosageForm);
+      out.add("frequency", rx.medications[0].frequency);
+    }
+    out.endObject();
+    return true;
+  }
+  return false;
+}
+
+void PrescriptionListSource::trailer(JsonStageBuffer& out) {
+  // nextCursor may point at an MRN tag collision; the next page simply skips it
+  if (limited && remaining == 0 && recNo != RX_STORE_NO_RECORD) {
+    out.add("nextCursor", (long)recNo);
+  }
+}
+
+bool parsePrescriptionJson(const char* body, size_t length, Prescription& rx) {
+  JsonDocument doc;
+  DeserializationError error = deserializeJson(doc, body, length);
+  if (error) return false;
+
+  rx.id = doc["id"] | "";
+  rx.patientName = doc["patientName"] | "";
+  rx.patientMRN = doc["patientMRN"] | "";
+  rx.ward = doc["ward"] | "";
+  rx.bedNumber = doc["bedNumber"] | "";
+  rx.status = doc["status"] | "pending";
+  rx.date = doc["date"] | "";
+  rx.prescribingPhysician = doc["prescribingPhysician"] | "";
+  rx.medications.clear();
+
+  // Parse medications array (frontend format)
+  if (doc["medications"].is<JsonArray>()) {
+    JsonArray medsArr = doc["medications"].as<JsonArray>();
+    for (JsonVariant v : medsArr) {
+      JsonObject med = v.as<JsonObject>();
+      Medication m;
+      m.medicationName = med["medicationName"] | "";
+      m.strength = med["strength"] | "";
+      m.dosageForm = med["dosageForm"] | "";
+      m.frequency = med["frequency"] | "";
+      rx.medications.push_back(m);
+    }
+  }
+  return true;
+}
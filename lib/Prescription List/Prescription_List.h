@@ -0,0 +1,38 @@
+#ifndef PRESCRIPTION_LIST_H
+#define PRESCRIPTION_LIST_H
+
+#include <Arduino.h>
+#include "Json_Stream.h"
+#include "Prescription_Store.h"
+
+// JSON for the prescription endpoints: the list source for
+// GET /api/prescriptions and the body parser for POST /api/prescription.
+//
+// The list source walks one physician's prescriptions newest first, one
+// summary object per record (only the first medication is included). Status
+// and date filters are answered from the RAM index; only candidate records
+// are read from storage. With a limit, the trailer carries nextCursor for the
+// following page.
+
+class PrescriptionListSource : public JsonArraySource {
+private:
+  PrescriptionQuery query;
+  uint16_t recNo;
+  uint16_t remaining;         // 0 = unlimited
+  bool limited;
+  PrescriptionRecord rx;
+
+public:
+  PrescriptionListSource(uint16_t start, const PrescriptionQuery& filter, uint16_t limit);
+
+  bool next(JsonStageBuffer& out) override;
+  void trailer(JsonStageBuffer& out) override;
+};
+
+// Fills rx from a submitted prescription (the frontend's format). Missing
+// fields are left empty, status defaults to "pending", and
+// prescribingUsername is left for the caller to set from the session.
+// Returns false if the body is not valid JSON.
+bool parsePrescriptionJson(const char* body, size_t length, Prescription& rx);
+
+#endif
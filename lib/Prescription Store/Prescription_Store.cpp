@@ -0,0 +1,477 @@
+#include "Prescription_Store.h"
+#include "Async_Log.h"
+#include <rom/crc.h>
+
+#define RX_RECORD_MAGIC 0x52584442   // "RXDB"
+#define RX_RECORD_VERSION 1
+
+static_assert(sizeof(PrescriptionRecord) == RX_STORE_RECORD_SIZE, "PrescriptionRecord must fill exactly one record slot");
+
+// Global instance
+PrescriptionStore Prescriptions;
+
+PrescriptionStore::PrescriptionStore()
+  : storage(nullptr), initialized(false), lock(nullptr),
+    recordCount(0), holeCount(0), recordCapacity(0), idTableMask(0),
+    idTable(nullptr), entries(nullptr), physicians(nullptr), physicianCount(0) {}
+
+// FNV-1a
+uint32_t PrescriptionStore::hashId(const char* id) {
+  uint32_t hash = 2166136261u;
+  while (*id) {
+    hash ^= (uint8_t)*id++;
+    hash *= 16777619u;
+  }
+  return hash;
+}
+
+uint32_t PrescriptionStore::recordCrc(const PrescriptionRecord& record) {
+  PrescriptionRecord copy = record;
+  copy.crc = 0;
+  return crc32_le(0, (const uint8_t*)&copy, sizeof(copy));
+}
+
+void PrescriptionStore::copyField(char* dest, size_t size, const String& value) {
+  size_t len = value.length();
+  if (len >= size) len = size - 1;
+  memcpy(dest, value.c_str(), len);
+  memset(dest + len, 0, size - len);
+}
+
+void* PrescriptionStore::allocateIndex(size_t bytes) {
+  void* ptr = psramFound() ? ps_malloc(bytes) : nullptr;
+  if (!ptr) ptr = malloc(bytes);
+  if (ptr) memset(ptr, 0, bytes);
+  return ptr;
+}
+
+void PrescriptionStore::releaseIndex() {
+  free(idTable);
+  free(entries);
+  free(physicians);
+  idTable = nullptr;
+  entries = nullptr;
+  physicians = nullptr;
+  recordCapacity = 0;
+  idTableMask = 0;
+}
+
+bool PrescriptionStore::begin(StorageManager& storageManager, const String& filePath, uint16_t capacity) {
+  end();
+
+  storage = &storageManager;
+  path = filePath;
+
+  if (!storage->isInitialized()) {
+    Serial.println("PrescriptionStore: Storage not initialized");
+    return false;
+  }
+
+  if (!lock) lock = xSemaphoreCreateMutex();
+
+  if (capacity == 0) {
+    capacity = psramFound() ? RX_STORE_CAPACITY_PSRAM : RX_STORE_CAPACITY_INTERNAL;
+  }
+  if (capacity >= RX_STORE_NO_RECORD) capacity = RX_STORE_NO_RECORD - 1;
+
+  // Keep the ID table at most half full so probe sequences stay short
+  uint32_t tableSize = 1;
+  while (tableSize < (uint32_t)capacity * 2) tableSize <<= 1;
+
+  idTable = (uint16_t*)allocateIndex(tableSize * sizeof(uint16_t));
+  entries = (IndexEntry*)allocateIndex(capacity * sizeof(IndexEntry));
+  physicians = (Physician*)allocateIndex(RX_STORE_MAX_PHYSICIANS * sizeof(Physician));
+  if (!idTable || !entries || !physicians) {
+    Serial.printf("PrescriptionStore: Failed to allocate index for %u records\n", capacity);
+    releaseIndex();
+    return false;
+  }
+  recordCapacity = capacity;
+  idTableMask = tableSize - 1;
+
+  if (!storage->exists(path)) {
+    File created = storage->open(path, "w");
+    if (!created) {
+      Serial.println("PrescriptionStore: Failed to create " + path);
+      releaseIndex();
+      return false;
+    }
+    created.close();
+  }
+
+  dataFile = storage->open(path, "r+");
+  if (!dataFile) {
+    Serial.println("PrescriptionStore: Failed to open " + path);
+    releaseIndex();
+    return false;
+  }
+
+  unsigned long start = millis();
+  replay();
+  initialized = true;
+
+  Serial.printf("PrescriptionStore: %u records loaded from %s in %lu ms (capacity %u, index %u bytes)\n",
+                count(), path.c_str(), millis() - start, recordCapacity, (unsigned)indexBytes());
+  if (holeCount > 0) Serial.printf("PrescriptionStore: %u invalid records skipped\n", holeCount);
+  return true;
+}
+
+void PrescriptionStore::end() {
+  if (dataFile) dataFile.close();
+  releaseIndex();
+  recordCount = 0;
+  holeCount = 0;
+  physicianCount = 0;
+  initialized = false;
+}
+
+bool PrescriptionStore::replay() {
+  recordCount = 0;
+  holeCount = 0;
+  physicianCount = 0;
+
+  size_t fileRecords = dataFile.size() / RX_STORE_RECORD_SIZE;
+  if (fileRecords == 0) return true;
+
+  PrescriptionRecord record;
+  dataFile.seek(0);
+  for (size_t recNo = 0; recNo < fileRecords; recNo++) {
+    if (recordCount >= recordCapacity) {
+      Serial.printf("PrescriptionStore: Index full, %u records not loaded\n", (unsigned)(fileRecords - recNo));
+      break;
+    }
+    if (dataFile.read((uint8_t*)&record, sizeof(record)) != sizeof(record)) break;
+    if (record.magic != RX_RECORD_MAGIC || record.version != RX_RECORD_VERSION || record.crc != recordCrc(record)) {
+      // Status updates rewrite records in place, so a torn write can be
+      // anywhere. Keep the slot as a hole and carry on with the rest.
+      Serial.printf("PrescriptionStore: Invalid record %u, skipped\n", (unsigned)recNo);
+      markHole(recordCount);
+    } else {
+      indexRecord(recordCount, record);
+    }
+    recordCount++;
+  }
+  return true;
+}
+
+int PrescriptionStore::findPhysician(const char* username) {
+  for (int i = 0; i < physicianCount; i++) {
+    if (strcmp(physicians[i].username, username) == 0) return i;
+  }
+  return -1;
+}
+
+int PrescriptionStore::findOrAddPhysician(const char* username) {
+  int slot = findPhysician(username);
+  if (slot >= 0) return slot;
+  if (physicianCount >= RX_STORE_MAX_PHYSICIANS) return -1;
+
+  Physician& p = physicians[physicianCount];
+  strncpy(p.username, username, sizeof(p.username) - 1);
+  p.username[sizeof(p.username) - 1] = '\0';
+  p.latest = RX_STORE_NO_RECORD;
+  p.count = 0;
+  return physicianCount++;
+}
+
+void PrescriptionStore::markHole(uint16_t recNo) {
+  IndexEntry& entry = entries[recNo];
+  entry.prevByUser = RX_STORE_NO_RECORD;
+  entry.day = 0;
+  entry.idTag = 0;
+  entry.mrnTag = 0;
+  entry.physician = 0xFF;
+  entry.status = RX_STATUS_HOLE;
+  holeCount++;
+}
+
+void PrescriptionStore::indexRecord(uint16_t recNo, const PrescriptionRecord& record) {
+  IndexEntry& entry = entries[recNo];
+  int slot = findOrAddPhysician(record.prescribingUsername);
+  if (slot >= 0) {
+    entry.prevByUser = physicians[slot].latest;
+    entry.physician = slot;
+    physicians[slot].latest = recNo;
+    physicians[slot].count++;
+  } else {
+    entry.prevByUser = RX_STORE_NO_RECORD;
+    entry.physician = 0xFF;
+  }
+  entry.day = dayNumber(record.date);
+  entry.mrnTag = hashId(record.patientMRN) >> 24;
+  entry.status = statusCode(record.status);
+
+  uint32_t hash = hashId(record.id);
+  uint32_t pos = hash & idTableMask;
+  while (idTable[pos] != 0) pos = (pos + 1) & idTableMask;
+  idTable[pos] = recNo + 1;
+  entry.idTag = hash >> 24;
+}
+
+// IDs are not guaranteed unique across physicians, so a username narrows the match.
+uint16_t PrescriptionStore::lookupId(const String& id, const String& username, PrescriptionRecord* record) {
+  uint32_t hash = hashId(id.c_str());
+  uint8_t tag = hash >> 24;
+  PrescriptionRecord scratch;
+  PrescriptionRecord& candidate = record ? *record : scratch;
+
+  for (uint32_t pos = hash & idTableMask; idTable[pos] != 0; pos = (pos + 1) & idTableMask) {
+    uint16_t recNo = idTable[pos] - 1;
+    if (entries[recNo].idTag != tag) continue;
+    if (!readRecordLocked(recNo, candidate)) continue;
+    if (strcmp(candidate.id, id.c_str()) != 0) continue;
+    if (!username.isEmpty() && strcmp(candidate.prescribingUsername, username.c_str()) != 0) continue;
+    return recNo;
+  }
+  return RX_STORE_NO_RECORD;
+}
+
+bool PrescriptionStore::readRecordLocked(uint16_t recNo, PrescriptionRecord& record) {
+  if (recNo >= recordCount || entries[recNo].status == RX_STATUS_HOLE) return false;
+  // Through the storage block cache; recently listed records stay in RAM
+  return storage->read(dataFile, path, (uint32_t)recNo * RX_STORE_RECORD_SIZE,
+                       (uint8_t*)&record, sizeof(record)) == sizeof(record);
+}
+
+bool PrescriptionStore::writeRecordLocked(uint16_t recNo, PrescriptionRecord& record) {
+  record.magic = RX_RECORD_MAGIC;
+  record.version = RX_RECORD_VERSION;
+  record.crc = recordCrc(record);
+
+  uint32_t offset = (uint32_t)recNo * RX_STORE_RECORD_SIZE;
+  storage->invalidate(path, offset, sizeof(record));
+  if (!dataFile.seek(offset)) return false;
+  size_t written = dataFile.write((const uint8_t*)&record, sizeof(record));
+  dataFile.flush();
+  return written == sizeof(record);
+}
+
+bool PrescriptionStore::append(const Prescription& rx, uint16_t* recNo) {
+  if (!initialized) return false;
+
+  PrescriptionRecord record;
+  fromPrescription(rx, record);
+
+  xSemaphoreTake(lock, portMAX_DELAY);
+  bool success = false;
+  if (recordCount >= recordCapacity) {
+    LOGW("PrescriptionStore: Store full, prescription not saved: %s", rx.id.c_str());
+  } else if (findOrAddPhysician(record.prescribingUsername) < 0) {
+    // An unindexed record could never be listed or found by its author
+    LOGW("PrescriptionStore: Physician table full, prescription not saved: %s", rx.id.c_str());
+  } else if (!writeRecordLocked(recordCount, record)) {
+    LOGW("PrescriptionStore: Failed to write prescription: %s", rx.id.c_str());
+  } else {
+    indexRecord(recordCount, record);
+    if (recNo) *recNo = recordCount;
+    recordCount++;
+    success = true;
+  }
+  xSemaphoreGive(lock);
+  return success;
+}
+
+bool PrescriptionStore::updateStatus(const String& id, const String& status, const String& username) {
+  if (!initialized) return false;
+
+  PrescriptionRecord record;
+  xSemaphoreTake(lock, portMAX_DELAY);
+  bool success = false;
+  uint16_t recNo = lookupId(id, username, &record);
+  if (recNo != RX_STORE_NO_RECORD) {
+    copyField(record.status, sizeof(record.status), status);
+    success = writeRecordLocked(recNo, record);
+    if (success) entries[recNo].status = statusCode(record.status);
+  }
+  xSemaphoreGive(lock);
+  return success;
+}
+
+bool PrescriptionStore::updateStatusAt(uint16_t recNo, const String& id, const String& status) {
+  if (!initialized) return false;
+
+  PrescriptionRecord record;
+  xSemaphoreTake(lock, portMAX_DELAY);
+  bool success = false;
+  if (readRecordLocked(recNo, record) && strcmp(record.id, id.c_str()) == 0 &&
+      entries[recNo].status != RX_STATUS_CANCELLED) {
+    copyField(record.status, sizeof(record.status), status);
+    success = writeRecordLocked(recNo, record);
+    if (success) entries[recNo].status = statusCode(record.status);
+  }
+  xSemaphoreGive(lock);
+  return success;
+}
+
+bool PrescriptionStore::findById(const String& id, Prescription& rx, const String& username, uint16_t* recNo) {
+  if (!initialized) return false;
+
+  PrescriptionRecord record;
+  xSemaphoreTake(lock, portMAX_DELAY);
+  uint16_t found = lookupId(id, username, &record);
+  xSemaphoreGive(lock);
+
+  if (found == RX_STORE_NO_RECORD) return false;
+  if (recNo) *recNo = found;
+  toPrescription(record, rx);
+  return true;
+}
+
+bool PrescriptionStore::readRecord(uint16_t recNo, PrescriptionRecord& record) {
+  if (!initialized) return false;
+
+  xSemaphoreTake(lock, portMAX_DELAY);
+  bool success = readRecordLocked(recNo, record);
+  xSemaphoreGive(lock);
+  return success;
+}
+
+bool PrescriptionStore::read(uint16_t recNo, Prescription& rx) {
+  PrescriptionRecord record;
+  if (!readRecord(recNo, record)) return false;
+  toPrescription(record, rx);
+  return true;
+}
+
+uint16_t PrescriptionStore::latestForUser(const String& username) {
+  if (!initialized) return RX_STORE_NO_RECORD;
+
+  xSemaphoreTake(lock, portMAX_DELAY);
+  int slot = findPhysician(username.c_str());
+  uint16_t recNo = slot >= 0 ? physicians[slot].latest : RX_STORE_NO_RECORD;
+  xSemaphoreGive(lock);
+  return recNo;
+}
+
+uint16_t PrescriptionStore::previousForUser(uint16_t recNo) {
+  if (!initialized || recNo >= recordCount) return RX_STORE_NO_RECORD;
+  return entries[recNo].prevByUser;
+}
+
+uint16_t PrescriptionStore::countForUser(const String& username) {
+  if (!initialized) return 0;
+
+  xSemaphoreTake(lock, portMAX_DELAY);
+  int slot = findPhysician(username.c_str());
+  uint16_t count = slot >= 0 ? physicians[slot].count : 0;
+  xSemaphoreGive(lock);
+  return count;
+}
+
+uint16_t PrescriptionStore::seekForUser(uint16_t recNo, const PrescriptionQuery& query) {
+  if (!initialized) return RX_STORE_NO_RECORD;
+
+  bool checkMrn = !query.patientMRN.isEmpty();
+  uint8_t mrnTag = checkMrn ? hashId(query.patientMRN.c_str()) >> 24 : 0;
+  bool checkDate = query.fromDay != 0 || query.toDay != 0;
+  uint16_t toDay = query.toDay ? query.toDay : 0xFFFF;
+
+  while (recNo < recordCount) {
+    const IndexEntry& entry = entries[recNo];
+    bool match = true;
+    if (query.statusMask && !(query.statusMask & (1 << entry.status))) match = false;
+    else if (checkDate && (entry.day == 0 || entry.day < query.fromDay || entry.day > toDay)) match = false;
+    else if (checkMrn && entry.mrnTag != mrnTag) match = false;
+    if (match) return recNo;
+    recNo = entry.prevByUser;
+  }
+  return RX_STORE_NO_RECORD;
+}
+
+bool PrescriptionStore::belongsTo(uint16_t recNo, const String& username) {
+  if (!initialized || recNo >= recordCount) return false;
+
+  xSemaphoreTake(lock, portMAX_DELAY);
+  int slot = findPhysician(username.c_str());
+  bool owned = slot >= 0 && entries[recNo].physician == slot;
+  xSemaphoreGive(lock);
+  return owned;
+}
+
+size_t PrescriptionStore::indexBytes() {
+  if (!recordCapacity) return 0;
+  return (idTableMask + 1) * sizeof(uint16_t)
+       + recordCapacity * sizeof(IndexEntry)
+       + RX_STORE_MAX_PHYSICIANS * sizeof(Physician);
+}
+
+uint8_t PrescriptionStore::statusCode(const char* status) {
+  static const char* const names[] = {
+    "pending", "processing", "dispensing", "ready", "dispensed", "partially-dispensed", "cancelled", "failed"
+  };
+  for (uint8_t i = 0; i < sizeof(names) / sizeof(names[0]); i++) {
+    if (strcasecmp(status, names[i]) == 0) return i;
+  }
+  return RX_STATUS_OTHER;
+}
+
+uint16_t PrescriptionStore::statusMask(const String& statusList) {
+  uint16_t mask = 0;
+  int start = 0;
+  while (start < (int)statusList.length()) {
+    int end = statusList.indexOf(',', start);
+    if (end < 0) end = statusList.length();
+    String name = statusList.substring(start, end);
+    name.trim();
+    if (!name.isEmpty()) mask |= 1 << statusCode(name.c_str());
+    start = end + 1;
+  }
+  return mask;
+}
+
+uint16_t PrescriptionStore::dayNumber(const char* date) {
+  int year, month, day;
+  if (sscanf(date, "%4d-%2d-%2d", &year, &month, &day) != 3) return 0;
+  if (year < 2000 || year > 2150 || month < 1 || month > 12 || day < 1 || day > 31) return 0;
+
+  // Days since 1970-01-01 (proleptic Gregorian), rebased so 2000-01-01 is day 1
+  int y = year - (month <= 2);
+  int era = y / 400;
+  int yoe = y - era * 400;
+  int doy = (153 * (month > 2 ? month - 3 : month + 9) + 2) / 5 + day - 1;
+  int doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+  long days = (long)era * 146097 + doe - 719468;
+  return (uint16_t)(days - 10957 + 1);
+}
+
+void PrescriptionStore::toPrescription(const PrescriptionRecord& record, Prescription& rx) {
+  rx.id = record.id;
+  rx.patientName = record.patientName;
+  rx.patientMRN = record.patientMRN;
+  rx.ward = record.ward;
+  rx.bedNumber = record.bedNumber;
+  rx.status = record.status;
+  rx.date = record.date;
+  rx.prescribingPhysician = record.prescribingPhysician;
+  rx.prescribingUsername = record.prescribingUsername;
+
+  rx.medications.clear();
+  for (uint8_t i = 0; i < record.medicationCount && i < RX_STORE_MAX_MEDICATIONS; i++) {
+    const PrescriptionRecordMedication& src = record.medications[i];
+    rx.medications.push_back({src.medicationName, src.strength, src.dosageForm, src.frequency});
+  }
+}
+
+void PrescriptionStore::fromPrescription(const Prescription& rx, PrescriptionRecord& record) {
+  memset(&record, 0, sizeof(record));
+  copyField(record.id, sizeof(record.id), rx.id);
+  copyField(record.patientName, sizeof(record.patientName), rx.patientName);
+  copyField(record.patientMRN, sizeof(record.patientMRN), rx.patientMRN);
+  copyField(record.ward, sizeof(record.ward), rx.ward);
+  copyField(record.bedNumber, sizeof(record.bedNumber), rx.bedNumber);
+  copyField(record.status, sizeof(record.status), rx.status);
+  copyField(record.date, sizeof(record.date), rx.date);
+  copyField(record.prescribingPhysician, sizeof(record.prescribingPhysician), rx.prescribingPhysician);
+  copyField(record.prescribingUsername, sizeof(record.prescribingUsername), rx.prescribingUsername);
+
+  size_t count = rx.medications.size();
+  if (count > RX_STORE_MAX_MEDICATIONS) count = RX_STORE_MAX_MEDICATIONS;
+  record.medicationCount = count;
+  for (size_t i = 0; i < count; i++) {
+    PrescriptionRecordMedication& dest = record.medications[i];
+    copyField(dest.medicationName, sizeof(dest.medicationName), rx.medications[i].medicationName);
+    copyField(dest.strength, sizeof(dest.strength), rx.medications[i].strength);
+    copyField(dest.dosageForm, sizeof(dest.dosageForm), rx.medications[i].dosageForm);
+    copyField(dest.frequency, sizeof(dest.frequency), rx.medications[i].frequency);
+  }
+}
@@ -0,0 +1,205 @@
+#ifndef PRESCRIPTION_STORE_H
+#define PRESCRIPTION_STORE_H
+
+#include <Arduino.h>
+#include <vector>
+#include "Storage_Manager.h"
+
+// Persistent prescription storage.
+//
+// Prescriptions are written as fixed-size 512-byte records (one SD sector each)
+// to an append-only file and replayed at boot. Only a compact index is kept in
+// RAM, preallocated once in begin(), so heap use does not grow with history:
+//   - an open-addressing hash table mapping prescription IDs to record numbers
+//   - a per-physician chain (newest -> oldest) of record numbers
+//   - per-record status, date and MRN tag so list filters skip records
+//     without touching the SD card
+// Record numbers are 16-bit, so a store holds up to 65534 prescriptions.
+// Records that fail their CRC at replay (a torn in-place status rewrite) are
+// left in the file as holes: they are not indexed and their slot is never
+// reused, so nothing written after them is lost or overwritten.
+
+#define RX_STORE_DEFAULT_PATH "/prescriptions.dat"
+#define RX_STORE_RECORD_SIZE 512
+#define RX_STORE_MAX_MEDICATIONS 3
+#define RX_STORE_MAX_PHYSICIANS 255   // 0xFF marks "no physician" in the index
+#define RX_STORE_NO_RECORD 0xFFFF
+
+#ifndef RX_STORE_CAPACITY_INTERNAL
+#define RX_STORE_CAPACITY_INTERNAL 4096   // records indexed when only internal RAM is available
+#endif
+#ifndef RX_STORE_CAPACITY_PSRAM
+#define RX_STORE_CAPACITY_PSRAM 32768     // records indexed when PSRAM is present
+#endif
+
+// Status values indexed in RAM; anything else is stored as RX_STATUS_OTHER
+enum PrescriptionStatus : uint8_t {
+  RX_STATUS_PENDING,
+  RX_STATUS_PROCESSING,
+  RX_STATUS_DISPENSING,
+  RX_STATUS_READY,
+  RX_STATUS_DISPENSED,
+  RX_STATUS_PARTIALLY_DISPENSED,
+  RX_STATUS_CANCELLED,
+  RX_STATUS_FAILED,           // never reached or never finished at the dispenser
+  RX_STATUS_OTHER,
+  RX_STATUS_HOLE = 0xFF       // index only: record failed validation at replay
+};
+
+// Filter for per-physician listing. Zero/empty fields match everything.
+struct PrescriptionQuery {
+  uint16_t statusMask;        // bit (1 << PrescriptionStatus) per accepted status
+  uint16_t fromDay;           // inclusive, see PrescriptionStore::dayNumber()
+  uint16_t toDay;             // inclusive, 0 = open ended
+  String patientMRN;
+
+  PrescriptionQuery() : statusMask(0), fromDay(0), toDay(0) {}
+};
+
+struct Medication {
+  String medicationName;
+  String strength;
+  String dosageForm;
+  String frequency;
+};
+
+struct Prescription {
+  String id;
+  String patientName;
+  String patientMRN;
+  String ward;
+  String bedNumber;
+  std::vector<Medication> medications;
+  String status;
+  String date;
+  String prescribingPhysician;
+  String prescribingUsername; // Links the prescription to its user
+};
+
+// On-disk record layout. Strings are NUL-terminated and truncated to fit.
+struct PrescriptionRecordMedication {
+  char medicationName[32];
+  char strength[16];
+  char dosageForm[16];
+  char frequency[8];
+};
+
+struct PrescriptionRecord {
+  uint32_t magic;
+  uint16_t version;
+  uint8_t medicationCount;
+  uint8_t reserved;
+  uint32_t crc;               // CRC32 of the record with this field zeroed
+  char id[24];
+  char patientName[48];
+  char patientMRN[20];
+  char ward[20];
+  char bedNumber[16];
+  char status[24];
+  char date[12];
+  char prescribingPhysician[48];
+  char prescribingUsername[32];
+  PrescriptionRecordMedication medications[RX_STORE_MAX_MEDICATIONS];
+  uint8_t padding[40];
+};
+
+class PrescriptionStore {
+private:
+  struct Physician {
+    char username[32];
+    uint16_t latest;          // newest record for this physician
+    uint16_t count;
+  };
+
+  // 8 bytes of RAM per stored prescription
+  struct IndexEntry {
+    uint16_t prevByUser;      // physician's previous record
+    uint16_t day;             // prescription date, 0 if unparseable
+    uint8_t idTag;            // ID hash tag, avoids SD reads on probe collisions
+    uint8_t mrnTag;           // patient MRN hash tag
+    uint8_t physician;        // slot in physicians[], 0xFF for holes
+    uint8_t status;           // PrescriptionStatus, RX_STATUS_HOLE for unreadable records
+  };
+
+  StorageManager* storage;
+  File dataFile;
+  String path;
+  bool initialized;
+  SemaphoreHandle_t lock;
+
+  uint16_t recordCount;       // slots in the file, holes included; the next append goes here
+  uint16_t holeCount;
+  uint16_t recordCapacity;
+  uint32_t idTableMask;
+  uint16_t* idTable;          // record number + 1, 0 = empty slot
+  IndexEntry* entries;        // indexed by record number
+  Physician* physicians;      // RX_STORE_MAX_PHYSICIANS slots
+  uint8_t physicianCount;
+
+  static uint32_t hashId(const char* id);
+  static uint32_t recordCrc(const PrescriptionRecord& record);
+  static void copyField(char* dest, size_t size, const String& value);
+
+  void* allocateIndex(size_t bytes);
+  void releaseIndex();
+  int findPhysician(const char* username);
+  int findOrAddPhysician(const char* username);
+  void markHole(uint16_t recNo);
+  void indexRecord(uint16_t recNo, const PrescriptionRecord& record);
+  uint16_t lookupId(const String& id, const String& username, PrescriptionRecord* record);
+  bool readRecordLocked(uint16_t recNo, PrescriptionRecord& record);
+  bool writeRecordLocked(uint16_t recNo, PrescriptionRecord& record);
+  bool replay();
+
+public:
+  PrescriptionStore();
+
+  // Opens (or creates) the data file and rebuilds the index from it.
+  // capacity = 0 picks RX_STORE_CAPACITY_PSRAM or RX_STORE_CAPACITY_INTERNAL.
+  bool begin(StorageManager& storageManager, const String& filePath = RX_STORE_DEFAULT_PATH, uint16_t capacity = 0);
+  void end();
+
+  // Writes. append() reports the new record's number through recNo.
+  bool append(const Prescription& rx, uint16_t* recNo = nullptr);
+  bool updateStatus(const String& id, const String& status, const String& username = "");
+  // Status from the dispenser for the record an order was placed from. Fails
+  // if recNo no longer holds id, and never moves a record out of cancelled.
+  bool updateStatusAt(uint16_t recNo, const String& id, const String& status);
+
+  // Lookups
+  bool findById(const String& id, Prescription& rx, const String& username = "", uint16_t* recNo = nullptr);
+  bool readRecord(uint16_t recNo, PrescriptionRecord& record);
+  bool read(uint16_t recNo, Prescription& rx);
+
+  // Per-physician iteration, newest first:
+  //   for (uint16_t r = store.latestForUser(u); r != RX_STORE_NO_RECORD; r = store.previousForUser(r))
+  uint16_t latestForUser(const String& username);
+  uint16_t previousForUser(uint16_t recNo);
+  uint16_t countForUser(const String& username);
+
+  // Filtered per-physician iteration. Returns recNo itself if it passes the
+  // RAM-indexed filters, otherwise the next older record that does.
+  // The MRN filter is tag based; callers confirm it against the record.
+  uint16_t seekForUser(uint16_t recNo, const PrescriptionQuery& query);
+  bool belongsTo(uint16_t recNo, const String& username);
+
+  // Info
+  bool isInitialized() { return initialized; }
+  uint16_t count() { return recordCount - holeCount; }
+  uint16_t slots() { return recordCount; }                // read(recNo) bound; fails on holes
+  uint16_t holes() { return holeCount; }
+  uint16_t capacity() { return recordCapacity; }
+  size_t indexBytes();
+
+  static uint8_t statusCode(const char* status);
+  static uint16_t statusMask(const String& statusList);  // comma separated
+  static uint16_t dayNumber(const char* date);            // "YYYY-MM-DD" -> days since 2000-01-01
+
+  static void toPrescription(const PrescriptionRecord& record, Prescription& rx);
+  static void fromPrescription(const Prescription& rx, PrescriptionRecord& record);
+};
+
+// Global instance
+extern PrescriptionStore Prescriptions;
+
+#endif
@@ -0,0 +1,257 @@
+#include "Session_Table.h"
+
+#define SESSION_NO_BUCKET 0xFF
+
+// Global instance
+SessionTable Sessions;
+
+SessionTable::SessionTable()
+  : lock(nullptr) {
+  timeoutMs = SESSION_DEFAULT_TIMEOUT;
+  tickMs = SESSION_DEFAULT_TIMEOUT / (SESSION_WHEEL_SLOTS - 1) + 1;
+  clear();
+}
+
+// Tokens are random, so their first bytes are already a good hash
+uint32_t SessionTable::hashToken(const SessionToken& token) {
+  return (uint32_t)token.bytes[0] | ((uint32_t)token.bytes[1] << 8) |
+         ((uint32_t)token.bytes[2] << 16) | ((uint32_t)token.bytes[3] << 24);
+}
+
+void SessionTable::copyField(char* dest, size_t size, const char* value) {
+  size_t len = value ? strnlen(value, size - 1) : 0;
+  if (len) memcpy(dest, value, len);
+  memset(dest + len, 0, size - len);
+}
+
+void SessionTable::begin(uint32_t timeout) {
+  if (!lock) lock = xSemaphoreCreateMutex();
+  xSemaphoreTake(lock, portMAX_DELAY);
+  clear();
+  timeoutMs = timeout;
+  // The wheel spans slightly more than one timeout so a fresh session is
+  // swept once, at its expiry
+  tickMs = timeout / (SESSION_WHEEL_SLOTS - 1) + 1;
+  lastTickAt = millis();
+  xSemaphoreGive(lock);
+}
+
+void SessionTable::clear() {
+  memset(index, 0, sizeof(index));
+  for (size_t i = 0; i < SESSION_WHEEL_SLOTS; i++) wheel[i] = SESSION_NONE;
+  for (uint16_t i = 0; i < SESSION_TABLE_CAPACITY; i++) {
+    slots[i].used = false;
+    slots[i].bucket = SESSION_NO_BUCKET;
+    slots[i].wheelPrev = SESSION_NONE;
+    slots[i].wheelNext = (i + 1 < SESSION_TABLE_CAPACITY) ? i + 1 : SESSION_NONE;
+  }
+  freeHead = 0;
+  used = 0;
+  currentBucket = 0;
+  lastTickAt = 0;
+}
+
+uint16_t SessionTable::findLocked(const SessionToken& token, uint32_t* position) {
+  for (uint32_t pos = hashToken(token) & (SESSION_INDEX_SIZE - 1); index[pos] != 0;
+       pos = (pos + 1) & (SESSION_INDEX_SIZE - 1)) {
+    uint16_t slot = index[pos] - 1;
+    if (memcmp(slots[slot].session.token.bytes, token.bytes, SESSION_TOKEN_SIZE) == 0) {
+      if (position) *position = pos;
+      return slot;
+    }
+  }
+  return SESSION_NONE;
+}
+
+// Backward-shift deletion: pull later entries of the probe run into the hole
+// so lookups never need tombstones
+void SessionTable::unindexLocked(uint32_t position) {
+  const uint32_t mask = SESSION_INDEX_SIZE - 1;
+  uint32_t hole = position;
+  for (uint32_t next = (hole + 1) & mask; index[next] != 0; next = (next + 1) & mask) {
+    uint32_t home = hashToken(slots[index[next] - 1].session.token) & mask;
+    if (((next - home) & mask) >= ((next - hole) & mask)) {
+      index[hole] = index[next];
+      hole = next;
+    }
+  }
+  index[hole] = 0;
+}
+
+void SessionTable::scheduleLocked(uint16_t slot, uint32_t now) {
+  Slot& s = slots[slot];
+  uint32_t idle = now - s.session.lastAccessed;
+  uint32_t remaining = idle >= timeoutMs ? 0 : timeoutMs - idle;
+  uint32_t ticks = (remaining + tickMs - 1) / tickMs;
+  if (ticks < 1) ticks = 1;
+  if (ticks > SESSION_WHEEL_SLOTS - 1) ticks = SESSION_WHEEL_SLOTS - 1;
+
+  uint8_t bucket = (currentBucket + ticks) % SESSION_WHEEL_SLOTS;
+  s.bucket = bucket;
+  s.wheelPrev = SESSION_NONE;
+  s.wheelNext = wheel[bucket];
+  if (wheel[bucket] != SESSION_NONE) slots[wheel[bucket]].wheelPrev = slot;
+  wheel[bucket] = slot;
+}
+
+void SessionTable::unscheduleLocked(uint16_t slot) {
+  Slot& s = slots[slot];
+  if (s.bucket == SESSION_NO_BUCKET) return;
+  if (s.wheelPrev != SESSION_NONE) slots[s.wheelPrev].wheelNext = s.wheelNext;
+  else wheel[s.bucket] = s.wheelNext;
+  if (s.wheelNext != SESSION_NONE) slots[s.wheelNext].wheelPrev = s.wheelPrev;
+  s.bucket = SESSION_NO_BUCKET;
+  s.wheelPrev = s.wheelNext = SESSION_NONE;
+}
+
+void SessionTable::releaseLocked(uint16_t slot, uint32_t position) {
+  unindexLocked(position);
+  unscheduleLocked(slot);
+  slots[slot].used = false;
+  slots[slot].wheelNext = freeHead;
+  freeHead = slot;
+  used--;
+}
+
+// Drops the least recently used session of the first occupied bucket ahead
+// of now, i.e. one of the sessions due to expire soonest
+uint16_t SessionTable::evictLocked() {
+  uint32_t now = millis();
+  for (uint16_t step = 1; step <= SESSION_WHEEL_SLOTS; step++) {
+    uint16_t slot = wheel[(currentBucket + step) % SESSION_WHEEL_SLOTS];
+    if (slot == SESSION_NONE) continue;
+    for (uint16_t other = slots[slot].wheelNext; other != SESSION_NONE; other = slots[other].wheelNext) {
+      if (now - slots[other].session.lastAccessed > now - slots[slot].session.lastAccessed) slot = other;
+    }
+    uint32_t position;
+    if (findLocked(slots[slot].session.token, &position) != slot) return SESSION_NONE;
+    releaseLocked(slot, position);
+    return slot;
+  }
+  return SESSION_NONE;
+}
+
+bool SessionTable::create(const SessionToken& token, const char* username, const char* fullName) {
+  if (!lock) return false;
+  uint32_t now = millis();
+
+  static const SessionToken none = {};
+  if (memcmp(token.bytes, none.bytes, SESSION_TOKEN_SIZE) == 0) return false;
+
+  xSemaphoreTake(lock, portMAX_DELAY);
+  if (findLocked(token, nullptr) != SESSION_NONE) {
+    xSemaphoreGive(lock);
+    return false;
+  }
+  if (freeHead == SESSION_NONE && evictLocked() == SESSION_NONE) {
+    xSemaphoreGive(lock);
+    return false;
+  }
+
+  uint16_t slot = freeHead;
+  freeHead = slots[slot].wheelNext;
+  Slot& s = slots[slot];
+  s.used = true;
+  s.session.token = token;
+  copyField(s.session.username, sizeof(s.session.username), username);
+  copyField(s.session.fullName, sizeof(s.session.fullName), fullName);
+  s.session.createdAt = now;
+  s.session.lastAccessed = now;
+  s.bucket = SESSION_NO_BUCKET;
+  scheduleLocked(slot, now);
+
+  uint32_t pos = hashToken(token) & (SESSION_INDEX_SIZE - 1);
+  while (index[pos] != 0) pos = (pos + 1) & (SESSION_INDEX_SIZE - 1);
+  index[pos] = slot + 1;
+  used++;
+  xSemaphoreGive(lock);
+  return true;
+}
+
+bool SessionTable::touch(const SessionToken& token, Session* out) {
+  if (!lock) return false;
+  uint32_t now = millis();
+
+  xSemaphoreTake(lock, portMAX_DELAY);
+  uint32_t position;
+  uint16_t slot = findLocked(token, &position);
+  if (slot == SESSION_NONE) {
+    xSemaphoreGive(lock);
+    return false;
+  }
+  Session& session = slots[slot].session;
+  if (now - session.lastAccessed >= timeoutMs) {
+    releaseLocked(slot, position);
+    xSemaphoreGive(lock);
+    return false;
+  }
+  // The wheel entry is left alone; expire() reschedules it when its bucket comes up
+  session.lastAccessed = now;
+  if (out) *out = session;
+  xSemaphoreGive(lock);
+  return true;
+}
+
+bool SessionTable::get(const SessionToken& token, Session& out) {
+  if (!lock) return false;
+  xSemaphoreTake(lock, portMAX_DELAY);
+  uint16_t slot = findLocked(token, nullptr);
+  if (slot != SESSION_NONE) out = slots[slot].session;
+  xSemaphoreGive(lock);
+  return slot != SESSION_NONE;
+}
+
+bool SessionTable::remove(const SessionToken& token) {
+  if (!lock) return false;
+  xSemaphoreTake(lock, portMAX_DELAY);
+  uint32_t position;
+  uint16_t slot = findLocked(token, &position);
+  if (slot != SESSION_NONE) releaseLocked(slot, position);
+  xSemaphoreGive(lock);
+  return slot != SESSION_NONE;
+}
+
+void SessionTable::sweepBucketLocked(uint16_t bucket, uint32_t now, size_t& removed) {
+  // Rescheduling never targets the bucket being swept, so this terminates
+  while (wheel[bucket] != SESSION_NONE) {
+    uint16_t slot = wheel[bucket];
+    unscheduleLocked(slot);
+    if (now - slots[slot].session.lastAccessed >= timeoutMs) {
+      uint32_t position;
+      if (findLocked(slots[slot].session.token, &position) == slot) {
+        releaseLocked(slot, position);
+        removed++;
+      }
+    } else {
+      scheduleLocked(slot, now);
+    }
+  }
+}
+
+size_t SessionTable::expire(uint32_t now) {
+  if (!lock) return 0;
+  size_t removed = 0;
+
+  xSemaphoreTake(lock, portMAX_DELAY);
+  for (uint16_t steps = 0; now - lastTickAt >= tickMs; ) {
+    lastTickAt += tickMs;
+    currentBucket = (currentBucket + 1) % SESSION_WHEEL_SLOTS;
+    sweepBucketLocked(currentBucket, now, removed);
+    if (++steps >= SESSION_WHEEL_SLOTS) {
+      // Every bucket has been seen; no need to replay a long stall tick by tick
+      lastTickAt = now;
+      break;
+    }
+  }
+  xSemaphoreGive(lock);
+  return removed;
+}
+
+bool SessionTable::copyAt(size_t slot, Session& out) {
+  if (!lock || slot >= SESSION_TABLE_CAPACITY) return false;
+  xSemaphoreTake(lock, portMAX_DELAY);
+  bool occupied = slots[slot].used;
+  if (occupied) out = slots[slot].session;
+  xSemaphoreGive(lock);
+  return occupied;
+}
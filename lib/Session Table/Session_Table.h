@@ -0,0 +1,112 @@
+#ifndef SESSION_TABLE_H
+#define SESSION_TABLE_H
+
+#include <Arduino.h>
+#include "Session_Token.h"
+
+// Fixed-capacity table of login sessions.
+//
+// Sessions are keyed by a 128-bit binary token and kept in a static array,
+// so nothing is allocated after construction and the heap does not fragment
+// however many logins come and go. Lookups go through an open-addressing
+// index (linear probing, backward-shift deletion, no tombstones) keyed on the
+// token bytes, which are random and need no further hashing.
+//
+// Expiry is handled by a timing wheel: each session sits in the bucket for
+// the tick it would expire at if it were never used again. Touching a session
+// only updates lastAccessed; when its bucket comes round, expire() either
+// drops it or moves it to the bucket for its new expiry time. The per-call
+// cost of expire() is therefore one bucket, not the whole table.
+//
+// Tokens are generated and encoded by Session_Token.h.
+
+#define SESSION_USERNAME_SIZE 32      // same limits as the credential record
+#define SESSION_FULLNAME_SIZE 48
+#define SESSION_DEFAULT_TIMEOUT 3600000UL   // 1 hour in milliseconds
+
+#ifndef SESSION_TABLE_CAPACITY
+#define SESSION_TABLE_CAPACITY 64
+#endif
+#define SESSION_INDEX_SIZE 128        // power of two, at least twice the capacity
+#define SESSION_WHEEL_SLOTS 64
+#define SESSION_NONE 0xFFFF
+
+static_assert((SESSION_INDEX_SIZE & (SESSION_INDEX_SIZE - 1)) == 0, "SESSION_INDEX_SIZE must be a power of two");
+static_assert(SESSION_INDEX_SIZE >= SESSION_TABLE_CAPACITY * 2, "Session index must stay at most half full");
+
+struct Session {
+  SessionToken token;
+  char username[SESSION_USERNAME_SIZE];
+  char fullName[SESSION_FULLNAME_SIZE];
+  uint32_t createdAt;
+  uint32_t lastAccessed;
+};
+
+class SessionTable {
+private:
+  struct Slot {
+    Session session;
+    uint16_t wheelPrev;       // also the free list link when unused
+    uint16_t wheelNext;
+    uint8_t bucket;
+    bool used;
+  };
+
+  Slot slots[SESSION_TABLE_CAPACITY];
+  uint16_t index[SESSION_INDEX_SIZE];   // slot + 1, 0 = empty
+  uint16_t wheel[SESSION_WHEEL_SLOTS];  // first slot per bucket
+  uint16_t freeHead;
+  uint16_t used;
+  uint32_t timeoutMs;
+  uint32_t tickMs;            // wheel granularity
+  uint32_t lastTickAt;        // millis() of the last processed tick
+  uint16_t currentBucket;
+  SemaphoreHandle_t lock;
+
+  static uint32_t hashToken(const SessionToken& token);
+  static void copyField(char* dest, size_t size, const char* value);
+
+  uint16_t findLocked(const SessionToken& token, uint32_t* position);
+  void unindexLocked(uint32_t position);
+  void scheduleLocked(uint16_t slot, uint32_t now);
+  void unscheduleLocked(uint16_t slot);
+  void releaseLocked(uint16_t slot, uint32_t position);
+  uint16_t evictLocked();
+  void sweepBucketLocked(uint16_t bucket, uint32_t now, size_t& removed);
+
+public:
+  SessionTable();
+
+  void begin(uint32_t timeout = SESSION_DEFAULT_TIMEOUT);
+  void clear();
+
+  // Adds a session. When the table is full the session closest to expiry is
+  // dropped to make room. Fails if the token is already in use or all zero,
+  // which is reserved to mean "no token".
+  bool create(const SessionToken& token, const char* username, const char* fullName);
+
+  // Returns true and refreshes lastAccessed if the session exists and has not
+  // timed out; copies it to out when given. Expired sessions are removed.
+  bool touch(const SessionToken& token, Session* out = nullptr);
+
+  // Copies the session without refreshing it
+  bool get(const SessionToken& token, Session& out);
+  bool remove(const SessionToken& token);
+
+  // Advances the timing wheel; call often (e.g. every loop()). Returns the
+  // number of sessions removed.
+  size_t expire(uint32_t now);
+
+  // Iteration over occupied slots, e.g. for (size_t i = 0; i < capacity(); i++) if (copyAt(i, s)) ...
+  size_t capacity() const { return SESSION_TABLE_CAPACITY; }
+  bool copyAt(size_t slot, Session& out);
+
+  size_t count() const { return used; }
+  uint32_t timeout() const { return timeoutMs; }
+  size_t memoryBytes() const { return sizeof(slots) + sizeof(index) + sizeof(wheel); }
+};
+
+// Global instance
+extern SessionTable Sessions;
+
+#endif
@@ -0,0 +1,109 @@
+#include "Session_Token.h"
+#include <string.h>
+
+#ifdef ESP_PLATFORM
+#include <esp_system.h>
+#else
+#include <random>
+#endif
+
+static const char BASE64URL_ALPHABET[] =
+  "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789-_";
+
+static int base64UrlValue(char c) {
+  if (c >= 'A' && c <= 'Z') return c - 'A';
+  if (c >= 'a' && c <= 'z') return c - 'a' + 26;
+  if (c >= '0' && c <= '9') return c - '0' + 52;
+  if (c == '-') return 62;
+  if (c == '_') return 63;
+  return -1;
+}
+
+static void fillRandom(uint8_t* data, size_t length) {
+#ifdef ESP_PLATFORM
+  // True random while the radio is on (the AP always is); see esp_random()
+  esp_fill_random(data, length);
+#else
+  static std::random_device device;
+  for (size_t i = 0; i < length; i += sizeof(uint32_t)) {
+    uint32_t value = device();
+    size_t n = length - i < sizeof(value) ? length - i : sizeof(value);
+    memcpy(data + i, &value, n);
+  }
+#endif
+}
+
+void generateSessionToken(SessionToken& token) {
+  static const SessionToken none = {};
+  do {
+    fillRandom(token.bytes, sizeof(token.bytes));
+  } while (memcmp(token.bytes, none.bytes, sizeof(token.bytes)) == 0);
+}
+
+size_t formatSessionToken(const SessionToken& token, char* out) {
+  return base64UrlEncode(token.bytes, sizeof(token.bytes), out);
+}
+
+bool parseSessionToken(const char* text, size_t length, SessionToken& token) {
+  SessionToken decoded;
+  if (!base64UrlDecode(text, length, decoded.bytes, sizeof(decoded.bytes))) return false;
+  token = decoded;
+  return true;
+}
+
+size_t base64UrlEncode(const uint8_t* data, size_t length, char* out) {
+  char* p = out;
+  size_t i = 0;
+  for (; i + 3 <= length; i += 3) {
+    uint32_t v = ((uint32_t)data[i] << 16) | ((uint32_t)data[i + 1] << 8) | data[i + 2];
+    *p++ = BASE64URL_ALPHABET[(v >> 18) & 0x3F];
+    *p++ = BASE64URL_ALPHABET[(v >> 12) & 0x3F];
+    *p++ = BASE64URL_ALPHABET[(v >> 6) & 0x3F];
+    *p++ = BASE64URL_ALPHABET[v & 0x3F];
+  }
+  if (length - i == 1) {
+    uint32_t v = (uint32_t)data[i] << 16;
+    *p++ = BASE64URL_ALPHABET[(v >> 18) & 0x3F];
+    *p++ = BASE64URL_ALPHABET[(v >> 12) & 0x3F];
+  } else if (length - i == 2) {
+    uint32_t v = ((uint32_t)data[i] << 16) | ((uint32_t)data[i + 1] << 8);
+    *p++ = BASE64URL_ALPHABET[(v >> 18) & 0x3F];
+    *p++ = BASE64URL_ALPHABET[(v >> 12) & 0x3F];
+    *p++ = BASE64URL_ALPHABET[(v >> 6) & 0x3F];
+  }
+  *p = '\0';
+  return p - out;
+}
+
+bool base64UrlDecode(const char* text, size_t length, uint8_t* out, size_t outLength) {
+  if (!text || length != BASE64URL_LENGTH(outLength)) return false;
+
+  size_t o = 0;
+  size_t i = 0;
+  for (; i + 4 <= length; i += 4) {
+    int a = base64UrlValue(text[i]), b = base64UrlValue(text[i + 1]);
+    int c = base64UrlValue(text[i + 2]), d = base64UrlValue(text[i + 3]);
+    if ((a | b | c | d) < 0) return false;
+    uint32_t v = ((uint32_t)a << 18) | ((uint32_t)b << 12) | ((uint32_t)c << 6) | (uint32_t)d;
+    out[o++] = (uint8_t)(v >> 16);
+    out[o++] = (uint8_t)(v >> 8);
+    out[o++] = (uint8_t)v;
+  }
+
+  // 2 characters carry 1 byte, 3 carry 2; the unused low bits must be zero
+  // so every token has exactly one spelling
+  size_t rest = length - i;
+  if (rest == 2 || rest == 3) {
+    int a = base64UrlValue(text[i]), b = base64UrlValue(text[i + 1]);
+    int c = rest == 3 ? base64UrlValue(text[i + 2]) : 0;
+    if ((a | b | c) < 0) return false;
+    uint32_t v = ((uint32_t)a << 18) | ((uint32_t)b << 12) | ((uint32_t)c << 6);
+    if (rest == 2 && (v & 0xFFFF)) return false;
+    if (rest == 3 && (v & 0xFF)) return false;
+    out[o++] = (uint8_t)(v >> 16);
+    if (rest == 3) out[o++] = (uint8_t)(v >> 8);
+  } else if (rest != 0) {
+    return false;
+  }
+  return o == outLength;
+}
@@ -0,0 +1,48 @@
+#ifndef SESSION_TOKEN_H
+#define SESSION_TOKEN_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Session token generation and text encoding.
+//
+// A token is SESSION_TOKEN_SIZE random bytes from the ESP32 hardware RNG
+// (esp_fill_random), sent to the browser as unpadded base64url. Encoding
+// writes straight into a caller-supplied buffer in a single pass, so issuing
+// a token does not touch the heap.
+//
+// Nothing here depends on Arduino, so the codec also builds for the native
+// test environment (test/test_session_token), where the RNG falls back to
+// std::random_device.
+
+#ifndef SESSION_TOKEN_SIZE
+#define SESSION_TOKEN_SIZE 16   // 128 bits; 32 also works
+#endif
+
+// Characters needed for n bytes of unpadded base64url
+#define BASE64URL_LENGTH(n) (((n) * 4 + 2) / 3)
+#define SESSION_TOKEN_TEXT_LENGTH BASE64URL_LENGTH(SESSION_TOKEN_SIZE)
+
+struct SessionToken {
+  uint8_t bytes[SESSION_TOKEN_SIZE];
+};
+
+// Fills token from the hardware RNG. Never returns the all-zero token,
+// which callers use to mean "no token".
+void generateSessionToken(SessionToken& token);
+
+// Writes SESSION_TOKEN_TEXT_LENGTH characters plus a NUL to out
+size_t formatSessionToken(const SessionToken& token, char* out);
+
+// Accepts exactly SESSION_TOKEN_TEXT_LENGTH canonical base64url characters;
+// leaves token untouched on failure
+bool parseSessionToken(const char* text, size_t length, SessionToken& token);
+
+// Unpadded base64url (RFC 4648 section 5). encode writes
+// BASE64URL_LENGTH(length) characters plus a NUL and returns the count
+// without the NUL. decode requires text to be exactly the encoding of
+// outLength bytes, with unused trailing bits zero.
+size_t base64UrlEncode(const uint8_t* data, size_t length, char* out);
+bool base64UrlDecode(const char* text, size_t length, uint8_t* out, size_t outLength);
+
+#endif
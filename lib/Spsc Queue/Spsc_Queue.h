@@ -0,0 +1,61 @@
+#ifndef SPSC_QUEUE_H
+#define SPSC_QUEUE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Fixed-size queue for handing items from one task to another without a
+// mutex, typically across cores.
+//
+// Exactly one task may push and exactly one task may pop. The producer only
+// writes head and the consumer only writes tail, so neither ever waits for
+// the other; a full queue makes push() fail instead of blocking. Items are
+// copied in and out, so keep T small and trivially copyable.
+//
+// The queue itself never sleeps. Pair it with a task notification (or
+// anything else that wakes the consumer) when the consumer should block
+// until there is work. Nothing here depends on Arduino, so
+// test/test_spsc_queue runs it on the host with real threads.
+
+template <typename T, size_t Size>
+class SpscQueue {
+  static_assert(Size > 0 && (Size & (Size - 1)) == 0, "SpscQueue size must be a power of two");
+
+private:
+  T items[Size];
+  volatile uint32_t head;   // next slot to write (producer)
+  volatile uint32_t tail;   // next slot to read (consumer)
+
+public:
+  SpscQueue() : head(0), tail(0) {}
+
+  // Producer side; false if the queue is full
+  bool push(const T& item) {
+    uint32_t h = head;
+    if (h - tail >= Size) return false;
+    items[h & (Size - 1)] = item;
+    // The item must be visible before the consumer sees the new head
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    head = h + 1;
+    return true;
+  }
+  size_t space() const { return Size - (head - tail); }
+
+  // Consumer side; false if the queue is empty
+  bool pop(T& item) {
+    uint32_t t = tail;
+    if (t == head) return false;
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    item = items[t & (Size - 1)];
+    // Done reading the slot before the producer may reuse it
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    tail = t + 1;
+    return true;
+  }
+  size_t count() const { return head - tail; }
+  bool empty() const { return head == tail; }
+
+  static constexpr size_t capacity() { return Size; }
+};
+
+#endif
@@ -0,0 +1,63 @@
+#include "Step_Queue.h"
+
+static_assert((STEP_QUEUE_SIZE & (STEP_QUEUE_SIZE - 1)) == 0, "STEP_QUEUE_SIZE must be a power of two");
+
+bool StepQueue::push(uint32_t intervalTicks, bool forward) {
+  uint32_t h = head;
+  if (h - tail >= STEP_QUEUE_SIZE) return false;
+  items[h & (STEP_QUEUE_SIZE - 1)] = (intervalTicks & STEP_INTERVAL_MASK) | (forward ? STEP_FORWARD_FLAG : 0);
+  // The item must be visible before the consumer sees the new head
+  __atomic_thread_fence(__ATOMIC_RELEASE);
+  head = h + 1;
+  return true;
+}
+
+bool StepQueue::pop(uint32_t& intervalTicks, bool& forward) {
+  uint32_t t = tail;
+  if (t == head) return false;
+  __atomic_thread_fence(__ATOMIC_ACQUIRE);
+  uint32_t item = items[t & (STEP_QUEUE_SIZE - 1)];
+  tail = t + 1;
+  intervalTicks = item & STEP_INTERVAL_MASK;
+  forward = (item & STEP_FORWARD_FLAG) != 0;
+  return true;
+}
+
+StepPulseEngine::StepPulseEngine()
+  : pendingInterval(0), pendingForward(true), lastForward(true), alarmAt(0), running(false), planning(false),
+    position(0), emitted(0), underruns(0) {}
+
+bool StepPulseEngine::start(uint32_t now, uint32_t& firstAlarm) {
+  if (running) return false;
+  if (!queue.pop(pendingInterval, pendingForward)) return false;
+
+  // The first step after a stop (or an underrun) is timed from now
+  alarmAt = now + pendingInterval;
+  firstAlarm = alarmAt;
+  running = true;
+  return true;
+}
+
+bool StepPulseEngine::onAlarm(StepPulse& pulse, uint32_t& nextAlarm) {
+  pulse.forward = pendingForward;
+  pulse.directionChanged = emitted == 0 || pendingForward != lastForward;
+  lastForward = pendingForward;
+  position = position + (pendingForward ? 1 : -1);
+  emitted = emitted + 1;
+
+  if (!queue.pop(pendingInterval, pendingForward)) {
+    running = false;
+    if (planning) underruns = underruns + 1;
+    return false;
+  }
+
+  // Absolute scheduling: latency in this interrupt does not carry over
+  alarmAt += pendingInterval;
+  nextAlarm = alarmAt;
+  return true;
+}
+
+uint32_t StepPulseEngine::late(uint32_t now, uint32_t minTicks) {
+  alarmAt = now + minTicks;
+  return alarmAt;
+}
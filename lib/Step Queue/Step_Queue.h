@@ -0,0 +1,97 @@
+#ifndef STEP_QUEUE_H
+#define STEP_QUEUE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Precomputed step timing for interrupt-driven stepping.
+//
+// The planner (StepTimer in lib/AccelStepper) works out step intervals ahead
+// of time in task context and pushes them into a StepQueue. A hardware timer
+// interrupt runs StepPulseEngine::onAlarm(), which pops one interval per
+// step and re-arms the timer. Alarms are scheduled on absolute timer ticks,
+// so interrupt latency delays a pulse but never shifts the ones after it,
+// and the step rate no longer depends on how often loop() gets round to
+// polling.
+//
+// The queue is single-producer/single-consumer and lock-free: the task only
+// writes head, the interrupt only writes tail. Nothing here depends on
+// Arduino, so test/test_step_queue drives it from a host-side simulator.
+
+#ifndef STEP_QUEUE_SIZE
+#define STEP_QUEUE_SIZE 256     // steps; must be a power of two (~50 ms at 5000 steps/s)
+#endif
+
+#define STEP_INTERVAL_MASK 0x7FFFFFFFu
+#define STEP_FORWARD_FLAG 0x80000000u
+
+class StepQueue {
+private:
+  uint32_t items[STEP_QUEUE_SIZE];   // interval in ticks | STEP_FORWARD_FLAG
+  volatile uint32_t head;            // next slot to write (producer)
+  volatile uint32_t tail;            // next slot to read (consumer)
+
+public:
+  StepQueue() : head(0), tail(0) {}
+
+  // Producer side. intervalTicks is the wait before this step, measured
+  // from the previous one.
+  bool push(uint32_t intervalTicks, bool forward);
+  size_t space() const { return STEP_QUEUE_SIZE - (head - tail); }
+
+  // Consumer side
+  bool pop(uint32_t& intervalTicks, bool& forward);
+  size_t count() const { return head - tail; }
+
+  // Only safe while the consumer is stopped
+  void clear() { tail = head; }
+};
+
+// One step to put on the pins
+struct StepPulse {
+  bool forward;
+  bool directionChanged;   // set the DIR pin (and allow setup time) before STEP
+};
+
+class StepPulseEngine {
+private:
+  uint32_t pendingInterval;
+  bool pendingForward;
+  bool lastForward;
+  uint32_t alarmAt;
+  volatile bool running;
+  volatile bool planning;
+  volatile long position;
+  volatile uint32_t emitted;
+  volatile uint32_t underruns;
+
+public:
+  StepQueue queue;
+
+  StepPulseEngine();
+
+  // Producer: true while more steps will follow the ones queued, so running
+  // dry counts as an underrun rather than the end of the move
+  void setPlanning(bool more) { planning = more; }
+
+  // Producer: starts emitting if stopped and steps are queued. Returns true
+  // and the absolute tick to arm the timer for.
+  bool start(uint32_t now, uint32_t& firstAlarm);
+
+  // Interrupt: the armed alarm fired. Fills pulse with the step to emit now
+  // and returns true with nextAlarm set if another step is queued; false
+  // when the queue ran dry (the timer should stay disarmed).
+  bool onAlarm(StepPulse& pulse, uint32_t& nextAlarm);
+
+  // Interrupt: the timer ran past nextAlarm before it could be armed;
+  // reschedules the same pulse for now + minTicks
+  uint32_t late(uint32_t now, uint32_t minTicks);
+
+  bool isRunning() const { return running; }
+  long currentPosition() const { return position; }
+  void setCurrentPosition(long steps) { position = steps; }
+  uint32_t emittedCount() const { return emitted; }
+  uint32_t underrunCount() const { return underruns; }
+};
+
+#endif
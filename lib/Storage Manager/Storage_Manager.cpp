@@ -1,9 +1,17 @@
 #include "Storage_Manager.h"
+#include "Async_Log.h"
 
 // Global instance
 StorageManager Storage;
 
-StorageManager::StorageManager() : initialized(false), sdCSPin(5) {}
+#define CACHE_NONE 0xFFFF
+#define CACHE_FREE 0xFF
+
+StorageManager::StorageManager()
+  : initialized(false), sdCSPin(5),
+    cacheData(nullptr), cacheBlocks(nullptr), cacheBuckets(nullptr),
+    cacheBlockCount(0), cacheBucketMask(0), lruNewest(CACHE_NONE), lruOldest(CACHE_NONE),
+    cacheStats(), cacheLock(nullptr) {}
 
 fs::FS* StorageManager::getFileSystem() {
   if (!initialized) return nullptr;
@@ -50,7 +58,7 @@ bool StorageManager::begin(StorageType type, int csPin) {
             default: Serial.println("UNKNOWN"); break;
           }
           uint64_t cardSize = SD.cardSize() / (1024 * 1024);
-          Serial.printf("StorageManager: SD Card Size: %lluMB\n", cardSize);
+          Serial.printf("StorageManager: SD Card Size: %lluMB\n", (unsigned long long)cardSize);
           Serial.println("StorageManager: SD Card mounted successfully");
         } else {
           Serial.println("StorageManager: No SD card attached");
@@ -61,6 +69,7 @@ bool StorageManager::begin(StorageType type, int csPin) {
       break;
   }
   
+  if (initialized) initCache();
   return initialized;
 }
 
@@ -76,6 +85,7 @@ void StorageManager::end() {
       break;
   }
   
+  releaseCache();
   initialized = false;
   Serial.println("StorageManager: Storage unmounted");
 }
@@ -89,6 +99,7 @@ bool StorageManager::exists(const String& path) {
 
 File StorageManager::open(const String& path, const String& mode) {
   if (!initialized) return File();
+  if (mode != "r") invalidate(path);
   
   fs::FS* fs = getFileSystem();
   return fs ? fs->open(path, mode.c_str()) : File();
@@ -96,6 +107,7 @@ File StorageManager::open(const String& path, const String& mode) {
 
 bool StorageManager::remove(const String& path) {
   if (!initialized) return false;
+  invalidate(path);
   
   fs::FS* fs = getFileSystem();
   return fs ? fs->remove(path) : false;
@@ -103,6 +115,8 @@ bool StorageManager::remove(const String& path) {
 
 bool StorageManager::rename(const String& pathFrom, const String& pathTo) {
   if (!initialized) return false;
+  invalidate(pathFrom);
+  invalidate(pathTo);
   
   fs::FS* fs = getFileSystem();
   return fs ? fs->rename(pathFrom, pathTo) : false;
@@ -132,7 +146,7 @@ File StorageManager::openDir(const String& path) {
 bool StorageManager::writeFile(const String& path, const String& content) {
   File file = open(path, "w");
   if (!file) {
-    Serial.println("StorageManager: Failed to open file for writing: " + path);
+    LOGW("StorageManager: Failed to open file for writing: %s", path.c_str());
     return false;
   }
   
@@ -141,9 +155,9 @@ bool StorageManager::writeFile(const String& path, const String& content) {
   
   bool success = (written == content.length());
   if (success) {
-    Serial.println("StorageManager: File written successfully: " + path);
+    LOGD("StorageManager: File written successfully: %s", path.c_str());
   } else {
-    Serial.println("StorageManager: Failed to write file: " + path);
+    LOGW("StorageManager: Failed to write file: %s", path.c_str());
   }
   
   return success;
@@ -152,7 +166,7 @@ bool StorageManager::writeFile(const String& path, const String& content) {
 bool StorageManager::appendFile(const String& path, const String& content) {
   File file = open(path, "a");
   if (!file) {
-    Serial.println("StorageManager: Failed to open file for appending: " + path);
+    LOGW("StorageManager: Failed to open file for appending: %s", path.c_str());
     return false;
   }
   
@@ -161,9 +175,9 @@ bool StorageManager::appendFile(const String& path, const String& content) {
   
   bool success = (written == content.length());
   if (success) {
-    Serial.println("StorageManager: Content appended successfully: " + path);
+    LOGD("StorageManager: Content appended successfully: %s", path.c_str());
   } else {
-    Serial.println("StorageManager: Failed to append to file: " + path);
+    LOGW("StorageManager: Failed to append to file: %s", path.c_str());
   }
   
   return success;
@@ -172,14 +186,29 @@ bool StorageManager::appendFile(const String& path, const String& content) {
 String StorageManager::readFile(const String& path) {
   File file = open(path, "r");
   if (!file) {
-    Serial.println("StorageManager: Failed to open file for reading: " + path);
+    LOGW("StorageManager: Failed to open file for reading: %s", path.c_str());
     return String();
   }
   
-  String content = file.readString();
+  // Read through the block cache into a buffer sized once, rather than
+  // letting readString() grow the heap String piecemeal
+  size_t size = file.size();
+  String content;
+  if (!content.reserve(size)) {
+    LOGW("StorageManager: Not enough memory to read file: %s", path.c_str());
+    file.close();
+    return String();
+  }
+  uint8_t chunk[STORAGE_CACHE_BLOCK_SIZE];
+  for (uint32_t offset = 0; offset < size; ) {
+    size_t n = read(file, path, offset, chunk, sizeof(chunk));
+    if (n == 0) break;
+    content.concat((const char*)chunk, n);
+    offset += n;
+  }
   file.close();
   
-  Serial.println("StorageManager: File read successfully: " + path + " (" + String(content.length()) + " bytes)");
+  LOGD("StorageManager: File read successfully: %s (%u bytes)", path.c_str(), (unsigned)content.length());
   return content;
 }
 
@@ -285,4 +314,294 @@ String StorageManager::getContentType(const String& filename) {
   else if (filename.endsWith(".zip")) return "application/zip";
   else if (filename.endsWith(".gz")) return "application/x-gzip";
   return "text/plain";
-}
\ No newline at end of file
+}
+// --- Block cache ---
+
+void StorageManager::initCache() {
+  releaseCache();
+  if (!cacheLock) cacheLock = xSemaphoreCreateMutex();
+
+  bool psram = psramFound();
+  size_t bytes = psram ? STORAGE_CACHE_BYTES_PSRAM : STORAGE_CACHE_BYTES_INTERNAL;
+  uint32_t count = bytes / STORAGE_CACHE_BLOCK_SIZE;
+  if (count >= CACHE_NONE) count = CACHE_NONE - 1;
+  if (count == 0) return;
+
+  uint32_t buckets = 1;
+  while (buckets < count) buckets <<= 1;
+
+  cacheData = (uint8_t*)(psram ? ps_malloc(count * STORAGE_CACHE_BLOCK_SIZE) : malloc(count * STORAGE_CACHE_BLOCK_SIZE));
+  cacheBlocks = (CacheBlock*)malloc(count * sizeof(CacheBlock));
+  cacheBuckets = (uint16_t*)malloc(buckets * sizeof(uint16_t));
+  if (!cacheData || !cacheBlocks || !cacheBuckets) {
+    Serial.println("StorageManager: Not enough memory for block cache, reading uncached");
+    releaseCache();
+    return;
+  }
+
+  cacheBlockCount = count;
+  cacheBucketMask = buckets - 1;
+  for (uint32_t i = 0; i < buckets; i++) cacheBuckets[i] = CACHE_NONE;
+
+  // Every block starts free on the LRU list, so the oldest block is always the one to reuse
+  for (uint16_t i = 0; i < cacheBlockCount; i++) {
+    CacheBlock& block = cacheBlocks[i];
+    block.file = CACHE_FREE;
+    block.length = 0;
+    block.blockNo = 0;
+    block.chain = CACHE_NONE;
+    block.newer = (i + 1 < cacheBlockCount) ? i + 1 : CACHE_NONE;
+    block.older = i ? i - 1 : CACHE_NONE;
+  }
+  lruOldest = 0;
+  lruNewest = cacheBlockCount - 1;
+
+  cacheStats = StorageCacheStats();
+  cacheStats.blockCount = cacheBlockCount;
+  cacheStats.bytes = (size_t)cacheBlockCount * STORAGE_CACHE_BLOCK_SIZE;
+  cacheStats.psram = psram;
+
+  Serial.printf("StorageManager: Block cache %u x %u bytes in %s\n",
+                cacheBlockCount, STORAGE_CACHE_BLOCK_SIZE, psram ? "PSRAM" : "internal RAM");
+}
+
+void StorageManager::releaseCache() {
+  if (cacheLock) xSemaphoreTake(cacheLock, portMAX_DELAY);
+  free(cacheData);
+  free(cacheBlocks);
+  free(cacheBuckets);
+  cacheData = nullptr;
+  cacheBlocks = nullptr;
+  cacheBuckets = nullptr;
+  cacheBlockCount = 0;
+  cacheBucketMask = 0;
+  lruNewest = lruOldest = CACHE_NONE;
+  for (uint8_t i = 0; i < STORAGE_CACHE_MAX_FILES; i++) cacheFiles[i] = "";
+  cacheStats.blocksUsed = 0;
+  cacheStats.blockCount = 0;
+  cacheStats.bytes = 0;
+  if (cacheLock) xSemaphoreGive(cacheLock);
+}
+
+int StorageManager::cacheFileSlot(const String& path, bool create) {
+  int empty = -1;
+  for (uint8_t i = 0; i < STORAGE_CACHE_MAX_FILES; i++) {
+    if (cacheFiles[i] == path) return i;
+    if (empty < 0 && cacheFiles[i].isEmpty()) empty = i;
+  }
+  if (!create || empty < 0) return -1;
+  cacheFiles[empty] = path;
+  return empty;
+}
+
+static inline uint32_t cacheHash(uint8_t file, uint32_t blockNo) {
+  return (blockNo * 2654435761u) ^ ((uint32_t)file * 40503u);
+}
+
+uint16_t StorageManager::cacheFind(uint8_t file, uint32_t blockNo) {
+  uint16_t slot = cacheBuckets[cacheHash(file, blockNo) & cacheBucketMask];
+  while (slot != CACHE_NONE) {
+    const CacheBlock& block = cacheBlocks[slot];
+    if (block.file == file && block.blockNo == blockNo) return slot;
+    slot = block.chain;
+  }
+  return CACHE_NONE;
+}
+
+// Removes a block from its hash chain, marks it free and moves it to the
+// oldest end of the LRU list so it is reused before any live block
+void StorageManager::cacheUnlink(uint16_t slot) {
+  CacheBlock& block = cacheBlocks[slot];
+  if (block.file == CACHE_FREE) return;
+
+  uint16_t* link = &cacheBuckets[cacheHash(block.file, block.blockNo) & cacheBucketMask];
+  while (*link != CACHE_NONE && *link != slot) link = &cacheBlocks[*link].chain;
+  if (*link == slot) *link = block.chain;
+
+  block.file = CACHE_FREE;
+  block.chain = CACHE_NONE;
+  block.length = 0;
+  cacheStats.blocksUsed--;
+
+  if (slot == lruOldest) return;
+  cacheBlocks[block.older].newer = block.newer;   // slot != lruOldest, so older exists
+  if (block.newer != CACHE_NONE) cacheBlocks[block.newer].older = block.older;
+  else lruNewest = block.older;
+
+  block.newer = lruOldest;
+  block.older = CACHE_NONE;
+  cacheBlocks[lruOldest].older = slot;
+  lruOldest = slot;
+}
+
+// Moves a block to the newest end of the LRU list
+void StorageManager::cacheTouch(uint16_t slot) {
+  if (slot == lruNewest) return;
+  CacheBlock& block = cacheBlocks[slot];
+
+  if (block.older != CACHE_NONE) cacheBlocks[block.older].newer = block.newer;
+  else lruOldest = block.newer;
+  cacheBlocks[block.newer].older = block.older;   // slot != lruNewest, so newer exists
+
+  block.older = lruNewest;
+  block.newer = CACHE_NONE;
+  cacheBlocks[lruNewest].newer = slot;
+  lruNewest = slot;
+}
+
+uint16_t StorageManager::cacheInsert(uint8_t file, uint32_t blockNo) {
+  uint16_t slot = lruOldest;
+  CacheBlock& block = cacheBlocks[slot];
+  if (block.file != CACHE_FREE) {
+    cacheUnlink(slot);
+    cacheStats.evictions++;
+  }
+
+  uint16_t& bucket = cacheBuckets[cacheHash(file, blockNo) & cacheBucketMask];
+  block.file = file;
+  block.blockNo = blockNo;
+  block.length = 0;
+  block.chain = bucket;
+  bucket = slot;
+  cacheStats.blocksUsed++;
+  cacheTouch(slot);
+  return slot;
+}
+
+void StorageManager::cacheDropFile(uint8_t file, uint32_t firstBlock, uint32_t lastBlock) {
+  for (uint16_t slot = 0; slot < cacheBlockCount; slot++) {
+    const CacheBlock& block = cacheBlocks[slot];
+    if (block.file != file || block.blockNo < firstBlock || block.blockNo > lastBlock) continue;
+    cacheUnlink(slot);
+  }
+}
+
+size_t StorageManager::read(const String& path, uint32_t offset, uint8_t* buffer, size_t length) {
+  File none;
+  return read(none, path, offset, buffer, length);
+}
+
+size_t StorageManager::read(File& file, const String& path, uint32_t offset, uint8_t* buffer, size_t length) {
+  if (!initialized || length == 0) return 0;
+
+  File opened;
+  File* source = file ? &file : nullptr;
+
+  if (!cacheBlocks) {
+    if (!source) {
+      opened = open(path, "r");
+      if (!opened) return 0;
+      source = &opened;
+    }
+    if (!source->seek(offset)) return 0;
+    return source->read(buffer, length);
+  }
+
+  xSemaphoreTake(cacheLock, portMAX_DELAY);
+  int fileSlot = cacheFileSlot(path, true);
+  size_t copied = 0;
+
+  while (copied < length) {
+    uint32_t position = offset + copied;
+    uint32_t blockNo = position / STORAGE_CACHE_BLOCK_SIZE;
+    uint32_t within = position % STORAGE_CACHE_BLOCK_SIZE;
+    uint8_t* data;
+    uint16_t available;
+    uint8_t direct[STORAGE_CACHE_BLOCK_SIZE];
+
+    uint16_t slot = fileSlot >= 0 ? cacheFind(fileSlot, blockNo) : CACHE_NONE;
+    if (slot != CACHE_NONE) {
+      cacheStats.hits++;
+      cacheTouch(slot);
+      data = cacheData + (size_t)slot * STORAGE_CACHE_BLOCK_SIZE;
+      available = cacheBlocks[slot].length;
+    } else {
+      cacheStats.misses++;
+      if (!source) {
+        opened = open(path, "r");
+        if (!opened) break;
+        source = &opened;
+      }
+      // Without a file slot (table full) the block is read but not kept
+      if (fileSlot >= 0) {
+        slot = cacheInsert(fileSlot, blockNo);
+        data = cacheData + (size_t)slot * STORAGE_CACHE_BLOCK_SIZE;
+      } else {
+        data = direct;
+      }
+
+      available = 0;
+      uint32_t readStart = micros();
+      if (source->seek(blockNo * STORAGE_CACHE_BLOCK_SIZE)) {
+        available = source->read(data, STORAGE_CACHE_BLOCK_SIZE);
+      }
+      uint32_t readTime = micros() - readStart;
+      cacheStats.readMicros += readTime;
+      if (readTime > cacheStats.maxReadMicros) cacheStats.maxReadMicros = readTime;
+      if (slot != CACHE_NONE) {
+        if (available == 0) cacheUnlink(slot);
+        else cacheBlocks[slot].length = available;
+      }
+    }
+
+    if (available <= within) break;   // past end of file
+    size_t n = available - within;
+    if (n > length - copied) n = length - copied;
+    memcpy(buffer + copied, data + within, n);
+    copied += n;
+    if (available < STORAGE_CACHE_BLOCK_SIZE) break;   // short block is the last one
+  }
+
+  xSemaphoreGive(cacheLock);
+  return copied;
+}
+
+void StorageManager::invalidate(const String& path) {
+  if (!cacheBlocks) return;
+  xSemaphoreTake(cacheLock, portMAX_DELAY);
+  int fileSlot = cacheFileSlot(path, false);
+  if (fileSlot >= 0) {
+    cacheDropFile(fileSlot, 0, UINT32_MAX);
+    cacheFiles[fileSlot] = "";
+  }
+  xSemaphoreGive(cacheLock);
+}
+
+void StorageManager::invalidate(const String& path, uint32_t offset, size_t length) {
+  if (!cacheBlocks || length == 0) return;
+  xSemaphoreTake(cacheLock, portMAX_DELAY);
+  int fileSlot = cacheFileSlot(path, false);
+  if (fileSlot >= 0) {
+    uint32_t first = offset / STORAGE_CACHE_BLOCK_SIZE;
+    uint32_t last = (offset + length - 1) / STORAGE_CACHE_BLOCK_SIZE;
+    if (last - first < 4) {
+      // Typical case (one record rewritten): hash lookups instead of a full scan
+      for (uint32_t blockNo = first; blockNo <= last; blockNo++) {
+        uint16_t slot = cacheFind(fileSlot, blockNo);
+        if (slot != CACHE_NONE) cacheUnlink(slot);
+      }
+    } else {
+      cacheDropFile(fileSlot, first, last);
+    }
+  }
+  xSemaphoreGive(cacheLock);
+}
+
+StorageCacheStats StorageManager::getCacheStats() {
+  if (!cacheLock) return cacheStats;
+  xSemaphoreTake(cacheLock, portMAX_DELAY);
+  StorageCacheStats stats = cacheStats;
+  xSemaphoreGive(cacheLock);
+  return stats;
+}
+
+void StorageManager::resetCacheStats() {
+  if (!cacheLock) return;
+  xSemaphoreTake(cacheLock, portMAX_DELAY);
+  cacheStats.hits = 0;
+  cacheStats.misses = 0;
+  cacheStats.evictions = 0;
+  cacheStats.readMicros = 0;
+  cacheStats.maxReadMicros = 0;
+  xSemaphoreGive(cacheLock);
+}
@@ -12,6 +12,28 @@ enum StorageType {
   STORAGE_SD
 };
 
+// Block cache sizing. The cache lives in PSRAM when the board has it.
+#define STORAGE_CACHE_BLOCK_SIZE 512
+#define STORAGE_CACHE_MAX_FILES 16
+#ifndef STORAGE_CACHE_BYTES_PSRAM
+#define STORAGE_CACHE_BYTES_PSRAM (512 * 1024)
+#endif
+#ifndef STORAGE_CACHE_BYTES_INTERNAL
+#define STORAGE_CACHE_BYTES_INTERNAL (32 * 1024)
+#endif
+
+struct StorageCacheStats {
+  uint32_t hits;
+  uint32_t misses;
+  uint32_t evictions;
+  uint32_t readMicros;        // time spent reading missed blocks from the card
+  uint32_t maxReadMicros;
+  uint16_t blocksUsed;
+  uint16_t blockCount;
+  size_t bytes;               // block data budget
+  bool psram;
+};
+
 struct StorageInfo {
   String type;
   bool initialized;
@@ -27,9 +49,38 @@ private:
   bool initialized;
   int sdCSPin;
   String storageTypeName;
-  
+
+  // LRU block cache. Blocks are keyed by (file slot, block number); files are
+  // tracked by path in a small table so keys never collide.
+  struct CacheBlock {
+    uint8_t file;             // slot in cacheFiles[], 0xFF = free
+    uint16_t length;          // valid bytes (short at end of file)
+    uint32_t blockNo;
+    uint16_t newer, older;    // LRU list links
+    uint16_t chain;           // next block in the same hash bucket
+  };
+
+  uint8_t* cacheData;
+  CacheBlock* cacheBlocks;
+  uint16_t* cacheBuckets;     // head block per bucket
+  uint16_t cacheBlockCount;
+  uint16_t cacheBucketMask;
+  uint16_t lruNewest, lruOldest;
+  String cacheFiles[STORAGE_CACHE_MAX_FILES];
+  StorageCacheStats cacheStats;
+  SemaphoreHandle_t cacheLock;
+
   fs::FS* getFileSystem();
 
+  void initCache();
+  void releaseCache();
+  int cacheFileSlot(const String& path, bool create);
+  uint16_t cacheFind(uint8_t file, uint32_t blockNo);
+  uint16_t cacheInsert(uint8_t file, uint32_t blockNo);
+  void cacheUnlink(uint16_t slot);
+  void cacheTouch(uint16_t slot);
+  void cacheDropFile(uint8_t file, uint32_t firstBlock, uint32_t lastBlock);
+
 public:
   StorageManager();
   
@@ -48,6 +99,18 @@ public:
   // Directory operations
   File openDir(const String& path);
   
+  // Cached reads. Missing blocks are loaded through `file` when given (it is
+  // seeked as needed), otherwise the path is opened. Returns bytes copied.
+  size_t read(const String& path, uint32_t offset, uint8_t* buffer, size_t length);
+  size_t read(File& file, const String& path, uint32_t offset, uint8_t* buffer, size_t length);
+
+  // Drops cached blocks for a path; callers that write files directly must call this
+  void invalidate(const String& path);
+  void invalidate(const String& path, uint32_t offset, size_t length);
+
+  StorageCacheStats getCacheStats();
+  void resetCacheStats();
+
   // Write operations
   bool writeFile(const String& path, const String& content);
   bool appendFile(const String& path, const String& content);
@@ -0,0 +1,475 @@
+#include "Web_Metrics.h"
+#include <memory>
+
+WebMetrics Metrics;
+
+const uint32_t metricsBucketBounds[METRICS_BUCKETS - 1] = {
+  100, 250, 500, 1000, 2500, 5000, 10000, 25000, 50000, 100000, 250000
+};
+
+// Every counter is written by one task at a time but read from others, so
+// relaxed atomics are enough: no value is ever torn, and totals may lag a
+// request behind while /api/metrics is being rendered.
+static inline void atomicAdd(uint32_t* value, uint32_t n) {
+  __atomic_fetch_add(value, n, __ATOMIC_RELAXED);
+}
+
+static inline uint32_t atomicLoad(const uint32_t* value) {
+  return __atomic_load_n(value, __ATOMIC_RELAXED);
+}
+
+static inline void atomicStore(uint32_t* value, uint32_t n) {
+  __atomic_store_n(value, n, __ATOMIC_RELAXED);
+}
+
+static inline void atomicMax(uint32_t* value, uint32_t n) {
+  uint32_t seen = atomicLoad(value);
+  while (n > seen && !__atomic_compare_exchange_n(value, &seen, n, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {}
+}
+
+static inline void atomicMin(uint32_t* value, uint32_t n) {
+  uint32_t seen = atomicLoad(value);
+  while (n < seen && !__atomic_compare_exchange_n(value, &seen, n, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {}
+}
+
+static uint8_t bucketFor(uint32_t micros) {
+  uint8_t b = 0;
+  while (b < METRICS_BUCKETS - 1 && micros > metricsBucketBounds[b]) b++;
+  return b;
+}
+
+WebMetrics::WebMetrics() : routeCount(0), current(METRICS_NO_ROUTE) {
+  memset(routes, 0, sizeof(routes));
+  memset(&gauges, 0, sizeof(gauges));
+  gauges.largestBlockLow = UINT32_MAX;
+}
+
+uint8_t WebMetrics::addRoute(const char* uri, WebRequestMethodComposite method) {
+  if (routeCount >= METRICS_MAX_ROUTES) {
+    Serial.printf("WebMetrics: Route table full, %s is not measured\n", uri);
+    return METRICS_NO_ROUTE;
+  }
+  MetricsRoute& route = routes[routeCount];
+  route.uri = uri;
+  route.method = method;
+  return routeCount++;
+}
+
+void WebMetrics::record(uint8_t route, uint32_t micros) {
+  MetricsRoute& r = routes[route];
+  micros += __atomic_exchange_n(&r.bodyMicros, 0, __ATOMIC_RELAXED);
+  atomicAdd(&r.requests, 1);
+  atomicAdd(&r.totalMicros, micros);
+  atomicAdd(&r.buckets[bucketFor(micros)], 1);
+  atomicMax(&r.maxMicros, micros);
+}
+
+void WebMetrics::on(AsyncWebServer& server, const char* uri, WebRequestMethodComposite method,
+                    ArRequestHandlerFunction onRequest) {
+  on(server, uri, method, onRequest, nullptr, nullptr);
+}
+
+void WebMetrics::on(AsyncWebServer& server, const char* uri, WebRequestMethodComposite method,
+                    ArRequestHandlerFunction onRequest, ArUploadHandlerFunction onUpload,
+                    ArBodyHandlerFunction onBody) {
+  uint8_t route = addRoute(uri, method);
+  if (route == METRICS_NO_ROUTE) {
+    server.on(uri, method, onRequest, onUpload, onBody);
+    return;
+  }
+
+  ArRequestHandlerFunction timedRequest = [this, route, onRequest](AsyncWebServerRequest* request) {
+    uint8_t outer = current;
+    current = route;
+    uint32_t start = micros();
+    if (onRequest) onRequest(request);
+    record(route, micros() - start);
+    current = outer;
+  };
+
+  // Body and upload chunks arrive before onRequest runs; their time is
+  // carried over to the request that follows
+  ArUploadHandlerFunction timedUpload = nullptr;
+  if (onUpload) {
+    timedUpload = [this, route, onUpload](AsyncWebServerRequest* request, const String& filename, size_t index,
+                                          uint8_t* data, size_t len, bool final) {
+      uint8_t outer = current;
+      current = route;
+      uint32_t start = micros();
+      onUpload(request, filename, index, data, len, final);
+      atomicAdd(&routes[route].bodyMicros, micros() - start);
+      current = outer;
+    };
+  }
+  ArBodyHandlerFunction timedBody = nullptr;
+  if (onBody) {
+    timedBody = [this, route, onBody](AsyncWebServerRequest* request, uint8_t* data, size_t len, size_t index,
+                                      size_t total) {
+      uint8_t outer = current;
+      current = route;
+      uint32_t start = micros();
+      onBody(request, data, len, index, total);
+      atomicAdd(&routes[route].bodyMicros, micros() - start);
+      current = outer;
+    };
+  }
+
+  if (!timedUpload && !timedBody) server.on(uri, method, timedRequest);
+  else server.on(uri, method, timedRequest, timedUpload, timedBody);
+}
+
+void WebMetrics::onNotFound(AsyncWebServer& server, ArRequestHandlerFunction handler) {
+  uint8_t route = addRoute("(not found)", HTTP_ANY);
+  if (route == METRICS_NO_ROUTE) {
+    server.onNotFound(handler);
+    return;
+  }
+  server.onNotFound([this, route, handler](AsyncWebServerRequest* request) {
+    uint8_t outer = current;
+    current = route;
+    uint32_t start = micros();
+    handler(request);
+    record(route, micros() - start);
+    current = outer;
+  });
+}
+
+void WebMetrics::noteResponse(int code, size_t bytes) {
+  uint8_t route = current;
+  if (route >= routeCount || code < 200) return;
+  uint8_t statusClass = code >= 500 ? 3 : (uint8_t)(code / 100 - 2);
+  atomicAdd(&routes[route].responses[statusClass], 1);
+  atomicAdd(&routes[route].bytes, (uint32_t)bytes);
+}
+
+void WebMetrics::addResponseBytes(uint8_t route, size_t bytes) {
+  if (route >= routeCount) return;
+  atomicAdd(&routes[route].bytes, (uint32_t)bytes);
+}
+
+void WebMetrics::sampleHeap() {
+  uint32_t largest = ESP.getMaxAllocHeap();
+  atomicStore(&gauges.freeHeap, ESP.getFreeHeap());
+  atomicStore(&gauges.minFreeHeap, ESP.getMinFreeHeap());
+  atomicStore(&gauges.largestBlock, largest);
+  atomicMin(&gauges.largestBlockLow, largest);
+}
+
+void WebMetrics::observeUartQueue(size_t depth) {
+  atomicStore(&gauges.uartQueue, (uint32_t)depth);
+  atomicMax(&gauges.uartQueueHigh, (uint32_t)depth);
+}
+
+bool WebMetrics::copyRoute(uint8_t route, MetricsRoute& out) {
+  if (route >= routeCount) return false;
+  const MetricsRoute& r = routes[route];
+  out.uri = r.uri;
+  out.method = r.method;
+  out.requests = atomicLoad(&r.requests);
+  for (int i = 0; i < 4; i++) out.responses[i] = atomicLoad(&r.responses[i]);
+  out.bytes = atomicLoad(&r.bytes);
+  out.totalMicros = atomicLoad(&r.totalMicros);
+  out.maxMicros = atomicLoad(&r.maxMicros);
+  for (int i = 0; i < METRICS_BUCKETS; i++) out.buckets[i] = atomicLoad(&r.buckets[i]);
+  out.bodyMicros = atomicLoad(&r.bodyMicros);
+  return true;
+}
+
+MetricsGauges WebMetrics::getGauges() {
+  MetricsGauges out;
+  out.freeHeap = atomicLoad(&gauges.freeHeap);
+  out.minFreeHeap = atomicLoad(&gauges.minFreeHeap);
+  out.largestBlock = atomicLoad(&gauges.largestBlock);
+  out.largestBlockLow = atomicLoad(&gauges.largestBlockLow);
+  if (out.largestBlockLow == UINT32_MAX) out.largestBlockLow = out.largestBlock;
+  out.uartQueue = atomicLoad(&gauges.uartQueue);
+  out.uartQueueHigh = atomicLoad(&gauges.uartQueueHigh);
+  return out;
+}
+
+// Counters restart from zero; a request finishing meanwhile may keep part of its numbers
+void WebMetrics::reset() {
+  for (uint8_t i = 0; i < routeCount; i++) {
+    MetricsRoute& r = routes[i];
+    atomicStore(&r.requests, 0);
+    for (int c = 0; c < 4; c++) atomicStore(&r.responses[c], 0);
+    atomicStore(&r.bytes, 0);
+    atomicStore(&r.totalMicros, 0);
+    atomicStore(&r.maxMicros, 0);
+    for (int b = 0; b < METRICS_BUCKETS; b++) atomicStore(&r.buckets[b], 0);
+  }
+  atomicStore(&gauges.largestBlockLow, atomicLoad(&gauges.largestBlock));
+  atomicStore(&gauges.uartQueueHigh, atomicLoad(&gauges.uartQueue));
+}
+
+uint32_t WebMetrics::percentile(const MetricsRoute& route, uint8_t percent) {
+  uint32_t total = 0;
+  for (int i = 0; i < METRICS_BUCKETS; i++) total += route.buckets[i];
+  if (total == 0) return 0;
+  uint32_t target = (uint32_t)(((uint64_t)total * percent + 99) / 100);
+  uint32_t seen = 0;
+  for (int i = 0; i < METRICS_BUCKETS - 1; i++) {
+    seen += route.buckets[i];
+    if (seen >= target) return metricsBucketBounds[i];
+  }
+  return UINT32_MAX;
+}
+
+const char* WebMetrics::methodName(WebRequestMethodComposite method) {
+  switch (method) {
+    case HTTP_GET: return "GET";
+    case HTTP_POST: return "POST";
+    case HTTP_DELETE: return "DELETE";
+    case HTTP_PUT: return "PUT";
+    case HTTP_PATCH: return "PATCH";
+    case HTTP_HEAD: return "HEAD";
+    case HTTP_OPTIONS: return "OPTIONS";
+    default: return "ANY";
+  }
+}
+
+static void formatBound(char* out, size_t size, uint32_t micros) {
+  if (micros == UINT32_MAX) snprintf(out, size, ">%lums", (unsigned long)(metricsBucketBounds[METRICS_BUCKETS - 2] / 1000));
+  else if (micros < 1000) snprintf(out, size, "<=%luus", (unsigned long)micros);
+  else snprintf(out, size, "<=%.1fms", micros / 1000.0);
+}
+
+void WebMetrics::printSummary(Print& out) {
+  sampleHeap();
+  out.println("=== WEB METRICS ===");
+  out.printf("%-7s %-36s %6s %5s %5s %9s %9s %9s %8s\n", "Method", "Route", "Reqs", "4xx", "5xx", "p50", "p99",
+             "max", "KB out");
+  for (uint8_t i = 0; i < routeCount; i++) {
+    MetricsRoute r;
+    copyRoute(i, r);
+    if (r.requests == 0) continue;
+    char p50[12], p99[12];
+    formatBound(p50, sizeof(p50), percentile(r, 50));
+    formatBound(p99, sizeof(p99), percentile(r, 99));
+    out.printf("%-7s %-36.36s %6lu %5lu %5lu %9s %9s %7.1fms %8lu\n", methodName(r.method), r.uri,
+               (unsigned long)r.requests, (unsigned long)r.responses[2], (unsigned long)r.responses[3], p50, p99,
+               r.maxMicros / 1000.0, (unsigned long)(r.bytes / 1024));
+  }
+
+  MetricsGauges g = getGauges();
+  StorageCacheStats sd = Storage.getCacheStats();
+  out.printf("Heap: %lu free, %lu min free, largest block %lu (low %lu)\n", (unsigned long)g.freeHeap,
+             (unsigned long)g.minFreeHeap, (unsigned long)g.largestBlock, (unsigned long)g.largestBlockLow);
+  out.printf("UART TX queue: %lu bytes (high %lu)\n", (unsigned long)g.uartQueue, (unsigned long)g.uartQueueHigh);
+  out.printf("SD reads: %lu, avg %lu us, max %lu us; cache hits %lu\n", (unsigned long)sd.misses,
+             (unsigned long)(sd.misses ? sd.readMicros / sd.misses : 0), (unsigned long)sd.maxReadMicros,
+             (unsigned long)sd.hits);
+}
+
+// --- Text exposition ---
+
+enum MetricsFamily : uint8_t {
+  FAMILY_REQUESTS,
+  FAMILY_RESPONSES,
+  FAMILY_BYTES,
+  FAMILY_HANDLER,
+  FAMILY_GAUGES,
+  FAMILY_COUNT
+};
+
+static const char* const familyNames[] = {
+  "pharmassist_http_requests_total",
+  "pharmassist_http_responses_total",
+  "pharmassist_http_response_bytes_total",
+  "pharmassist_http_handler_us",
+};
+
+static const char* const familyTypes[] = {"counter", "counter", "counter", "histogram"};
+
+static const char* const statusClasses[] = {"2xx", "3xx", "4xx", "5xx"};
+
+#define GAUGE_COUNT 11
+
+MetricsTextStream::MetricsTextStream(WebMetrics& source)
+  : metrics(source), family(FAMILY_REQUESTS), route(-1), item(0), haveSnapshot(false), lineLength(0),
+    staged(0) {
+  metrics.sampleHeap();
+  gauges = metrics.getGauges();
+  storage = Storage.getCacheStats();
+  line[0] = '\0';
+}
+
+// Route URIs can be regular expressions; backslashes and quotes are escaped
+static void appendLabels(char* out, size_t size, const MetricsRoute& r) {
+  size_t n = snprintf(out, size, "{method=\"%s\",route=\"", WebMetrics::methodName(r.method));
+  for (const char* p = r.uri; *p && n + 4 < size; p++) {
+    if (*p == '\\' || *p == '"') out[n++] = '\\';
+    out[n++] = *p;
+  }
+  out[n] = '\0';
+}
+
+bool MetricsTextStream::nextRouteLine() {
+  const char* name = familyNames[family];
+  if (route < 0) {
+    lineLength = snprintf(line, sizeof(line), "# TYPE %s %s\n", name, familyTypes[family]);
+    route = 0;
+    return true;
+  }
+
+  while (route < metrics.count()) {
+    if (!haveSnapshot) {
+      metrics.copyRoute((uint8_t)route, snapshot);
+      haveSnapshot = true;
+      item = 0;
+    }
+
+    char labels[METRICS_LINE_SIZE / 2];
+    appendLabels(labels, sizeof(labels), snapshot);
+    bool wrote = false;
+    if (snapshot.requests > 0) {
+      switch (family) {
+        case FAMILY_REQUESTS:
+          if (item == 0) {
+            lineLength = snprintf(line, sizeof(line), "%s%s\"} %lu\n", name, labels,
+                                  (unsigned long)snapshot.requests);
+            wrote = true;
+          }
+          item = 1;
+          break;
+        case FAMILY_RESPONSES:
+          while (item < 4 && snapshot.responses[item] == 0) item++;
+          if (item < 4) {
+            lineLength = snprintf(line, sizeof(line), "%s%s\",code=\"%s\"} %lu\n", name, labels,
+                                  statusClasses[item], (unsigned long)snapshot.responses[item]);
+            wrote = true;
+            item++;
+          }
+          break;
+        case FAMILY_BYTES:
+          if (item == 0) {
+            lineLength = snprintf(line, sizeof(line), "%s%s\"} %lu\n", name, labels,
+                                  (unsigned long)snapshot.bytes);
+            wrote = true;
+          }
+          item = 1;
+          break;
+        case FAMILY_HANDLER:
+          if (item < METRICS_BUCKETS) {
+            uint32_t cumulative = 0;
+            for (uint8_t b = 0; b <= item; b++) cumulative += snapshot.buckets[b];
+            if (item < METRICS_BUCKETS - 1) {
+              lineLength = snprintf(line, sizeof(line), "%s_bucket%s\",le=\"%lu\"} %lu\n", name, labels,
+                                    (unsigned long)metricsBucketBounds[item], (unsigned long)cumulative);
+            } else {
+              lineLength = snprintf(line, sizeof(line), "%s_bucket%s\",le=\"+Inf\"} %lu\n", name, labels,
+                                    (unsigned long)cumulative);
+            }
+          } else if (item == METRICS_BUCKETS) {
+            lineLength = snprintf(line, sizeof(line), "%s_sum%s\"} %lu\n", name, labels,
+                                  (unsigned long)snapshot.totalMicros);
+          } else if (item == METRICS_BUCKETS + 1) {
+            lineLength = snprintf(line, sizeof(line), "%s_count%s\"} %lu\n", name, labels,
+                                  (unsigned long)snapshot.requests);
+          } else {
+            break;
+          }
+          wrote = true;
+          item++;
+          break;
+      }
+    }
+    if (wrote) {
+      if (lineLength >= sizeof(line)) lineLength = sizeof(line) - 1;
+      return true;
+    }
+    route++;
+    haveSnapshot = false;
+  }
+  return false;
+}
+
+bool MetricsTextStream::nextGaugeLine() {
+  static const char* const names[GAUGE_COUNT] = {
+    "pharmassist_uptime_seconds",
+    "pharmassist_heap_free_bytes",
+    "pharmassist_heap_min_free_bytes",
+    "pharmassist_heap_largest_block_bytes",
+    "pharmassist_heap_largest_block_low_bytes",
+    "pharmassist_uart_tx_queue_bytes",
+    "pharmassist_uart_tx_queue_high_bytes",
+    "pharmassist_sd_reads_total",
+    "pharmassist_sd_read_us_total",
+    "pharmassist_sd_read_us_max",
+    "pharmassist_storage_cache_hits_total",
+  };
+  uint8_t index = item / 2;
+  if (index >= GAUGE_COUNT) return false;
+
+  if (item % 2 == 0) {
+    bool counter = strstr(names[index], "_total") != nullptr;
+    lineLength = snprintf(line, sizeof(line), "# TYPE %s %s\n", names[index], counter ? "counter" : "gauge");
+  } else {
+    uint32_t values[GAUGE_COUNT] = {
+      (uint32_t)(millis() / 1000), gauges.freeHeap, gauges.minFreeHeap, gauges.largestBlock, gauges.largestBlockLow,
+      gauges.uartQueue, gauges.uartQueueHigh, storage.misses, storage.readMicros, storage.maxReadMicros,
+      storage.hits,
+    };
+    lineLength = snprintf(line, sizeof(line), "%s %lu\n", names[index], (unsigned long)values[index]);
+  }
+  item++;
+  return true;
+}
+
+bool MetricsTextStream::nextLine() {
+  while (family < FAMILY_COUNT) {
+    bool wrote = family == FAMILY_GAUGES ? nextGaugeLine() : nextRouteLine();
+    if (wrote) return true;
+    family++;
+    route = -1;
+    item = 0;
+    haveSnapshot = false;
+  }
+  return false;
+}
+
+size_t MetricsTextStream::fill(uint8_t* buffer, size_t maxLen) {
+  size_t written = 0;
+  while (written < maxLen) {
+    if (staged == lineLength) {
+      if (!nextLine()) break;
+      staged = 0;
+    }
+    size_t n = lineLength - staged;
+    if (n > maxLen - written) n = maxLen - written;
+    memcpy(buffer + written, line + staged, n);
+    staged += n;
+    written += n;
+  }
+  return written;
+}
+
+// --- Response helpers ---
+
+void sendResponse(AsyncWebServerRequest* request, int code, const String& contentType, const String& content) {
+  Metrics.noteResponse(code, content.length());
+  request->send(code, contentType, content);
+}
+
+void sendResponse(AsyncWebServerRequest* request, AsyncWebServerResponse* response, int code, size_t bytes) {
+  Metrics.noteResponse(code, bytes);
+  request->send(response);
+}
+
+void sendRedirect(AsyncWebServerRequest* request, const String& url) {
+  Metrics.noteResponse(302, 0);
+  request->redirect(url);
+}
+
+void sendMetrics(AsyncWebServerRequest* request) {
+  std::shared_ptr<MetricsTextStream> stream = std::make_shared<MetricsTextStream>(Metrics);
+  uint8_t route = Metrics.currentRoute();
+  AsyncWebServerResponse* resp = request->beginChunkedResponse("text/plain; version=0.0.4",
+    [stream, route](uint8_t* buffer, size_t maxLen, size_t index) -> size_t {
+      size_t n = stream->fill(buffer, maxLen);
+      Metrics.addResponseBytes(route, n);
+      return n;
+    });
+  Metrics.noteResponse(200, 0);
+  request->send(resp);
+}
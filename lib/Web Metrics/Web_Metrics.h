@@ -0,0 +1,131 @@
+#ifndef WEB_METRICS_H
+#define WEB_METRICS_H
+
+#include <Arduino.h>
+#include <ESPAsyncWebServer.h>
+#include "Storage_Manager.h"
+
+// Runtime metrics for the web server.
+//
+// Routes registered through Metrics.on() get a slot counting requests,
+// responses by status class, response bytes and a histogram of the time their
+// handlers held the async TCP task (body chunks included). Recording is a few
+// relaxed atomic adds with no lock, cheap enough to leave on in production.
+// Gauges are sampled by the tasks that own them: heap and largest free block
+// by the console task, the UART transmit queue by the comm task. SD read time
+// comes from the storage block cache (StorageCacheStats).
+//
+// GET /api/metrics streams everything in the Prometheus text format one line
+// at a time (see MetricsTextStream); the serial "metrics" command prints a
+// summary table.
+
+#define METRICS_MAX_ROUTES 32
+#define METRICS_NO_ROUTE 0xFF
+#define METRICS_BUCKETS 12          // last bucket is +Inf
+#define METRICS_LINE_SIZE 192
+
+// Upper bounds of the latency buckets in microseconds
+extern const uint32_t metricsBucketBounds[METRICS_BUCKETS - 1];
+
+struct MetricsRoute {
+  const char* uri;
+  WebRequestMethodComposite method;
+  uint32_t requests;
+  uint32_t responses[4];            // 2xx, 3xx, 4xx, 5xx
+  uint32_t bytes;
+  uint32_t totalMicros;
+  uint32_t maxMicros;
+  uint32_t buckets[METRICS_BUCKETS];
+  uint32_t bodyMicros;              // body handler time not yet added to a request
+};
+
+struct MetricsGauges {
+  uint32_t freeHeap;
+  uint32_t minFreeHeap;             // since boot, tracked by the heap allocator
+  uint32_t largestBlock;
+  uint32_t largestBlockLow;         // smallest largest-free-block seen
+  uint32_t uartQueue;
+  uint32_t uartQueueHigh;
+};
+
+class WebMetrics {
+private:
+  MetricsRoute routes[METRICS_MAX_ROUTES];
+  uint8_t routeCount;
+  volatile uint8_t current;         // route whose handler is running (async TCP task only)
+  MetricsGauges gauges;
+
+  uint8_t addRoute(const char* uri, WebRequestMethodComposite method);
+  void record(uint8_t route, uint32_t micros);
+
+public:
+  WebMetrics();
+
+  // Drop-in replacements for AsyncWebServer::on()/onNotFound() that time the handlers
+  void on(AsyncWebServer& server, const char* uri, WebRequestMethodComposite method,
+          ArRequestHandlerFunction onRequest);
+  void on(AsyncWebServer& server, const char* uri, WebRequestMethodComposite method,
+          ArRequestHandlerFunction onRequest, ArUploadHandlerFunction onUpload, ArBodyHandlerFunction onBody);
+  void onNotFound(AsyncWebServer& server, ArRequestHandlerFunction handler);
+
+  // Counts a response against the route whose handler is running
+  void noteResponse(int code, size_t bytes);
+  // For responses that finish after their handler returned (chunked streams)
+  uint8_t currentRoute() { return current; }
+  void addResponseBytes(uint8_t route, size_t bytes);
+
+  // Gauge sampling
+  void sampleHeap();
+  void observeUartQueue(size_t depth);
+
+  uint8_t count() { return routeCount; }
+  bool copyRoute(uint8_t route, MetricsRoute& out);
+  MetricsGauges getGauges();
+  void reset();
+
+  // Bucket upper bound (microseconds) below which the given share of requests finished
+  static uint32_t percentile(const MetricsRoute& route, uint8_t percent);
+  static const char* methodName(WebRequestMethodComposite method);
+
+  void printSummary(Print& out);
+};
+
+// Renders every metric as Prometheus text, one line per call
+class MetricsTextStream {
+private:
+  WebMetrics& metrics;
+  uint8_t family;
+  int16_t route;                    // -1 = the family's # TYPE line
+  uint8_t item;
+  MetricsRoute snapshot;
+  bool haveSnapshot;
+  MetricsGauges gauges;
+  StorageCacheStats storage;
+  char line[METRICS_LINE_SIZE];
+  size_t lineLength;
+  size_t staged;
+
+  bool nextLine();
+  bool nextRouteLine();
+  bool nextGaugeLine();
+
+public:
+  MetricsTextStream(WebMetrics& source);
+
+  // AwsResponseFiller body: copies up to maxLen bytes, returns 0 when finished
+  size_t fill(uint8_t* buffer, size_t maxLen);
+};
+
+// request->send() that also counts the response against the current route
+void sendResponse(AsyncWebServerRequest* request, int code, const String& contentType = String(),
+                  const String& content = String());
+void sendResponse(AsyncWebServerRequest* request, AsyncWebServerResponse* response, int code, size_t bytes);
+void sendRedirect(AsyncWebServerRequest* request, const String& url);
+
+// GET /api/metrics
+void sendMetrics(AsyncWebServerRequest* request);
+
+// Global instance
+extern WebMetrics Metrics;
+
+#endif
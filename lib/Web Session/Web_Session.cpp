@@ -0,0 +1,44 @@
+#include "Web_Session.h"
+
+#define SESSION_COOKIE "session_token="
+#define BEARER_PREFIX "Bearer "
+
+SessionToken sessionTokenFromHeaders(const char* cookie, const char* authorization) {
+  SessionToken token;
+  memset(&token, 0, sizeof(token));
+
+  // Check for session token in cookies
+  const char* start = cookie ? strstr(cookie, SESSION_COOKIE) : nullptr;
+  if (start) {
+    start += sizeof(SESSION_COOKIE) - 1;
+    const char* end = strchr(start, ';');
+    size_t length = end ? (size_t)(end - start) : strlen(start);
+    if (parseSessionToken(start, length, token)) return token;
+  }
+
+  // Check for Authorization header
+  if (authorization && strncmp(authorization, BEARER_PREFIX, sizeof(BEARER_PREFIX) - 1) == 0) {
+    const char* value = authorization + sizeof(BEARER_PREFIX) - 1;
+    parseSessionToken(value, strlen(value), token);
+  }
+  return token;
+}
+
+SessionToken getSessionToken(AsyncWebServerRequest* request) {
+  const AsyncWebHeader* cookie = request->getHeader("Cookie");
+  const AsyncWebHeader* authorization = request->getHeader("Authorization");
+  return sessionTokenFromHeaders(cookie ? cookie->value().c_str() : nullptr,
+                                 authorization ? authorization->value().c_str() : nullptr);
+}
+
+bool validateSession(const SessionToken& token) {
+  return Sessions.touch(token);
+}
+
+String getCurrentUsername(const SessionToken& token) {
+  Session session;
+  if (Sessions.get(token, session)) {
+    return session.username;
+  }
+  return "";
+}
@@ -0,0 +1,26 @@
+#ifndef WEB_SESSION_H
+#define WEB_SESSION_H
+
+#include <Arduino.h>
+#include <ESPAsyncWebServer.h>
+#include "Session_Table.h"
+
+// The session checks every API handler starts with. They live here rather
+// than in main.cpp so the native test env can run them against the
+// AsyncWebServerRequest stand-in in test/stubs.
+
+// Reads the token from the session cookie or a Bearer header without copying
+// the header; a missing or malformed token comes back all zero, which never
+// matches a session
+SessionToken getSessionToken(AsyncWebServerRequest* request);
+
+// The same lookup on raw header values; either may be null
+SessionToken sessionTokenFromHeaders(const char* cookie, const char* authorization);
+
+// Refreshes the session in Sessions; false if it is unknown or expired
+bool validateSession(const SessionToken& token);
+
+// Empty if the token has no session
+String getCurrentUsername(const SessionToken& token);
+
+#endif
@@ -0,0 +1,40 @@
+"""Pre-compress web assets in data/ for the firmware's static file server.
+
+Writes <name>.gz next to every .html/.css/.js file whose compressed copy is
+missing or older than the source. Output is deterministic (mtime 0), so the
+ETag the firmware derives from the file only changes when the content does.
+Copy data/ (including the .gz files) to the SD card root as before.
+
+Runs automatically before each PlatformIO build (see extra_scripts in
+platformio.ini) and can also be run by hand:  python scripts/gzip_assets.py
+"""
+
+import gzip
+import os
+
+EXTENSIONS = (".html", ".css", ".js")
+
+
+def compress_assets(data_dir):
+    for name in sorted(os.listdir(data_dir)):
+        if not name.endswith(EXTENSIONS):
+            continue
+        source = os.path.join(data_dir, name)
+        target = source + ".gz"
+        if os.path.exists(target) and os.path.getmtime(target) >= os.path.getmtime(source):
+            continue
+
+        with open(source, "rb") as f:
+            raw = f.read()
+        with open(target, "wb") as f:
+            with gzip.GzipFile(filename="", mode="wb", fileobj=f, compresslevel=9, mtime=0) as gz:
+                gz.write(raw)
+        print("gzip_assets: %s %d -> %d bytes" % (name, len(raw), os.path.getsize(target)))
+
+
+try:
+    Import("env")  # noqa: F821 - provided by PlatformIO
+    compress_assets(env.subst("$PROJECT_DATA_DIR"))  # noqa: F821
+except NameError:
+    if __name__ == "__main__":
+        compress_assets(os.path.join(os.path.dirname(os.path.abspath(__file__)), "..", "data"))
@@ -0,0 +1,413 @@
+"""Replay doctor traffic against the Pharmassist web API and report how it holds up.
+
+Each simulated doctor logs in through /api/login and then behaves like
+data/script.js in a browser tab:
+
+  page load   GET /api/validate-session, POST /api/log, then in parallel
+              GET /api/prescriptions (active), /api/notifications,
+              /api/patients and /api/medications, then the first history page
+  navigation  one of the dashboard pages (active, history, notifications),
+              sometimes the next history page
+  submit      POST /api/prescription followed by a refresh of active orders
+
+with exponential think time between actions. Submitted orders use only the
+medications GET /api/medications lists, as the form does.
+
+WARNING: a submitted prescription goes to the dispenser like any other and the
+machine dispenses it. Against a board with stocked cabinets run with
+--no-submit unless dispensing is wanted. Like a browser, each doctor keeps
+up to three keep-alive connections, so N doctors hold up to 3N sockets.
+
+The target is any base URL: a board on its access point (the default) or
+anything else serving the same API. Free heap comes from the serial console's
+"mem" command when --serial is given (needs pyserial); without it only the
+HTTP side is measured.
+
+Examples:
+  python scripts/load_test.py --doctors 8 --duration 120 --no-submit
+  python scripts/load_test.py --url http://192.168.4.1 --doctors 20 --serial /dev/ttyUSB0 --csv run.csv
+"""
+
+import argparse
+import concurrent.futures
+import datetime
+import http.client
+import json
+import random
+import re
+import sys
+import threading
+import time
+import urllib.parse
+
+# Accounts seeded on first boot (seedSampleUsers in src/main.cpp)
+DEFAULT_USERS = "test:test123,admin:admin123,doctor1:pass123,doctor2:med456,Doctor A:DocA123"
+
+ACTIVE_QUERY = "/api/prescriptions?status=pending,processing,dispensing,ready"
+HISTORY_QUERY = "/api/prescriptions?status=dispensed,partially-dispensed,cancelled&limit=20"
+
+# Used until /api/medications answers: the default cabinet map's names
+MEDICATIONS = ["Medicine %d" % i for i in range(1, 10)]
+# The form's choices (frequencyList in src/main.cpp)
+FREQUENCIES = ["once", "bid", "tid"]
+
+
+def percentile(sorted_values, p):
+    """Nearest-rank percentile of an already sorted list."""
+    if not sorted_values:
+        return 0.0
+    rank = max(1, int(round(p / 100.0 * len(sorted_values))))
+    return sorted_values[min(rank, len(sorted_values)) - 1]
+
+
+class Results:
+    """Every request outcome plus heap samples, shared by all threads."""
+
+    def __init__(self):
+        self.lock = threading.Lock()
+        self.requests = []      # (time, route, latency ms, status, error)
+        self.heap = []          # (time, free, largest block)
+        self.started = time.monotonic()
+
+    def add(self, route, latency_ms, status, error):
+        with self.lock:
+            self.requests.append((time.monotonic() - self.started, route, latency_ms, status, error))
+
+    def add_heap(self, free, largest):
+        with self.lock:
+            self.heap.append((time.monotonic() - self.started, free, largest))
+
+    def snapshot(self):
+        with self.lock:
+            return list(self.requests), list(self.heap)
+
+
+class Client:
+    """One keep-alive connection, reopened after any failure."""
+
+    def __init__(self, base, timeout):
+        self.host = base.hostname
+        self.port = base.port or 80
+        self.timeout = timeout
+        self.conn = None
+
+    def request(self, method, path, body=None, cookie=None):
+        headers = {"Accept": "application/json"}
+        if body is not None:
+            headers["Content-Type"] = "application/json"
+        if cookie:
+            headers["Cookie"] = cookie
+        try:
+            if self.conn is None:
+                self.conn = http.client.HTTPConnection(self.host, self.port, timeout=self.timeout)
+            self.conn.request(method, path, body=body, headers=headers)
+            response = self.conn.getresponse()
+            data = response.read()
+            if response.getheader("Connection", "").lower() == "close":
+                self.close()
+            return response.status, response.getheader("Set-Cookie"), data
+        except Exception:
+            self.close()
+            raise
+
+    def close(self):
+        if self.conn is not None:
+            self.conn.close()
+            self.conn = None
+
+
+class Doctor(threading.Thread):
+    def __init__(self, number, username, password, args, results, stop):
+        super().__init__(name="doctor-%d" % number, daemon=True)
+        self.number = number
+        self.username = username
+        self.password = password
+        self.args = args
+        self.results = results
+        self.stop = stop
+        self.random = random.Random(args.seed + number)
+        self.base = urllib.parse.urlsplit(args.url)
+        self.local = threading.local()
+        self.pool = concurrent.futures.ThreadPoolExecutor(max_workers=3)
+        self.cookie = None
+        self.history_cursor = None
+        self.medications = MEDICATIONS
+        self.submitted = 0
+
+    def client(self):
+        if not hasattr(self.local, "client"):
+            self.local.client = Client(self.base, self.args.timeout)
+        return self.local.client
+
+    def call(self, route, method, path, body=None):
+        """Times one request; returns the parsed JSON body or None."""
+        start = time.monotonic()
+        status, error, data, set_cookie = 0, None, b"", None
+        try:
+            status, set_cookie, data = self.client().request(method, path, body, self.cookie)
+        except Exception as e:
+            error = type(e).__name__
+        latency = (time.monotonic() - start) * 1000.0
+        if error is None and status >= 400:
+            error = "HTTP %d" % status
+        self.results.add(route, latency, status, error)
+        if set_cookie and "session_token=" in set_cookie:
+            self.cookie = set_cookie.split(";", 1)[0]
+        if error is not None:
+            return None
+        try:
+            return json.loads(data.decode("utf-8")) if data else None
+        except ValueError:
+            return None
+
+    def think(self):
+        self.stop.wait(self.random.expovariate(1.0 / self.args.think))
+
+    def login(self):
+        body = json.dumps({"type": "username", "username": self.username, "password": self.password})
+        result = self.call("POST /api/login", "POST", "/api/login", body)
+        return bool(result and result.get("success"))
+
+    def history_page(self, more):
+        path = HISTORY_QUERY
+        if more and self.history_cursor is not None:
+            path += "&cursor=%d" % self.history_cursor
+        result = self.call("GET /api/prescriptions (history)", "GET", path)
+        self.history_cursor = result.get("nextCursor") if result else None
+
+    def fetch_medications(self):
+        result = self.call("GET /api/medications", "GET", "/api/medications")
+        if result and result.get("success") and isinstance(result.get("data"), list):
+            self.medications = [m["name"] for m in result["data"] if m.get("name")]
+
+    def page_load(self):
+        result = self.call("GET /api/validate-session", "GET", "/api/validate-session")
+        if not result or not result.get("valid"):
+            self.cookie = None
+            return False
+        self.call("POST /api/log", "POST", "/api/log", json.dumps({"context": "index", "details": {"session": "verifying"}}))
+        # fetchAllData(): issued at once as Promise.all does, over three connections
+        futures = [
+            self.pool.submit(self.call, "GET /api/prescriptions (active)", "GET", ACTIVE_QUERY),
+            self.pool.submit(self.call, "GET /api/notifications", "GET", "/api/notifications"),
+            self.pool.submit(self.call, "GET /api/patients", "GET", "/api/patients"),
+            self.pool.submit(self.fetch_medications),
+        ]
+        concurrent.futures.wait(futures)
+        self.history_page(False)
+        return True
+
+    def submit(self):
+        if not self.medications:
+            # Nothing the dispenser stocks; the form could not submit either
+            self.navigate()
+            return
+        self.submitted += 1
+        prescription = {
+            "id": "RX-LOAD-%d-%d-%d" % (self.number, self.submitted, int(time.time() * 1000) % 100000),
+            "patientName": "Load Patient %d" % self.random.randint(1, 200),
+            "patientMRN": "MRN-%08d" % self.random.randint(1, 99999999),
+            "ward": self.random.choice(["emergency", "outpatient", "icu", "general"]),
+            "bedNumber": str(self.random.randint(1, 40)),
+            "medications": [
+                {
+                    "medicationName": self.random.choice(MEDICATIONS),
+                    "strength": "500mg",
+                    "dosageForm": "tablet",
+                    "frequency": self.random.choice(FREQUENCIES),
+                }
+                for _ in range(self.random.randint(1, 3))
+            ],
+            "status": "pending",
+            "date": datetime.date.today().isoformat(),
+            "prescribingPhysician": "Dr. %s" % self.username,
+        }
+        self.call("POST /api/prescription", "POST", "/api/prescription", json.dumps(prescription))
+        self.call("GET /api/prescriptions (active)", "GET", ACTIVE_QUERY)
+
+    def navigate(self):
+        page = self.random.choice(["active", "history", "notifications"])
+        if page == "active":
+            self.call("GET /api/prescriptions (active)", "GET", ACTIVE_QUERY)
+        elif page == "history":
+            self.history_page(self.history_cursor is not None and self.random.random() < 0.5)
+        else:
+            self.call("GET /api/notifications", "GET", "/api/notifications")
+
+    def run(self):
+        try:
+            while not self.stop.is_set():
+                if self.cookie is None:
+                    if not self.login():
+                        self.stop.wait(self.args.retry)
+                        continue
+                    if not self.page_load():
+                        continue
+                self.think()
+                if self.stop.is_set():
+                    break
+                roll = self.random.random()
+                if roll < self.args.submit_ratio and not self.args.no_submit:
+                    self.submit()
+                elif roll < self.args.submit_ratio + self.args.reload_ratio:
+                    self.page_load()
+                else:
+                    self.navigate()
+        finally:
+            self.pool.shutdown(wait=False)
+
+
+class HeapSampler(threading.Thread):
+    """Asks the serial console for "mem" and keeps the heap figures."""
+
+    FREE = re.compile(r"Free Heap:\s*(\d+)")
+    LARGEST = re.compile(r"Largest Free Block:\s*(\d+)")
+
+    def __init__(self, port, baud, interval, results, stop):
+        super().__init__(name="heap", daemon=True)
+        import serial  # pyserial, only needed with --serial
+        self.serial = serial.Serial(port, baud, timeout=0.2)
+        self.interval = interval
+        self.results = results
+        self.stop = stop
+
+    def run(self):
+        while not self.stop.is_set():
+            self.serial.reset_input_buffer()
+            self.serial.write(b"mem\n")
+            free = largest = None
+            deadline = time.monotonic() + 2.0
+            while time.monotonic() < deadline and (free is None or largest is None):
+                line = self.serial.readline().decode("utf-8", "replace")
+                match = self.FREE.search(line)
+                if match:
+                    free = int(match.group(1))
+                match = self.LARGEST.search(line)
+                if match:
+                    largest = int(match.group(1))
+            if free is not None:
+                self.results.add_heap(free, largest or 0)
+            self.stop.wait(self.interval)
+        self.serial.close()
+
+
+def summarize(requests):
+    latencies = sorted(r[2] for r in requests)
+    errors = sum(1 for r in requests if r[4] is not None)
+    return len(requests), percentile(latencies, 50), percentile(latencies, 99), errors
+
+
+def progress_line(results, since, until):
+    requests, heap = results.snapshot()
+    window = [r for r in requests if since <= r[0] < until]
+    count, p50, p99, errors = summarize(window)
+    line = "%6.0fs  %6.1f req/s  p50 %7.1f ms  p99 %7.1f ms  errors %5.1f%%" % (
+        until, count / max(until - since, 1e-9), p50, p99, 100.0 * errors / count if count else 0.0)
+    if heap:
+        line += "  heap %d (largest %d)" % (heap[-1][1], heap[-1][2])
+    return line
+
+
+def final_report(results, out):
+    requests, heap = results.snapshot()
+    routes = sorted(set(r[1] for r in requests))
+    out.write("\n%-36s %7s %9s %9s %9s %7s\n" % ("route", "count", "p50 ms", "p99 ms", "max ms", "err %"))
+    for route in routes + [None]:
+        rows = [r for r in requests if route is None or r[1] == route]
+        count, p50, p99, errors = summarize(rows)
+        worst = max((r[2] for r in rows), default=0.0)
+        out.write("%-36s %7d %9.1f %9.1f %9.1f %7.2f\n" % (
+            route or "all", count, p50, p99, worst, 100.0 * errors / count if count else 0.0))
+
+    kinds = {}
+    for r in requests:
+        if r[4] is not None:
+            kinds[r[4]] = kinds.get(r[4], 0) + 1
+    if kinds:
+        out.write("\nerrors: %s\n" % ", ".join("%s x%d" % kv for kv in sorted(kinds.items())))
+    if heap:
+        out.write("\nfree heap: start %d, min %d, end %d; largest block min %d\n" % (
+            heap[0][1], min(h[1] for h in heap), heap[-1][1], min(h[2] for h in heap)))
+
+
+def write_csv(results, path):
+    requests, heap = results.snapshot()
+    with open(path, "w") as f:
+        f.write("time_s,kind,route,latency_ms,status,error,free_heap,largest_block\n")
+        for t, route, latency, status, error in requests:
+            f.write('%.3f,request,"%s",%.2f,%d,%s,,\n' % (t, route, latency, status, error or ""))
+        for t, free, largest in heap:
+            f.write("%.3f,heap,,,,,%d,%d\n" % (t, free, largest))
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("--url", default="http://192.168.4.1", help="base URL of the server (default: the board's AP)")
+    parser.add_argument("--doctors", type=int, default=4, help="simulated doctors (default 4)")
+    parser.add_argument("--users", default=DEFAULT_USERS, help="comma separated user:password accounts, shared round robin")
+    parser.add_argument("--duration", type=float, default=60.0, help="seconds to run after the ramp (default 60)")
+    parser.add_argument("--ramp", type=float, default=10.0, help="seconds over which doctors log in (default 10)")
+    parser.add_argument("--think", type=float, default=5.0, help="mean seconds between a doctor's actions (default 5)")
+    parser.add_argument("--submit-ratio", type=float, default=0.1,
+                        help="share of actions that submit a prescription, which the board dispenses")
+    parser.add_argument("--no-submit", action="store_true",
+                        help="never submit; those actions navigate instead, so nothing is dispensed")
+    parser.add_argument("--reload-ratio", type=float, default=0.1, help="share of actions that reload the whole page")
+    parser.add_argument("--timeout", type=float, default=10.0, help="per-request timeout in seconds (default 10)")
+    parser.add_argument("--retry", type=float, default=2.0, help="seconds to wait after a failed login (default 2)")
+    parser.add_argument("--report-interval", type=float, default=5.0, help="seconds between progress lines (default 5)")
+    parser.add_argument("--serial", help="serial console port for heap samples, e.g. /dev/ttyUSB0")
+    parser.add_argument("--baud", type=int, default=115200)
+    parser.add_argument("--heap-interval", type=float, default=2.0, help="seconds between heap samples (default 2)")
+    parser.add_argument("--csv", help="write every request and heap sample to this file")
+    parser.add_argument("--seed", type=int, default=1)
+    args = parser.parse_args()
+
+    accounts = []
+    for entry in args.users.split(","):
+        username, _, password = entry.partition(":")
+        accounts.append((username, password))
+
+    results = Results()
+    stop = threading.Event()
+    if args.serial:
+        HeapSampler(args.serial, args.baud, args.heap_interval, results, stop).start()
+
+    doctors = []
+    for i in range(args.doctors):
+        username, password = accounts[i % len(accounts)]
+        doctors.append(Doctor(i, username, password, args, results, stop))
+
+    print("%d doctors against %s for %.0f s (+%.0f s ramp)" % (args.doctors, args.url, args.duration, args.ramp))
+    if not args.no_submit and args.submit_ratio > 0:
+        print("WARNING: %.0f%% of actions submit prescriptions and the dispenser will dispense them; "
+              "use --no-submit to only read" % (100.0 * args.submit_ratio))
+    end = time.monotonic() + args.ramp + args.duration
+    next_report = args.report_interval
+    last_report = 0.0
+    try:
+        for i, doctor in enumerate(doctors):
+            doctor.start()
+            if args.doctors > 1:
+                time.sleep(args.ramp / (args.doctors - 1) if i < args.doctors - 1 else 0)
+        while time.monotonic() < end:
+            time.sleep(0.2)
+            elapsed = time.monotonic() - results.started
+            if elapsed >= next_report:
+                print(progress_line(results, last_report, elapsed))
+                last_report = elapsed
+                next_report += args.report_interval
+    except KeyboardInterrupt:
+        pass
+    stop.set()
+    for doctor in doctors:
+        doctor.join(args.timeout + 1)
+
+    final_report(results, sys.stdout)
+    if args.csv:
+        write_csv(results, args.csv)
+        print("wrote %s" % args.csv)
+
+
+if __name__ == "__main__":
+    main()
@@ -6,9 +6,23 @@
 #include <SD.h>
 #include <SPI.h>
 #include <ArduinoJson.h>
-#include <map>
 #include <vector>
+#include <memory>
 #include "ESPrxtxESP.h"
+#include "Storage_Manager.h"
+#include "Prescription_Store.h"
+#include "Json_Stream.h"
+#include "Prescription_List.h"
+#include "Notification_List.h"
+#include "Asset_Cache.h"
+#include "Credential_Store.h"
+#include "Session_Table.h"
+#include "Web_Session.h"
+#include "Dispense_Queue.h"
+#include "Cabinet_Map.h"
+#include "Spsc_Queue.h"
+#include "Web_Metrics.h"
+#include "Async_Log.h"
 
 #define SD_CS_PIN 5   // SD Card Chip Select pin
 // VSPI
@@ -33,6 +47,12 @@ const char* AP_password = "pharma1234";
 
 ESPrxtxESP comm(&Serial2);
 
+// Send text to the dispenser as CRC-checked frames; needs a dispenser built
+// with the same ESPrxtxESP (it reads both forms either way)
+#ifndef COMM_FRAMED_TEXT
+#define COMM_FRAMED_TEXT 0
+#endif
+
 AsyncWebServer webServer(80);
 DNSServer dnsServer;
 
@@ -45,6 +65,85 @@ bool useSDCard = false;
 bool storageInitialized = false;
 String storageType = "";
 
+// Task layout
+//   core 1  comm      UART link to the dispenser and the dispense job queue
+//   core 0  WiFi, AsyncTCP (every web handler) and console (DNS, serial
+//           commands, session expiry)
+// Web handlers never touch the dispense queue themselves: orders and cancels
+// go to the comm task through dispenseHandoff, a lock-free queue whose only
+// producer is the AsyncTCP task, followed by a task notification. The comm
+// task sleeps until it is notified, UART data arrives or DispenseJobs has a
+// resend or batch hold falling due, so a dispense order no longer waits for
+// the next turn of a 10 ms loop().
+//
+// From POST /api/prescription to the dispenser starting to move:
+//   handler -> comm task    tens of microseconds (push + notify)
+//   batch hold              up to DISPENSE_BATCH_HOLD, so orders placed
+//                           together share one pass through the cabinets
+//   UART                    about 7 ms for an 80-byte DISPENSE line at 115200
+//   dispenser               parses the order, ACKs it and queues the first
+//                           steps for its step timer
+// The "latency" command shows the measured hand-off time and the time from
+// the POST to the dispenser's ACK, which covers every stage on this side.
+#define COMM_TASK_CORE 1
+#define COMM_TASK_PRIORITY 3
+#define COMM_TASK_STACK 6144
+#define COMM_TASK_MAX_SLEEP 100     // ms, bounds auto-ping jitter
+#define CONSOLE_TASK_CORE 0
+#define CONSOLE_TASK_PRIORITY 1
+#define CONSOLE_TASK_STACK 8192
+#define CONSOLE_TASK_PERIOD 10      // ms between DNS and serial console polls
+#define METRICS_HEAP_PERIOD 1000    // ms between heap gauge samples
+// Build with -DLOG_TO_SD to keep a copy of the log on the SD card
+#define LOG_FILE_PATH "/system.log"
+#define LOG_FILE_LIMIT 65536        // bytes before the log moves to /system.log.1
+#define DISPENSE_HANDOFF_SIZE 16    // orders in flight from web handlers to the comm task
+
+struct DispenseHandoff {
+  DispenseOrder order;        // job is unused
+  uint16_t prescriptionRecord;  // record number in Prescriptions
+  bool cancel;                // drop the unsent job for prescriptionRecord instead
+  uint32_t postedAt;          // micros() when the handler took the request
+};
+
+struct LatencyStats {
+  uint32_t count;
+  uint32_t min;
+  uint32_t max;
+  uint64_t total;
+
+  void add(uint32_t value) {
+    if (count == 0 || value < min) min = value;
+    if (value > max) max = value;
+    total += value;
+    count++;
+  }
+  void print(const char* label, const char* unit) const {
+    if (count == 0) {
+      Serial.printf("%s: no samples yet\n", label);
+      return;
+    }
+    Serial.printf("%s: %u samples, min %u %s, avg %u %s, max %u %s\n", label, (unsigned)count, (unsigned)min, unit,
+                  (unsigned)(total / count), unit, (unsigned)max, unit);
+  }
+};
+
+SpscQueue<DispenseHandoff, DISPENSE_HANDOFF_SIZE> dispenseHandoff;
+TaskHandle_t commTask = nullptr;
+TaskHandle_t consoleTask = nullptr;
+
+// Written by the comm task only; the console reads them without a lock
+LatencyStats handoffLatency;    // us, web handler to comm task
+LatencyStats acceptLatency;     // ms, POST to the dispenser's ACK
+
+// Jobs waiting for their first ACK, for acceptLatency
+struct PendingAccept {
+  uint32_t job;
+  uint32_t postedAt;            // millis()
+};
+PendingAccept pendingAccepts[DISPENSE_BATCH_MAX_ORDERS];
+size_t nextPendingAccept = 0;
+
 struct DispenseRequest {
   int medicationId[3]; // medicineID
   int quantity[3];     // qty (default 1 if not provided)
@@ -66,58 +165,30 @@ struct DispenseRequest {
 
 
 
-// Session management
-struct Session {
-  String token;
-  String username;
-  String fullName;
-  unsigned long createdAt;
-  unsigned long lastAccessed;
-};
-
-std::map<String, Session> activeSessions;
-const unsigned long SESSION_TIMEOUT = 3600000; // 1 hour in milliseconds
-
-// User database structure
-struct User {
-  int id;
-  String username;
-  String password;
-  String fullName;
-  String email;
-  String license;
-  String department;
-};
+// Session management (see Session_Table.h)
+const unsigned long SESSION_TIMEOUT = SESSION_DEFAULT_TIMEOUT; // 1 hour in milliseconds
 
-// Reduced sample user accounts (3 established doctors)
-std::vector<User> users = {
-  {1, "test", "test123", "Test User", "test@example.com", "MD-00001", "General Practice"},
-  {2, "admin", "admin123", "Dr. John Smith", "j.smith@hospital.com", "MD-12345", "Internal Medicine"},
-  {3, "doctor1", "pass123", "Dr. Sarah Johnson", "s.johnson@hospital.com", "MD-23456", "Cardiology"},
-  {4, "doctor2", "med456", "Dr. Michael Chen", "m.chen@hospital.com", "MD-34567", "Emergency Medicine"},
-  {5, "Doctor A", "DocA123", "Dr. Alice Brown", "a.brown@hospital.com", "MD-45678", "Pediatrics"}
-};
+// Sample user accounts, written to the credential store on first boot only
+void seedSampleUsers() {
+  if (!Users.isInitialized() || Users.count() > 0) return;
 
-// Prescription struct for storing submitted prescriptions
-struct Medication {
-  String medicationName;
-  String strength;
-  String dosageForm;
-  String frequency;
-};
+  struct SampleUser {
+    User user;
+    const char* password;
+  };
+  const std::vector<SampleUser> samples = {
+    {{1, "test", "Test User", "test@example.com", "MD-00001", "General Practice"}, "test123"},
+    {{2, "admin", "Dr. John Smith", "j.smith@hospital.com", "MD-12345", "Internal Medicine"}, "admin123"},
+    {{3, "doctor1", "Dr. Sarah Johnson", "s.johnson@hospital.com", "MD-23456", "Cardiology"}, "pass123"},
+    {{4, "doctor2", "Dr. Michael Chen", "m.chen@hospital.com", "MD-34567", "Emergency Medicine"}, "med456"},
+    {{5, "Doctor A", "Dr. Alice Brown", "a.brown@hospital.com", "MD-45678", "Pediatrics"}, "DocA123"}
+  };
 
-struct Prescription {
-  String id;
-  String patientName;
-  String patientMRN;
-  String ward;
-  String bedNumber;
-  std::vector<Medication> medications;
-  String status;
-  String date;
-  String prescribingPhysician;
-  String prescribingUsername; // New field to link to user
-};
+  for (const auto& sample : samples) {
+    Users.add(sample.user, sample.password);
+  }
+  Serial.printf("Seeded %d sample users\n", (int)samples.size());
+}
 
 // Sample patient data
 struct Patient {
@@ -136,19 +207,6 @@ std::vector<Patient> patients = {
   {"Maria Garcia", "MRN-55667788", "emergency", "ER-07"}
 };
 
-// Notification structure - now linked to specific users
-struct Notification {
-  String id;
-  String title;
-  String content;
-  String type;
-  String time;
-  bool read;
-  bool actionRequired;
-  String relatedOrderId;
-  String assignedToUsername; // New field to link notification to specific user
-};
-
 // Notifications linked to specific users
 std::vector<Notification> notifications = {
   // Notifications for Dr. John Smith (admin)
@@ -164,55 +222,65 @@ std::vector<Notification> notifications = {
   {"NOTIF-006", "Drug Interaction Alert", "Potential interaction detected between prescribed Medicine 9 and patient's existing Medicine 7 therapy for Maria Garcia. Review recommended.",   "warning", "45 minutes ago", false, true, "RX-2024-008", "doctor2"}
 };
 
-std::vector<Prescription> prescriptions = {
-  // ---------------- Test User ----------------
-  {"RX-2024-100", "Maria Garcia", "MRN-55667788", "emergency", "ER-07",
-   {{"Medicine 1","500mg","capsule","tid"}, {"Medicine 8","500mg","tablet","bid"}},
-   "pending",  "2024-01-20", "Test User", "test"},
-  {"RX-2024-101", "Robert Chen", "MRN-23456789", "outpatient", "",
-   {{"Medicine 3","500mg","tablet","tid"}, {"Medicine 2","10mg","tablet","bid"}},
-   "dispensing", "2024-01-21", "Test User", "test"},
-  {"RX-2024-102", "James Anderson", "MRN-11223344", "internal", "Ward-B-15",
-   {{"Medicine 8","500mg","tablet","tid"}},
-   "ready", "2024-01-22", "Test User", "test"},
-
-  // ---------------- Dr. John Smith ----------------
-  {"RX-2024-001", "Sarah Wilson", "MRN-78901234", "cardiology", "Ward-A-12",
-   {{"Medicine 2","10mg","tablet","tid"}},
-   "dispensing", "2024-01-16", "Dr. John Smith", "admin"},
-  {"RX-2024-002", "Michael Rodriguez", "MRN-56789012", "internal", "Ward-B-08",
-   {{"Medicine 5","100IU/ml","injection","bid"}},
-   "pending", "2024-01-16", "Dr. John Smith", "admin"},
-  {"RX-2024-009", "Robert Chen", "MRN-23456789", "outpatient", "",
-   {{"Medicine 3","500mg","tablet","tid"}},
-   "ready", "2024-01-15", "Dr. John Smith", "admin"},
-  // Multi-medication example
-  {"RX-2024-012", "James Anderson", "MRN-11223344", "internal", "Ward-B-15",
-   {{"Medicine 4","20mg","tablet","tid"}, {"Medicine 8","500mg","tablet","tid"}},
-  "pending", "2024-01-18", "Dr. John Smith", "admin"},
-
-  // ---------------- Dr. Sarah Johnson ----------------
-  {"RX-2024-006", "Lisa Williams", "MRN-12345678", "cardiology", "Ward-A-25",
-   {{"Medicine 7","5mg","tablet","tid"}},
-   "partially-dispensed", "2024-01-14", "Dr. Sarah Johnson", "doctor1"},
-  {"RX-2024-007", "James Anderson", "MRN-11223344", "internal", "Ward-B-15",
-   {{"Medicine 4","20mg","tablet","bid"}},
-   "dispensed", "2024-01-13", "Dr. Sarah Johnson", "doctor1"},
-  {"RX-2024-010", "Sarah Wilson", "MRN-78901234", "cardiology", "Ward-A-12",
-   {{"Medicine 8","81mg","tablet","tid"}}, // Aspirin replaced with Medicine 8 from the static list
-   "ready", "2024-01-16", "Dr. Sarah Johnson", "doctor1"},
-
-  // ---------------- Dr. Michael Chen ----------------
-  {"RX-2024-003", "Emma Thompson", "MRN-34567890", "emergency", "ER-03",
-   {{"Medicine 6","1mg/ml","injection","once"}},
-   "ready", "2024-01-16", "Dr. Michael Chen", "doctor2"},
-  {"RX-2024-008", "Maria Garcia", "MRN-55667788", "emergency", "ER-07",
-   {{"Medicine 9","250mg","tablet","once"}},
-    "dispensing", "2024-01-16", "Dr. Michael Chen", "doctor2"},
-  {"RX-2024-011", "Emma Thompson", "MRN-34567890", "emergency", "ER-03",
-   {{"Medicine 9","20mg","tablet","once"}}, // replaced with Medicine 8 to stay inside static 9
-  "pending", "2024-01-16", "Dr. Michael Chen", "doctor2"}
-};
+// Sample prescriptions, written to the prescription store on first boot only
+void seedSamplePrescriptions() {
+  if (!Prescriptions.isInitialized() || Prescriptions.count() > 0) return;
+
+  const std::vector<Prescription> samples = {
+    // ---------------- Test User ----------------
+    {"RX-2024-100", "Maria Garcia", "MRN-55667788", "emergency", "ER-07",
+     {{"Medicine 1","500mg","capsule","tid"}, {"Medicine 8","500mg","tablet","bid"}},
+     "pending",  "2024-01-20", "Test User", "test"},
+    {"RX-2024-101", "Robert Chen", "MRN-23456789", "outpatient", "",
+     {{"Medicine 3","500mg","tablet","tid"}, {"Medicine 2","10mg","tablet","bid"}},
+     "dispensing", "2024-01-21", "Test User", "test"},
+    {"RX-2024-102", "James Anderson", "MRN-11223344", "internal", "Ward-B-15",
+     {{"Medicine 8","500mg","tablet","tid"}},
+     "ready", "2024-01-22", "Test User", "test"},
+
+    // ---------------- Dr. John Smith ----------------
+    {"RX-2024-001", "Sarah Wilson", "MRN-78901234", "cardiology", "Ward-A-12",
+     {{"Medicine 2","10mg","tablet","tid"}},
+     "dispensing", "2024-01-16", "Dr. John Smith", "admin"},
+    {"RX-2024-002", "Michael Rodriguez", "MRN-56789012", "internal", "Ward-B-08",
+     {{"Medicine 5","100IU/ml","injection","bid"}},
+     "pending", "2024-01-16", "Dr. John Smith", "admin"},
+    {"RX-2024-009", "Robert Chen", "MRN-23456789", "outpatient", "",
+     {{"Medicine 3","500mg","tablet","tid"}},
+     "ready", "2024-01-15", "Dr. John Smith", "admin"},
+    // Multi-medication example
+    {"RX-2024-012", "James Anderson", "MRN-11223344", "internal", "Ward-B-15",
+     {{"Medicine 4","20mg","tablet","tid"}, {"Medicine 8","500mg","tablet","tid"}},
+    "pending", "2024-01-18", "Dr. John Smith", "admin"},
+
+    // ---------------- Dr. Sarah Johnson ----------------
+    {"RX-2024-006", "Lisa Williams", "MRN-12345678", "cardiology", "Ward-A-25",
+     {{"Medicine 7","5mg","tablet","tid"}},
+     "partially-dispensed", "2024-01-14", "Dr. Sarah Johnson", "doctor1"},
+    {"RX-2024-007", "James Anderson", "MRN-11223344", "internal", "Ward-B-15",
+     {{"Medicine 4","20mg","tablet","bid"}},
+     "dispensed", "2024-01-13", "Dr. Sarah Johnson", "doctor1"},
+    {"RX-2024-010", "Sarah Wilson", "MRN-78901234", "cardiology", "Ward-A-12",
+     {{"Medicine 8","81mg","tablet","tid"}}, // Aspirin replaced with Medicine 8 from the static list
+     "ready", "2024-01-16", "Dr. Sarah Johnson", "doctor1"},
+
+    // ---------------- Dr. Michael Chen ----------------
+    {"RX-2024-003", "Emma Thompson", "MRN-34567890", "emergency", "ER-03",
+     {{"Medicine 6","1mg/ml","injection","once"}},
+     "ready", "2024-01-16", "Dr. Michael Chen", "doctor2"},
+    {"RX-2024-008", "Maria Garcia", "MRN-55667788", "emergency", "ER-07",
+     {{"Medicine 9","250mg","tablet","once"}},
+      "dispensing", "2024-01-16", "Dr. Michael Chen", "doctor2"},
+    {"RX-2024-011", "Emma Thompson", "MRN-34567890", "emergency", "ER-03",
+     {{"Medicine 9","20mg","tablet","once"}}, // replaced with Medicine 8 to stay inside static 9
+    "pending", "2024-01-16", "Dr. Michael Chen", "doctor2"}
+  };
+
+  for (const auto& rx : samples) {
+    Prescriptions.append(rx);
+  }
+  Serial.printf("Seeded %d sample prescriptions\n", (int)samples.size());
+}
 
 long initial_homing=-1; // to make the direction go counterclockwise
 long maxSpeed = 5000.0; // max speed possible for stepper motor
@@ -225,19 +293,6 @@ long yMax = yLInitial_max; // identified max steps for y axis
 int row = 0; // variable for the row of a dispenser
 int column = 0; // variable for the column of a dispenser
 
-// Medication master list (1-9)
-const char* medicationList[9] = {
-  "Medicine 1",
-  "Medicine 2",
-  "Medicine 3",
-  "Medicine 4",
-  "Medicine 5",
-  "Medicine 6",
-  "Medicine 7",
-  "Medicine 8",
-  "Medicine 9"
-};
-
 const char* frequencyList[3] = {
   "once",
   "bid",
@@ -250,86 +305,21 @@ int getMedicationFrequency(const String& name) {
   }
   return 0;
 }
+// Medication ids and names come from the cabinet map (Cabinet_Map.h)
 int getMedicationIndex(const String& name) {
-  for (int i = 0; i < 9; ++i) {
-    if (name.equalsIgnoreCase(medicationList[i])) return i + 1;
-  }
-  return 0;
+  return Cabinets.drugByName(name.c_str());
 }
 String getMedicationName(int idx) {
-  if (idx >= 1 && idx <= 9) return String(medicationList[idx - 1]);
-  return "";
+  const char* name = (idx > 0 && idx <= CABINET_MAX_DRUGS) ? Cabinets.drugName(idx) : nullptr;
+  return name ? String(name) : "";
 }
 
 // Session utility functions
-String generateSessionToken() {
-  String token = "";
-  const char charset[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789";
-  for (int i = 0; i < 32; i++) {
-    token += charset[random(0, sizeof(charset) - 1)];
-  }
-  return token;
-}
-
 void cleanupExpiredSessions() {
-  unsigned long currentTime = millis();
-  auto it = activeSessions.begin();
-  while (it != activeSessions.end()) {
-    if (currentTime - it->second.lastAccessed > SESSION_TIMEOUT) {
-      Serial.printf("Cleaning up expired session: %s\n", it->first.c_str());
-      it = activeSessions.erase(it);
-    } else {
-      ++it;
-    }
-  }
-}
-
-bool validateSession(const String& token) {
-  if (token.isEmpty()) return false;
-  
-  auto it = activeSessions.find(token);
-  if (it != activeSessions.end()) {
-    unsigned long currentTime = millis();
-    if (currentTime - it->second.lastAccessed < SESSION_TIMEOUT) {
-      it->second.lastAccessed = currentTime; // Update last accessed time
-      return true;
-    } else {
-      activeSessions.erase(it); // Remove expired session
-    }
-  }
-  return false;
-}
-
-String getSessionToken(AsyncWebServerRequest *request) {
-  // Check for session token in cookies
-  if (request->hasHeader("Cookie")) {
-    String cookies = request->getHeader("Cookie")->value();
-    int tokenStart = cookies.indexOf("session_token=");
-    if (tokenStart != -1) {
-      tokenStart += 14; // Length of "session_token="
-      int tokenEnd = cookies.indexOf(";", tokenStart);
-      if (tokenEnd == -1) tokenEnd = cookies.length();
-      return cookies.substring(tokenStart, tokenEnd);
-    }
-  }
-  
-  // Check for Authorization header
-  if (request->hasHeader("Authorization")) {
-    String auth = request->getHeader("Authorization")->value();
-    if (auth.startsWith("Bearer ")) {
-      return auth.substring(7);
-    }
+  size_t removed = Sessions.expire(millis());
+  if (removed > 0) {
+    Serial.printf("Cleaned up %u expired sessions\n", (unsigned)removed);
   }
-  
-  return "";
-}
-
-String getCurrentUsername(const String& token) {
-  auto it = activeSessions.find(token);
-  if (it != activeSessions.end()) {
-    return it->second.username;
-  }
-  return "";
 }
 
 // Storage interface functions
@@ -338,26 +328,10 @@ bool initStorage() {
   int retries = 0;
   const int maxRetries = 100;
   while (retries < maxRetries) {
-    if (SD.begin(SD_CS_PIN)) {
-      uint8_t cardType = SD.cardType();
-      if (cardType != CARD_NONE) {
-        useSDCard = true;
-        storageType = "SD Card";
-        Serial.print("SD Card Type: ");
-        if (cardType == CARD_MMC) {
-          Serial.println("MMC");
-        } else if (cardType == CARD_SD) {
-          Serial.println("SDSC");
-        } else if (cardType == CARD_SDHC) {
-          Serial.println("SDHC");
-        } else {
-          Serial.println("UNKNOWN");
-        }
-        uint64_t cardSize = SD.cardSize() / (1024 * 1024);
-        Serial.printf("SD Card Size: %lluMB\n", cardSize);
-        Serial.println("SD Card mounted successfully");
-        return true;  
-      }
+    if (Storage.begin(STORAGE_SD, SD_CS_PIN)) {
+      useSDCard = true;
+      storageType = Storage.getStorageType();
+      return true;
     }
     Serial.println("SD Card not detected, retrying in 2 seconds...");
     delay(2000);
@@ -367,6 +341,23 @@ bool initStorage() {
   return false;
 }
 
+// Replaces the built-in 3x3 layout with CABINET_MAP_PATH when the card has one
+void loadCabinetMap() {
+  Cabinets.loadDefault();
+  if (!storageInitialized || !Storage.exists(CABINET_MAP_PATH)) {
+    Serial.println("Cabinet map: using the built-in 3x3 layout");
+    return;
+  }
+  String text = Storage.readFile(CABINET_MAP_PATH);
+  if (Cabinets.parse(text.c_str(), text.length())) {
+    Serial.printf("Cabinet map: %u slots, %u medications from %s\n", Cabinets.slotCount(), Cabinets.maxDrug(),
+                  CABINET_MAP_PATH);
+  } else {
+    Serial.printf("Cabinet map: %s line %u is invalid, using the built-in 3x3 layout\n", CABINET_MAP_PATH,
+                  (unsigned)Cabinets.errorLine());
+  }
+}
+
 bool fileExists(const char* path) {
   // Only SD card supported
   return SD.exists(path);
@@ -377,25 +368,50 @@ File openFile(const char* path, const char* mode = "r") {
   return SD.open(path, mode);
 }
 
+// Static assets are served pre-gzipped when the client accepts it and always
+// carry a strong ETag. Clients must revalidate (no-cache), but a matching
+// If-None-Match is answered with 304 from the asset table without SD access.
 void serveFile(AsyncWebServerRequest *request, const char* filename, const char* contentType) {
-  Serial.printf("[LOG] serveFile: Request for %s (%s)\n", filename, contentType);
-  if(fileExists(filename)) {
-    Serial.printf("[LOG] serveFile: Found %s, sending file.\n", filename);
-    request->send(SD, filename, contentType);
-  } else {
-    Serial.printf("[LOG] serveFile: %s not found in %s\n", filename, storageType.c_str());
-    request->send(404, "text/plain", String(filename) + " not found in " + storageType);
+  LOGD("serveFile: Request for %s (%s)", filename, contentType);
+  const AssetInfo* asset = Assets.lookup(filename);
+  if (!asset) {
+    LOGD("serveFile: %s not found in %s", filename, storageType.c_str());
+    sendResponse(request, 404, "text/plain", String(filename) + " not found in " + storageType);
+    return;
   }
+
+  bool acceptsGzip = request->hasHeader("Accept-Encoding") &&
+                     request->header("Accept-Encoding").indexOf("gzip") >= 0;
+  bool useGzip = asset->gzip.present && (acceptsGzip || !asset->plain.present);
+  const AssetVariant& variant = useGzip ? asset->gzip : asset->plain;
+
+  if (request->hasHeader("If-None-Match") && request->header("If-None-Match") == variant.etag) {
+    LOGD("serveFile: %s not modified.", filename);
+    AsyncWebServerResponse *response = request->beginResponse(304);
+    response->addHeader("ETag", variant.etag);
+    response->addHeader("Cache-Control", "private, no-cache");
+    response->addHeader("Vary", "Accept-Encoding");
+    sendResponse(request, response, 304, 0);
+    return;
+  }
+
+  String path = useGzip ? asset->path + ".gz" : asset->path;
+  LOGD("serveFile: Sending %s (%u bytes).", path.c_str(), (unsigned)variant.size);
+  // Body comes from the storage block cache, so hot assets are served from RAM
+  AsyncWebServerResponse *response = request->beginResponse(contentType, variant.size,
+    [path](uint8_t *buffer, size_t maxLen, size_t index) -> size_t {
+      return Storage.read(path, index, buffer, maxLen);
+    });
+  if (useGzip) response->addHeader("Content-Encoding", "gzip");
+  response->addHeader("ETag", variant.etag);
+  response->addHeader("Cache-Control", "private, no-cache");
+  response->addHeader("Vary", "Accept-Encoding");
+  sendResponse(request, response, 200, variant.size);
 }
 
 // Authentication function
-User* authenticateUser(const String& username, const String& password) {
-  for (auto& user : users) {
-    if (user.username == username && user.password == password) {
-      return &user;
-    }
-  }
-  return nullptr;
+const User* authenticateUser(const String& username, const String& password) {
+  return Users.authenticate(username, password);
 }
 
 void printHelp() {
@@ -417,6 +433,11 @@ void printHelp() {
   Serial.println("  clear, cls        - Clear screen");
   Serial.println("  reset             - Restart ESP32");
   Serial.println("  cleanup           - Clean expired sessions");
+  Serial.println("  hashcost [n]      - Show or set password hash iterations");
+  Serial.println("  jobs, dispense    - Show the dispense job queue");
+  Serial.println("  latency           - Show dispense order latency");
+  Serial.println("  metrics [reset]   - Show or reset web request metrics");
+  Serial.println("  log [level <0-4>] - Show log statistics or set the log level");
   Serial.println("  all, dump         - Dump all data");
   Serial.println("  notif <username>  - Show notifications for specific user");
 }
@@ -430,32 +451,48 @@ void printSystemStatus() {
   Serial.printf("Flash Size: %u bytes\n", ESP.getFlashChipSize());
   Serial.printf("Storage Type: %s\n", storageType.c_str());
   Serial.printf("Storage Initialized: %s\n", storageInitialized ? "YES" : "NO");
-  Serial.printf("Active Users: %d\n", users.size());
-  Serial.printf("Active Sessions: %d\n", activeSessions.size());
-  Serial.printf("Total Prescriptions: %d\n", prescriptions.size());
+  Serial.printf("Active Users: %u\n", (unsigned)Users.count());
+  Serial.printf("Active Sessions: %u\n", (unsigned)Sessions.count());
+  Serial.printf("Total Prescriptions: %u\n", Prescriptions.count());
   Serial.printf("Total Notifications: %d\n", notifications.size());
   Serial.printf("Total Patients: %d\n", patients.size());
+  const ESPFrameStats& link = comm.frameStats();
+  Serial.printf("Dispenser Link: %u frames, %u CRC errors, %u lost, %u overruns, %u text bytes dropped\n",
+                (unsigned)link.received, (unsigned)link.crcErrors, (unsigned)link.sequenceGaps, (unsigned)link.overruns,
+                (unsigned)link.textDropped);
+  Serial.printf("Dispenser TX: %u bytes queued, %u messages dropped\n", (unsigned)comm.txPending(), (unsigned)comm.txDropped());
+  Serial.printf("Dispense Jobs: %u unfinished\n", (unsigned)DispenseJobs.pending());
+}
+
+void printDispenseJobs() {
+  Serial.println("=== DISPENSE JOBS ===");
+  Serial.printf("Unfinished: %u of %u slots (%s)\n\n", (unsigned)DispenseJobs.pending(), (unsigned)DispenseJobs.capacity(),
+                DispenseJobs.isPersistent() ? "persistent" : "RAM only");
+
+  DispenseJob job;
+  for (size_t slot = 0; slot < DispenseJobs.capacity(); slot++) {
+    if (!DispenseJobs.copyAt(slot, job)) continue;
+    Serial.printf("Job %u: %s, prescription %s, %u/%u dispensed, %u sends\n", (unsigned)job.id,
+                  DispenseQueue::stateName(job.state), job.prescriptionId, job.dispensed, job.count, job.attempts);
+  }
 }
 
 void printUsers() {
   Serial.println("=== USER DATABASE ===");
-  Serial.printf("Total Users: %d\n\n", users.size());
+  Serial.printf("Total Users: %u (%s)\n\n", (unsigned)Users.count(), Users.isPersistent() ? "persistent" : "RAM only");
   
-  for (const auto& user : users) {
+  for (size_t i = 0; i < Users.count(); i++) {
+    const User& user = Users.at(i);
     Serial.printf("ID: %d\n", user.id);
     Serial.printf("  Username: %s\n", user.username.c_str());
-    Serial.printf("  Password: %s\n", user.password.c_str());
     Serial.printf("  Full Name: %s\n", user.fullName.c_str());
     Serial.printf("  Email: %s\n", user.email.c_str());
     Serial.printf("  License: %s\n", user.license.c_str());
     Serial.printf("  Department: %s\n", user.department.c_str());
     
     // Count prescriptions and notifications for this user
-    int prescriptionCount = 0;
+    int prescriptionCount = Prescriptions.countForUser(user.username);
     int notificationCount = 0;
-    for (const auto& rx : prescriptions) {
-      if (rx.prescribingUsername == user.username) prescriptionCount++;
-    }
     for (const auto& notif : notifications) {
       if (notif.assignedToUsername == user.username) notificationCount++;
     }
@@ -467,24 +504,27 @@ void printUsers() {
 
 void printActiveSessions() {
   Serial.println("=== ACTIVE SESSIONS ===");
-  Serial.printf("Total Active Sessions: %d\n", activeSessions.size());
+  Serial.printf("Total Active Sessions: %u of %u\n", (unsigned)Sessions.count(), (unsigned)Sessions.capacity());
   Serial.printf("Session Timeout: %lu ms (%lu minutes)\n", SESSION_TIMEOUT, SESSION_TIMEOUT / 60000);
   Serial.println();
   
-  if (activeSessions.empty()) {
+  if (Sessions.count() == 0) {
     Serial.println("No active sessions.");
     return;
   }
   
   unsigned long currentTime = millis();
-  for (const auto& pair : activeSessions) {
-    const Session& session = pair.second;
+  Session session;
+  char tokenText[SESSION_TOKEN_TEXT_LENGTH + 1];
+  for (size_t i = 0; i < Sessions.capacity(); i++) {
+    if (!Sessions.copyAt(i, session)) continue;
     unsigned long ageMs = currentTime - session.createdAt;
     unsigned long lastAccessMs = currentTime - session.lastAccessed;
+    formatSessionToken(session.token, tokenText);
     
-    Serial.printf("Token: %s\n", session.token.c_str());
-    Serial.printf("  Username: %s\n", session.username.c_str());
-    Serial.printf("  Full Name: %s\n", session.fullName.c_str());
+    Serial.printf("Token: %s\n", tokenText);
+    Serial.printf("  Username: %s\n", session.username);
+    Serial.printf("  Full Name: %s\n", session.fullName);
     Serial.printf("  Age: %lu seconds\n", ageMs / 1000);
     Serial.printf("  Last Access: %lu seconds ago\n", lastAccessMs / 1000);
     Serial.printf("  Expires in: %lu seconds\n", (SESSION_TIMEOUT - lastAccessMs) / 1000);
@@ -494,14 +534,16 @@ void printActiveSessions() {
 
 void printPrescriptions() {
   Serial.println("=== PRESCRIPTIONS DATABASE ===");
-  Serial.printf("Total Prescriptions: %d\n\n", prescriptions.size());
+  Serial.printf("Total Prescriptions: %u\n\n", Prescriptions.count());
   
-  if (prescriptions.empty()) {
+  if (Prescriptions.count() == 0) {
     Serial.println("No prescriptions found.");
     return;
   }
   
-  for (const auto& rx : prescriptions) {
+  Prescription rx;
+  for (uint16_t recNo = 0; recNo < Prescriptions.slots(); recNo++) {
+    if (!Prescriptions.read(recNo, rx)) continue;
     Serial.printf("ID: %s\n", rx.id.c_str());
     Serial.printf("  Patient: %s (MRN: %s)\n", rx.patientName.c_str(), rx.patientMRN.c_str());
     Serial.printf("  Ward: %s, Bed: %s\n", rx.ward.c_str(), rx.bedNumber.c_str());
@@ -606,8 +648,14 @@ void printMedications() {
   Serial.println("=== MEDICATION MASTER LIST ===");
   Serial.println("Available Medications:");
   
-  for (int i = 0; i < 9; i++) {
-    Serial.printf("  %d. %s\n", i+1, medicationList[i]);
+  for (int id = 1; id <= Cabinets.maxDrug(); id++) {
+    const char* name = Cabinets.drugName(id);
+    if (!name) continue;
+    Serial.printf("  %d. %s (cabinet", id, name);
+    for (uint8_t slot = Cabinets.firstSlot(id); slot; slot = Cabinets.nextSlot(slot)) {
+      Serial.printf(" %u", slot);
+    }
+    Serial.println(")");
   }
   Serial.println();
 }
@@ -618,6 +666,13 @@ void printStorageInfo() {
   Serial.printf("Storage Initialized: %s\n", storageInitialized ? "YES" : "NO");
   Serial.printf("Using SD Card: %s\n", useSDCard ? "YES" : "NO");
   Serial.printf("SD CS Pin: %d\n", SD_CS_PIN);
+
+  StorageCacheStats cache = Storage.getCacheStats();
+  uint32_t lookups = cache.hits + cache.misses;
+  Serial.printf("Block Cache: %u/%u blocks used, %u bytes in %s\n",
+                cache.blocksUsed, cache.blockCount, (unsigned)cache.bytes, cache.psram ? "PSRAM" : "internal RAM");
+  Serial.printf("Cache Hits: %u, Misses: %u, Evictions: %u (hit rate %.1f%%)\n",
+                cache.hits, cache.misses, cache.evictions, lookups ? 100.0 * cache.hits / lookups : 0.0);
   
   if (useSDCard && storageInitialized) {
     uint64_t cardSize = SD.cardSize() / (1024 * 1024);
@@ -651,16 +706,16 @@ void printMemoryInfo() {
   Serial.printf("Free PSRAM: %u bytes\n", ESP.getFreePsram());
   
   // Calculate approximate memory usage by data structures
-  size_t userMemory = users.size() * sizeof(User);
-  size_t sessionMemory = activeSessions.size() * sizeof(Session);
-  size_t prescriptionMemory = prescriptions.size() * sizeof(Prescription);
+  size_t userMemory = Users.indexBytes();
+  size_t sessionMemory = Sessions.memoryBytes();
+  size_t prescriptionMemory = Prescriptions.indexBytes();
   size_t patientMemory = patients.size() * sizeof(Patient);
   size_t notificationMemory = notifications.size() * sizeof(Notification);
   
   Serial.println("\nApproximate Data Structure Memory Usage:");
-  Serial.printf("  Users: %u bytes (%d entries)\n", userMemory, users.size());
-  Serial.printf("  Sessions: %u bytes (%d entries)\n", sessionMemory, activeSessions.size());
-  Serial.printf("  Prescriptions: %u bytes (%d entries)\n", prescriptionMemory, prescriptions.size());
+  Serial.printf("  Users: %u bytes (%u entries)\n", userMemory, (unsigned)Users.count());
+  Serial.printf("  Sessions: %u bytes fixed (%u entries)\n", sessionMemory, (unsigned)Sessions.count());
+  Serial.printf("  Prescriptions: %u bytes index (%u entries on %s)\n", prescriptionMemory, Prescriptions.count(), storageType.c_str());
   Serial.printf("  Patients: %u bytes (%d entries)\n", patientMemory, patients.size());
   Serial.printf("  Notifications: %u bytes (%d entries)\n", notificationMemory, notifications.size());
   Serial.printf("  Total Data: ~%u bytes\n", 
@@ -680,31 +735,30 @@ void printWiFiInfo() {
 void printPrescriptionDetails(String rxId) {
   Serial.printf("=== PRESCRIPTION DETAILS: %s ===\n", rxId.c_str());
   
-  bool found = false;
-  for (const auto& rx : prescriptions) {
-    if (rx.id.equalsIgnoreCase(rxId)) {
-      found = true;
-      Serial.printf("Prescription ID: %s\n", rx.id.c_str());
-      Serial.printf("Patient Name: %s\n", rx.patientName.c_str());
-      Serial.printf("Patient MRN: %s\n", rx.patientMRN.c_str());
-      Serial.printf("Ward: %s\n", rx.ward.c_str());
-      Serial.printf("Bed Number: %s\n", rx.bedNumber.c_str());
-      Serial.printf("Status: %s\n", rx.status.c_str());
-      Serial.printf("Date: %s\n", rx.date.c_str());
-      Serial.printf("Prescribing Physician: %s (%s)\n", rx.prescribingPhysician.c_str(), rx.prescribingUsername.c_str());
+  Prescription rx;
+  String upperId = rxId;
+  upperId.toUpperCase();
+  bool found = Prescriptions.findById(rxId, rx) || Prescriptions.findById(upperId, rx);
+  if (found) {
+    Serial.printf("Prescription ID: %s\n", rx.id.c_str());
+    Serial.printf("Patient Name: %s\n", rx.patientName.c_str());
+    Serial.printf("Patient MRN: %s\n", rx.patientMRN.c_str());
+    Serial.printf("Ward: %s\n", rx.ward.c_str());
+    Serial.printf("Bed Number: %s\n", rx.bedNumber.c_str());
+    Serial.printf("Status: %s\n", rx.status.c_str());
+    Serial.printf("Date: %s\n", rx.date.c_str());
+    Serial.printf("Prescribing Physician: %s (%s)\n", rx.prescribingPhysician.c_str(), rx.prescribingUsername.c_str());
 
-      
-      
-      Serial.printf("\nMedications (%d):\n", rx.medications.size());
-      for (size_t i = 0; i < rx.medications.size(); i++) {
-        const auto& med = rx.medications[i];
-        Serial.printf("  %d. (%d) Medication: %s\n", (int)i+1, getMedicationIndex(med.medicationName), med.medicationName.c_str());
-        Serial.printf("     Strength: %s\n", med.strength.c_str());
-        Serial.printf("     Dosage Form: %s\n", med.dosageForm.c_str());
-        Serial.printf("     Frequency: %s\n", med.frequency.c_str());
-        Serial.println();
-      }
-      break;
+    
+    
+    Serial.printf("\nMedications (%d):\n", rx.medications.size());
+    for (size_t i = 0; i < rx.medications.size(); i++) {
+      const auto& med = rx.medications[i];
+      Serial.printf("  %d. (%d) Medication: %s\n", (int)i+1, getMedicationIndex(med.medicationName), med.medicationName.c_str());
+      Serial.printf("     Strength: %s\n", med.strength.c_str());
+      Serial.printf("     Dosage Form: %s\n", med.dosageForm.c_str());
+      Serial.printf("     Frequency: %s\n", med.frequency.c_str());
+      Serial.println();
     }
   }
   
@@ -717,24 +771,21 @@ void printUserDetails(String username) {
   Serial.printf("=== USER DETAILS: %s ===\n", username.c_str());
   
   bool found = false;
-  for (const auto& user : users) {
+  for (size_t i = 0; i < Users.count(); i++) {
+    const User& user = Users.at(i);
     if (user.username.equalsIgnoreCase(username)) {
       found = true;
       Serial.printf("User ID: %d\n", user.id);
       Serial.printf("Username: %s\n", user.username.c_str());
-      Serial.printf("Password: %s\n", user.password.c_str());
       Serial.printf("Full Name: %s\n", user.fullName.c_str());
       Serial.printf("Email: %s\n", user.email.c_str());
       Serial.printf("License: %s\n", user.license.c_str());
       Serial.printf("Department: %s\n", user.department.c_str());
       
       // Count prescriptions and notifications for this user
-      int prescriptionCount = 0;
+      int prescriptionCount = Prescriptions.countForUser(user.username);
       int notificationCount = 0;
       int unreadNotifications = 0;
-      for (const auto& rx : prescriptions) {
-        if (rx.prescribingUsername == user.username) prescriptionCount++;
-      }
       for (const auto& notif : notifications) {
         if (notif.assignedToUsername == user.username) {
           notificationCount++;
@@ -747,12 +798,15 @@ void printUserDetails(String username) {
       // Check if user has active sessions
       Serial.println("\nActive Sessions:");
       bool hasSession = false;
-      for (const auto& pair : activeSessions) {
-        if (pair.second.username.equalsIgnoreCase(username)) {
+      Session session;
+      char tokenText[SESSION_TOKEN_TEXT_LENGTH + 1];
+      for (size_t s = 0; s < Sessions.capacity(); s++) {
+        if (Sessions.copyAt(s, session) && username.equalsIgnoreCase(session.username)) {
           hasSession = true;
-          Serial.printf("  Token: %s\n", pair.second.token.c_str());
-          Serial.printf("  Created: %lu seconds ago\n", (millis() - pair.second.createdAt) / 1000);
-          Serial.printf("  Last Access: %lu seconds ago\n", (millis() - pair.second.lastAccessed) / 1000);
+          formatSessionToken(session.token, tokenText);
+          Serial.printf("  Token: %s\n", tokenText);
+          Serial.printf("  Created: %lu seconds ago\n", (millis() - session.createdAt) / 1000);
+          Serial.printf("  Last Access: %lu seconds ago\n", (millis() - session.lastAccessed) / 1000);
         }
       }
       if (!hasSession) {
@@ -770,16 +824,16 @@ void printUserDetails(String username) {
 void printSessionDetails(String token) {
   Serial.printf("=== SESSION DETAILS: %s ===\n", token.c_str());
   
-  auto it = activeSessions.find(token);
-  if (it != activeSessions.end()) {
-    const Session& session = it->second;
+  SessionToken key;
+  Session session;
+  if (parseSessionToken(token.c_str(), token.length(), key) && Sessions.get(key, session)) {
     unsigned long currentTime = millis();
     unsigned long ageMs = currentTime - session.createdAt;
     unsigned long lastAccessMs = currentTime - session.lastAccessed;
     
-    Serial.printf("Token: %s\n", session.token.c_str());
-    Serial.printf("Username: %s\n", session.username.c_str());
-    Serial.printf("Full Name: %s\n", session.fullName.c_str());
+    Serial.printf("Token: %s\n", token.c_str());
+    Serial.printf("Username: %s\n", session.username);
+    Serial.printf("Full Name: %s\n", session.fullName);
     Serial.printf("Created At: %lu ms (system time)\n", session.createdAt);
     Serial.printf("Last Accessed: %lu ms (system time)\n", session.lastAccessed);
     Serial.printf("Session Age: %lu seconds\n", ageMs / 1000);
@@ -904,6 +958,7 @@ void handleSerialCommand(String command) {
   }
   else if (command == "reset") {
     Serial.println("Restarting ESP32 in 3 seconds...");
+    Log.flush();
     delay(3000);
     ESP.restart();
   }
@@ -911,6 +966,43 @@ void handleSerialCommand(String command) {
     cleanupExpiredSessions();
     Serial.println("Session cleanup completed.");
   }
+  else if (command == "hashcost" || command.startsWith("hashcost ")) {
+    // Tune PBKDF2 cost; existing accounts pick it up on their next login
+    String value = command.substring(8);
+    value.trim();
+    if (value.length() > 0) Users.setIterations(value.toInt());
+    Serial.printf("Password hash: %u iterations, %lu ms per login\n",
+                  (unsigned)Users.iterations(), Users.measureHashMillis());
+  }
+  else if (command == "jobs" || command == "dispense") {
+    printDispenseJobs();
+  }
+  else if (command == "latency") {
+    handoffLatency.print("Web handler to comm task", "us");
+    acceptLatency.print("POST to dispenser ACK", "ms");
+    Serial.printf("Hand-off queue: %u of %u in use\n", (unsigned)dispenseHandoff.count(),
+                  (unsigned)dispenseHandoff.capacity());
+  }
+  else if (command == "metrics") {
+    Metrics.sampleHeap();
+    Metrics.printSummary(Serial);
+  }
+  else if (command == "metrics reset") {
+    Metrics.reset();
+    Storage.resetCacheStats();
+    Serial.println("Web request metrics reset.");
+  }
+  else if (command == "log" || command.startsWith("log level")) {
+    String value = command.substring(9);
+    value.trim();
+    if (value.length() > 0) Log.setLevel(value.toInt());
+    LogStats stats = Log.getStats();
+    Serial.printf("Log level: %s (compiled up to %s)\n", AsyncLog::levelName(Log.getLevel()),
+                  AsyncLog::levelName(LOG_LEVEL));
+    Serial.printf("Lines: %lu written, %u queued, %lu dropped, %lu rate limited\n", (unsigned long)stats.written,
+                  (unsigned)Log.pending(), (unsigned long)stats.dropped, (unsigned long)stats.suppressed);
+    if (Log.mirroring()) Serial.printf("Log file: %s, %lu bytes\n", LOG_FILE_PATH, (unsigned long)stats.fileBytes);
+  }
   else if (command == "all" || command == "dump") {
     printAllData();
   } else {
@@ -921,20 +1013,202 @@ void handleSerialCommand(String command) {
   Serial.println();
 }
 
-void SendDispenseRequest(byte setUID[4], int medications[3], int frequency[3]) {
-  String payload = "DISPENSE";
-  // for (int i = 0; i < 4; i++) {
-  //   if (i > 0) payload += ",";
-  //   payload += String(setUID[i], HEX);
-  // }
-  payload += "|";
-  for (int i = 0; i < rx.medications.size(); i++) {
-    if (i > 0) payload += ",";
-    payload += "M"+ String(medications[i]);
-    payload += ":";
-    payload += String(frequency[i]);
-  }
-  comm.send(payload);// Sample : DISPENSE|M1:1,M2:2,M3:3
+static bool handOff(DispenseHandoff& handoff) {
+  handoff.postedAt = micros();
+  if (!dispenseHandoff.push(handoff)) return false;
+  if (commTask) xTaskNotifyGive(commTask);
+  return true;
+}
+
+// Hands the order to the comm task, which queues it with DispenseJobs; the
+// queue sends it and retries until the dispenser acknowledges it. Returns
+// false if the hand-off queue is full. Web handlers only (single producer).
+bool SendDispenseRequest(const String& prescriptionId, uint16_t prescriptionRecord, int medications[], int frequency[],
+                         size_t count) {
+  DispenseHandoff handoff = {};
+  strlcpy(handoff.order.prescriptionId, prescriptionId.c_str(), sizeof(handoff.order.prescriptionId));
+  handoff.prescriptionRecord = prescriptionRecord;
+  handoff.order.count = (uint8_t)min(count, (size_t)DISPENSE_MAX_ITEMS);
+  for (size_t i = 0; i < handoff.order.count; i++) {
+    handoff.order.medication[i] = (uint8_t)constrain(medications[i], 0, 255);
+    handoff.order.quantity[i] = (uint8_t)constrain(frequency[i], 0, 255);
+  }
+  if (!handOff(handoff)) {
+    LOGW("Dispense request dropped, comm task is not keeping up");
+    return false;
+  }
+  return true;
+}
+
+// Asks the comm task to cancel a prescription. It goes through the same
+// queue as orders, so it cannot overtake its own order; the comm task marks
+// the prescription cancelled only if nothing will be dispensed for it.
+// Returns false if the hand-off queue is full. Web handlers only.
+bool CancelDispenseRequest(const String& prescriptionId, uint16_t prescriptionRecord) {
+  DispenseHandoff handoff = {};
+  strlcpy(handoff.order.prescriptionId, prescriptionId.c_str(), sizeof(handoff.order.prescriptionId));
+  handoff.prescriptionRecord = prescriptionRecord;
+  handoff.cancel = true;
+  return handOff(handoff);
+}
+
+// Comm task: cancels a prescription if its order can still be pulled back.
+// A job that is sent or further along stays, and so does the status, which
+// onDispenseStateChange keeps following.
+static void takeDispenseCancel(const DispenseHandoff& handoff) {
+  const char* prescriptionId = handoff.order.prescriptionId;
+  DispenseState state = DispenseJobs.cancel(handoff.prescriptionRecord);
+  bool cancelled = state == DISPENSE_CANCELLED;
+  if (state == DISPENSE_EMPTY || state == DISPENSE_FAILED) {
+    // No job, or one the dispenser gave up on: nothing to pull back as long
+    // as nothing was dispensed
+    Prescription rx;
+    cancelled = Prescriptions.read(handoff.prescriptionRecord, rx) && rx.id == prescriptionId &&
+                (rx.status.equalsIgnoreCase("pending") || rx.status.equalsIgnoreCase("failed"));
+  }
+  if (!cancelled) {
+    LOGW("Prescription %s not cancelled, dispense job is %s", prescriptionId, DispenseQueue::stateName(state));
+    return;
+  }
+  if (!Prescriptions.updateStatusAt(handoff.prescriptionRecord, prescriptionId, "cancelled")) {
+    LOGW("Failed to save cancellation of prescription %s", prescriptionId);
+    return;
+  }
+  LOGI("Prescription %s cancelled", prescriptionId);
+}
+
+// Comm task: turns a handed-off request into a dispense job
+void takeDispenseHandoff(const DispenseHandoff& handoff) {
+  handoffLatency.add(micros() - handoff.postedAt);
+  if (handoff.cancel) {
+    takeDispenseCancel(handoff);
+    return;
+  }
+
+  int medications[DISPENSE_MAX_ITEMS];
+  int quantities[DISPENSE_MAX_ITEMS];
+  for (size_t i = 0; i < handoff.order.count; i++) {
+    medications[i] = handoff.order.medication[i];
+    quantities[i] = handoff.order.quantity[i];
+  }
+  uint32_t jobId = DispenseJobs.enqueue(handoff.order.prescriptionId, handoff.prescriptionRecord, medications,
+                                       quantities, handoff.order.count);
+  if (jobId == 0) {
+    LOGW("Dispense request dropped, dispense queue full");
+    Prescriptions.updateStatusAt(handoff.prescriptionRecord, handoff.order.prescriptionId, "failed");
+    return;
+  }
+  LOGI("Dispense job %u queued for prescription %s", (unsigned)jobId, handoff.order.prescriptionId);
+
+  uint32_t age = (micros() - handoff.postedAt) / 1000;
+  pendingAccepts[nextPendingAccept] = {jobId, (uint32_t)(millis() - age)};
+  nextPendingAccept = (nextPendingAccept + 1) % DISPENSE_BATCH_MAX_ORDERS;
+}
+
+// Mirrors dispenser progress into the status of the prescription the order
+// was placed from. Prescription ids are only unique per physician, so the
+// record number picks the right one; a cancelled prescription stays cancelled.
+void onDispenseStateChange(const DispenseJob& job) {
+  LOGI("Dispense job %u (%s): %s, %u/%u dispensed", (unsigned)job.id, job.prescriptionId,
+       DispenseQueue::stateName(job.state), job.dispensed, job.count);
+  const char* status = nullptr;
+  switch (job.state) {
+    case DISPENSE_ACCEPTED:
+      for (PendingAccept& pending : pendingAccepts) {
+        if (pending.job != job.id) continue;
+        acceptLatency.add(millis() - pending.postedAt);
+        pending.job = 0;
+      }
+      status = "dispensing";
+      break;
+    case DISPENSE_DONE:
+      status = "ready";
+      break;
+    case DISPENSE_FAILED:
+      status = job.dispensed > 0 ? "partially-dispensed" : "failed";
+      break;
+    default:
+      break;
+  }
+  if (!status) return;
+  if (job.prescriptionRecord == DISPENSE_NO_RECORD) {
+    LOGW("Dispense job %u has no prescription record, status not updated", (unsigned)job.id);
+  } else if (!Prescriptions.updateStatusAt(job.prescriptionRecord, job.prescriptionId, status)) {
+    LOGD("Prescription %s not moved to %s (cancelled or gone)", job.prescriptionId, status);
+  }
+}
+
+// Wakes the comm task as soon as the dispenser sends something
+void onDispenserData() {
+  if (commTask) xTaskNotifyGive(commTask);
+}
+
+void commTaskMain(void* arg) {
+  for (;;) {
+    DispenseHandoff handoff;
+    while (dispenseHandoff.pop(handoff)) {
+      takeDispenseHandoff(handoff);
+    }
+
+    // Everything the dispenser has sent, not just one line per wake-up
+    bool received;
+    do {
+      comm.update();
+      received = false;
+      if (comm.available()) {
+        String msg = comm.read();
+        // Dispense replies are logged by onDispenseStateChange
+        if (!DispenseJobs.handleMessage(msg)) {
+          LOGI("Received via Comm: %s", msg.c_str());
+        }
+        received = true;
+      } else if (comm.frameAvailable()) {
+        // Binary frames have no consumer yet; drain them so text keeps flowing
+        ESPFrame frame;
+        comm.readFrame(frame);
+        LOGD("Received frame via Comm: type 0x%02X, seq %u, %u bytes", frame.type, frame.seq, frame.length);
+        received = true;
+      }
+    } while (received);
+
+    comm.handleAutoPing();
+    DispenseJobs.update(millis());
+    Metrics.observeUartQueue(comm.txPending());
+
+    uint32_t sleep = min(DispenseJobs.nextDueIn(millis()), (uint32_t)COMM_TASK_MAX_SLEEP);
+    ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(sleep));
+  }
+}
+
+void consoleTaskMain(void* arg) {
+  String serialBuffer;
+  uint32_t lastHeapSample = 0;
+  for (;;) {
+    dnsServer.processNextRequest();
+
+    if (millis() - lastHeapSample >= METRICS_HEAP_PERIOD) {
+      Metrics.sampleHeap();
+      lastHeapSample = millis();
+    }
+
+    // Advance the session timing wheel; only does work when a tick is due
+    cleanupExpiredSessions();
+
+    // Serial command parser
+    while (Serial.available()) {
+      char c = Serial.read();
+      if (c == '\n' || c == '\r') {
+        if (serialBuffer.length() > 0) {
+          handleSerialCommand(serialBuffer);
+          serialBuffer = "";
+        }
+      } else if (isAscii(c)) {
+        serialBuffer += c;
+      }
+    }
+
+    vTaskDelay(pdMS_TO_TICKS(CONSOLE_TASK_PERIOD));
+  }
 }
 
 
@@ -944,16 +1218,44 @@ void setup() {
   Serial.println("ESP32 Started");
 
   comm.begin(115200); // RX, TX
+  comm.setFramedText(COMM_FRAMED_TEXT);
+  comm.setNonBlocking(true); // sends are queued and written by a background task
   comm.enableAutoPing(30000); // Auto ping every 30 seconds
 
-  // Initialize random seed
-  randomSeed(analogRead(0));
-
   // Initialize storage (SD Card with SPIFFS fallback)
   storageInitialized = initStorage();
   if(!storageInitialized) {
     Serial.println("Failed to initialize any storage. Web server will not serve files.");
+  } else if (Prescriptions.begin(Storage)) {
+    seedSamplePrescriptions();
+  } else {
+    Serial.println("Failed to open prescription store. Prescriptions will not be saved.");
   }
+
+  // Log lines are written out by a background task from here on
+#ifdef LOG_TO_SD
+  if (Storage.getCurrentStorage() == STORAGE_SD) Log.mirrorToFile(Storage, LOG_FILE_PATH, LOG_FILE_LIMIT);
+#endif
+  Log.begin(Serial);
+
+  Assets.begin(Storage);
+  loadCabinetMap();
+
+  // Accounts fall back to RAM when storage is missing
+  Users.begin(Storage);
+  seedSampleUsers();
+  Sessions.begin(SESSION_TIMEOUT);
+
+  // Unfinished dispense jobs from before a reset are sent again
+  DispenseJobs.begin(Storage, comm);
+  DispenseJobs.onStateChange(onDispenseStateChange);
+
+  // The comm task owns the UART link and the dispense queue from here on
+  if (xTaskCreatePinnedToCore(commTaskMain, "comm", COMM_TASK_STACK, nullptr, COMM_TASK_PRIORITY, &commTask,
+                              COMM_TASK_CORE) != pdPASS) {
+    Serial.println("Failed to start the comm task. Dispense orders will not be sent.");
+  }
+  Serial2.onReceive(onDispenserData);
 // RFID reader initialization
 //   SPI.begin(HSPI_SCK, HSPI_MISO, HSPI_MOSI, SS_PIN); // Start SPI bus
 //   hspi.begin(HSPI_SCK, HSPI_MISO, HSPI_MOSI, SS_PIN);
@@ -986,147 +1288,143 @@ void setup() {
   DefaultHeaders::Instance().addHeader("Access-Control-Allow-Headers", "Content-Type, Authorization");
 
   // Handle OPTIONS requests for CORS
-  webServer.onNotFound([](AsyncWebServerRequest *request) {
-    Serial.printf("[LOG] onNotFound: %s %s\n", (request->method() == HTTP_OPTIONS ? "OPTIONS" : "NOTFOUND"), request->url().c_str());
+  Metrics.onNotFound(webServer, [](AsyncWebServerRequest *request) {
+    LOGD("onNotFound: %s %s", (request->method() == HTTP_OPTIONS ? "OPTIONS" : "NOTFOUND"), request->url().c_str());
     if (request->method() == HTTP_OPTIONS) {
-      request->send(200);
-      Serial.println("[LOG] Sent CORS preflight response.");
+      sendResponse(request, 200);
+      LOGD("Sent CORS preflight response.");
       return;
     }
-    Serial.print("Request for: ");
-    Serial.println(request->url());
     
     // For captive portal, redirect to login page
     if (!request->url().startsWith("/api/")) {
       String redirectURL = "http://PharmaAssist.com/login.html";
-      request->redirect(redirectURL);
+      sendRedirect(request, redirectURL);
     } else {
-      request->send(404, "text/plain", "Not Found");
+      sendResponse(request, 404, "text/plain", "Not Found");
     }
   });
 
   // Root route - redirect to login or main page based on session
-  webServer.on("/", HTTP_GET, [](AsyncWebServerRequest *request) {
-    Serial.printf("[LOG] GET /\n");
+  Metrics.on(webServer, "/", HTTP_GET, [](AsyncWebServerRequest *request) {
+    LOGD("GET /");
     if(!storageInitialized) {
-      request->send(500, "text/plain", String("Storage (") + storageType + ") not initialized");
+      sendResponse(request, 500, "text/plain", String("Storage (") + storageType + ") not initialized");
       return;
     }
     
-    String token = getSessionToken(request);
+    SessionToken token = getSessionToken(request);
     if (validateSession(token)) {
-      Serial.println("[LOG] Valid session, redirecting to /index.html");
+      LOGD("Valid session, redirecting to /index.html");
       String redirectURL = "http://" + WiFi.softAPIP().toString() + "/index.html";
-      request->redirect(redirectURL);
+      sendRedirect(request, redirectURL);
     } else {
-      Serial.println("[LOG] No valid session, redirecting to /login.html");
+      LOGD("No valid session, redirecting to /login.html");
       String redirectURL = "http://" + WiFi.softAPIP().toString() + "/login.html";
-      request->redirect(redirectURL);
+      sendRedirect(request, redirectURL);
     }
   });
 
   // Login page (public)
-  webServer.on("/login.html", HTTP_GET, [](AsyncWebServerRequest *request) {
-    Serial.println("[LOG] GET /login.html");
+  Metrics.on(webServer, "/login.html", HTTP_GET, [](AsyncWebServerRequest *request) {
+    LOGD("GET /login.html");
     if(!storageInitialized) {
-      request->send(500, "text/plain", String("Storage (") + storageType + ") not initialized");
+      sendResponse(request, 500, "text/plain", String("Storage (") + storageType + ") not initialized");
       return;
     }
     serveFile(request, "/login.html", "text/html");
   });
 
   // CSS file (public)
-  webServer.on("/login-styles.css", HTTP_GET, [](AsyncWebServerRequest *request) {
-    Serial.println("[LOG] GET /login-styles.css");
+  Metrics.on(webServer, "/login-styles.css", HTTP_GET, [](AsyncWebServerRequest *request) {
+    LOGD("GET /login-styles.css");
     if(!storageInitialized) {
-      request->send(500, "text/plain", String("Storage (") + storageType + ") not initialized");
+      sendResponse(request, 500, "text/plain", String("Storage (") + storageType + ") not initialized");
       return;
     }
     serveFile(request, "/login-styles.css", "text/css");
   });
 
   // JavaScript file (public)
-  webServer.on("/login-script.js", HTTP_GET, [](AsyncWebServerRequest *request) {
-    Serial.println("[LOG] GET /login-script.js");
+  Metrics.on(webServer, "/login-script.js", HTTP_GET, [](AsyncWebServerRequest *request) {
+    LOGD("GET /login-script.js");
     if(!storageInitialized) {
-      request->send(500, "text/plain", String("Storage (") + storageType + ") not initialized");
+      sendResponse(request, 500, "text/plain", String("Storage (") + storageType + ") not initialized");
       return;
     }
     serveFile(request, "/login-script.js", "application/javascript");
   });
 
   // Protected routes - require valid session
-  webServer.on("/index.html", HTTP_GET, [](AsyncWebServerRequest *request) {
-    Serial.println("[LOG] GET /index.html");
+  Metrics.on(webServer, "/index.html", HTTP_GET, [](AsyncWebServerRequest *request) {
+    LOGD("GET /index.html");
     if(!storageInitialized) {
-      request->send(500, "text/plain", String("Storage (") + storageType + ") not initialized");
+      sendResponse(request, 500, "text/plain", String("Storage (") + storageType + ") not initialized");
       return;
     }
     
-    String token = getSessionToken(request);
+    SessionToken token = getSessionToken(request);
     if (!validateSession(token)) {
-      Serial.println("[LOG] Unauthorized access to /index.html, redirecting to /login.html");
+      LOGD("Unauthorized access to /index.html, redirecting to /login.html");
       String redirectURL = "http://" + WiFi.softAPIP().toString() + "/login.html";
-      request->redirect(redirectURL);
+      sendRedirect(request, redirectURL);
       return;
     }
     
-    Serial.println("[LOG] Authorized access to /index.html, serving file.");
+    LOGD("Authorized access to /index.html, serving file.");
     serveFile(request, "/index.html", "text/html");
   });
 
-  webServer.on("/styles.css", HTTP_GET, [](AsyncWebServerRequest *request) {
-    Serial.println("[LOG] GET /styles.css");
+  Metrics.on(webServer, "/styles.css", HTTP_GET, [](AsyncWebServerRequest *request) {
+    LOGD("GET /styles.css");
     if(!storageInitialized) {
-      request->send(500, "text/plain", String("Storage (") + storageType + ") not initialized");
+      sendResponse(request, 500, "text/plain", String("Storage (") + storageType + ") not initialized");
       return;
     }
     
-    String token = getSessionToken(request);
+    SessionToken token = getSessionToken(request);
     if (!validateSession(token)) {
-      Serial.println("[LOG] Unauthorized access to /styles.css");
-      request->send(401, "text/plain", "Unauthorized");
+      LOGD("Unauthorized access to /styles.css");
+      sendResponse(request, 401, "text/plain", "Unauthorized");
       return;
     }
     
-    Serial.println("[LOG] Authorized access to /styles.css, serving file.");
+    LOGD("Authorized access to /styles.css, serving file.");
     serveFile(request, "/styles.css", "text/css");
   });
 
-  webServer.on("/script.js", HTTP_GET, [](AsyncWebServerRequest *request) {
-    Serial.println("[LOG] GET /script.js");
+  Metrics.on(webServer, "/script.js", HTTP_GET, [](AsyncWebServerRequest *request) {
+    LOGD("GET /script.js");
     if(!storageInitialized) {
-      request->send(500, "text/plain", String("Storage (") + storageType + ") not initialized");
+      sendResponse(request, 500, "text/plain", String("Storage (") + storageType + ") not initialized");
       return;
     }
     
-    String token = getSessionToken(request);
+    SessionToken token = getSessionToken(request);
     if (!validateSession(token)) {
-      Serial.println("[LOG] Unauthorized access to /script.js");
-      request->send(401, "text/plain", "Unauthorized");
+      LOGD("Unauthorized access to /script.js");
+      sendResponse(request, 401, "text/plain", "Unauthorized");
       return;
     }
     
-    Serial.println("[LOG] Authorized access to /script.js, serving file.");
+    LOGD("Authorized access to /script.js, serving file.");
     serveFile(request, "/script.js", "application/javascript");
   });
 
   // Authentication endpoint
-  webServer.on("/api/login", HTTP_POST, [](AsyncWebServerRequest *request) {
-    Serial.println("[LOG] POST /api/login (headers received)");
+  Metrics.on(webServer, "/api/login", HTTP_POST, [](AsyncWebServerRequest *request) {
+    LOGD("POST /api/login (headers received)");
     }, NULL, [](AsyncWebServerRequest *request, uint8_t *data, size_t len, size_t index, size_t total) {
-    Serial.println("[LOG] POST /api/login (body received)");
+    LOGD("POST /api/login (body received)");
     String body = String((char*)data).substring(0, len);
-    Serial.printf("[LOG] Received body: %s\n", body.c_str());
-    Serial.printf("[DEBUG] Body length: %u, Index: %u, Total: %u\n", (unsigned)len, (unsigned)index, (unsigned)total);
+    LOGD("Body length: %u, Index: %u, Total: %u", (unsigned)len, (unsigned)index, (unsigned)total);
     
     JsonDocument doc;
     DeserializationError error = deserializeJson(doc, body);
     
     if (error) {
-      Serial.println("[LOG] JSON parsing failed");
-      Serial.printf("[DEBUG] JSON error: %s\n", error.c_str());
-      request->send(400, "application/json", "{\"success\":false,\"message\":\"Invalid JSON\"}");
+      LOGW("Login JSON parsing failed: %s", error.c_str());
+      sendResponse(request, 400, "application/json", "{\"success\":false,\"message\":\"Invalid JSON\"}");
       return;
     }
     
@@ -1136,50 +1434,39 @@ void setup() {
     String password = doc["password"].as<String>();
 
     if (type != "username" && type != "email") {
-      Serial.println("[LOG] Invalid login type");
-      request->send(400, "application/json", "{\"success\":false,\"message\":\"Invalid login type\"}");
+      LOGW("Invalid login type");
+      sendResponse(request, 400, "application/json", "{\"success\":false,\"message\":\"Invalid login type\"}");
       return;
     } else {
-      Serial.printf("[LOG] Login type: %s\n", type.c_str());
+      LOGD("Login type: %s", type.c_str());
     }
 
-    User* user = nullptr;
+    const User* user = nullptr;
     if (type == "username") {
       username = doc["username"].as<String>();
-      Serial.println("[LOG] Processing login by username");
-      Serial.printf("[DEBUG] Parsed username: %s\n", username.c_str());
-      Serial.printf("[DEBUG] Parsed password: %s\n", password.c_str());
-      Serial.printf("[LOG] Login attempt - User: %s, Pass: %s\n", username.c_str(), password.c_str());
+      LOGD("Processing login by username");
+      LOGD("Login attempt - User: %s", username.c_str());
       user = authenticateUser(username, password);
     } else {
       email = doc["email"].as<String>();
-      Serial.println("[LOG] Processing login by email");
-      Serial.printf("[DEBUG] Parsed email: %s\n", email.c_str());
-      Serial.printf("[DEBUG] Parsed password: %s\n", password.c_str());
-      Serial.printf("[LOG] Login attempt - Email: %s, Pass: %s\n", email.c_str(), password.c_str());
-      // Find user by email
-      for (auto& u : users) {
-        if (u.email.equalsIgnoreCase(email) && u.password == password) {
-          user = &u;
-          username = u.username;
-          break;
-        }
-      }
+      LOGD("Processing login by email");
+      LOGD("Login attempt - Email: %s", email.c_str());
+      user = Users.authenticateEmail(email, password);
+      if (user != nullptr) username = user->username;
     }
     if (user != nullptr) {
-      Serial.printf("[LOG] Authentication successful for %s\n", user->fullName.c_str());
-      Serial.printf("[DEBUG] User struct: username=%s, email=%s, fullName=%s\n", user->username.c_str(), user->email.c_str(), user->fullName.c_str());
+      LOGI("Authentication successful for %s", user->fullName.c_str());
+      LOGD("User struct: username=%s, email=%s, fullName=%s", user->username.c_str(), user->email.c_str(), user->fullName.c_str());
       // Create new session
-      String sessionToken = generateSessionToken();
-      Serial.printf("[LOG] Session generated: %s for user: %s\n", sessionToken.c_str(), user->username.c_str());
-      Session newSession;
-      newSession.token = sessionToken;
-      newSession.username = user->username;
-      newSession.fullName = user->fullName;
-      newSession.createdAt = millis();
-      newSession.lastAccessed = millis();
-      
-      activeSessions[sessionToken] = newSession;
+      SessionToken token;
+      generateSessionToken(token);
+      if (!Sessions.create(token, user->username.c_str(), user->fullName.c_str())) {
+        sendResponse(request, 503, "application/json", "{\"success\":false,\"message\":\"Could not create session\"}");
+        return;
+      }
+      char sessionToken[SESSION_TOKEN_TEXT_LENGTH + 1];
+      formatSessionToken(token, sessionToken);
+      LOGD("Session generated for user: %s", user->username.c_str());
       
       // Send success response with session info
       JsonDocument response;
@@ -1196,244 +1483,264 @@ void setup() {
       
       // Set session cookie
       AsyncWebServerResponse* resp = request->beginResponse(200, "application/json", responseStr);
-      resp->addHeader("Set-Cookie", "session_token=" + sessionToken + "; Path=/; Max-Age=3600");
-      request->send(resp);
+      resp->addHeader("Set-Cookie", String("session_token=") + sessionToken + "; Path=/; Max-Age=3600");
+      sendResponse(request, resp, 200, responseStr.length());
       
-      Serial.printf("[LOG] Sending authentication success response for %s\n", user->fullName.c_str());
+      LOGD("Sending authentication success response for %s", user->fullName.c_str());
     } else {
-      Serial.println("[LOG] Authentication failed");
-      Serial.println("[DEBUG] No matching user found for given credentials.");
-      request->send(401, "application/json", "{\"success\":false,\"message\":\"Invalid credentials\"}");
+      LOGW("Authentication failed");
+      LOGD("No matching user found for given credentials.");
+      sendResponse(request, 401, "application/json", "{\"success\":false,\"message\":\"Invalid credentials\"}");
     }
   });
 
   // Session validation endpoint
-  webServer.on("/api/validate-session", HTTP_GET, [](AsyncWebServerRequest *request) {
-    Serial.println("[LOG] GET /api/validate-session");
-    String token = getSessionToken(request);
+  Metrics.on(webServer, "/api/validate-session", HTTP_GET, [](AsyncWebServerRequest *request) {
+    LOGD("GET /api/validate-session");
+    SessionToken token = getSessionToken(request);
     
     if (validateSession(token)) {
-      Serial.println("[LOG] Session valid");
-      auto it = activeSessions.find(token);
-      if (it != activeSessions.end()) {
+      LOGD("Session valid");
+      Session session;
+      if (Sessions.get(token, session)) {
         JsonDocument response;
         response["valid"] = true;
-        response["username"] = it->second.username;
-        response["fullName"] = it->second.fullName;
+        response["username"] = session.username;
+        response["fullName"] = session.fullName;
         
         String responseStr;
         serializeJson(response, responseStr);
-        request->send(200, "application/json", responseStr);
+        sendResponse(request, 200, "application/json", responseStr);
       } else {
-        request->send(200, "application/json", "{\"valid\":false}");
+        sendResponse(request, 200, "application/json", "{\"valid\":false}");
       }
     } else {
-      Serial.println("[LOG] Session invalid");
-      request->send(200, "application/json", "{\"valid\":false}");
+      LOGD("Session invalid");
+      sendResponse(request, 200, "application/json", "{\"valid\":false}");
     }
   });
 
   // Logout endpoint
-  webServer.on("/api/logout", HTTP_POST, [](AsyncWebServerRequest *request) {
-    Serial.println("[LOG] POST /api/logout");
-    String token = getSessionToken(request);
+  Metrics.on(webServer, "/api/logout", HTTP_POST, [](AsyncWebServerRequest *request) {
+    LOGD("POST /api/logout");
+    SessionToken token = getSessionToken(request);
     
-    if (!token.isEmpty()) {
-      auto it = activeSessions.find(token);
-      if (it != activeSessions.end()) {
-        Serial.printf("[LOG] Logging out user: %s\n", it->second.fullName.c_str());
-        activeSessions.erase(it);
-      }
+    Session session;
+    if (Sessions.get(token, session) && Sessions.remove(token)) {
+      LOGI("Logging out user: %s", session.fullName);
     }
     
-    Serial.println("[LOG] Sending logout response");
+    LOGD("Sending logout response");
     // Clear session cookie
-    AsyncWebServerResponse* resp = request->beginResponse(200, "application/json", "{\"success\":true,\"message\":\"Logged out successfully\"}");
+    static const char body[] = "{\"success\":true,\"message\":\"Logged out successfully\"}";
+    AsyncWebServerResponse* resp = request->beginResponse(200, "application/json", body);
     resp->addHeader("Set-Cookie", "session_token=; Path=/; Max-Age=0");
-    request->send(resp);
+    sendResponse(request, resp, 200, sizeof(body) - 1);
   });
 
   // Session info endpoint (protected)
-  webServer.on("/api/session-info", HTTP_GET, [](AsyncWebServerRequest *request) {
-    Serial.println("[LOG] GET /api/session-info");
-    String token = getSessionToken(request);
+  Metrics.on(webServer, "/api/session-info", HTTP_GET, [](AsyncWebServerRequest *request) {
+    LOGD("GET /api/session-info");
+    SessionToken token = getSessionToken(request);
     
     if (!validateSession(token)) {
-      Serial.println("[LOG] Unauthorized session-info request");
-      request->send(401, "application/json", "{\"error\":\"Unauthorized\"}");
+      LOGD("Unauthorized session-info request");
+      sendResponse(request, 401, "application/json", "{\"error\":\"Unauthorized\"}");
       return;
     }
     
-    auto it = activeSessions.find(token);
-    if (it != activeSessions.end()) {
-      Serial.printf("[LOG] Session info for user: %s\n", it->second.fullName.c_str());
+    Session session;
+    if (Sessions.get(token, session)) {
+      LOGD("Session info for user: %s", session.fullName);
       JsonDocument response;
-      response["username"] = it->second.username;
-      response["fullName"] = it->second.fullName;
-      response["sessionAge"] = (millis() - it->second.createdAt) / 1000; // in seconds
-      response["activeSessions"] = activeSessions.size();
+      response["username"] = session.username;
+      response["fullName"] = session.fullName;
+      response["sessionAge"] = (millis() - session.createdAt) / 1000; // in seconds
+      response["activeSessions"] = Sessions.count();
       
       String responseStr;
       serializeJson(response, responseStr);
-      request->send(200, "application/json", responseStr);
+      sendResponse(request, 200, "application/json", responseStr);
     } else {
-      Serial.println("[LOG] Session not found");
-      request->send(401, "application/json", "{\"error\":\"Session not found\"}");
+      LOGD("Session not found");
+      sendResponse(request, 401, "application/json", "{\"error\":\"Session not found\"}");
     }
   });
 
   // Handle favicon requests
-  webServer.on("/favicon.ico", HTTP_GET, [](AsyncWebServerRequest *request) {
-    Serial.println("[LOG] GET /favicon.ico");
+  Metrics.on(webServer, "/favicon.ico", HTTP_GET, [](AsyncWebServerRequest *request) {
+    LOGD("GET /favicon.ico");
     if(!storageInitialized) {
-      request->send(404, "text/plain", "Storage not available");
+      sendResponse(request, 404, "text/plain", "Storage not available");
       return;
     }
     serveFile(request, "/favicon.ico", "image/x-icon");
   });
 
   // Prescription submission endpoint
-  webServer.on("/api/prescription", HTTP_POST, [](AsyncWebServerRequest *request) {
-    Serial.println("[LOG] POST /api/prescription (headers received)");
-    String token = getSessionToken(request);
+  Metrics.on(webServer, "/api/prescription", HTTP_POST, [](AsyncWebServerRequest *request) {
+    LOGD("POST /api/prescription (headers received)");
+    SessionToken token = getSessionToken(request);
     if (!validateSession(token)) {
-      request->send(401, "application/json", "{\"success\":false,\"message\":\"Unauthorized\"}");
+      sendResponse(request, 401, "application/json", "{\"success\":false,\"message\":\"Unauthorized\"}");
       return;
     }
 }, NULL, [](AsyncWebServerRequest *request, uint8_t *data, size_t len, size_t index, size_t total) {
+  // The body arrives before the request handler above runs, so the session
+  // is checked here too. Without one the body is dropped unread and the
+  // request handler answers 401.
   static String bodyBuffer;
-  if (index == 0) bodyBuffer = "";
+  static bool bodyAuthorized = false;
+  if (index == 0) {
+    bodyBuffer = "";
+    bodyAuthorized = validateSession(getSessionToken(request));
+  }
+  if (!bodyAuthorized) return;
   bodyBuffer += String((char*)data).substring(0, len);
   if (index + len == total) {
-    Serial.println("[LOG] POST /api/prescription (body received, final chunk)");
-    Serial.printf("[LOG] Received prescription body: %s\n", bodyBuffer.c_str());
-
-    String token = getSessionToken(request);
+    LOGD("POST /api/prescription (body received, final chunk)");
+    // Size only: the body carries patient details
+    LOGD("Received prescription body: %u bytes", (unsigned)bodyBuffer.length());
+
+    // The session may have ended while the body was arriving
+    SessionToken token = getSessionToken(request);
+    bodyAuthorized = validateSession(token);
+    if (!bodyAuthorized) return;
     String currentUsername = getCurrentUsername(token);
 
-    JsonDocument doc;
-    DeserializationError error = deserializeJson(doc, bodyBuffer);
-    if (error) {
-      Serial.println("[LOG] JSON parsing failed for prescription");
-      request->send(400, "application/json", "{\"success\":false,\"message\":\"Invalid JSON\"}");
+    Prescription rx;
+    if (!parsePrescriptionJson(bodyBuffer.c_str(), bodyBuffer.length(), rx)) {
+      LOGW("JSON parsing failed for prescription");
+      sendResponse(request, 400, "application/json", "{\"success\":false,\"message\":\"Invalid JSON\"}");
       return;
     }
-
-    Prescription rx;
-    rx.id = doc["id"] | "";
-    rx.patientName = doc["patientName"] | "";
-    rx.patientMRN = doc["patientMRN"] | "";
-    rx.ward = doc["ward"] | "";
-    rx.bedNumber = doc["bedNumber"] | "";
-    rx.status = doc["status"] | "pending";
-    rx.date = doc["date"] | "";
-    rx.prescribingPhysician = doc["prescribingPhysician"] | "";
     rx.prescribingUsername = currentUsername;
 
-    // Parse medications array (frontend format)
-    if (doc["medications"].is<JsonArray>()) {
-      JsonArray medsArr = doc["medications"].as<JsonArray>();
-      for (JsonVariant v : medsArr) {
-        JsonObject med = v.as<JsonObject>();
-        Medication m;
-        m.medicationName = med["medicationName"] | "";
-        m.strength = med["strength"] | "";
-        m.dosageForm = med["dosageForm"] | "";
-        m.frequency = med["frequency"] | "";
-        rx.medications.push_back(m);
-      }
+    // A resubmitted form must not become a second order
+    Prescription existing;
+    if (Prescriptions.findById(rx.id, existing, currentUsername)) {
+      LOGW("Prescription %s already exists", rx.id.c_str());
+      sendResponse(request, 409, "application/json", "{\"success\":false,\"message\":\"Prescription already submitted\"}");
+      return;
     }
 
-    prescriptions.push_back(rx);
-    Serial.printf("[LOG] Prescription saved by %s. Total prescriptions: %d\n", currentUsername.c_str(), (int)prescriptions.size());
-
-    // Dispense logic (if needed)
-    int medications[rx.medications.size()];
-    int frequency[rx.medications.size()];
-    byte setUID[4] = {0x06, 0x7F, 0xC0, 0x04};
+    // One dispense order per prescription: 1 to DISPENSE_MAX_ITEMS medications,
+    // each with a cabinet, or the dispenser cannot fill it
+    static_assert(DISPENSE_MAX_ITEMS <= RX_STORE_MAX_MEDICATIONS, "stored prescriptions must hold a whole order");
+    if (rx.medications.empty() || rx.medications.size() > DISPENSE_MAX_ITEMS) {
+      LOGW("Prescription %s has %u medications", rx.id.c_str(), (unsigned)rx.medications.size());
+      sendResponse(request, 400, "application/json",
+                   "{\"success\":false,\"message\":\"A prescription needs 1 to 3 medications\"}");
+      return;
+    }
+    int medications[DISPENSE_MAX_ITEMS];
+    int frequency[DISPENSE_MAX_ITEMS];
     for (size_t i = 0; i < rx.medications.size(); i++) {
       medications[i] = getMedicationIndex(rx.medications[i].medicationName);
       frequency[i] = getMedicationFrequency(rx.medications[i].frequency);
-      Serial.printf("Medication %d: %s, Frequency: %d\n", (int)i+1, rx.medications[i].medicationName.c_str(), frequency[i]);
+      LOGD("Medication %d: %s, Frequency: %d", (int)i+1, rx.medications[i].medicationName.c_str(), frequency[i]);
+      if (medications[i] == 0) {
+        LOGW("Prescription %s names an unknown medication", rx.id.c_str());
+        sendResponse(request, 400, "application/json", "{\"success\":false,\"message\":\"Unknown medication\"}");
+        return;
+      }
+    }
+
+    uint16_t recNo;
+    if (!Prescriptions.append(rx, &recNo)) {
+      LOGW("Failed to store prescription");
+      sendResponse(request, 500, "application/json", "{\"success\":false,\"message\":\"Failed to save prescription\"}");
+      return;
+    }
+    LOGI("Prescription saved by %s. Total prescriptions: %u", currentUsername.c_str(), Prescriptions.count());
+
+    LOGD("Demo-dispensing medications for Doctor A");
+    if (!SendDispenseRequest(rx.id, recNo, medications, frequency, rx.medications.size())) {
+      Prescriptions.updateStatusAt(recNo, rx.id, "failed");
+      sendResponse(request, 503, "application/json",
+                   "{\"success\":false,\"message\":\"Dispenser busy, prescription saved but not sent\"}");
+      return;
     }
-    Serial.println("[LOG] Demo-dispensing medications for Doctor A");
-    SendDispenseRequest(setUID, medications, frequency);
-    
 
-    request->send(200, "application/json", "{\"success\":true,\"message\":\"Prescription received and saved.\"}");
+    sendResponse(request, 200, "application/json", "{\"success\":true,\"message\":\"Prescription received and saved.\"}");
   }
 });
 
   // Logging endpoint: POST /api/log
-  webServer.on("/api/log", HTTP_POST, [](AsyncWebServerRequest *request) {
+  Metrics.on(webServer, "/api/log", HTTP_POST, [](AsyncWebServerRequest *request) {
     // No headers to process
   }, NULL, [](AsyncWebServerRequest *request, uint8_t *data, size_t len, size_t index, size_t total) {
-    Serial.println("[LOG] POST /api/log (body received)");
+    LOGD("POST /api/log (body received)");
     String body = String((char*)data).substring(0, len);
     JsonDocument doc;
     DeserializationError error = deserializeJson(doc, body);
     if (error) {
-      Serial.println("[LOG] /api/log: Invalid JSON");
-      request->send(400, "application/json", "{\"success\":false,\"message\":\"Invalid JSON\"}");
+      LOGW("/api/log: Invalid JSON");
+      sendResponse(request, 400, "application/json", "{\"success\":false,\"message\":\"Invalid JSON\"}");
       return;
     }
     String context = doc["context"] | "unknown";
     String details = doc["details"].isNull() ? "" : doc["details"].as<String>();
-    Serial.printf("[CLIENT LOG] %s : %s\n", context.c_str(), details.c_str());
-    request->send(200, "application/json", "{\"success\":true}");
+    LOGI("Client %s: %s", context.c_str(), details.c_str());
+    sendResponse(request, 200, "application/json", "{\"success\":true}");
   });
 
   // --- API: Register ---
-  webServer.on("/api/register", HTTP_POST, [](AsyncWebServerRequest *request) {
+  Metrics.on(webServer, "/api/register", HTTP_POST, [](AsyncWebServerRequest *request) {
     // No headers to process
   }, NULL, [](AsyncWebServerRequest *request, uint8_t *data, size_t len, size_t index, size_t total) {
     String body = String((char*)data).substring(0, len);
     JsonDocument doc;
     DeserializationError error = deserializeJson(doc, body);
     if (error) {
-      request->send(400, "application/json", "{\"success\":false,\"message\":\"Invalid JSON\"}");
+      sendResponse(request, 400, "application/json", "{\"success\":false,\"message\":\"Invalid JSON\"}");
       return;
     }
     String email = doc["email"] | "";
     String password = doc["password"] | "";
     if (email.isEmpty() || password.isEmpty()) {
-      request->send(400, "application/json", "{\"success\":false,\"message\":\"Missing email or password\"}");
+      sendResponse(request, 400, "application/json", "{\"success\":false,\"message\":\"Missing email or password\"}");
       return;
     }
     // Extract username from email
     String username = email;
     int atIndex = username.indexOf('@');
     if (atIndex > 0) username = username.substring(0, atIndex);
+    if (username.length() >= USER_STORE_USERNAME_SIZE || email.length() >= USER_STORE_EMAIL_SIZE) {
+      sendResponse(request, 400, "application/json", "{\"success\":false,\"message\":\"Email address too long\"}");
+      return;
+    }
 
     // Check if user exists
-    for (const auto& user : users) {
-      if (user.username == username) {
-        request->send(409, "application/json", "{\"success\":false,\"message\":\"User already exists\"}");
-        return;
-      }
+    if (Users.exists(username) || Users.findByEmail(email) != nullptr) {
+      sendResponse(request, 409, "application/json", "{\"success\":false,\"message\":\"User already exists\"}");
+      return;
     }
     // Create new user with empty data (newly registered accounts should be empty)
     User newUser;
-    newUser.id = users.size() + 1;
+    newUser.id = 0; // next free id
     newUser.username = username;
-    newUser.password = password;
     newUser.fullName = username;
     newUser.email = email;
     newUser.license = "MD-NEW";
     newUser.department = "General Practice";
-    users.push_back(newUser);
+    if (!Users.add(newUser, password)) {
+      // Lost a race for the same name, or the store is full
+      sendResponse(request, 409, "application/json", "{\"success\":false,\"message\":\"Could not create account\"}");
+      return;
+    }
     
-    Serial.printf("[LOG] New user registered: %s (%s)\n", username.c_str(), email.c_str());
+    LOGI("New user registered: %s (%s)", username.c_str(), email.c_str());
 
     // Create session
-    String sessionToken = generateSessionToken();
-    Session newSession;
-    newSession.token = sessionToken;
-    newSession.username = newUser.username;
-    newSession.fullName = newUser.fullName;
-    newSession.createdAt = millis();
-    newSession.lastAccessed = millis();
-    activeSessions[sessionToken] = newSession;
+    SessionToken token;
+    generateSessionToken(token);
+    if (!Sessions.create(token, newUser.username.c_str(), newUser.fullName.c_str())) {
+      sendResponse(request, 503, "application/json", "{\"success\":false,\"message\":\"Could not create session\"}");
+      return;
+    }
+    char sessionToken[SESSION_TOKEN_TEXT_LENGTH + 1];
+    formatSessionToken(token, sessionToken);
 
     JsonDocument response;
     response["success"] = true;
@@ -1447,88 +1754,77 @@ void setup() {
     serializeJson(response, responseStr);
 
     AsyncWebServerResponse* resp = request->beginResponse(200, "application/json", responseStr);
-    resp->addHeader("Set-Cookie", "session_token=" + sessionToken + "; Path=/; Max-Age=3600");
-    request->send(resp);
+    resp->addHeader("Set-Cookie", String("session_token=") + sessionToken + "; Path=/; Max-Age=3600");
+    sendResponse(request, resp, 200, responseStr.length());
   });
 
   // --- API: Prescriptions (filtered by current user) ---
-  webServer.on("/api/prescriptions", HTTP_GET, [](AsyncWebServerRequest *request) {
-    String token = getSessionToken(request);
+  Metrics.on(webServer, "/api/prescriptions", HTTP_GET, [](AsyncWebServerRequest *request) {
+    SessionToken token = getSessionToken(request);
     if (!validateSession(token)) {
-      request->send(401, "application/json", "{\"error\":\"Unauthorized\"}");
+      sendResponse(request, 401, "application/json", "{\"error\":\"Unauthorized\"}");
       return;
     }
     
     String currentUsername = getCurrentUsername(token);
-    
-    JsonDocument doc;
-    JsonArray arr = doc["data"].to<JsonArray>();
-    
-    // Only return prescriptions for the current user
-    for (const auto& rx : prescriptions) {
-      if (rx.prescribingUsername == currentUsername) {
-        JsonObject o = arr.add<JsonObject>();
-        o["id"] = rx.id;
-        o["patientName"] = rx.patientName;
-        o["patientMRN"] = rx.patientMRN;
-        o["ward"] = rx.ward;
-        o["bedNumber"] = rx.bedNumber;
-        o["status"] = rx.status;
-        o["date"] = rx.date;
-        o["prescribingPhysician"] = rx.prescribingPhysician;
-        // Only send first medication for summary
-        if (!rx.medications.empty()) {
-          o["medicationName"] = rx.medications[0].medicationName;
-          o["strength"] = rx.medications[0].strength;
-          o["dosageForm"] = rx.medications[0].dosageForm;
-          o["frequency"] = rx.medications[0].frequency;
-        }
+
+    // Optional query: limit, cursor, status (comma separated), patientMRN, from/to (YYYY-MM-DD)
+    PrescriptionQuery query;
+    uint16_t limit = 0;
+    uint16_t start = Prescriptions.latestForUser(currentUsername);
+
+    if (request->hasParam("limit")) {
+      long value = request->getParam("limit")->value().toInt();
+      limit = value < 0 ? 0 : (value > 500 ? 500 : value);
+    }
+    if (request->hasParam("cursor")) {
+      long cursor = request->getParam("cursor")->value().toInt();
+      // Cursors are record numbers; only accept ones on this user's chain
+      if (cursor < 0 || cursor >= RX_STORE_NO_RECORD || !Prescriptions.belongsTo(cursor, currentUsername)) {
+        sendResponse(request, 400, "application/json", "{\"error\":\"Invalid cursor\"}");
+        return;
       }
+      start = cursor;
     }
-    doc["success"] = true;
-    String out;
-    serializeJson(doc, out);
-    request->send(200, "application/json", out);
+    if (request->hasParam("status")) {
+      query.statusMask = PrescriptionStore::statusMask(request->getParam("status")->value());
+    }
+    if (request->hasParam("patientMRN")) {
+      query.patientMRN = request->getParam("patientMRN")->value();
+    }
+    if (request->hasParam("from")) {
+      query.fromDay = PrescriptionStore::dayNumber(request->getParam("from")->value().c_str());
+    }
+    if (request->hasParam("to")) {
+      query.toDay = PrescriptionStore::dayNumber(request->getParam("to")->value().c_str());
+    }
+
+    LOGD("Listing prescriptions for %s (limit %u, status mask 0x%02x)",
+         currentUsername.c_str(), limit, query.statusMask);
+
+    // Only return prescriptions for the current user (newest first)
+    sendJsonArrayStream(request, new PrescriptionListSource(start, query, limit));
   });
 
   // --- API: Notifications (filtered by current user) ---
-  webServer.on("/api/notifications", HTTP_GET, [](AsyncWebServerRequest *request) {
-    String token = getSessionToken(request);
+  Metrics.on(webServer, "/api/notifications", HTTP_GET, [](AsyncWebServerRequest *request) {
+    SessionToken token = getSessionToken(request);
     if (!validateSession(token)) {
-      request->send(401, "application/json", "{\"error\":\"Unauthorized\"}");
+      sendResponse(request, 401, "application/json", "{\"error\":\"Unauthorized\"}");
       return;
     }
     
     String currentUsername = getCurrentUsername(token);
     
-    JsonDocument doc;
-    JsonArray arr = doc["data"].to<JsonArray>();
-    
     // Only return notifications for the current user
-    for (const auto& n : notifications) {
-      if (n.assignedToUsername == currentUsername) {
-        JsonObject o = arr.add<JsonObject>();
-        o["id"] = n.id;
-        o["title"] = n.title;
-        o["content"] = n.content;
-        o["type"] = n.type;
-        o["time"] = n.time;
-        o["read"] = n.read;
-        o["actionRequired"] = n.actionRequired;
-        o["relatedOrderId"] = n.relatedOrderId;
-      }
-    }
-    doc["success"] = true;
-    String out;
-    serializeJson(doc, out);
-    request->send(200, "application/json", out);
+    sendJsonArrayStream(request, new NotificationListSource(notifications, currentUsername));
   });
 
   // --- API: Mark notification as read ---
-  webServer.on("^\\/api\\/notifications\\/([\\w\\-]+)/read$", HTTP_POST, [](AsyncWebServerRequest *request) {
-    String token = getSessionToken(request);
+  Metrics.on(webServer, "^\\/api\\/notifications\\/([\\w\\-]+)/read$", HTTP_POST, [](AsyncWebServerRequest *request) {
+    SessionToken token = getSessionToken(request);
     if (!validateSession(token)) {
-      request->send(401, "application/json", "{\"error\":\"Unauthorized\"}");
+      sendResponse(request, 401, "application/json", "{\"error\":\"Unauthorized\"}");
       return;
     }
     
@@ -1541,14 +1837,14 @@ void setup() {
         break;
       }
     }
-    request->send(200, "application/json", "{\"success\":true}");
+    sendResponse(request, 200, "application/json", "{\"success\":true}");
   });
 
   // --- API: Mark all notifications as read ---
-  webServer.on("/api/notifications/mark-all-read", HTTP_POST, [](AsyncWebServerRequest *request) {
-    String token = getSessionToken(request);
+  Metrics.on(webServer, "/api/notifications/mark-all-read", HTTP_POST, [](AsyncWebServerRequest *request) {
+    SessionToken token = getSessionToken(request);
     if (!validateSession(token)) {
-      request->send(401, "application/json", "{\"error\":\"Unauthorized\"}");
+      sendResponse(request, 401, "application/json", "{\"error\":\"Unauthorized\"}");
       return;
     }
     
@@ -1559,14 +1855,14 @@ void setup() {
         n.read = true;
       }
     }
-    request->send(200, "application/json", "{\"success\":true}");
+    sendResponse(request, 200, "application/json", "{\"success\":true}");
   });
 
   // --- API: Patients ---
-  webServer.on("/api/patients", HTTP_GET, [](AsyncWebServerRequest *request) {
-    String token = getSessionToken(request);
+  Metrics.on(webServer, "/api/patients", HTTP_GET, [](AsyncWebServerRequest *request) {
+    SessionToken token = getSessionToken(request);
     if (!validateSession(token)) {
-      request->send(401, "application/json", "{\"error\":\"Unauthorized\"}");
+      sendResponse(request, 401, "application/json", "{\"error\":\"Unauthorized\"}");
       return;
     }
     
@@ -1582,48 +1878,94 @@ void setup() {
     doc["success"] = true;
     String out;
     serializeJson(doc, out);
-    request->send(200, "application/json", out);
+    sendResponse(request, 200, "application/json", out);
+  });
+
+  // Medications the cabinet map knows, for the order form
+  Metrics.on(webServer, "/api/medications", HTTP_GET, [](AsyncWebServerRequest *request) {
+    SessionToken token = getSessionToken(request);
+    if (!validateSession(token)) {
+      sendResponse(request, 401, "application/json", "{\"error\":\"Unauthorized\"}");
+      return;
+    }
+
+    JsonDocument doc;
+    JsonArray arr = doc["data"].to<JsonArray>();
+    for (unsigned drug = 1; drug <= Cabinets.maxDrug(); drug++) {
+      const char* name = Cabinets.drugName(drug);
+      if (!name) continue;
+      JsonObject o = arr.add<JsonObject>();
+      o["id"] = drug;
+      o["name"] = name;
+    }
+    doc["success"] = true;
+    String out;
+    serializeJson(doc, out);
+    sendResponse(request, 200, "application/json", out);
   });
 
   // --- API: Prescription actions (collect/cancel) ---
-  webServer.on("^\\/api\\/prescriptions\\/([\\w\\-]+)/collect$", HTTP_POST, [](AsyncWebServerRequest *request) {
-    String token = getSessionToken(request);
+  Metrics.on(webServer, "^\\/api\\/prescriptions\\/([\\w\\-]+)/collect$", HTTP_POST, [](AsyncWebServerRequest *request) {
+    SessionToken token = getSessionToken(request);
     if (!validateSession(token)) {
-      request->send(401, "application/json", "{\"error\":\"Unauthorized\"}");
+      sendResponse(request, 401, "application/json", "{\"error\":\"Unauthorized\"}");
       return;
     }
     
     String currentUsername = getCurrentUsername(token);
     String rxId = request->pathArg(0);
     
-    for (auto& rx : prescriptions) {
-      if (rx.id == rxId && rx.prescribingUsername == currentUsername) {
-        rx.status = "dispensed";
-        Serial.printf("[LOG] Prescription %s marked as collected by %s\n", rxId.c_str(), currentUsername.c_str());
-        break;
-      }
+    if (Prescriptions.updateStatus(rxId, "dispensed", currentUsername)) {
+      LOGI("Prescription %s marked as collected by %s", rxId.c_str(), currentUsername.c_str());
     }
-    request->send(200, "application/json", "{\"success\":true}");
+    sendResponse(request, 200, "application/json", "{\"success\":true}");
   });
   
-  webServer.on("^\\/api\\/prescriptions\\/([\\w\\-]+)/cancel$", HTTP_POST, [](AsyncWebServerRequest *request) {
-    String token = getSessionToken(request);
+  Metrics.on(webServer, "^\\/api\\/prescriptions\\/([\\w\\-]+)/cancel$", HTTP_POST, [](AsyncWebServerRequest *request) {
+    SessionToken token = getSessionToken(request);
     if (!validateSession(token)) {
-      request->send(401, "application/json", "{\"error\":\"Unauthorized\"}");
+      sendResponse(request, 401, "application/json", "{\"error\":\"Unauthorized\"}");
       return;
     }
     
     String currentUsername = getCurrentUsername(token);
     String rxId = request->pathArg(0);
-    
-    for (auto& rx : prescriptions) {
-      if (rx.id == rxId && rx.prescribingUsername == currentUsername) {
-        rx.status = "cancelled";
-        Serial.printf("[LOG] Prescription %s cancelled by %s\n", rxId.c_str(), currentUsername.c_str());
-        break;
-      }
+
+    Prescription rx;
+    uint16_t recNo;
+    if (!Prescriptions.findById(rxId, rx, currentUsername, &recNo)) {
+      sendResponse(request, 404, "application/json", "{\"success\":false,\"message\":\"Prescription not found\"}");
+      return;
+    }
+    if (rx.status.equalsIgnoreCase("cancelled")) {
+      sendResponse(request, 200, "application/json", "{\"success\":true}");
+      return;
     }
-    request->send(200, "application/json", "{\"success\":true}");
+
+    // Only orders the dispenser has not accepted can be pulled back. Whether
+    // this one still can is up to the comm task, which owns the dispense
+    // queue, so the answer is 202 and the status shows the outcome.
+    if (!rx.status.equalsIgnoreCase("pending") && !rx.status.equalsIgnoreCase("failed")) {
+      sendResponse(request, 409, "application/json",
+                   "{\"success\":false,\"message\":\"Already sent to the dispenser\"}");
+      return;
+    }
+    if (!CancelDispenseRequest(rxId, recNo)) {
+      sendResponse(request, 503, "application/json", "{\"success\":false,\"message\":\"Busy, try again\"}");
+      return;
+    }
+    LOGI("Cancel of prescription %s requested by %s", rxId.c_str(), currentUsername.c_str());
+    sendResponse(request, 202, "application/json", "{\"success\":true,\"message\":\"Cancel requested\"}");
+  });
+
+  // --- API: Runtime metrics (Prometheus text format) ---
+  Metrics.on(webServer, "/api/metrics", HTTP_GET, [](AsyncWebServerRequest *request) {
+    SessionToken token = getSessionToken(request);
+    if (!validateSession(token)) {
+      sendResponse(request, 401, "application/json", "{\"error\":\"Unauthorized\"}");
+      return;
+    }
+    sendMetrics(request);
   });
 
   webServer.begin();
@@ -1631,19 +1973,16 @@ void setup() {
   Serial.printf("Using %s for file storage\n", storageType.c_str());
   Serial.print("Access the web interface at: http://");
   Serial.println(WiFi.softAPIP());
-  Serial.println("\nSample user accounts:");
-  for (const auto& user : users) {
+  Serial.println("\nUser accounts:");
+  for (size_t i = 0; i < Users.count(); i++) {
+    const User& user = Users.at(i);
     // Count prescriptions and notifications for each user
-    int prescriptionCount = 0;
+    int prescriptionCount = Prescriptions.countForUser(user.username);
     int notificationCount = 0;
-    for (const auto& rx : prescriptions) {
-      if (rx.prescribingUsername == user.username) prescriptionCount++;
-    }
     for (const auto& notif : notifications) {
       if (notif.assignedToUsername == user.username) notificationCount++;
     }
-    Serial.printf("  Username: %s, Password: %s, Name: %s\n", 
-                  user.username.c_str(), user.password.c_str(), user.fullName.c_str());
+    Serial.printf("  Username: %s, Name: %s\n", user.username.c_str(), user.fullName.c_str());
     Serial.printf("    Prescriptions: %d, Notifications: %d\n", prescriptionCount, notificationCount);
   }
   Serial.println("\nAPI endpoints:");
@@ -1655,6 +1994,7 @@ void setup() {
   Serial.println("  GET /api/prescriptions - User's prescriptions (protected, filtered)");
   Serial.println("  GET /api/notifications - User's notifications (protected, filtered)");
   Serial.println("  GET /api/patients - Patient database (protected)");
+  Serial.println("  GET /api/medications - Medications in the cabinet map (protected)");
   Serial.println("  POST /api/prescription - Submit prescription data (protected)");
   Serial.println("  POST /api/log - Client logging");
   Serial.println("  POST /api/notifications/{id}/read - Mark notification as read");
@@ -1663,9 +2003,9 @@ void setup() {
   Serial.println("  POST /api/prescriptions/{id}/cancel - Cancel prescription");
   
   Serial.println("\nData Structure Summary:");
-  Serial.printf("  Total Users: %d (3 sample + new registrations)\n", users.size());
+  Serial.printf("  Total Users: %u (samples + new registrations, PBKDF2 x%u)\n", (unsigned)Users.count(), (unsigned)Users.iterations());
   Serial.printf("  Total Patients: %d\n", patients.size());
-  Serial.printf("  Total Prescriptions: %d\n", prescriptions.size());
+  Serial.printf("  Total Prescriptions: %u\n", Prescriptions.count());
   Serial.printf("  Total Notifications: %d\n", notifications.size());
   Serial.println("  - Each notification is linked to a specific doctor");
   Serial.println("  - Each prescription is linked to its prescribing doctor");
@@ -1673,41 +2013,15 @@ void setup() {
   Serial.println("  - All API endpoints are now user-specific and protected");
 
   printHelp();
-}
-
-void loop() {
-  dnsServer.processNextRequest();
-  
-  // Clean up expired sessions every 60 seconds
-  static unsigned long lastCleanup = 0;
-  if (millis() - lastCleanup > 60000) {
-    cleanupExpiredSessions();
-    lastCleanup = millis();
-  }
 
-  // Serial command parser
-  static String serialBuffer;
-  while (Serial.available()) {
-    char c = Serial.read();
-    if (c == '\n' || c == '\r') {
-      if (serialBuffer.length() > 0) {
-        handleSerialCommand(serialBuffer);
-        serialBuffer = "";
-      }
-    } else if (isAscii(c)) {
-      serialBuffer += c;
-    }
-  }
-
-  comm.update();
-  comm.handleAutoPing();
-  
-  if (comm.available()) {
-    String msg = comm.read();
-    Serial.print("Received via Comm: ");
-    Serial.println(msg);
-    // Process incoming messages as needed
+  // The serial console and captive-portal DNS share core 0 with WiFi
+  if (xTaskCreatePinnedToCore(consoleTaskMain, "console", CONSOLE_TASK_STACK, nullptr, CONSOLE_TASK_PRIORITY,
+                              &consoleTask, CONSOLE_TASK_CORE) != pdPASS) {
+    Serial.println("Failed to start the console task");
   }
+}
 
-  delay(10);
-}
\ No newline at end of file
+// Everything runs in the tasks started by setup()
+void loop() {
+  vTaskDelete(NULL);
+}
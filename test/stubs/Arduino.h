@@ -0,0 +1,87 @@
+// Minimal Arduino.h for building Arduino libraries in the native test env.
+// Time only moves when a test sets stubMicros. Outputs are ignored; inputs
+// read stubPinLevel[], and stubSetPin() fires any interrupt on that pin.
+//
+// Like the ESP32 core it pulls in String (WString.h), Serial/Serial2
+// (HardwareSerial.h), ESP (Esp.h) and the FreeRTOS task and mutex calls.
+#ifndef STUB_ARDUINO_H
+#define STUB_ARDUINO_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <math.h>
+#include <algorithm>
+
+typedef bool boolean;
+typedef uint8_t byte;
+
+#define INPUT 0
+#define OUTPUT 1
+#define LOW 0
+#define HIGH 1
+#define RISING 1
+#define FALLING 2
+#define CHANGE 3
+
+#ifndef IRAM_ATTR
+#define IRAM_ATTR
+#endif
+
+#define STUB_PINS 64
+
+inline unsigned long stubMicros = 0;
+
+inline unsigned long micros() { return stubMicros; }
+inline unsigned long millis() { return stubMicros / 1000; }
+inline void delayMicroseconds(unsigned int us) { stubMicros += us; }
+inline void delay(unsigned long ms) { stubMicros += ms * 1000; }
+inline void yield() {}
+inline void pinMode(uint8_t, uint8_t) {}
+inline void digitalWrite(uint8_t, uint8_t) {}
+
+inline uint8_t stubPinLevel[STUB_PINS];
+inline int digitalRead(uint8_t pin) { return stubPinLevel[pin]; }
+
+struct StubInterrupt {
+  void (*handler)(void*);
+  void* arg;
+  int mode;
+};
+inline StubInterrupt stubInterrupts[STUB_PINS];
+
+inline uint8_t digitalPinToInterrupt(uint8_t pin) { return pin; }
+inline void attachInterruptArg(uint8_t pin, void (*handler)(void*), void* arg, int mode) {
+  stubInterrupts[pin] = {handler, arg, mode};
+}
+inline void detachInterrupt(uint8_t pin) { stubInterrupts[pin] = {nullptr, nullptr, 0}; }
+
+inline void stubSetPin(uint8_t pin, uint8_t level) {
+  uint8_t old = stubPinLevel[pin];
+  stubPinLevel[pin] = level;
+  const StubInterrupt& irq = stubInterrupts[pin];
+  if (!irq.handler || old == level) return;
+  if (irq.mode == CHANGE || (irq.mode == RISING && level == HIGH) || (irq.mode == FALLING && level == LOW)) {
+    irq.handler(irq.arg);
+  }
+}
+
+inline bool isAscii(int c) { return (c & ~0x7F) == 0; }
+inline bool isDigit(int c) { return isdigit(c) != 0; }
+inline bool isAlpha(int c) { return isalpha(c) != 0; }
+inline bool isSpace(int c) { return isspace(c) != 0; }
+
+using std::max;
+using std::min;
+#define constrain(amt, low, high) ((amt) < (low) ? (low) : ((amt) > (high) ? (high) : (amt)))
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
+#include "WString.h"
+#include "HardwareSerial.h"
+#include "Esp.h"
+
+#endif
@@ -0,0 +1,252 @@
+// AsyncWebServer for the native test env. A test builds an
+// AsyncWebServerRequest with the headers, query/body params and path
+// captures it needs, hands it to a handler (directly or through
+// AsyncWebServer::stubDispatch), and reads back what the handler sent.
+// Chunked responses are drained into the same body string, so streamed JSON
+// can be checked like any other reply.
+#ifndef STUB_ESPASYNCWEBSERVER_H
+#define STUB_ESPASYNCWEBSERVER_H
+
+#include <functional>
+#include <memory>
+#include <regex>
+#include <string>
+#include <utility>
+#include <vector>
+#include "Arduino.h"
+#include "FS.h"
+
+typedef enum {
+  HTTP_GET = 0b00000001,
+  HTTP_POST = 0b00000010,
+  HTTP_DELETE = 0b00000100,
+  HTTP_PUT = 0b00001000,
+  HTTP_PATCH = 0b00010000,
+  HTTP_HEAD = 0b00100000,
+  HTTP_OPTIONS = 0b01000000,
+  HTTP_ANY = 0b01111111,
+} WebRequestMethod;
+typedef uint8_t WebRequestMethodComposite;
+
+class AsyncWebServerRequest;
+class AsyncWebServerResponse;
+
+typedef std::function<void(AsyncWebServerRequest* request)> ArRequestHandlerFunction;
+typedef std::function<void(AsyncWebServerRequest* request, const String& filename, size_t index, uint8_t* data,
+                           size_t len, bool final)>
+    ArUploadHandlerFunction;
+typedef std::function<void(AsyncWebServerRequest* request, uint8_t* data, size_t len, size_t index, size_t total)>
+    ArBodyHandlerFunction;
+typedef std::function<size_t(uint8_t* buffer, size_t maxLen, size_t index)> AwsResponseFiller;
+
+class AsyncWebHeader {
+private:
+  String headerName;
+  String headerValue;
+
+public:
+  AsyncWebHeader(const String& name, const String& value) : headerName(name), headerValue(value) {}
+  const String& name() const { return headerName; }
+  const String& value() const { return headerValue; }
+};
+
+class AsyncWebParameter {
+private:
+  String paramName;
+  String paramValue;
+  bool post;
+
+public:
+  AsyncWebParameter(const String& name, const String& value, bool form = false)
+    : paramName(name), paramValue(value), post(form) {}
+  const String& name() const { return paramName; }
+  const String& value() const { return paramValue; }
+  bool isPost() const { return post; }
+};
+
+class AsyncWebServerResponse {
+public:
+  int code;
+  String contentType;
+  String content;
+  std::vector<AsyncWebHeader> headers;
+  AwsResponseFiller filler;
+
+  AsyncWebServerResponse(int status, const String& type, const String& body) : code(status), contentType(type),
+                                                                               content(body) {}
+  void addHeader(const String& name, const String& value) { headers.emplace_back(name, value); }
+  void setCode(int status) { code = status; }
+
+  // Runs a chunked filler to the end, maxLen bytes at a time
+  void stubDrain(size_t maxLen = 1436) {
+    if (!filler) return;
+    std::vector<uint8_t> buffer(maxLen);
+    size_t index = 0;
+    size_t n;
+    while ((n = filler(buffer.data(), maxLen, index)) > 0) {
+      content.concat((const char*)buffer.data(), n);
+      index += n;
+    }
+    filler = nullptr;
+  }
+};
+
+class AsyncWebServerRequest {
+private:
+  std::vector<AsyncWebHeader> requestHeaders;
+  std::vector<AsyncWebParameter> requestParams;
+  std::vector<String> pathArgs;
+  WebRequestMethodComposite requestMethod;
+  String requestUrl;
+
+public:
+  // What the handler sent; null until it calls send() or redirect()
+  std::unique_ptr<AsyncWebServerResponse> stubResponse;
+
+  AsyncWebServerRequest(WebRequestMethodComposite method = HTTP_GET, const String& url = "/")
+    : requestMethod(method), requestUrl(url) {}
+
+  // Test side
+  void stubHeader(const String& name, const String& value) { requestHeaders.emplace_back(name, value); }
+  void stubParam(const String& name, const String& value, bool post = false) {
+    requestParams.emplace_back(name, value, post);
+  }
+  void stubPathArgs(const std::vector<String>& args) { pathArgs = args; }
+  int stubCode() const { return stubResponse ? stubResponse->code : 0; }
+  const String& stubBody() const {
+    static const String none;
+    return stubResponse ? stubResponse->content : none;
+  }
+
+  WebRequestMethodComposite method() const { return requestMethod; }
+  const String& url() const { return requestUrl; }
+
+  bool hasHeader(const String& name) const { return getHeader(name) != nullptr; }
+  const AsyncWebHeader* getHeader(const String& name) const {
+    for (const AsyncWebHeader& header : requestHeaders) {
+      if (header.name().equalsIgnoreCase(name)) return &header;
+    }
+    return nullptr;
+  }
+  const String& header(const char* name) const {
+    static const String none;
+    const AsyncWebHeader* found = getHeader(name);
+    return found ? found->value() : none;
+  }
+
+  bool hasParam(const String& name, bool post = false, bool file = false) const {
+    return getParam(name, post, file) != nullptr;
+  }
+  const AsyncWebParameter* getParam(const String& name, bool post = false, bool file = false) const {
+    for (const AsyncWebParameter& param : requestParams) {
+      if (param.name() == name && param.isPost() == post) return &param;
+    }
+    return nullptr;
+  }
+  const String& arg(const char* name) const {
+    static const String none;
+    for (const AsyncWebParameter& param : requestParams) {
+      if (param.name() == name) return param.value();
+    }
+    return none;
+  }
+  const String& pathArg(size_t i) const {
+    static const String none;
+    return i < pathArgs.size() ? pathArgs[i] : none;
+  }
+
+  AsyncWebServerResponse* beginResponse(int code, const String& contentType = String(),
+                                        const String& content = String()) {
+    return new AsyncWebServerResponse(code, contentType, content);
+  }
+  AsyncWebServerResponse* beginResponse(const String& contentType, size_t length, AwsResponseFiller callback) {
+    AsyncWebServerResponse* response = new AsyncWebServerResponse(200, contentType, "");
+    response->filler = callback;
+    return response;
+  }
+  AsyncWebServerResponse* beginChunkedResponse(const String& contentType, AwsResponseFiller callback) {
+    return beginResponse(contentType, 0, callback);
+  }
+  AsyncWebServerResponse* beginResponse(fs::FS& fs, const String& path, const String& contentType = String(),
+                                        bool download = false) {
+    File file = fs.open(path, "r");
+    if (!file) return new AsyncWebServerResponse(404, contentType, "");
+    return new AsyncWebServerResponse(200, contentType, file.readString());
+  }
+
+  void send(AsyncWebServerResponse* response) {
+    response->stubDrain();
+    stubResponse.reset(response);
+  }
+  void send(int code, const String& contentType = String(), const String& content = String()) {
+    send(beginResponse(code, contentType, content));
+  }
+  void send(fs::FS& fs, const String& path, const String& contentType = String(), bool download = false) {
+    send(beginResponse(fs, path, contentType, download));
+  }
+  void redirect(const String& url) {
+    AsyncWebServerResponse* response = beginResponse(302);
+    response->addHeader("Location", url);
+    send(response);
+  }
+};
+
+class AsyncWebServer {
+private:
+  struct Route {
+    String uri;
+    WebRequestMethodComposite method;
+    ArRequestHandlerFunction onRequest;
+    ArBodyHandlerFunction onBody;
+  };
+  std::vector<Route> routes;
+  ArRequestHandlerFunction notFound;
+
+  // Exact paths, or "^..." regular expressions whose groups become pathArg()s
+  static bool matches(const Route& route, AsyncWebServerRequest& request) {
+    if (!(route.method & request.method())) return false;
+    if (!route.uri.startsWith("^")) return route.uri == request.url();
+    std::smatch match;
+    std::string url(request.url().c_str());
+    if (!std::regex_match(url, match, std::regex(route.uri.c_str()))) return false;
+    std::vector<String> args;
+    for (size_t i = 1; i < match.size(); i++) args.push_back(String(match[i].str()));
+    request.stubPathArgs(args);
+    return true;
+  }
+
+public:
+  explicit AsyncWebServer(uint16_t port) {}
+
+  void begin() {}
+  void end() {}
+  void on(const char* uri, WebRequestMethodComposite method, ArRequestHandlerFunction onRequest) {
+    routes.push_back({uri, method, onRequest, nullptr});
+  }
+  void on(const char* uri, WebRequestMethodComposite method, ArRequestHandlerFunction onRequest,
+          ArUploadHandlerFunction onUpload, ArBodyHandlerFunction onBody = nullptr) {
+    routes.push_back({uri, method, onRequest, onBody});
+  }
+  void onNotFound(ArRequestHandlerFunction handler) { notFound = handler; }
+
+  // Runs the first matching route as AsyncWebServer would: the body handler
+  // (in one piece) if the route has one, then the request handler if nothing
+  // has been sent yet. Returns false if nothing matched and there is no
+  // not-found handler.
+  bool stubDispatch(AsyncWebServerRequest& request, const String& body = String()) {
+    for (const Route& route : routes) {
+      if (!matches(route, request)) continue;
+      if (route.onBody && body.length() > 0) {
+        String copy = body;
+        route.onBody(&request, (uint8_t*)copy.c_str(), copy.length(), 0, copy.length());
+      }
+      if (!request.stubResponse && route.onRequest) route.onRequest(&request);
+      return true;
+    }
+    if (!notFound) return false;
+    notFound(&request);
+    return true;
+  }
+};
+
+#endif
@@ -0,0 +1,40 @@
+// ESP for the native test env. Heap figures come from stubHeapFree and
+// friends so tests can play out low-memory cases; the cycle counter runs
+// off the host's steady clock at the ESP32's 240 MHz.
+#ifndef STUB_ESP_H
+#define STUB_ESP_H
+
+#include <chrono>
+#include <stdint.h>
+#include <stdlib.h>
+
+inline uint32_t stubHeapFree = 200000;
+inline uint32_t stubHeapMinFree = 180000;
+inline uint32_t stubHeapMaxAlloc = 110000;
+inline bool stubRestartRequested = false;
+
+class EspClass {
+public:
+  uint32_t getFreeHeap() { return stubHeapFree; }
+  uint32_t getMinFreeHeap() { return stubHeapMinFree; }
+  uint32_t getMaxAllocHeap() { return stubHeapMaxAlloc; }
+  uint32_t getHeapSize() { return 320000; }
+  uint32_t getFreePsram() { return 0; }
+  uint32_t getPsramSize() { return 0; }
+  uint32_t getFlashChipSize() { return 4 * 1024 * 1024; }
+  uint32_t getCpuFreqMHz() { return 240; }
+  const char* getChipModel() { return "native"; }
+  void restart() { stubRestartRequested = true; }
+
+  uint32_t getCycleCount() {
+    auto elapsed = std::chrono::steady_clock::now().time_since_epoch();
+    return (uint32_t)(std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count() * 240 / 1000);
+  }
+};
+
+inline EspClass ESP;
+
+inline bool psramFound() { return false; }
+inline void* ps_malloc(size_t size) { return malloc(size); }
+
+#endif
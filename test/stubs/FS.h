@@ -0,0 +1,235 @@
+// In-memory fs::FS for the native test env. Each file system keeps its files
+// in a map; File objects share the bytes of an open file the way ESP32 VFS
+// handles do, so a reader sees what another handle just wrote. Directories
+// exist implicitly through the paths of the files in them, or through
+// mkdir(). stubFailWrites makes every write fail, for full-card cases.
+#ifndef STUB_FS_H
+#define STUB_FS_H
+
+#include <functional>
+#include <map>
+#include <memory>
+#include <set>
+#include <string>
+#include <vector>
+#include "Print.h"
+
+#define FILE_READ "r"
+#define FILE_WRITE "w"
+#define FILE_APPEND "a"
+
+namespace fs {
+
+enum SeekMode { SeekSet = 0, SeekCur = 1, SeekEnd = 2 };
+
+typedef std::shared_ptr<std::vector<uint8_t>> StubFileData;
+
+class File : public Stream {
+private:
+  struct Handle {
+    std::string path;
+    StubFileData data;
+    size_t position = 0;
+    bool readable = false;
+    bool writable = false;
+    bool append = false;
+    bool failWrites = false;
+    // Directories only
+    bool directory = false;
+    std::vector<std::string> entries;
+    size_t nextEntry = 0;
+    std::function<File(const std::string&)> openEntry;
+  };
+  std::shared_ptr<Handle> handle;
+
+public:
+  File() {}
+
+  static File stubFile(const std::string& path, StubFileData data, bool readable, bool writable, bool append,
+                       bool failWrites) {
+    File file;
+    file.handle = std::make_shared<Handle>();
+    file.handle->path = path;
+    file.handle->data = data;
+    file.handle->readable = readable;
+    file.handle->writable = writable;
+    file.handle->append = append;
+    file.handle->failWrites = failWrites;
+    return file;
+  }
+  static File stubDirectory(const std::string& path, const std::vector<std::string>& entries,
+                            std::function<File(const std::string&)> openEntry) {
+    File dir;
+    dir.handle = std::make_shared<Handle>();
+    dir.handle->path = path;
+    dir.handle->directory = true;
+    dir.handle->entries = entries;
+    dir.handle->openEntry = openEntry;
+    return dir;
+  }
+
+  explicit operator bool() const { return handle != nullptr; }
+
+  using Print::write;
+  size_t write(uint8_t c) override { return write(&c, 1); }
+  size_t write(const uint8_t* buffer, size_t size) override {
+    if (!handle || !handle->writable || handle->failWrites) return 0;
+    std::vector<uint8_t>& bytes = *handle->data;
+    if (handle->append) handle->position = bytes.size();
+    if (handle->position + size > bytes.size()) bytes.resize(handle->position + size);
+    memcpy(bytes.data() + handle->position, buffer, size);
+    handle->position += size;
+    return size;
+  }
+
+  int available() override {
+    if (!handle || !handle->readable || handle->directory) return 0;
+    size_t size = handle->data->size();
+    return handle->position < size ? (int)(size - handle->position) : 0;
+  }
+  int read() override {
+    uint8_t c;
+    return read(&c, 1) == 1 ? c : -1;
+  }
+  size_t read(uint8_t* buffer, size_t size) {
+    size_t left = (size_t)available();
+    if (size > left) size = left;
+    if (size > 0) memcpy(buffer, handle->data->data() + handle->position, size);
+    if (handle) handle->position += size;
+    return size;
+  }
+  int peek() override { return available() ? (*handle->data)[handle->position] : -1; }
+
+  bool seek(uint32_t position, SeekMode mode = SeekSet) {
+    if (!handle || handle->directory) return false;
+    long base = mode == SeekSet ? 0 : mode == SeekCur ? (long)handle->position : (long)handle->data->size();
+    long target = base + (long)position;
+    if (target < 0) return false;
+    handle->position = (size_t)target;
+    return true;
+  }
+  size_t position() const { return handle ? handle->position : 0; }
+  size_t size() const { return handle && !handle->directory ? handle->data->size() : 0; }
+  void flush() override {}
+  void close() { handle.reset(); }
+
+  const char* path() const { return handle ? handle->path.c_str() : ""; }
+  const char* name() const {
+    if (!handle) return "";
+    size_t slash = handle->path.rfind('/');
+    return handle->path.c_str() + (slash == std::string::npos ? 0 : slash + 1);
+  }
+  bool isDirectory() const { return handle && handle->directory; }
+  File openNextFile() {
+    if (!isDirectory() || handle->nextEntry >= handle->entries.size()) return File();
+    return handle->openEntry(handle->entries[handle->nextEntry++]);
+  }
+  void rewindDirectory() {
+    if (handle) handle->nextEntry = 0;
+  }
+};
+
+class FS {
+private:
+  std::map<std::string, StubFileData> files;
+  std::set<std::string> directories;
+
+  static std::string parentOf(const std::string& path) {
+    size_t slash = path.rfind('/');
+    return slash == 0 || slash == std::string::npos ? "/" : path.substr(0, slash);
+  }
+  bool isDirectory(const std::string& path) const {
+    if (path == "/" || directories.count(path)) return true;
+    std::string prefix = path + "/";
+    auto it = files.lower_bound(prefix);
+    return it != files.end() && it->first.compare(0, prefix.size(), prefix) == 0;
+  }
+
+public:
+  bool stubFailWrites = false;
+
+  virtual ~FS() {}
+
+  File open(const char* path, const char* mode = FILE_READ, bool create = false) {
+    std::string name(path);
+    if (isDirectory(name)) {
+      std::set<std::string> children;
+      std::string prefix = name == "/" ? "/" : name + "/";
+      for (const auto& file : files) {
+        if (file.first.compare(0, prefix.size(), prefix) != 0) continue;
+        size_t end = file.first.find('/', prefix.size());
+        children.insert(file.first.substr(0, end));
+      }
+      for (const std::string& dir : directories) {
+        if (dir.size() > prefix.size() && dir.compare(0, prefix.size(), prefix) == 0 &&
+            dir.find('/', prefix.size()) == std::string::npos) {
+          children.insert(dir);
+        }
+      }
+      return File::stubDirectory(name, std::vector<std::string>(children.begin(), children.end()),
+                                 [this](const std::string& child) { return open(child.c_str()); });
+    }
+
+    bool plus = strchr(mode, '+') != nullptr;
+    auto it = files.find(name);
+    if (mode[0] == 'r') {
+      if (it == files.end()) return File();
+      return File::stubFile(name, it->second, true, plus, false, stubFailWrites);
+    }
+    if (mode[0] != 'w' && mode[0] != 'a') return File();
+    if (!isDirectory(parentOf(name))) return File();
+    if (it == files.end()) {
+      it = files.emplace(name, std::make_shared<std::vector<uint8_t>>()).first;
+    } else if (mode[0] == 'w') {
+      // Truncate in place so other open handles see it, as on the card
+      it->second->clear();
+    }
+    return File::stubFile(name, it->second, plus, true, mode[0] == 'a', stubFailWrites);
+  }
+  File open(const String& path, const char* mode = FILE_READ, bool create = false) {
+    return open(path.c_str(), mode, create);
+  }
+
+  bool exists(const char* path) { return files.count(path) > 0 || isDirectory(path); }
+  bool exists(const String& path) { return exists(path.c_str()); }
+  bool remove(const char* path) { return files.erase(path) > 0; }
+  bool remove(const String& path) { return remove(path.c_str()); }
+  bool rename(const char* from, const char* to) {
+    auto it = files.find(from);
+    if (it == files.end() || files.count(to)) return false;
+    StubFileData data = it->second;
+    files.erase(it);
+    files[to] = data;
+    return true;
+  }
+  bool rename(const String& from, const String& to) { return rename(from.c_str(), to.c_str()); }
+  bool mkdir(const char* path) {
+    if (files.count(path)) return false;
+    directories.insert(path);
+    return true;
+  }
+  bool mkdir(const String& path) { return mkdir(path.c_str()); }
+  bool rmdir(const char* path) { return directories.erase(path) > 0; }
+  bool rmdir(const String& path) { return rmdir(path.c_str()); }
+
+  // Test side
+  size_t stubUsedBytes() const {
+    size_t used = 0;
+    for (const auto& file : files) used += file.second->size();
+    return used;
+  }
+  void stubFormat() {
+    files.clear();
+    directories.clear();
+  }
+};
+
+}  // namespace fs
+
+using fs::File;
+using fs::FS;
+using fs::SeekCur;
+using fs::SeekEnd;
+using fs::SeekSet;
+
+#endif
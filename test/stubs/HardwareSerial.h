@@ -0,0 +1,97 @@
+// HardwareSerial for the native test env. Bytes a test feeds with
+// stubReceive() come out of read(); everything written is kept for
+// stubSent(). Two ports can be cross-wired with stubLink() to run both ends
+// of a UART protocol in one process. Serial is silent unless stubEcho is
+// set, so library logging does not flood test output.
+#ifndef STUB_HARDWARESERIAL_H
+#define STUB_HARDWARESERIAL_H
+
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <string>
+#include "Print.h"
+
+typedef std::function<void(void)> OnReceiveCb;
+
+#define SERIAL_8N1 0x800001c
+
+class HardwareSerial : public Stream {
+private:
+  std::deque<uint8_t> rx;
+  std::string tx;
+  std::recursive_mutex lock;
+  HardwareSerial* peer;
+  OnReceiveCb onReceiveCb;
+
+public:
+  bool stubEcho;
+
+  HardwareSerial() : peer(nullptr), stubEcho(false) {}
+
+  void begin(unsigned long baud, uint32_t config = SERIAL_8N1, int8_t rxPin = -1, int8_t txPin = -1) {}
+  void end() {}
+  void onReceive(OnReceiveCb callback, bool onlyOnTimeout = false) { onReceiveCb = callback; }
+
+  int available() override {
+    std::lock_guard<std::recursive_mutex> guard(lock);
+    return (int)rx.size();
+  }
+  int read() override {
+    std::lock_guard<std::recursive_mutex> guard(lock);
+    if (rx.empty()) return -1;
+    uint8_t c = rx.front();
+    rx.pop_front();
+    return c;
+  }
+  int peek() override {
+    std::lock_guard<std::recursive_mutex> guard(lock);
+    return rx.empty() ? -1 : rx.front();
+  }
+
+  using Print::write;
+  size_t write(uint8_t c) override { return write(&c, 1); }
+  size_t write(const uint8_t* buffer, size_t size) override {
+    HardwareSerial* target;
+    {
+      std::lock_guard<std::recursive_mutex> guard(lock);
+      tx.append((const char*)buffer, size);
+      target = peer;
+    }
+    if (stubEcho) fwrite(buffer, 1, size, stdout);
+    if (target) target->stubReceive(buffer, size);
+    return size;
+  }
+
+  // Test side
+  void stubReceive(const uint8_t* data, size_t length) {
+    OnReceiveCb callback;
+    {
+      std::lock_guard<std::recursive_mutex> guard(lock);
+      rx.insert(rx.end(), data, data + length);
+      callback = onReceiveCb;
+    }
+    if (callback) callback();
+  }
+  void stubReceive(const char* text) { stubReceive((const uint8_t*)text, strlen(text)); }
+  std::string stubSent() {
+    std::lock_guard<std::recursive_mutex> guard(lock);
+    return tx;
+  }
+  void stubReset() {
+    std::lock_guard<std::recursive_mutex> guard(lock);
+    rx.clear();
+    tx.clear();
+  }
+  // Whatever either port writes arrives at the other
+  static void stubLink(HardwareSerial& a, HardwareSerial& b) {
+    a.peer = &b;
+    b.peer = &a;
+  }
+};
+
+inline HardwareSerial Serial;
+inline HardwareSerial Serial1;
+inline HardwareSerial Serial2;
+
+#endif
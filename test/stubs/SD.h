@@ -0,0 +1,32 @@
+// SD card for the native test env: an in-memory fs::FS. stubCardType sets
+// what cardType() reports (CARD_NONE for an empty slot) and stubMountFails
+// makes begin() fail.
+#ifndef STUB_SD_H
+#define STUB_SD_H
+
+#include "FS.h"
+#include "SPI.h"
+
+typedef enum { CARD_NONE, CARD_MMC, CARD_SD, CARD_SDHC, CARD_UNKNOWN } sdcard_type_t;
+
+class SDFS : public fs::FS {
+public:
+  uint8_t stubCardType = CARD_SDHC;
+  bool stubMountFails = false;
+  bool stubMounted = false;
+
+  bool begin(uint8_t ssPin = 5, SPIClass& spi = SPI, uint32_t frequency = 4000000, const char* mountpoint = "/sd",
+             uint8_t maxFiles = 5, bool formatIfEmpty = false) {
+    stubMounted = !stubMountFails;
+    return stubMounted;
+  }
+  void end() { stubMounted = false; }
+  uint8_t cardType() { return stubMounted ? stubCardType : CARD_NONE; }
+  uint64_t cardSize() { return 16ULL * 1024 * 1024 * 1024; }
+  uint64_t totalBytes() { return cardSize(); }
+  uint64_t usedBytes() { return stubUsedBytes(); }
+};
+
+inline SDFS SD;
+
+#endif
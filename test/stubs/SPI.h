@@ -0,0 +1,19 @@
+// SPI bus for the native test env; nothing is wired to it
+#ifndef STUB_SPI_H
+#define STUB_SPI_H
+
+#include <stdint.h>
+
+#define VSPI 3
+#define HSPI 2
+
+class SPIClass {
+public:
+  explicit SPIClass(uint8_t bus = VSPI) {}
+  void begin(int8_t sck = -1, int8_t miso = -1, int8_t mosi = -1, int8_t ss = -1) {}
+  void end() {}
+};
+
+inline SPIClass SPI;
+
+#endif
@@ -0,0 +1,26 @@
+// SPIFFS for the native test env: an in-memory fs::FS
+#ifndef STUB_SPIFFS_H
+#define STUB_SPIFFS_H
+
+#include "FS.h"
+
+class SPIFFSFS : public fs::FS {
+public:
+  bool stubMountFails = false;
+
+  bool begin(bool formatOnFail = false, const char* basePath = "/spiffs", uint8_t maxOpenFiles = 10,
+             const char* partitionLabel = nullptr) {
+    return !stubMountFails;
+  }
+  void end() {}
+  bool format() {
+    stubFormat();
+    return true;
+  }
+  size_t totalBytes() { return 1408 * 1024; }
+  size_t usedBytes() { return stubUsedBytes(); }
+};
+
+inline SPIFFSFS SPIFFS;
+
+#endif
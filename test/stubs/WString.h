@@ -0,0 +1,181 @@
+// Arduino String for the native test env, on top of std::string. Covers the
+// members this project uses, with the same results for out-of-range
+// arguments (indexOf() returns -1, substring() clamps).
+#ifndef STUB_WSTRING_H
+#define STUB_WSTRING_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <ctype.h>
+#include <string>
+
+class String {
+private:
+  std::string text;
+
+  static std::string number(const char* format, long long value) {
+    char buffer[24];
+    snprintf(buffer, sizeof(buffer), format, value);
+    return buffer;
+  }
+
+public:
+  String(const char* value = "") : text(value ? value : "") {}
+  String(const char* value, size_t length) : text(value, length) {}
+  String(const std::string& value) : text(value) {}
+  explicit String(char c) : text(1, c) {}
+  String(int value) : text(number("%lld", value)) {}
+  String(unsigned int value) : text(number("%llu", value)) {}
+  String(long value) : text(number("%lld", value)) {}
+  String(unsigned long value) : text(number("%llu", (long long)value)) {}
+  String(long long value) : text(number("%lld", value)) {}
+  String(unsigned long long value) : text(number("%llu", (long long)value)) {}
+  String(double value, unsigned int decimals = 2) {
+    char buffer[48];
+    snprintf(buffer, sizeof(buffer), "%.*f", decimals, value);
+    text = buffer;
+  }
+
+  const char* c_str() const { return text.c_str(); }
+  unsigned int length() const { return text.size(); }
+  bool isEmpty() const { return text.empty(); }
+  bool reserve(unsigned int size) {
+    text.reserve(size);
+    return true;
+  }
+
+  char charAt(unsigned int index) const { return index < text.size() ? text[index] : 0; }
+  char operator[](unsigned int index) const { return charAt(index); }
+  char& operator[](unsigned int index) { return text[index]; }
+  void setCharAt(unsigned int index, char c) {
+    if (index < text.size()) text[index] = c;
+  }
+
+  String& operator=(const char* value) {
+    text = value ? value : "";
+    return *this;
+  }
+  bool concat(const String& value) {
+    text += value.text;
+    return true;
+  }
+  bool concat(const char* value) {
+    if (value) text += value;
+    return true;
+  }
+  bool concat(const char* value, unsigned int length) {
+    text.append(value, length);
+    return true;
+  }
+  bool concat(char c) {
+    text += c;
+    return true;
+  }
+  String& operator+=(const String& value) {
+    concat(value);
+    return *this;
+  }
+  String& operator+=(const char* value) {
+    concat(value);
+    return *this;
+  }
+  String& operator+=(char c) {
+    concat(c);
+    return *this;
+  }
+  String& operator+=(int value) { return *this += String(value); }
+  String& operator+=(unsigned int value) { return *this += String(value); }
+  String& operator+=(long value) { return *this += String(value); }
+  String& operator+=(unsigned long value) { return *this += String(value); }
+
+  friend String operator+(const String& a, const String& b) { return String(a.text + b.text); }
+  friend String operator+(const String& a, const char* b) { return String(a.text + (b ? b : "")); }
+  friend String operator+(const char* a, const String& b) { return String((a ? a : "") + b.text); }
+  friend String operator+(const String& a, char b) { return String(a.text + b); }
+
+  bool equals(const String& other) const { return text == other.text; }
+  bool equals(const char* other) const { return text == (other ? other : ""); }
+  bool equalsIgnoreCase(const String& other) const {
+    return text.size() == other.text.size() && strcasecmp(text.c_str(), other.text.c_str()) == 0;
+  }
+  bool operator==(const String& other) const { return equals(other); }
+  bool operator==(const char* other) const { return equals(other); }
+  bool operator!=(const String& other) const { return !equals(other); }
+  bool operator!=(const char* other) const { return !equals(other); }
+  bool operator<(const String& other) const { return text < other.text; }
+  int compareTo(const String& other) const { return text.compare(other.text); }
+
+  bool startsWith(const String& prefix) const { return text.compare(0, prefix.text.size(), prefix.text) == 0; }
+  bool startsWith(const String& prefix, unsigned int offset) const {
+    return offset <= text.size() && text.compare(offset, prefix.text.size(), prefix.text) == 0;
+  }
+  bool endsWith(const String& suffix) const {
+    return suffix.text.size() <= text.size() &&
+           text.compare(text.size() - suffix.text.size(), suffix.text.size(), suffix.text) == 0;
+  }
+
+  int indexOf(char c, unsigned int from = 0) const {
+    size_t at = text.find(c, from);
+    return at == std::string::npos ? -1 : (int)at;
+  }
+  int indexOf(const String& value, unsigned int from = 0) const {
+    size_t at = text.find(value.text, from);
+    return at == std::string::npos ? -1 : (int)at;
+  }
+  int indexOf(const char* value, unsigned int from = 0) const { return indexOf(String(value), from); }
+  int lastIndexOf(char c) const {
+    size_t at = text.rfind(c);
+    return at == std::string::npos ? -1 : (int)at;
+  }
+  int lastIndexOf(const String& value) const {
+    size_t at = text.rfind(value.text);
+    return at == std::string::npos ? -1 : (int)at;
+  }
+
+  String substring(unsigned int from) const { return substring(from, text.size()); }
+  String substring(unsigned int from, unsigned int to) const {
+    if (from > to) std::swap(from, to);
+    if (from >= text.size()) return String();
+    if (to > text.size()) to = text.size();
+    return String(text.substr(from, to - from));
+  }
+
+  void trim() {
+    size_t start = 0;
+    while (start < text.size() && isspace((unsigned char)text[start])) start++;
+    size_t end = text.size();
+    while (end > start && isspace((unsigned char)text[end - 1])) end--;
+    text = text.substr(start, end - start);
+  }
+  void toLowerCase() {
+    for (char& c : text) c = (char)tolower((unsigned char)c);
+  }
+  void toUpperCase() {
+    for (char& c : text) c = (char)toupper((unsigned char)c);
+  }
+  void replace(const String& find, const String& with) {
+    if (find.text.empty()) return;
+    size_t at = 0;
+    while ((at = text.find(find.text, at)) != std::string::npos) {
+      text.replace(at, find.text.size(), with.text);
+      at += with.text.size();
+    }
+  }
+  void replace(char find, char with) {
+    for (char& c : text) {
+      if (c == find) c = with;
+    }
+  }
+  void remove(unsigned int index) { remove(index, text.size()); }
+  void remove(unsigned int index, unsigned int count) {
+    if (index < text.size()) text.erase(index, count);
+  }
+
+  long toInt() const { return atol(text.c_str()); }
+  float toFloat() const { return (float)atof(text.c_str()); }
+  double toDouble() const { return atof(text.c_str()); }
+};
+
+#endif
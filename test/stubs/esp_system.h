@@ -0,0 +1,20 @@
+// esp_system.h for the native test env. The random functions use the host's
+// std::random_device, which is fine for tests but is not the ESP32 RNG.
+#ifndef STUB_ESP_SYSTEM_H
+#define STUB_ESP_SYSTEM_H
+
+#include <random>
+#include <stddef.h>
+#include <stdint.h>
+
+inline uint32_t esp_random() {
+  static std::random_device device;
+  return device();
+}
+
+inline void esp_fill_random(void* buffer, size_t length) {
+  uint8_t* out = (uint8_t*)buffer;
+  for (size_t i = 0; i < length; i++) out[i] = (uint8_t)esp_random();
+}
+
+#endif
@@ -0,0 +1,88 @@
+// FreeRTOS tasks for the native test env. Each task is a std::thread with a
+// notification counter, so code that hands work to a background task (the
+// ESPrxtxESP sender, the comm task) runs for real. Core and priority are
+// ignored. A deleted task is detached and simply never woken again.
+#ifndef STUB_FREERTOS_TASK_H
+#define STUB_FREERTOS_TASK_H
+
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include "FreeRTOS.h"
+
+typedef void (*TaskFunction_t)(void*);
+
+struct StubTask {
+  std::mutex mutex;
+  std::condition_variable wake;
+  uint32_t notifications = 0;
+  bool deleted = false;
+};
+typedef StubTask* TaskHandle_t;
+
+// Thrown by vTaskDelete(NULL) to leave the task function
+struct StubTaskExit {};
+
+inline thread_local StubTask* stubCurrentTask = nullptr;
+
+inline TaskHandle_t xTaskGetCurrentTaskHandle() {
+  // Threads not started by xTaskCreate (the test itself) get a handle on demand
+  if (!stubCurrentTask) stubCurrentTask = new StubTask();
+  return stubCurrentTask;
+}
+
+inline BaseType_t xTaskCreatePinnedToCore(TaskFunction_t function, const char* name, uint32_t stackDepth,
+                                          void* parameter, UBaseType_t priority, TaskHandle_t* created,
+                                          BaseType_t core) {
+  StubTask* task = new StubTask();
+  if (created) *created = task;
+  std::thread([task, function, parameter] {
+    stubCurrentTask = task;
+    try {
+      function(parameter);
+    } catch (const StubTaskExit&) {
+    }
+  }).detach();
+  return pdPASS;
+}
+
+inline BaseType_t xTaskCreate(TaskFunction_t function, const char* name, uint32_t stackDepth, void* parameter,
+                              UBaseType_t priority, TaskHandle_t* created) {
+  return xTaskCreatePinnedToCore(function, name, stackDepth, parameter, priority, created, tskNO_AFFINITY);
+}
+
+inline void vTaskDelete(TaskHandle_t task) {
+  if (!task || task == stubCurrentTask) throw StubTaskExit();
+  std::lock_guard<std::mutex> guard(task->mutex);
+  task->deleted = true;
+}
+
+inline void vTaskDelay(TickType_t ticks) {
+  std::this_thread::sleep_for(std::chrono::milliseconds(ticks));
+}
+
+inline BaseType_t xTaskNotifyGive(TaskHandle_t task) {
+  std::lock_guard<std::mutex> guard(task->mutex);
+  if (!task->deleted) {
+    task->notifications++;
+    task->wake.notify_one();
+  }
+  return pdPASS;
+}
+
+inline uint32_t ulTaskNotifyTake(BaseType_t clearOnExit, TickType_t ticks) {
+  StubTask* task = xTaskGetCurrentTaskHandle();
+  std::unique_lock<std::mutex> guard(task->mutex);
+  auto ready = [task] { return task->notifications > 0 && !task->deleted; };
+  if (ticks == portMAX_DELAY) {
+    task->wake.wait(guard, ready);
+  } else {
+    task->wake.wait_for(guard, std::chrono::milliseconds(ticks), ready);
+  }
+  uint32_t count = task->notifications;
+  if (count > 0) task->notifications = clearOnExit ? 0 : count - 1;
+  return count;
+}
+
+#endif
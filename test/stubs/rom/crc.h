@@ -0,0 +1,17 @@
+// ROM CRC32 for the native test env, bit for bit the same as the ESP32's
+// crc32_le (reflected polynomial 0xEDB88320, the zlib CRC when crc starts at 0)
+#ifndef STUB_ROM_CRC_H
+#define STUB_ROM_CRC_H
+
+#include <stdint.h>
+
+inline uint32_t crc32_le(uint32_t crc, const uint8_t* buf, uint32_t len) {
+  crc = ~crc;
+  for (uint32_t i = 0; i < len; i++) {
+    crc ^= buf[i];
+    for (int b = 0; b < 8; b++) crc = (crc >> 1) ^ (0xEDB88320u & (0u - (crc & 1)));
+  }
+  return ~crc;
+}
+
+#endif
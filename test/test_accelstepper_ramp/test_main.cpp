@@ -0,0 +1,181 @@
+// Float vs fixed point AccelStepper speed calculation: pio test -e native
+//
+// Runs the real AccelStepper against the stub clock in test/stubs, jumping
+// straight to each step, and compares where the steps land.
+#include <unity.h>
+#include <chrono>
+#include <stdio.h>
+#include <vector>
+#include "AccelStepper.h"
+
+void setUp() {}
+void tearDown() {}
+
+static std::vector<unsigned long> stepTimes;
+static void forward() { stepTimes.push_back(stubMicros); }
+static void backward() { stepTimes.push_back(stubMicros); }
+
+// Remembers each interval run() asks for, so the loop can jump to it
+class RampProbe : public AccelStepper {
+public:
+  RampProbe() : AccelStepper(forward, backward), interval(0) {}
+  unsigned long interval;
+
+protected:
+  unsigned long computeNewSpeed() override {
+    interval = AccelStepper::computeNewSpeed();
+    return interval;
+  }
+};
+
+struct Move {
+  float maxSpeed;
+  float acceleration;
+  long target;
+};
+
+struct Profile {
+  std::vector<unsigned long> times;   // of each step, from the first
+  long position;
+};
+
+static void runTo(RampProbe& stepper, long target, size_t limit) {
+  stepper.moveTo(target);
+  while (stepTimes.size() < limit) {
+    stubMicros += stepper.interval;
+    if (!stepper.run()) break;
+  }
+}
+
+static Profile profile(const Move& move, bool fixedPoint) {
+  RampProbe stepper;
+  stepper.setFixedPoint(fixedPoint);
+  stepper.setMaxSpeed(move.maxSpeed);
+  stepper.setAcceleration(move.acceleration);
+  stepTimes.clear();
+  stubMicros = 0;
+  runTo(stepper, move.target, labs(move.target) * 2 + 10);
+  Profile result = {stepTimes, stepper.currentPosition()};
+  return result;
+}
+
+static void compare(const Move& move) {
+  Profile reference = profile(move, false);
+  Profile fixed = profile(move, true);
+  char message[160];
+
+  TEST_ASSERT_EQUAL(move.target, reference.position);
+  TEST_ASSERT_EQUAL(move.target, fixed.position);
+
+  // AccelStepper can overshoot by a step or two and come back; it has to do
+  // the same either way. Compare the ramp up step by step and the total time.
+  TEST_ASSERT_EQUAL(reference.times.size(), fixed.times.size());
+  unsigned long worst = 0;
+  for (size_t i = 0; i < reference.times.size() / 2; i++) {
+    unsigned long a = reference.times[i], b = fixed.times[i];
+    unsigned long error = a > b ? a - b : b - a;
+    if (error > worst) worst = error;
+  }
+  float referenceTime = reference.times.back() / 1e6f;
+  float fixedTime = fixed.times.back() / 1e6f;
+  snprintf(message, sizeof(message), "%g steps/s, %g steps/s/s, %ld steps: %.4f s float, %.4f s fixed, ramp drift %lu us",
+           move.maxSpeed, move.acceleration, move.target, referenceTime, fixedTime, worst);
+  TEST_MESSAGE(message);
+  TEST_ASSERT_FLOAT_WITHIN(referenceTime * 0.01f, referenceTime, fixedTime);
+  TEST_ASSERT_TRUE(worst <= reference.times.back() / 1000 + 10);
+}
+
+// The dispenser's gantry settings, a short move that never reaches maxSpeed,
+// a slow axis and a fast one
+void test_profiles_match() {
+  const Move moves[] = {
+    {5000.0f, 5000.0f, 11000},
+    {5000.0f, 5000.0f, -7600},
+    {5000.0f, 5000.0f, 300},
+    {200.0f, 50.0f, 1500},
+    {20000.0f, 40000.0f, 60000},
+    {1000.0f, 0.5f, 200},
+  };
+  for (const Move& move : moves) compare(move);
+}
+
+// stop() and a new target mid-move go through the same decisions in both
+void test_reversal_and_stop_match() {
+  for (int fixedPoint = 0; fixedPoint < 2; fixedPoint++) {
+    RampProbe stepper;
+    stepper.setFixedPoint(fixedPoint);
+    stepper.setMaxSpeed(5000.0f);
+    stepper.setAcceleration(5000.0f);
+    stepTimes.clear();
+    stubMicros = 0;
+
+    runTo(stepper, 10000, 3000);
+    runTo(stepper, -2000, 6000);
+    stepper.stop();
+    runTo(stepper, stepper.targetPosition(), 20000);
+    TEST_ASSERT_EQUAL(stepper.targetPosition(), stepper.currentPosition());
+    TEST_ASSERT_TRUE(stepper.currentPosition() > 2500 && stepper.currentPosition() < 4500);
+    TEST_ASSERT_FALSE(stepper.isRunning());
+  }
+}
+
+// Switching calculation mid-move carries on from the same speed
+void test_switch_mid_move() {
+  Move move = {5000.0f, 5000.0f, 11000};
+  Profile reference = profile(move, false);
+
+  RampProbe stepper;
+  stepper.setMaxSpeed(move.maxSpeed);
+  stepper.setAcceleration(move.acceleration);
+  stepTimes.clear();
+  stubMicros = 0;
+  runTo(stepper, move.target, 1000);
+  stepper.setFixedPoint(true);
+  runTo(stepper, move.target, 6000);
+  stepper.setFixedPoint(false);
+  runTo(stepper, move.target, 20000);
+
+  TEST_ASSERT_EQUAL(move.target, stepper.currentPosition());
+  TEST_ASSERT_EQUAL(reference.times.size(), stepTimes.size());
+  for (size_t i = 1; i < stepTimes.size(); i++) {
+    long a = reference.times[i] - reference.times[i - 1];
+    long b = stepTimes[i] - stepTimes[i - 1];
+    TEST_ASSERT_TRUE(labs(a - b) <= 2);
+  }
+}
+
+static double stepsPerSecond(bool fixedPoint) {
+  const long steps = 2000000;
+  RampProbe stepper;
+  stepper.setFixedPoint(fixedPoint);
+  stepper.setMaxSpeed(40000.0f);
+  stepper.setAcceleration(20000.0f);
+  stepTimes.clear();
+  stepTimes.reserve(steps);
+  stubMicros = 0;
+  auto start = std::chrono::steady_clock::now();
+  runTo(stepper, steps, steps);
+  auto elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+  return stepTimes.size() / elapsed;
+}
+
+// Host numbers only show the relative cost; the ESP32 has no double precision
+// FPU, so the float path loses by more there
+void test_benchmark() {
+  double floatRate = stepsPerSecond(false);
+  double fixedRate = stepsPerSecond(true);
+  char message[128];
+  snprintf(message, sizeof(message), "run() with computeNewSpeed: %.2f M steps/s float, %.2f M steps/s fixed (x%.2f)",
+           floatRate / 1e6, fixedRate / 1e6, fixedRate / floatRate);
+  TEST_MESSAGE(message);
+  TEST_ASSERT_TRUE(floatRate > 0 && fixedRate > 0);
+}
+
+int main(int argc, char** argv) {
+  UNITY_BEGIN();
+  RUN_TEST(test_profiles_match);
+  RUN_TEST(test_reversal_and_stop_match);
+  RUN_TEST(test_switch_mid_move);
+  RUN_TEST(test_benchmark);
+  return UNITY_END();
+}
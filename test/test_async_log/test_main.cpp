@@ -0,0 +1,201 @@
+// Host-side tests for the deferred logger: pio test -e native
+//
+// Log is started without its task, so each test drains it by hand into a
+// capturing Print. The producer test uses real threads against the ring.
+#include <unity.h>
+#include <thread>
+#include <vector>
+#include "Async_Log.h"
+#include "Storage_Manager.h"
+
+class CapturePrint : public Print {
+public:
+  String text;
+  using Print::write;
+  size_t write(uint8_t c) override { return write(&c, 1); }
+  size_t write(const uint8_t* buffer, size_t size) override {
+    text.concat((const char*)buffer, size);
+    return size;
+  }
+};
+
+static CapturePrint capture;
+
+static int countOf(const String& text, const char* needle) {
+  int count = 0;
+  for (int at = text.indexOf(needle); at >= 0; at = text.indexOf(needle, at + 1)) count++;
+  return count;
+}
+
+void setUp() {
+  stubMicros = 5000000UL;
+  Log.setLevel(LOG_LEVEL);
+  Log.begin(capture, false);
+  Log.drain();
+  capture.text = "";
+}
+void tearDown() {}
+
+void test_lines_keep_order_and_level() {
+  stubMicros = 12345678UL;
+  LOGI("first %d", 1);
+  LOGW("second %s", "two");
+  LOGE("third");
+  TEST_ASSERT_EQUAL(3, Log.pending());
+  TEST_ASSERT_EQUAL_STRING("", capture.text.c_str());
+
+  TEST_ASSERT_EQUAL(3, Log.drain());
+  TEST_ASSERT_EQUAL_STRING("[12.345 I] first 1\n[12.345 W] second two\n[12.345 E] third\n", capture.text.c_str());
+  TEST_ASSERT_EQUAL(0, Log.pending());
+}
+
+void test_debug_is_compiled_out() {
+  int evaluated = 0;
+  LOGD("never %d", ++evaluated);
+  TEST_ASSERT_EQUAL(0, evaluated);
+  TEST_ASSERT_EQUAL(0, Log.pending());
+}
+
+void test_runtime_level() {
+  Log.setLevel(LOG_LEVEL_WARN);
+  LOGI("quiet");
+  LOGW("loud");
+  Log.drain();
+  TEST_ASSERT_EQUAL(-1, capture.text.indexOf("quiet"));
+  TEST_ASSERT_TRUE(capture.text.indexOf("loud") >= 0);
+
+  // Never above what was compiled in
+  Log.setLevel(LOG_LEVEL_DEBUG);
+  TEST_ASSERT_EQUAL(LOG_LEVEL, Log.getLevel());
+}
+
+void test_long_lines_are_cut() {
+  char text[LOG_LINE_SIZE * 2];
+  memset(text, 'x', sizeof(text) - 1);
+  text[sizeof(text) - 1] = '\0';
+  LOGI("%s", text);
+  Log.drain();
+  TEST_ASSERT_EQUAL(strlen("[5.000 I] ") + LOG_LINE_SIZE - 1 + 1, capture.text.length());
+  TEST_ASSERT_TRUE(capture.text.endsWith("x\n"));
+}
+
+static void busy(int i) {
+  LOGI("busy %d", i);
+}
+
+void test_call_sites_are_rate_limited() {
+  uint32_t suppressed = Log.getStats().suppressed;
+  for (int i = 0; i < LOG_RATE_BURST + 15; i++) {
+    busy(i);
+    LOGW("other %d", i);
+    if (i == 0) LOGI("rare");
+  }
+  Log.drain();
+  TEST_ASSERT_EQUAL(LOG_RATE_BURST, countOf(capture.text, "busy"));
+  TEST_ASSERT_EQUAL(1, countOf(capture.text, "rare"));
+  TEST_ASSERT_EQUAL(suppressed + 30, Log.getStats().suppressed);
+
+  // The next window starts over and says how much was skipped
+  capture.text = "";
+  stubMicros += LOG_RATE_WINDOW * 1000UL;
+  busy(100);
+  busy(101);
+  Log.drain();
+  TEST_ASSERT_EQUAL_STRING("[6.000 I] busy 100 (15 more suppressed)\n[6.000 I] busy 101\n", capture.text.c_str());
+}
+
+void test_full_ring_drops_and_reports() {
+  uint32_t dropped = Log.getStats().dropped;
+  for (int i = 0; i < LOG_RING_SIZE + 5; i++) {
+    LogSite site = {};
+    Log.write(LOG_LEVEL_INFO, site, "line %d", i);
+  }
+  TEST_ASSERT_EQUAL(LOG_RING_SIZE, Log.pending());
+  TEST_ASSERT_EQUAL(dropped + 5, Log.getStats().dropped);
+
+  TEST_ASSERT_EQUAL(LOG_RING_SIZE, Log.drain());
+  TEST_ASSERT_TRUE(capture.text.startsWith("[5.000 W] 5 log lines dropped, ring full\n[5.000 I] line 0\n"));
+  TEST_ASSERT_TRUE(capture.text.endsWith("line 31\n"));
+
+  // Reported once only
+  capture.text = "";
+  LOGI("after");
+  Log.drain();
+  TEST_ASSERT_EQUAL_STRING("[5.000 I] after\n", capture.text.c_str());
+}
+
+// Several tasks log at once while another drains; every line arrives whole
+// and each task's lines stay in order
+void test_concurrent_producers() {
+  const int producers = 4;
+  const int perProducer = 2000;
+  uint32_t droppedBefore = Log.getStats().dropped;
+  std::vector<std::thread> threads;
+  for (int p = 0; p < producers; p++) {
+    threads.emplace_back([p] {
+      for (int i = 0; i < perProducer; i++) {
+        LogSite site = {};
+        Log.write(LOG_LEVEL_INFO, site, "p%d %d", p, i);
+        if (i % 64 == 0) std::this_thread::yield();
+      }
+    });
+  }
+  size_t received = 0;
+  while (received + (Log.getStats().dropped - droppedBefore) < (size_t)(producers * perProducer)) {
+    received += Log.drain();
+    std::this_thread::yield();
+  }
+  for (std::thread& t : threads) t.join();
+  uint32_t dropped = Log.getStats().dropped - droppedBefore;
+  TEST_ASSERT_EQUAL(producers * perProducer, received + dropped);
+
+  int last[producers];
+  for (int p = 0; p < producers; p++) last[p] = -1;
+  int lines = 0;
+  for (int start = 0; start < (int)capture.text.length();) {
+    int end = capture.text.indexOf('\n', start);
+    TEST_ASSERT_TRUE(end > start);
+    String line = capture.text.substring(start, end);
+    start = end + 1;
+    int p, i;
+    if (sscanf(line.c_str(), "[5.000 I] p%d %d", &p, &i) != 2) continue;
+    TEST_ASSERT_TRUE(p >= 0 && p < producers);
+    TEST_ASSERT_TRUE(i > last[p]);
+    last[p] = i;
+    lines++;
+  }
+  TEST_ASSERT_EQUAL(received, lines);
+}
+
+void test_file_mirror_rotates() {
+  SD.stubFormat();
+  TEST_ASSERT_TRUE(Storage.begin(STORAGE_SD));
+  TEST_ASSERT_TRUE(Log.mirrorToFile(Storage, "/test.log", 200));
+  for (int i = 0; i < LOG_RATE_BURST; i++) {
+    LOGI("mirrored line %02d", i);
+    Log.drain();                                  // one small write per line
+  }
+  TEST_ASSERT_TRUE(Storage.exists("/test.log.1"));
+  TEST_ASSERT_TRUE(Storage.getFileSize("/test.log") <= 200);
+  TEST_ASSERT_EQUAL(Storage.getFileSize("/test.log"), Log.getStats().fileBytes);
+  String current = Storage.readFile("/test.log");
+  TEST_ASSERT_TRUE(current.endsWith("mirrored line 09\n"));
+  TEST_ASSERT_TRUE(capture.text.endsWith(current));
+
+  Log.mirrorToFile(Storage, "/test.log", 0);
+  TEST_ASSERT_FALSE(Log.mirroring());
+  Storage.end();
+}
+
+int main(int argc, char** argv) {
+  UNITY_BEGIN();
+  RUN_TEST(test_lines_keep_order_and_level);
+  RUN_TEST(test_debug_is_compiled_out);
+  RUN_TEST(test_runtime_level);
+  RUN_TEST(test_long_lines_are_cut);
+  RUN_TEST(test_call_sites_are_rate_limited);
+  RUN_TEST(test_full_ring_drops_and_reports);
+  RUN_TEST(test_concurrent_producers);
+  RUN_TEST(test_file_mirror_rotates);
+  return UNITY_END();
+}
@@ -0,0 +1,305 @@
+// Homing and max travel state machines against a simulated gantry:
+// pio test -e native
+#include <unity.h>
+#include <stdio.h>
+#include "Axis_Calibration.h"
+
+void setUp() {}
+void tearDown() {}
+
+// One carriage on a rail. The switches have 3 steps of hysteresis, like a
+// lever microswitch: closed at the end, open again 3 steps back from it.
+struct Rail {
+  uint8_t minPin;
+  uint8_t maxPin;
+  long position;      // physical, in steps from the min end
+  long length;
+  bool flagSwitch;    // min switch only pulses as the carriage passes it
+  long steps;
+};
+
+static Rail railX = {35, 4};
+static Rail railY = {2, 34};
+static Rail railZ = {36, AXIS_NO_END_STOP};
+
+static void updateSwitches(Rail& rail) {
+  if (rail.flagSwitch) {
+    if (rail.position == 0) {
+      stubSetPin(rail.minPin, HIGH);
+      stubSetPin(rail.minPin, LOW);
+    }
+  } else {
+    if (rail.position <= 0) stubSetPin(rail.minPin, HIGH);
+    if (rail.position >= 3) stubSetPin(rail.minPin, LOW);
+  }
+  if (rail.maxPin != AXIS_NO_END_STOP) {
+    if (rail.position >= rail.length) stubSetPin(rail.maxPin, HIGH);
+    if (rail.position <= rail.length - 3) stubSetPin(rail.maxPin, LOW);
+  }
+}
+
+static void stepRail(Rail& rail, int direction) {
+  rail.position += direction;
+  rail.steps++;
+  updateSwitches(rail);
+}
+
+static void forwardX() { stepRail(railX, 1); }
+static void backwardX() { stepRail(railX, -1); }
+static void forwardY() { stepRail(railY, 1); }
+static void backwardY() { stepRail(railY, -1); }
+static void forwardZ() { stepRail(railZ, 1); }
+static void backwardZ() { stepRail(railZ, -1); }
+
+static void placeRail(Rail& rail, long position, long length, bool flagSwitch = false) {
+  rail.position = position;
+  rail.length = length;
+  rail.flagSwitch = flagSwitch;
+  rail.steps = 0;
+  stubSetPin(rail.minPin, LOW);
+  if (rail.maxPin != AXIS_NO_END_STOP) stubSetPin(rail.maxPin, LOW);
+  updateSwitches(rail);
+}
+
+// The dispenser's run settings; fast approach at run speed, retract like
+// the old sketch's back-off pass
+static const AxisCalibrationConfig gantry = {5000.0f, 10000.0f, 100.0f, 100.0f, 20000, 200, 5000.0f, 5000.0f, 50};
+
+static long mostStepsPerUpdate;
+
+// Runs the motion task loop until no axis is busy. Returns seconds taken.
+static float runCalibration(AxisCalibration** axes, size_t count, unsigned long limitUs = 120000000) {
+  unsigned long started = stubMicros;
+  bool busy = true;
+  while (busy && stubMicros - started < limitUs) {
+    stubMicros += 20;
+    busy = false;
+    for (size_t i = 0; i < count; i++) {
+      Rail& rail = i == 0 ? railX : railZ;
+      long before = rail.steps;
+      if (axes[i]->update()) busy = true;
+      if (rail.steps - before > mostStepsPerUpdate) mostStepsPerUpdate = rail.steps - before;
+    }
+  }
+  return (stubMicros - started) / 1e6f;
+}
+
+void test_homes_and_finds_max_travel() {
+  AccelStepper stepperX(forwardX, backwardX);
+  AccelStepper stepperZ(forwardZ, backwardZ);
+  AxisCalibration x(stepperX, railX.minPin, railX.maxPin);
+  AxisCalibration z(stepperZ, railZ.minPin);
+  x.begin(gantry);
+  z.begin(gantry);
+  placeRail(railX, 5000, 12000);
+  placeRail(railZ, 800, 3000);
+
+  TEST_ASSERT_TRUE(x.start(true));
+  TEST_ASSERT_TRUE(z.start(true));
+  TEST_ASSERT_FALSE(x.start(true));
+  AxisCalibration* axes[] = {&x, &z};
+  mostStepsPerUpdate = 0;
+  float seconds = runCalibration(axes, 2);
+  TEST_ASSERT_EQUAL(1, mostStepsPerUpdate);
+
+  TEST_ASSERT_EQUAL(AXIS_CAL_DONE, x.getState());
+  TEST_ASSERT_EQUAL(AXIS_CAL_DONE, z.getState());
+  TEST_ASSERT_TRUE(x.isHomed());
+  TEST_ASSERT_TRUE(z.isHomed());
+
+  // Position 0 is where the min switch opens; max is where the max switch opens
+  TEST_ASSERT_EQUAL(railX.position - 3, stepperX.currentPosition());
+  TEST_ASSERT_EQUAL(12000 - 3 - 3, x.maxPosition());
+  TEST_ASSERT_EQUAL(railZ.position - 3, stepperZ.currentPosition());
+  TEST_ASSERT_EQUAL(0, z.maxPosition());
+
+  // Run settings are back
+  TEST_ASSERT_EQUAL_FLOAT(5000.0f, stepperX.maxSpeed());
+  TEST_ASSERT_EQUAL_FLOAT(5000.0f, stepperX.acceleration());
+
+  // The same search with the old sketch's 500 steps/s approach
+  AxisCalibrationConfig slow = gantry;
+  slow.fastSpeed = 500.0f;
+  x.begin(slow);
+  placeRail(railX, 5000, 12000);
+  TEST_ASSERT_TRUE(x.start(true));
+  AxisCalibration* xOnly[] = {&x};
+  float slowSeconds = runCalibration(xOnly, 1);
+  TEST_ASSERT_EQUAL(12000 - 3 - 3, x.maxPosition());
+
+  char message[128];
+  snprintf(message, sizeof(message), "X and Z calibrated in %.2f s; X alone with a 500 steps/s approach: %.2f s",
+           seconds, slowSeconds);
+  TEST_MESSAGE(message);
+  TEST_ASSERT_TRUE(seconds < slowSeconds);
+}
+
+// A switch that is only closed for an instant between two update() calls is
+// caught by the interrupt latch
+void test_interrupt_catches_short_pulse() {
+  AccelStepper stepperX(forwardX, backwardX);
+  AxisCalibration x(stepperX, railX.minPin, railX.maxPin);
+  x.begin(gantry);
+  placeRail(railX, 2000, 12000, true);
+
+  TEST_ASSERT_TRUE(x.start(false));
+  AxisCalibration* axes[] = {&x};
+  runCalibration(axes, 1, 5000000);
+  // The flag never reads closed, so the slow pass confirms straight away
+  TEST_ASSERT_EQUAL(AXIS_CAL_DONE, x.getState());
+  TEST_ASSERT_TRUE(railX.position <= 0 && railX.position > -10);
+
+  // Without the interrupt the pulse is missed and the search runs out
+  detachInterrupt(railX.minPin);
+  placeRail(railX, 2000, 12000, true);
+  TEST_ASSERT_TRUE(x.start(false));
+  runCalibration(axes, 1);
+  TEST_ASSERT_EQUAL(AXIS_CAL_FAILED, x.getState());
+  TEST_ASSERT_EQUAL_STRING("min end stop not reached", x.failureReason());
+  TEST_ASSERT_FALSE(x.isHomed());
+}
+
+void test_missing_or_stuck_switch_fails() {
+  AccelStepper stepperX(forwardX, backwardX);
+  AxisCalibration x(stepperX, railX.minPin, railX.maxPin);
+  AxisCalibrationConfig config = gantry;
+  config.maxTravel = 3000;
+  x.begin(config);
+  AxisCalibration* axes[] = {&x};
+
+  // Further from the switch than maxTravel
+  placeRail(railX, 5000, 12000);
+  TEST_ASSERT_TRUE(x.start(true));
+  runCalibration(axes, 1);
+  TEST_ASSERT_EQUAL(AXIS_CAL_FAILED, x.getState());
+  TEST_ASSERT_EQUAL(5000 - 3000, railX.position);
+
+  // Switch wired closed
+  placeRail(railX, 5000, 12000);
+  stubPinLevel[railX.minPin] = HIGH;
+  railX.flagSwitch = true;   // and the rail never changes it
+  TEST_ASSERT_TRUE(x.start(true));
+  runCalibration(axes, 1);
+  TEST_ASSERT_EQUAL(AXIS_CAL_FAILED, x.getState());
+  TEST_ASSERT_EQUAL_STRING("min end stop stuck closed", x.failureReason());
+  TEST_ASSERT_EQUAL(5000 + 200, railX.position);
+  stubPinLevel[railX.minPin] = LOW;
+}
+
+void test_cancel_stops_at_once() {
+  AccelStepper stepperX(forwardX, backwardX);
+  AxisCalibration x(stepperX, railX.minPin, railX.maxPin);
+  x.begin(gantry);
+  placeRail(railX, 5000, 12000);
+
+  TEST_ASSERT_TRUE(x.start(true));
+  for (int i = 0; i < 5000; i++) {
+    stubMicros += 20;
+    x.update();
+  }
+  TEST_ASSERT_TRUE(x.busy());
+  x.cancel();
+  TEST_ASSERT_EQUAL(AXIS_CAL_IDLE, x.getState());
+  TEST_ASSERT_FALSE(x.isHomed());
+  TEST_ASSERT_FALSE(stepperX.isRunning());
+  long stoppedAt = railX.position;
+  stubMicros += 20;
+  TEST_ASSERT_FALSE(x.update());
+  TEST_ASSERT_EQUAL(stoppedAt, railX.position);
+}
+
+static float runGantry(GantryCalibration& gantryCalibration) {
+  unsigned long started = stubMicros;
+  while (gantryCalibration.update() && stubMicros - started < 120000000) stubMicros += 20;
+  return (stubMicros - started) / 1e6f;
+}
+
+// Boot with a stored calibration: home both, verify the shorter X, trust Y
+void test_gantry_verifies_stored_travel() {
+  AccelStepper stepperX(forwardX, backwardX);
+  AccelStepper stepperY(forwardY, backwardY);
+  AxisCalibration x(stepperX, railX.minPin, railX.maxPin);
+  AxisCalibration y(stepperY, railY.minPin, railY.maxPin);
+  x.begin(gantry);
+  y.begin(gantry);
+  AxisCalibration* axes[] = {&x, &y};
+  GantryCalibration gantryCalibration;
+  TEST_ASSERT_TRUE(gantryCalibration.begin(axes, 2));
+
+  placeRail(railX, 300, 13000);
+  placeRail(railY, 300, 18000);
+  gantryCalibration.start();
+  float fullSeconds = runGantry(gantryCalibration);
+  TEST_ASSERT_EQUAL(GANTRY_CALIBRATED, gantryCalibration.getResult());
+  TEST_ASSERT_EQUAL(12994, gantryCalibration.maxPosition(0));
+  TEST_ASSERT_EQUAL(17994, gantryCalibration.maxPosition(1));
+
+  // Parked near home, as after a normal shutdown
+  const long stored[] = {12994, 17994};
+  placeRail(railX, 300, 13000);
+  placeRail(railY, 300, 18000);
+  gantryCalibration.start(stored, 0);
+  float verifySeconds = runGantry(gantryCalibration);
+  TEST_ASSERT_EQUAL(GANTRY_VERIFIED, gantryCalibration.getResult());
+  TEST_ASSERT_EQUAL(12994, gantryCalibration.maxPosition(0));
+  TEST_ASSERT_EQUAL(17994, gantryCalibration.maxPosition(1));
+  TEST_ASSERT_EQUAL(railX.position - 3, stepperX.currentPosition());
+  TEST_ASSERT_EQUAL(railY.position - 3, stepperY.currentPosition());
+  TEST_ASSERT_EQUAL(0, stepperY.currentPosition());
+
+  char message[96];
+  snprintf(message, sizeof(message), "full calibration %.2f s, verify %.2f s", fullSeconds, verifySeconds);
+  TEST_MESSAGE(message);
+  TEST_ASSERT_TRUE(verifySeconds < fullSeconds);
+}
+
+// The X end stop was moved since the calibration was stored
+void test_gantry_recalibrates_when_verify_fails() {
+  AccelStepper stepperX(forwardX, backwardX);
+  AccelStepper stepperY(forwardY, backwardY);
+  AxisCalibration x(stepperX, railX.minPin, railX.maxPin);
+  AxisCalibration y(stepperY, railY.minPin, railY.maxPin);
+  x.begin(gantry);
+  y.begin(gantry);
+  AxisCalibration* axes[] = {&x, &y};
+  GantryCalibration gantryCalibration;
+  gantryCalibration.begin(axes, 2);
+
+  // Further out than stored: the approach is cut off
+  const long stored[] = {12000, 17994};
+  placeRail(railX, 300, 13000);
+  placeRail(railY, 300, 18000);
+  gantryCalibration.start(stored, 0);
+  runGantry(gantryCalibration);
+  TEST_ASSERT_EQUAL(GANTRY_CALIBRATED, gantryCalibration.getResult());
+  TEST_ASSERT_EQUAL(12994, gantryCalibration.maxPosition(0));
+  TEST_ASSERT_EQUAL(17994, gantryCalibration.maxPosition(1));
+
+  // Closer in than stored, just past the tolerance
+  const long storedLong[] = {12994 + 60, 17994};
+  placeRail(railX, 300, 13000);
+  placeRail(railY, 300, 18000);
+  gantryCalibration.start(storedLong, 0);
+  runGantry(gantryCalibration);
+  TEST_ASSERT_EQUAL(GANTRY_CALIBRATED, gantryCalibration.getResult());
+  TEST_ASSERT_EQUAL(12994, gantryCalibration.maxPosition(0));
+
+  // Within tolerance is still a pass
+  const long storedClose[] = {12994 + 40, 17994};
+  placeRail(railX, 300, 13000);
+  placeRail(railY, 300, 18000);
+  gantryCalibration.start(storedClose, 0);
+  runGantry(gantryCalibration);
+  TEST_ASSERT_EQUAL(GANTRY_VERIFIED, gantryCalibration.getResult());
+}
+
+int main(int argc, char** argv) {
+  UNITY_BEGIN();
+  RUN_TEST(test_homes_and_finds_max_travel);
+  RUN_TEST(test_interrupt_catches_short_pulse);
+  RUN_TEST(test_missing_or_stuck_switch_fails);
+  RUN_TEST(test_cancel_stops_at_once);
+  RUN_TEST(test_gantry_verifies_stored_travel);
+  RUN_TEST(test_gantry_recalibrates_when_verify_fails);
+  return UNITY_END();
+}
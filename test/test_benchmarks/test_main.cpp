@@ -0,0 +1,221 @@
+// Per-request cost of the API hot paths, in CPU cycles:
+//   pio test -e native -f test_benchmarks
+//   pio test -e esp32dev -f test_benchmarks      (board attached, SD optional)
+//
+// Each benchmark repeats one request's worth of work, takes the fastest of
+// BENCH_ROUNDS rounds to shed interrupts and host scheduling noise, and
+// prints the cycles per request next to the baseline in bench_baseline.h.
+// Cycles come from ESP.getCycleCount(); the native stand-in counts at 240 MHz
+// so the two targets read in the same unit.
+#include <unity.h>
+#include <Arduino.h>
+#include <vector>
+#include "Web_Session.h"
+#include "Prescription_List.h"
+#include "Notification_List.h"
+#include "bench_baseline.h"
+
+#define BENCH_ROUNDS 5
+#define BENCH_RX_PATH "/bench_rx.dat"
+#define BENCH_RX_TOTAL 120          // records in the store, spread over BENCH_DOCTORS
+#define BENCH_DOCTORS 6
+#define BENCH_NOTIFICATIONS 60
+
+// A run slower than baseline by more than this fails; 0 reports only.
+// Host timings depend on the machine, so native only reports by default.
+#ifndef BENCH_REGRESSION_PERCENT
+#ifdef ARDUINO_ARCH_ESP32
+#define BENCH_REGRESSION_PERCENT 150
+#else
+#define BENCH_REGRESSION_PERCENT 0
+#endif
+#endif
+
+static const char* benchBody =
+  "{\"id\":\"RX-2024-555\",\"patientName\":\"Maria Garcia\",\"patientMRN\":\"MRN-55667788\","
+  "\"ward\":\"emergency\",\"bedNumber\":\"ER-07\",\"status\":\"pending\",\"date\":\"2024-01-20\","
+  "\"prescribingPhysician\":\"Dr. Sarah Johnson\",\"medications\":["
+  "{\"medicationName\":\"Medicine 1\",\"strength\":\"500mg\",\"dosageForm\":\"capsule\",\"frequency\":\"tid\"},"
+  "{\"medicationName\":\"Medicine 8\",\"strength\":\"500mg\",\"dosageForm\":\"tablet\",\"frequency\":\"bid\"}]}";
+
+static std::vector<Notification> benchNotifications;
+static String benchCookies[8];
+static bool benchStorageReady = false;
+
+static uint32_t baselineFor(const char* name) {
+  for (const BenchBaseline& b : benchBaselines) {
+    if (strcmp(b.name, name) == 0) return b.cycles;
+  }
+  return 0;
+}
+
+// Fastest round, in cycles per call of op
+template <typename Op>
+static uint32_t measure(Op op, uint32_t iterations) {
+  for (uint32_t i = 0; i < iterations / 10 + 1; i++) op(i);    // warm caches
+  uint32_t best = UINT32_MAX;
+  for (int round = 0; round < BENCH_ROUNDS; round++) {
+    uint32_t start = ESP.getCycleCount();
+    for (uint32_t i = 0; i < iterations; i++) op(i);
+    uint32_t perOp = (ESP.getCycleCount() - start) / iterations;
+    if (perOp < best) best = perOp;
+  }
+  return best;
+}
+
+static void report(const char* name, uint32_t cycles) {
+  uint32_t baseline = baselineFor(name);
+  char message[128];
+  if (baseline == 0) {
+    snprintf(message, sizeof(message), "BENCH %s: %lu cycles (no baseline)", name, (unsigned long)cycles);
+  } else {
+    long delta = ((long)cycles - (long)baseline) * 100 / (long)baseline;
+    snprintf(message, sizeof(message), "BENCH %s: %lu cycles (baseline %lu, %+ld%%)", name,
+             (unsigned long)cycles, (unsigned long)baseline, delta);
+  }
+  TEST_MESSAGE(message);
+  if (BENCH_REGRESSION_PERCENT > 0 && baseline > 0 &&
+      (uint64_t)cycles * 100 > (uint64_t)baseline * BENCH_REGRESSION_PERCENT) {
+    TEST_FAIL_MESSAGE(message);
+  }
+}
+
+static String doctorName(int n) {
+  return "doctor" + String(n);
+}
+
+// Store, sessions and notifications shaped like a busy ward
+static void prepareData() {
+  Sessions.begin();
+  Sessions.clear();
+  for (size_t i = 0; i < SESSION_TABLE_CAPACITY; i++) {
+    SessionToken token;
+    for (size_t b = 0; b < SESSION_TOKEN_SIZE; b++) token.bytes[b] = (uint8_t)(i * 31 + b * 7 + 1);
+    Sessions.create(token, doctorName(i % BENCH_DOCTORS).c_str(), "Dr. Bench");
+    if (i < 8) {
+      char text[SESSION_TOKEN_TEXT_LENGTH + 1];
+      formatSessionToken(token, text);
+      benchCookies[i] = String("theme=dark; session_token=") + text;
+    }
+  }
+
+  benchNotifications.clear();
+  for (int i = 0; i < BENCH_NOTIFICATIONS; i++) {
+    benchNotifications.push_back({"NOTIF-" + String(i), "Prescription Dispensed",
+                                  "Medicine 4 for James Anderson has been successfully dispensed. Patient notified.",
+                                  "success", "4 hours ago", (i & 1) != 0, false, "RX-2024-007",
+                                  doctorName(i % BENCH_DOCTORS)});
+  }
+
+#ifndef ARDUINO_ARCH_ESP32
+  SD.stubFormat();
+#endif
+  benchStorageReady = Storage.begin(STORAGE_SD) || Storage.begin(STORAGE_SPIFFS);
+  if (!benchStorageReady) return;
+  Storage.remove(BENCH_RX_PATH);
+  benchStorageReady = Prescriptions.begin(Storage, BENCH_RX_PATH, 256);
+  for (int i = 0; benchStorageReady && i < BENCH_RX_TOTAL; i++) {
+    Prescription rx;
+    parsePrescriptionJson(benchBody, strlen(benchBody), rx);
+    rx.id = "RX-BENCH-" + String(i);
+    rx.prescribingUsername = doctorName(i % BENCH_DOCTORS);
+    benchStorageReady = Prescriptions.append(rx);
+  }
+}
+
+static void releaseData() {
+  Prescriptions.end();
+  if (benchStorageReady) Storage.remove(BENCH_RX_PATH);
+  Storage.end();
+}
+
+// Runs a JSON stream to the end through a response-sized buffer
+static size_t drain(JsonArraySource* source) {
+  static uint8_t buffer[1436];
+  JsonArrayStream stream(source);
+  size_t total = 0;
+  size_t n;
+  while ((n = stream.fill(buffer, sizeof(buffer))) > 0) total += n;
+  return total;
+}
+
+void setUp() {}
+void tearDown() {}
+
+void bench_session_token() {
+  volatile uint8_t sink = 0;
+  uint32_t cycles = measure([&](uint32_t i) {
+    SessionToken token = sessionTokenFromHeaders(benchCookies[i & 7].c_str(), nullptr);
+    sink = sink + token.bytes[0];
+  }, 2000);
+  report("session_token", cycles);
+}
+
+void bench_validate_session() {
+  SessionToken tokens[8];
+  for (int i = 0; i < 8; i++) tokens[i] = sessionTokenFromHeaders(benchCookies[i].c_str(), nullptr);
+  size_t valid = 0;
+  uint32_t cycles = measure([&](uint32_t i) {
+    if (validateSession(tokens[i & 7])) valid++;
+  }, 2000);
+  TEST_ASSERT_TRUE(valid > 0);
+  report("validate_session", cycles);
+}
+
+void bench_prescription_list() {
+  if (!benchStorageReady) TEST_IGNORE_MESSAGE("No storage for the prescription store");
+  PrescriptionQuery query;
+  uint16_t latest = Prescriptions.latestForUser(doctorName(1));
+  size_t bytes = 0;
+  uint32_t cycles = measure([&](uint32_t i) {
+    bytes = drain(new PrescriptionListSource(latest, query, 0));
+  }, 20);
+  TEST_ASSERT_TRUE(bytes > 1000);
+  report("prescription_list", cycles);
+}
+
+void bench_notification_filter() {
+  size_t bytes = 0;
+  uint32_t cycles = measure([&](uint32_t i) {
+    bytes = drain(new NotificationListSource(benchNotifications, doctorName(i % BENCH_DOCTORS)));
+  }, 200);
+  TEST_ASSERT_TRUE(bytes > 100);
+  report("notification_filter", cycles);
+}
+
+void bench_prescription_parse() {
+  size_t length = strlen(benchBody);
+  bool ok = true;
+  uint32_t cycles = measure([&](uint32_t i) {
+    Prescription rx;
+    ok = parsePrescriptionJson(benchBody, length, rx) && ok;
+  }, 200);
+  TEST_ASSERT_TRUE(ok);
+  report("prescription_parse", cycles);
+}
+
+static int runBenchmarks() {
+  prepareData();
+  UNITY_BEGIN();
+  RUN_TEST(bench_session_token);
+  RUN_TEST(bench_validate_session);
+  RUN_TEST(bench_prescription_list);
+  RUN_TEST(bench_notification_filter);
+  RUN_TEST(bench_prescription_parse);
+  int failures = UNITY_END();
+  releaseData();
+  return failures;
+}
+
+#ifdef ARDUINO_ARCH_ESP32
+void setup() {
+  delay(2000);    // let the test runner open the port
+  runBenchmarks();
+}
+
+void loop() {}
+#else
+int main(int argc, char** argv) {
+  return runBenchmarks();
+}
+#endif
@@ -0,0 +1,143 @@
+// Host-side tests for the cabinet map: pio test -e native
+#include <unity.h>
+#include <string.h>
+#include "Cabinet_Map.h"
+
+void setUp() {}
+void tearDown() {}
+
+static CabinetMap map;
+
+static bool parseText(const char* text) {
+  return map.parse(text, strlen(text));
+}
+
+// The coordinates cabinetNumber() used to hard-code
+void test_default_matches_old_layout() {
+  const long expected[9][2] = {
+    {2000, 1800}, {7500, 1800}, {13000, 1800},
+    {2000, 9400}, {7500, 9400}, {13000, 9400},
+    {2000, 17100}, {7400, 17100}, {13000, 17100},
+  };
+  map.loadDefault();
+  TEST_ASSERT_EQUAL(9, map.slotCount());
+  for (uint8_t cabinet = 1; cabinet <= 9; cabinet++) {
+    MotionPoint position;
+    TEST_ASSERT_TRUE(map.slotPosition(cabinet, position));
+    TEST_ASSERT_EQUAL(expected[cabinet - 1][0], position.x);
+    TEST_ASSERT_EQUAL(expected[cabinet - 1][1], position.y);
+    TEST_ASSERT_EQUAL(cabinet, map.firstSlot(cabinet));
+    TEST_ASSERT_EQUAL(0, map.nextSlot(cabinet));
+  }
+  TEST_ASSERT_EQUAL_STRING("Medicine 4", map.drugName(4));
+  TEST_ASSERT_EQUAL(8, map.drugByName("medicine 8"));
+  TEST_ASSERT_EQUAL(0, map.drugByName("Medicine 10"));
+  TEST_ASSERT_EQUAL(0, map.drugByName("Medicine"));
+}
+
+// A bigger cabinet: more than nine drugs, some in several slots
+void test_bigger_cabinet_needs_no_code() {
+  const char* text =
+    "# 4 columns, 5 rows\r\n"
+    "grid 4 5\r\n"
+    "origin 1000 1500\n"
+    "pitch 3000 3500   # steps\n"
+    "\n"
+    "offset 20 -50 25\n"
+    "drug 1 1,6,20 Paracetamol 500mg\n"
+    "drug 12 2 Amoxicillin\n"
+    "drug 17 3,4  Metformin  \n"
+    "stock 1 0\n"
+    "stock 6 4\n";
+  TEST_ASSERT_TRUE(parseText(text));
+  TEST_ASSERT_EQUAL(0, map.errorLine());
+  TEST_ASSERT_EQUAL(20, map.slotCount());
+  TEST_ASSERT_EQUAL(17, map.maxDrug());
+
+  MotionPoint position;
+  TEST_ASSERT_TRUE(map.slotPosition(6, position));      // column 1, row 1
+  TEST_ASSERT_EQUAL(4000, position.x);
+  TEST_ASSERT_EQUAL(5000, position.y);
+  TEST_ASSERT_TRUE(map.slotPosition(20, position));     // column 3, row 4
+  TEST_ASSERT_EQUAL(1000 + 3 * 3000 - 50, position.x);
+  TEST_ASSERT_EQUAL(1500 + 4 * 3500 + 25, position.y);
+  TEST_ASSERT_FALSE(map.slotPosition(21, position));
+
+  TEST_ASSERT_EQUAL(1, map.firstSlot(1));
+  TEST_ASSERT_EQUAL(6, map.nextSlot(1));
+  TEST_ASSERT_EQUAL(20, map.nextSlot(6));
+  TEST_ASSERT_EQUAL(0, map.nextSlot(20));
+  TEST_ASSERT_EQUAL(1, map.drugAt(20));
+  TEST_ASSERT_EQUAL(0, map.drugAt(5));
+  TEST_ASSERT_EQUAL_STRING("Paracetamol 500mg", map.drugName(1));
+  TEST_ASSERT_EQUAL_STRING("Metformin", map.drugName(17));
+  TEST_ASSERT_EQUAL(12, map.drugByName("AMOXICILLIN"));
+  TEST_ASSERT_NULL(map.drugName(2));
+
+  TEST_ASSERT_EQUAL(0, map.stock(1));
+  TEST_ASSERT_EQUAL(CABINET_STOCK_UNKNOWN, map.stock(20));
+}
+
+// Nearest slot with stock, in gantry travel time
+void test_pick_nearest_slot_with_stock() {
+  const char* text =
+    "grid 4 5\n"
+    "origin 1000 1500\n"
+    "pitch 3000 3500\n"
+    "drug 1 1,6,20 Paracetamol\n"
+    "stock 1 0\n"
+    "stock 6 4\n";
+  TEST_ASSERT_TRUE(parseText(text));
+  MotionPlanner planner({5000.0f, 5000.0f}, {5000.0f, 5000.0f});
+  MotionPoint home = {0, 0};
+
+  // Slot 1 is closest but empty
+  TEST_ASSERT_EQUAL(6, map.pickSlot(1, 1, home, planner));
+  // Slot 6 has only 4
+  TEST_ASSERT_EQUAL(20, map.pickSlot(1, 5, home, planner));
+
+  MotionPoint farCorner = {10000, 15500};
+  TEST_ASSERT_EQUAL(20, map.pickSlot(1, 1, farCorner, planner));
+
+  TEST_ASSERT_TRUE(map.takeStock(6, 4));
+  TEST_ASSERT_FALSE(map.takeStock(6, 1));
+  TEST_ASSERT_EQUAL(20, map.pickSlot(1, 1, home, planner));
+  TEST_ASSERT_TRUE(map.takeStock(20, 100));     // untracked
+  map.setStock(20, 0);
+  TEST_ASSERT_EQUAL(0, map.pickSlot(1, 1, home, planner));
+  TEST_ASSERT_EQUAL(0, map.pickSlot(2, 1, home, planner));
+}
+
+void test_bad_file_keeps_current_map() {
+  map.loadDefault();
+  const char* bad[] = {
+    "grid 3 3\ndrug 1 10 Out of range\n",
+    "grid 3 3\ndrug 1 1 A\ndrug 2 1 Same slot\n",
+    "grid 3 3\ndrug 1 1 A\ndrug 1 2 Same id twice\n",
+    "grid 3 3\ndrug 1 1\n",
+    "offset 1 0 0\ngrid 3 3\n",
+    "grid 9 9\n",
+    "grid 3 3\nshelf 1\n",
+    "origin 1 2\n",
+  };
+  const size_t lines[] = {2, 3, 3, 2, 1, 1, 2, 2};
+  for (size_t i = 0; i < sizeof(bad) / sizeof(bad[0]); i++) {
+    TEST_ASSERT_FALSE(parseText(bad[i]));
+    TEST_ASSERT_EQUAL(lines[i], map.errorLine());
+  }
+
+  // Still the default map
+  MotionPoint position;
+  TEST_ASSERT_TRUE(map.slotPosition(8, position));
+  TEST_ASSERT_EQUAL(7400, position.x);
+  TEST_ASSERT_EQUAL_STRING("Medicine 9", map.drugName(9));
+}
+
+int main(int argc, char** argv) {
+  UNITY_BEGIN();
+  RUN_TEST(test_default_matches_old_layout);
+  RUN_TEST(test_bigger_cabinet_needs_no_code);
+  RUN_TEST(test_pick_nearest_slot_with_stock);
+  RUN_TEST(test_bad_file_keeps_current_map);
+  return UNITY_END();
+}
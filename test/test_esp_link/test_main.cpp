@@ -0,0 +1,308 @@
+// Host-side tests for the web <-> dispenser UART link: pio test -e native
+//
+// Serial1 and Serial2 from test/stubs are cross-wired, so both ends of the
+// protocol run in this process: the web side through DispenseQueue on
+// Serial2, and a stand-in dispenser on Serial1 that parses orders with
+// Dispense_Batch and answers as the real one would.
+#include <unity.h>
+#include "Dispense_Queue.h"
+
+static ESPrxtxESP web(&Serial2);
+static ESPrxtxESP dispenser(&Serial1);
+
+static uint32_t now() { return millis(); }
+static void advance(uint32_t ms) { stubMicros += (unsigned long)ms * 1000UL; }
+
+// Lines the dispenser has received since the last call. DispenseQueue sends
+// through the TX task, so wait for it to hand everything to the UART first.
+static std::vector<String> dispenserLines() {
+  while (web.txPending() > 0) vTaskDelay(1);
+  std::vector<String> lines;
+  while (dispenser.available()) lines.push_back(dispenser.read());
+  return lines;
+}
+
+static void deliverReplies() {
+  while (web.available()) DispenseJobs.handleMessage(web.read());
+}
+
+static uint32_t enqueueOne(const char* rxId, int medication, int quantity, uint16_t record = 0) {
+  int medications[] = {medication};
+  int quantities[] = {quantity};
+  return DispenseJobs.enqueue(rxId, record, medications, quantities, 1);
+}
+
+static DispenseState stateOf(uint32_t id) {
+  DispenseJob job;
+  return DispenseJobs.get(id, job) ? job.state : DISPENSE_EMPTY;
+}
+
+void setUp() {
+  HardwareSerial::stubLink(Serial1, Serial2);
+  Serial1.stubReset();
+  Serial2.stubReset();
+  dispenser.flushReader();
+  web.flushReader();
+  stubMicros = 1000000UL;
+  SD.stubFormat();
+  TEST_ASSERT_TRUE(Storage.begin(STORAGE_SD));
+  TEST_ASSERT_TRUE(DispenseJobs.begin(Storage, web));
+}
+
+void tearDown() {
+  DispenseJobs.end();
+  Storage.end();
+}
+
+void test_text_and_frames_share_the_line() {
+  web.send("PING");
+  const uint8_t payload[] = {0x00, 0x01, 0x00, 0xFF};
+  TEST_ASSERT_TRUE(web.sendFrame(ESP_FRAME_USER, payload, sizeof(payload)));
+  web.send("STATUS");
+
+  TEST_ASSERT_TRUE(dispenser.available());
+  TEST_ASSERT_EQUAL_STRING("PING", dispenser.read().c_str());
+  ESPFrame frame;
+  TEST_ASSERT_TRUE(dispenser.readFrame(frame));
+  TEST_ASSERT_EQUAL(ESP_FRAME_USER, frame.type);
+  TEST_ASSERT_EQUAL(sizeof(payload), frame.length);
+  TEST_ASSERT_EQUAL_MEMORY(payload, frame.payload, sizeof(payload));
+  TEST_ASSERT_EQUAL_STRING("STATUS", dispenser.read().c_str());
+}
+
+void test_corrupted_frame_is_counted_and_dropped() {
+  uint8_t wire[ESP_FRAME_ENCODED_MAX + 2];
+  const uint8_t payload[] = {'D', 'O', 'N', 'E'};
+  size_t n = ESPFrameCodec::encodeFrame(ESP_FRAME_TEXT, 7, payload, sizeof(payload), wire);
+  uint32_t errors = dispenser.frameStats().crcErrors;
+  wire[3] ^= 0x20;
+  Serial1.stubReceive(wire, n);
+  TEST_ASSERT_FALSE(dispenser.available());
+  TEST_ASSERT_EQUAL(errors + 1, dispenser.frameStats().crcErrors);
+
+  // The link recovers at the next frame boundary
+  web.setFramedText(true);
+  web.send("AFTER");
+  web.setFramedText(false);
+  TEST_ASSERT_TRUE(dispenser.available());
+  TEST_ASSERT_EQUAL_STRING("AFTER", dispenser.read().c_str());
+}
+
+void test_partial_line_before_a_frame_is_counted() {
+  uint32_t dropped = dispenser.frameStats().textDropped;
+  const char partial[] = "DISPENSE:12";
+  Serial1.stubReceive((const uint8_t*)partial, strlen(partial));
+  web.setFramedText(true);
+  web.send("PING");
+  web.setFramedText(false);
+
+  TEST_ASSERT_TRUE(dispenser.available());
+  TEST_ASSERT_EQUAL_STRING("PING", dispenser.read().c_str());
+  TEST_ASSERT_FALSE(dispenser.available());
+  TEST_ASSERT_EQUAL(dropped + strlen(partial), dispenser.frameStats().textDropped);
+}
+
+void test_order_round_trip() {
+  uint32_t id = enqueueOne("RX-42", 3, 2);
+  TEST_ASSERT_NOT_EQUAL(0, id);
+  TEST_ASSERT_EQUAL(DISPENSE_QUEUED, stateOf(id));
+
+  advance(DISPENSE_BATCH_HOLD);
+  DispenseJobs.update(now());
+  std::vector<String> lines = dispenserLines();
+  TEST_ASSERT_EQUAL(1, lines.size());
+  TEST_ASSERT_TRUE(lines[0].startsWith("DISPENSE:"));
+  TEST_ASSERT_EQUAL(DISPENSE_SENT, stateOf(id));
+
+  DispenseBatch batch;
+  TEST_ASSERT_TRUE(parseDispenseBatch(lines[0].c_str(), lines[0].length(), batch));
+  TEST_ASSERT_EQUAL(1, batch.orderCount);
+  TEST_ASSERT_EQUAL(id, batch.orders[0].job);
+  TEST_ASSERT_EQUAL_STRING("RX-42", batch.orders[0].prescriptionId);
+  TEST_ASSERT_EQUAL(3, batch.orders[0].medication[0]);
+  TEST_ASSERT_EQUAL(2, batch.orders[0].quantity[0]);
+
+  dispenser.sendAck(id);
+  deliverReplies();
+  TEST_ASSERT_EQUAL(DISPENSE_ACCEPTED, stateOf(id));
+
+  dispenser.send("DONE:" + String(id));
+  deliverReplies();
+  TEST_ASSERT_EQUAL(DISPENSE_DONE, stateOf(id));
+  TEST_ASSERT_EQUAL(0, DispenseJobs.pending());
+}
+
+void test_orders_arriving_together_share_a_batch() {
+  uint32_t first = enqueueOne("RX-1", 1, 1);
+  advance(50);
+  uint32_t second = enqueueOne("RX-2", 2, 1);
+  advance(DISPENSE_BATCH_HOLD);
+  DispenseJobs.update(now());
+
+  std::vector<String> lines = dispenserLines();
+  TEST_ASSERT_EQUAL(1, lines.size());
+  DispenseBatch batch;
+  TEST_ASSERT_TRUE(lines[0].startsWith("BATCH:"));
+  TEST_ASSERT_TRUE(parseDispenseBatch(lines[0].c_str(), lines[0].length(), batch));
+  TEST_ASSERT_EQUAL(2, batch.orderCount);
+  TEST_ASSERT_EQUAL(first, batch.orders[0].job);
+  TEST_ASSERT_EQUAL(second, batch.orders[1].job);
+}
+
+void test_unacknowledged_order_is_resent_with_backoff() {
+  uint32_t id = enqueueOne("RX-7", 4, 1);
+  advance(DISPENSE_BATCH_HOLD);
+  DispenseJobs.update(now());
+  TEST_ASSERT_EQUAL(1, dispenserLines().size());
+
+  // Nothing goes out again before the ACK timeout
+  advance(DISPENSE_ACK_TIMEOUT - 1);
+  DispenseJobs.update(now());
+  TEST_ASSERT_EQUAL(0, dispenserLines().size());
+  TEST_ASSERT_EQUAL(1, DispenseJobs.nextDueIn(now()));
+
+  advance(1);
+  DispenseJobs.update(now());
+  std::vector<String> lines = dispenserLines();
+  TEST_ASSERT_EQUAL(1, lines.size());
+  DispenseBatch batch;
+  TEST_ASSERT_TRUE(parseDispenseBatch(lines[0].c_str(), lines[0].length(), batch));
+  TEST_ASSERT_EQUAL(id, batch.orders[0].job);
+
+  // Once accepted, only a reply can change anything
+  dispenser.sendAck(id);
+  deliverReplies();
+  TEST_ASSERT_EQUAL(DISPENSE_ACCEPTED, stateOf(id));
+  TEST_ASSERT_TRUE(DispenseJobs.nextDueIn(now()) > DISPENSE_MAX_BACKOFF);
+}
+
+// An order accepted before a reset is asked about again after it
+void test_open_order_survives_restart() {
+  uint32_t id = enqueueOne("RX-9", 5, 3);
+  advance(DISPENSE_BATCH_HOLD);
+  DispenseJobs.update(now());
+  dispenser.sendAck(id);
+  deliverReplies();
+  dispenserLines();
+
+  DispenseJobs.end();
+  TEST_ASSERT_TRUE(DispenseJobs.begin(Storage, web));
+  TEST_ASSERT_EQUAL(1, DispenseJobs.pending());
+  advance(DISPENSE_BATCH_HOLD);
+  DispenseJobs.update(now());
+
+  std::vector<String> lines = dispenserLines();
+  TEST_ASSERT_EQUAL(1, lines.size());
+  DispenseBatch batch;
+  TEST_ASSERT_TRUE(parseDispenseBatch(lines[0].c_str(), lines[0].length(), batch));
+  TEST_ASSERT_EQUAL(id, batch.orders[0].job);
+  TEST_ASSERT_EQUAL_STRING("RX-9", batch.orders[0].prescriptionId);
+
+  dispenser.send("FAIL:" + String(id) + ":0");
+  deliverReplies();
+  TEST_ASSERT_EQUAL(DISPENSE_FAILED, stateOf(id));
+}
+
+// Medications without a cabinet are reported as not dispensed
+void test_unknown_medication_fails_its_order() {
+  DispenseOrder orders[3] = {
+    {7, "RX-A", 2, {3, 0}, {1, 1}},
+    {8, "RX-B", 1, {0}, {2}},
+    {9, "RX-C", 1, {3}, {1}},
+  };
+  char line[DISPENSE_BATCH_MAX_LINE + 1];
+  TEST_ASSERT_NOT_EQUAL(0, formatDispenseBatch(orders, 3, line, sizeof(line)));
+  DispenseBatch batch;
+  TEST_ASSERT_TRUE(parseDispenseBatch(line, strlen(line), batch));
+  TEST_ASSERT_EQUAL(1, batch.pickCount);
+
+  // Nothing to pick for RX-B, so it is answered at once
+  char reply[32];
+  TEST_ASSERT_EQUAL(0, batch.remaining[1]);
+  TEST_ASSERT_TRUE(formatDispenseResult(batch, 1, reply, sizeof(reply)) > 0);
+  TEST_ASSERT_EQUAL_STRING("FAIL:8:0", reply);
+
+  TEST_ASSERT_EQUAL(0x05, completeDispensePick(batch, 0));
+  formatDispenseResult(batch, 0, reply, sizeof(reply));
+  TEST_ASSERT_EQUAL_STRING("FAIL:7:1", reply);
+  formatDispenseResult(batch, 2, reply, sizeof(reply));
+  TEST_ASSERT_EQUAL_STRING("DONE:9", reply);
+}
+
+static DispenseJob lastChange;
+static void recordChange(const DispenseJob& job) { lastChange = job; }
+
+// A job the dispenser took but never finished is given up on, not asked
+// about forever
+void test_silent_accepted_job_fails() {
+  lastChange = {};
+  DispenseJobs.onStateChange(recordChange);
+  uint32_t id = enqueueOne("RX-5", 2, 1);
+  advance(DISPENSE_BATCH_HOLD);
+  DispenseJobs.update(now());
+  dispenser.sendAck(id);
+  deliverReplies();
+  dispenserLines();
+
+  for (int i = 0; i < DISPENSE_MAX_QUERIES; i++) {
+    advance(DISPENSE_DONE_TIMEOUT);
+    DispenseJobs.update(now());
+    TEST_ASSERT_EQUAL(1, dispenserLines().size());
+    TEST_ASSERT_EQUAL(DISPENSE_ACCEPTED, stateOf(id));
+  }
+  advance(DISPENSE_DONE_TIMEOUT);
+  DispenseJobs.update(now());
+  TEST_ASSERT_EQUAL(0, dispenserLines().size());
+  TEST_ASSERT_EQUAL(DISPENSE_FAILED, stateOf(id));
+  TEST_ASSERT_EQUAL(id, lastChange.id);
+  TEST_ASSERT_EQUAL(DISPENSE_FAILED, lastChange.state);
+  TEST_ASSERT_EQUAL(0, DispenseJobs.pending());
+  DispenseJobs.onStateChange(nullptr);
+}
+
+// One long-running job must not block new ones once ids come round to its slot
+void test_open_job_does_not_block_the_queue() {
+  uint32_t stuck = enqueueOne("RX-STUCK", 1, 1, 0);
+  for (int i = 1; i <= DISPENSE_QUEUE_CAPACITY * 2; i++) {
+    String rxId = "RX-" + String(i);
+    TEST_ASSERT_NOT_EQUAL(0, enqueueOne(rxId.c_str(), 1, 1, i));
+    TEST_ASSERT_EQUAL(DISPENSE_CANCELLED, DispenseJobs.cancel(i));
+  }
+  TEST_ASSERT_EQUAL(DISPENSE_QUEUED, stateOf(stuck));
+
+  // Only a queue of open jobs is full
+  for (int i = 1; i < DISPENSE_QUEUE_CAPACITY; i++) TEST_ASSERT_NOT_EQUAL(0, enqueueOne("RX-FILL", 1, 1));
+  TEST_ASSERT_EQUAL(0, enqueueOne("RX-OVER", 1, 1));
+  TEST_ASSERT_EQUAL(DISPENSE_QUEUE_CAPACITY, DispenseJobs.pending());
+}
+
+// Ids carry on after a reset, so the dispenser never takes a new order
+// for a repeat of one it already served
+void test_job_ids_do_not_repeat_after_restart() {
+  uint32_t first = enqueueOne("RX-1", 1, 1);
+  DispenseJobs.end();
+  TEST_ASSERT_TRUE(DispenseJobs.begin(Storage, web));
+  TEST_ASSERT_TRUE(enqueueOne("RX-2", 1, 1) > first);
+
+  // Without storage there is nothing to carry on from
+  DispenseJobs.end();
+  Storage.end();
+  TEST_ASSERT_FALSE(DispenseJobs.begin(Storage, web));
+  TEST_ASSERT_NOT_EQUAL(1, enqueueOne("RX-3", 1, 1));
+}
+
+int main(int argc, char** argv) {
+  UNITY_BEGIN();
+  RUN_TEST(test_text_and_frames_share_the_line);
+  RUN_TEST(test_corrupted_frame_is_counted_and_dropped);
+  RUN_TEST(test_partial_line_before_a_frame_is_counted);
+  RUN_TEST(test_order_round_trip);
+  RUN_TEST(test_orders_arriving_together_share_a_batch);
+  RUN_TEST(test_unacknowledged_order_is_resent_with_backoff);
+  RUN_TEST(test_open_order_survives_restart);
+  RUN_TEST(test_unknown_medication_fails_its_order);
+  RUN_TEST(test_silent_accepted_job_fails);
+  RUN_TEST(test_open_job_does_not_block_the_queue);
+  RUN_TEST(test_job_ids_do_not_repeat_after_restart);
+  return UNITY_END();
+}
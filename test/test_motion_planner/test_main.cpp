@@ -0,0 +1,160 @@
+// Host-side tests for the cabinet visit planner: pio test -e native
+#include <unity.h>
+#include <algorithm>
+#include <math.h>
+#include <random>
+#include <stdio.h>
+#include "Motion_Planner.h"
+
+void setUp() {}
+void tearDown() {}
+
+// Speed and acceleration the dispenser sketch runs X and Y at
+static const AxisLimits MOTOR = {5000.0f, 5000.0f};
+
+// Cabinet centres from cabinetNumber(), cabinets 1..9
+static const MotionPoint CABINETS[9] = {
+  {2000, 1800}, {7500, 1800}, {13000, 1800},
+  {2000, 9400}, {7500, 9400}, {13000, 9400},
+  {2000, 17100}, {7400, 17100}, {13000, 17100},
+};
+
+static MotionPlanner planner(MOTOR, MOTOR);
+
+static float bruteForce(const MotionPoint& start, const MotionPoint* stops, size_t count, const MotionPoint* end) {
+  int order[MOTION_PLANNER_EXACT_MAX];
+  for (size_t i = 0; i < count; i++) order[i] = (int)i;
+  float best = INFINITY;
+  do {
+    float t = 0;
+    MotionPoint at = start;
+    for (size_t i = 0; i < count; i++) {
+      t += planner.moveTime(at, stops[order[i]]);
+      at = stops[order[i]];
+    }
+    if (end) t += planner.moveTime(at, *end);
+    best = std::min(best, t);
+  } while (std::next_permutation(order, order + count));
+  return best;
+}
+
+static void assertPermutation(const MotionPlan& plan) {
+  bool seen[MOTION_PLANNER_MAX_STOPS] = {false};
+  for (size_t i = 0; i < plan.count; i++) {
+    TEST_ASSERT_TRUE(plan.order[i] < plan.count);
+    TEST_ASSERT_FALSE(seen[plan.order[i]]);
+    seen[plan.order[i]] = true;
+  }
+}
+
+void test_axis_time_profiles() {
+  // 5000 steps/s at 5000 steps/s^2: full speed after 2500 steps of ramp up and down
+  TEST_ASSERT_FLOAT_WITHIN(1e-4f, 0.0f, MotionPlanner::axisTime(0, MOTOR));
+  TEST_ASSERT_FLOAT_WITHIN(1e-4f, 2.0f, MotionPlanner::axisTime(5000, MOTOR));
+  TEST_ASSERT_FLOAT_WITHIN(1e-4f, 2.0f, MotionPlanner::axisTime(-5000, MOTOR));
+  TEST_ASSERT_FLOAT_WITHIN(1e-4f, 3.0f, MotionPlanner::axisTime(10000, MOTOR));
+  // Short move never reaches maxSpeed: 2 * sqrt(1250 / 5000)
+  TEST_ASSERT_FLOAT_WITHIN(1e-4f, 1.0f, MotionPlanner::axisTime(1250, MOTOR));
+
+  // Both axes move together, so the slower one sets the time
+  MotionPlanner slowY(MOTOR, AxisLimits{1000.0f, 1000.0f});
+  MotionPoint a = {0, 0}, b = {10000, 1000};
+  TEST_ASSERT_FLOAT_WITHIN(1e-4f, 3.0f, slowY.moveTime(a, b));
+  b.y = 5000;
+  TEST_ASSERT_FLOAT_WITHIN(1e-4f, 6.0f, slowY.moveTime(a, b));
+}
+
+void test_exact_matches_brute_force() {
+  std::mt19937 rng(1234);
+  std::uniform_int_distribution<long> coord(0, 20000);
+  MotionPoint stops[7];
+  MotionPoint home = {0, 0};
+
+  for (int round = 0; round < 50; round++) {
+    size_t count = 1 + round % 7;
+    for (size_t i = 0; i < count; i++) stops[i] = {coord(rng), coord(rng)};
+    const MotionPoint* end = (round & 1) ? &home : nullptr;
+
+    MotionPlan plan;
+    TEST_ASSERT_TRUE(planner.plan(home, stops, count, plan, end));
+    TEST_ASSERT_TRUE(plan.exact);
+    TEST_ASSERT_EQUAL(count, plan.count);
+    assertPermutation(plan);
+    TEST_ASSERT_FLOAT_WITHIN(1e-3f, bruteForce(home, stops, count, end), plan.predictedSeconds);
+    TEST_ASSERT_TRUE(plan.predictedSeconds <= plan.naiveSeconds);
+  }
+}
+
+void test_heuristic_large_sets() {
+  std::mt19937 rng(99);
+  std::uniform_int_distribution<long> coord(0, 20000);
+  MotionPoint stops[MOTION_PLANNER_MAX_STOPS];
+  MotionPoint home = {0, 0};
+  float naive = 0, predicted = 0;
+
+  for (int round = 0; round < 20; round++) {
+    size_t count = MOTION_PLANNER_EXACT_MAX + 1 + round % (MOTION_PLANNER_MAX_STOPS - MOTION_PLANNER_EXACT_MAX);
+    for (size_t i = 0; i < count; i++) stops[i] = {coord(rng), coord(rng)};
+
+    MotionPlan plan;
+    TEST_ASSERT_TRUE(planner.plan(home, stops, count, plan));
+    TEST_ASSERT_FALSE(plan.exact);
+    assertPermutation(plan);
+    TEST_ASSERT_TRUE(plan.predictedSeconds <= plan.naiveSeconds);
+    naive += plan.naiveSeconds;
+    predicted += plan.predictedSeconds;
+  }
+
+  char message[96];
+  snprintf(message, sizeof(message), "random sets: naive %.1f s, planned %.1f s", naive, predicted);
+  TEST_MESSAGE(message);
+  TEST_ASSERT_TRUE(predicted < naive * 0.7f);
+
+  MotionPlan plan;
+  TEST_ASSERT_FALSE(planner.plan(home, stops, MOTION_PLANNER_MAX_STOPS + 1, plan));
+}
+
+// A shift-change batch touching every cabinet in prescription order
+void test_cabinet_batch_gain() {
+  const int visits[9] = {9, 1, 5, 3, 7, 2, 8, 4, 6};
+  MotionPoint stops[9];
+  for (int i = 0; i < 9; i++) stops[i] = CABINETS[visits[i] - 1];
+  MotionPoint home = {0, 0};
+
+  MotionPlan plan;
+  TEST_ASSERT_TRUE(planner.plan(home, stops, 9, plan, &home));
+  TEST_ASSERT_TRUE(plan.exact);
+  assertPermutation(plan);
+
+  char message[96];
+  snprintf(message, sizeof(message), "9 cabinets: naive %.2f s, planned %.2f s", plan.naiveSeconds, plan.predictedSeconds);
+  TEST_MESSAGE(message);
+  TEST_ASSERT_TRUE(plan.predictedSeconds < plan.naiveSeconds);
+
+  // Already optimal orders are kept as good as they are
+  MotionPoint row[3] = {CABINETS[0], CABINETS[1], CABINETS[2]};
+  TEST_ASSERT_TRUE(planner.plan(home, row, 3, plan));
+  TEST_ASSERT_FLOAT_WITHIN(1e-4f, plan.naiveSeconds, plan.predictedSeconds);
+}
+
+void test_empty_and_single() {
+  MotionPoint home = {0, 0};
+  MotionPlan plan;
+  TEST_ASSERT_TRUE(planner.plan(home, nullptr, 0, plan, &home));
+  TEST_ASSERT_EQUAL(0, plan.count);
+  TEST_ASSERT_FLOAT_WITHIN(1e-6f, 0.0f, plan.predictedSeconds);
+
+  TEST_ASSERT_TRUE(planner.plan(home, CABINETS, 1, plan, &home));
+  TEST_ASSERT_EQUAL(0, plan.order[0]);
+  TEST_ASSERT_FLOAT_WITHIN(1e-4f, 2 * planner.moveTime(home, CABINETS[0]), plan.predictedSeconds);
+}
+
+int main(int argc, char** argv) {
+  UNITY_BEGIN();
+  RUN_TEST(test_axis_time_profiles);
+  RUN_TEST(test_exact_matches_brute_force);
+  RUN_TEST(test_heuristic_large_sets);
+  RUN_TEST(test_cabinet_batch_gain);
+  RUN_TEST(test_empty_and_single);
+  return UNITY_END();
+}
@@ -0,0 +1,213 @@
+// Host-side tests for GET /api/prescriptions streaming: pio test -e native
+//
+// The store runs on the in-memory SD card from test/stubs. Responses are
+// drained through the same chunked filler AsyncWebServer would call, with
+// chunk sizes down to one byte, and compared byte for byte.
+#include <unity.h>
+#include <stdio.h>
+#include "Prescription_List.h"
+
+static Prescription makePrescription(int n, const char* username, const char* status, const char* date) {
+  Prescription rx;
+  rx.id = "RX" + String(n);
+  rx.patientName = "Patient " + String(n);
+  rx.patientMRN = "MRN" + String(1000 + n);
+  rx.ward = "Ward A";
+  rx.bedNumber = String(n);
+  rx.status = status;
+  rx.date = date;
+  rx.prescribingPhysician = "Dr. Test";
+  rx.prescribingUsername = username;
+  Medication med;
+  med.medicationName = "Paracetamol";
+  med.strength = "500mg";
+  med.dosageForm = "Tablet";
+  med.frequency = "BID";
+  rx.medications.push_back(med);
+  return rx;
+}
+
+static String expectedItem(int n, const char* status, const char* date) {
+  return "{\"id\":\"RX" + String(n) + "\",\"patientName\":\"Patient " + String(n) + "\",\"patientMRN\":\"MRN" +
+         String(1000 + n) + "\",\"ward\":\"Ward A\",\"bedNumber\":\"" + String(n) + "\",\"status\":\"" + status +
+         "\",\"date\":\"" + date + "\",\"prescribingPhysician\":\"Dr. Test\",\"medicationName\":\"Paracetamol\"," +
+         "\"strength\":\"500mg\",\"dosageForm\":\"Tablet\",\"frequency\":\"BID\"}";
+}
+
+// Runs a stream to the end, maxLen bytes per fill() call
+static String drain(JsonArraySource* source, size_t maxLen) {
+  JsonArrayStream stream(source);
+  String out;
+  uint8_t buffer[64];
+  size_t n;
+  while ((n = stream.fill(buffer, maxLen)) > 0) out.concat((const char*)buffer, n);
+  return out;
+}
+
+void setUp() {
+  SD.stubFormat();
+  SD.stubFailWrites = false;
+  TEST_ASSERT_TRUE(Storage.begin(STORAGE_SD));
+  TEST_ASSERT_TRUE(Prescriptions.begin(Storage, RX_STORE_DEFAULT_PATH, 256));
+}
+
+void tearDown() {
+  Prescriptions.end();
+  Storage.end();
+}
+
+void test_lists_newest_first_in_any_chunk_size() {
+  const char* dates[] = {"2025-01-01", "2025-01-02", "2025-01-03"};
+  for (int i = 0; i < 3; i++) {
+    TEST_ASSERT_TRUE(Prescriptions.append(makePrescription(i, "doctor1", "Pending", dates[i])));
+  }
+  TEST_ASSERT_TRUE(Prescriptions.append(makePrescription(9, "doctor2", "Pending", "2025-01-04")));
+
+  String expected = "{\"success\":true,\"data\":[" + expectedItem(2, "Pending", dates[2]) + "," +
+                    expectedItem(1, "Pending", dates[1]) + "," + expectedItem(0, "Pending", dates[0]) + "]}";
+  size_t sizes[] = {1, 2, 7, 64};
+  for (size_t maxLen : sizes) {
+    PrescriptionQuery query;
+    uint16_t start = Prescriptions.latestForUser("doctor1");
+    TEST_ASSERT_EQUAL_STRING(expected.c_str(), drain(new PrescriptionListSource(start, query, 0), maxLen).c_str());
+  }
+}
+
+void test_status_filter_and_paging() {
+  const char* statuses[] = {"Pending", "Dispensed", "Pending", "Cancelled", "Pending"};
+  for (int i = 0; i < 5; i++) {
+    TEST_ASSERT_TRUE(Prescriptions.append(makePrescription(i, "doctor1", statuses[i], "2025-02-01")));
+  }
+
+  PrescriptionQuery query;
+  query.statusMask = PrescriptionStore::statusMask("Pending");
+  uint16_t start = Prescriptions.latestForUser("doctor1");
+  String page1 = drain(new PrescriptionListSource(start, query, 2), 64);
+  // Record 0 is still unsent, so the first page points at it
+  String expected = "{\"success\":true,\"data\":[" + expectedItem(4, "Pending", "2025-02-01") + "," +
+                    expectedItem(2, "Pending", "2025-02-01") + "],\"nextCursor\":0}";
+  TEST_ASSERT_EQUAL_STRING(expected.c_str(), page1.c_str());
+
+  String page2 = drain(new PrescriptionListSource(0, query, 2), 64);
+  expected = "{\"success\":true,\"data\":[" + expectedItem(0, "Pending", "2025-02-01") + "]}";
+  TEST_ASSERT_EQUAL_STRING(expected.c_str(), page2.c_str());
+}
+
+void test_empty_list() {
+  PrescriptionQuery query;
+  uint16_t start = Prescriptions.latestForUser("nobody");
+  TEST_ASSERT_EQUAL(RX_STORE_NO_RECORD, start);
+  TEST_ASSERT_EQUAL_STRING("{\"success\":true,\"data\":[]}",
+                           drain(new PrescriptionListSource(start, query, 0), 5).c_str());
+}
+
+void test_escapes_and_truncates() {
+  JsonStageBuffer out;
+  out.beginObject();
+  out.add("name", "a\"b\\c\nd\te\x01");
+  out.endObject();
+  TEST_ASSERT_EQUAL_STRING("{\"name\":\"a\\\"b\\\\c\\nd\\te\\u0001\"}", out.c_str());
+
+  // An oversized value is cut short but the object still closes
+  String longValue;
+  for (int i = 0; i < JSON_STREAM_STAGE_SIZE * 2; i++) longValue += '"';
+  out.clear();
+  out.beginObject();
+  out.add("v", longValue);
+  out.endObject();
+  TEST_ASSERT_TRUE(out.length() < JSON_STREAM_STAGE_SIZE);
+  String staged(out.c_str());
+  TEST_ASSERT_TRUE(staged.startsWith("{\"v\":\"\\\""));
+  TEST_ASSERT_TRUE(staged.endsWith("\\\"\"}"));
+}
+
+// Through the chunked response, as main.cpp sends it
+void test_send_json_array_stream() {
+  TEST_ASSERT_TRUE(Prescriptions.append(makePrescription(1, "doctor1", "Ready", "2025-03-01")));
+  AsyncWebServerRequest request(HTTP_GET, "/api/prescriptions");
+  PrescriptionQuery query;
+  sendJsonArrayStream(&request, new PrescriptionListSource(Prescriptions.latestForUser("doctor1"), query, 0));
+  TEST_ASSERT_EQUAL(200, request.stubCode());
+  TEST_ASSERT_EQUAL_STRING("application/json", request.stubResponse->contentType.c_str());
+  String expected = "{\"success\":true,\"data\":[" + expectedItem(1, "Ready", "2025-03-01") + "]}";
+  TEST_ASSERT_EQUAL_STRING(expected.c_str(), request.stubBody().c_str());
+}
+
+// Records survive a remount: the index is rebuilt from the file
+void test_replay_after_remount() {
+  for (int i = 0; i < 4; i++) {
+    TEST_ASSERT_TRUE(Prescriptions.append(makePrescription(i, "doctor1", "Pending", "2025-04-01")));
+  }
+  TEST_ASSERT_TRUE(Prescriptions.updateStatus("RX2", "Dispensed", "doctor1"));
+  Prescriptions.end();
+  TEST_ASSERT_TRUE(Prescriptions.begin(Storage, RX_STORE_DEFAULT_PATH, 256));
+  TEST_ASSERT_EQUAL(4, Prescriptions.count());
+  TEST_ASSERT_EQUAL(4, Prescriptions.countForUser("doctor1"));
+
+  Prescription rx;
+  TEST_ASSERT_TRUE(Prescriptions.findById("RX2", rx, "doctor1"));
+  TEST_ASSERT_EQUAL_STRING("Dispensed", rx.status.c_str());
+  TEST_ASSERT_FALSE(Prescriptions.findById("RX2", rx, "doctor2"));
+}
+
+// A torn in-place rewrite in the middle of the file must not hide the
+// records after it, and later appends must not land on top of them
+void test_replay_skips_corrupt_middle_record() {
+  for (int i = 0; i < 4; i++) {
+    TEST_ASSERT_TRUE(Prescriptions.append(makePrescription(i, "doctor1", "Pending", "2025-04-01")));
+  }
+  Prescriptions.end();
+
+  File file = Storage.open(RX_STORE_DEFAULT_PATH, "r+");
+  TEST_ASSERT_TRUE(file.seek(RX_STORE_RECORD_SIZE + 100));
+  file.write((const uint8_t*)"torn", 4);
+  file.close();
+
+  TEST_ASSERT_TRUE(Prescriptions.begin(Storage, RX_STORE_DEFAULT_PATH, 256));
+  TEST_ASSERT_EQUAL(3, Prescriptions.count());
+  TEST_ASSERT_EQUAL(1, Prescriptions.holes());
+  TEST_ASSERT_EQUAL(4, Prescriptions.slots());
+  TEST_ASSERT_EQUAL(3, Prescriptions.countForUser("doctor1"));
+  Prescription rx;
+  TEST_ASSERT_FALSE(Prescriptions.read(1, rx));
+  TEST_ASSERT_FALSE(Prescriptions.findById("RX1", rx, "doctor1"));
+  TEST_ASSERT_TRUE(Prescriptions.findById("RX3", rx, "doctor1"));
+
+  TEST_ASSERT_TRUE(Prescriptions.append(makePrescription(4, "doctor1", "Pending", "2025-04-02")));
+  TEST_ASSERT_EQUAL(5 * RX_STORE_RECORD_SIZE, Storage.getFileSize(RX_STORE_DEFAULT_PATH));
+  TEST_ASSERT_TRUE(Prescriptions.findById("RX3", rx, "doctor1"));
+  TEST_ASSERT_TRUE(Prescriptions.findById("RX4", rx, "doctor1"));
+
+  // Newest first, the hole left out
+  PrescriptionQuery query;
+  String expected = "{\"success\":true,\"data\":[" + expectedItem(4, "Pending", "2025-04-02") + "," +
+                    expectedItem(3, "Pending", "2025-04-01") + "," + expectedItem(2, "Pending", "2025-04-01") + "," +
+                    expectedItem(0, "Pending", "2025-04-01") + "]}";
+  TEST_ASSERT_EQUAL_STRING(expected.c_str(),
+                           drain(new PrescriptionListSource(Prescriptions.latestForUser("doctor1"), query, 0), 7).c_str());
+}
+
+// Every saved prescription has to stay listable by its author
+void test_append_refused_when_physician_table_full() {
+  for (int i = 0; i < RX_STORE_MAX_PHYSICIANS; i++) {
+    String username = "doctor" + String(i);
+    TEST_ASSERT_TRUE(Prescriptions.append(makePrescription(i, username.c_str(), "Pending", "2025-05-01")));
+  }
+  TEST_ASSERT_FALSE(Prescriptions.append(makePrescription(999, "latecomer", "Pending", "2025-05-01")));
+  TEST_ASSERT_EQUAL(RX_STORE_MAX_PHYSICIANS, Prescriptions.count());
+  TEST_ASSERT_TRUE(Prescriptions.append(makePrescription(1000, "doctor7", "Pending", "2025-05-02")));
+  TEST_ASSERT_EQUAL(2, Prescriptions.countForUser("doctor7"));
+}
+
+int main(int argc, char** argv) {
+  UNITY_BEGIN();
+  RUN_TEST(test_lists_newest_first_in_any_chunk_size);
+  RUN_TEST(test_status_filter_and_paging);
+  RUN_TEST(test_empty_list);
+  RUN_TEST(test_escapes_and_truncates);
+  RUN_TEST(test_send_json_array_stream);
+  RUN_TEST(test_replay_after_remount);
+  RUN_TEST(test_replay_skips_corrupt_middle_record);
+  RUN_TEST(test_append_refused_when_physician_table_full);
+  return UNITY_END();
+}
@@ -0,0 +1,162 @@
+// Host-side tests for the session token codec: pio test -e native
+#include <unity.h>
+#include <chrono>
+#include <set>
+#include <string>
+#include <string.h>
+#include <stdio.h>
+#include "Session_Token.h"
+
+void setUp() {}
+void tearDown() {}
+
+static std::string encode(const char* data) {
+  char out[64];
+  base64UrlEncode((const uint8_t*)data, strlen(data), out);
+  return out;
+}
+
+// RFC 4648 test vectors, without padding
+void test_encode_known_vectors() {
+  TEST_ASSERT_EQUAL_STRING("", encode("").c_str());
+  TEST_ASSERT_EQUAL_STRING("Zg", encode("f").c_str());
+  TEST_ASSERT_EQUAL_STRING("Zm8", encode("fo").c_str());
+  TEST_ASSERT_EQUAL_STRING("Zm9v", encode("foo").c_str());
+  TEST_ASSERT_EQUAL_STRING("Zm9vYg", encode("foob").c_str());
+  TEST_ASSERT_EQUAL_STRING("Zm9vYmE", encode("fooba").c_str());
+  TEST_ASSERT_EQUAL_STRING("Zm9vYmFy", encode("foobar").c_str());
+
+  // The two characters that differ from standard base64
+  const uint8_t urlChars[] = {0xFB, 0xFF};
+  char out[8];
+  TEST_ASSERT_EQUAL(3, base64UrlEncode(urlChars, sizeof(urlChars), out));
+  TEST_ASSERT_EQUAL_STRING("-_8", out);
+}
+
+void test_round_trip_all_lengths() {
+  uint8_t data[48];
+  uint8_t decoded[48];
+  char text[BASE64URL_LENGTH(48) + 1];
+  for (size_t i = 0; i < sizeof(data); i++) data[i] = (uint8_t)(i * 37 + 11);
+
+  for (size_t length = 0; length <= sizeof(data); length++) {
+    size_t written = base64UrlEncode(data, length, text);
+    TEST_ASSERT_EQUAL(BASE64URL_LENGTH(length), written);
+    TEST_ASSERT_EQUAL(written, strlen(text));
+    TEST_ASSERT_TRUE(base64UrlDecode(text, written, decoded, length));
+    if (length > 0) TEST_ASSERT_EQUAL_MEMORY(data, decoded, length);
+  }
+}
+
+void test_parse_rejects_bad_tokens() {
+  SessionToken token;
+  generateSessionToken(token);
+  char text[SESSION_TOKEN_TEXT_LENGTH + 1];
+  TEST_ASSERT_EQUAL(SESSION_TOKEN_TEXT_LENGTH, formatSessionToken(token, text));
+
+  SessionToken parsed;
+  TEST_ASSERT_TRUE(parseSessionToken(text, SESSION_TOKEN_TEXT_LENGTH, parsed));
+  TEST_ASSERT_EQUAL_MEMORY(token.bytes, parsed.bytes, SESSION_TOKEN_SIZE);
+
+  SessionToken untouched = {};
+  TEST_ASSERT_FALSE(parseSessionToken(text, SESSION_TOKEN_TEXT_LENGTH - 1, untouched));
+  TEST_ASSERT_FALSE(parseSessionToken(nullptr, SESSION_TOKEN_TEXT_LENGTH, untouched));
+
+  char bad[SESSION_TOKEN_TEXT_LENGTH + 1];
+  memcpy(bad, text, sizeof(bad));
+  bad[5] = '+';   // standard base64, not base64url
+  TEST_ASSERT_FALSE(parseSessionToken(bad, SESSION_TOKEN_TEXT_LENGTH, untouched));
+  bad[5] = '=';
+  TEST_ASSERT_FALSE(parseSessionToken(bad, SESSION_TOKEN_TEXT_LENGTH, untouched));
+
+#if SESSION_TOKEN_SIZE % 3 != 0
+  // Non-zero unused trailing bits would give the same token a second spelling
+  memcpy(bad, text, sizeof(bad));
+  bad[SESSION_TOKEN_TEXT_LENGTH - 1] = '_';
+  TEST_ASSERT_FALSE(parseSessionToken(bad, SESSION_TOKEN_TEXT_LENGTH, untouched));
+#endif
+
+  static const SessionToken none = {};
+  TEST_ASSERT_EQUAL_MEMORY(none.bytes, untouched.bytes, SESSION_TOKEN_SIZE);
+}
+
+// Every bit should be set about half the time and every byte value about
+// equally often. The bounds are loose enough that a working RNG fails them
+// with negligible probability.
+void test_token_distribution() {
+  const int samples = 20000;
+  static uint32_t bitCounts[SESSION_TOKEN_SIZE * 8];
+  static uint32_t byteCounts[256];
+  memset(bitCounts, 0, sizeof(bitCounts));
+  memset(byteCounts, 0, sizeof(byteCounts));
+  std::set<std::string> seen;
+
+  char text[SESSION_TOKEN_TEXT_LENGTH + 1];
+  for (int n = 0; n < samples; n++) {
+    SessionToken token;
+    generateSessionToken(token);
+    for (size_t i = 0; i < SESSION_TOKEN_SIZE; i++) {
+      byteCounts[token.bytes[i]]++;
+      for (int b = 0; b < 8; b++) {
+        if (token.bytes[i] & (1 << b)) bitCounts[i * 8 + b]++;
+      }
+    }
+    formatSessionToken(token, text);
+    seen.insert(text);
+  }
+  TEST_ASSERT_EQUAL_MESSAGE(samples, (int)seen.size(), "duplicate tokens");
+
+  // Each bit: mean 10000, sigma ~71; allow 6 sigma
+  for (size_t i = 0; i < SESSION_TOKEN_SIZE * 8; i++) {
+    TEST_ASSERT_UINT32_WITHIN(430, samples / 2, bitCounts[i]);
+  }
+
+  // Chi-square over byte values, 255 degrees of freedom; p < 1e-6 above ~380
+  double expected = (double)samples * SESSION_TOKEN_SIZE / 256.0;
+  double chiSquare = 0;
+  for (int v = 0; v < 256; v++) {
+    double d = byteCounts[v] - expected;
+    chiSquare += d * d / expected;
+  }
+  char message[64];
+  snprintf(message, sizeof(message), "byte chi-square %.1f", chiSquare);
+  TEST_MESSAGE(message);
+  TEST_ASSERT_TRUE_MESSAGE(chiSquare < 380.0, message);
+}
+
+void test_throughput() {
+  const int iterations = 200000;
+  char text[SESSION_TOKEN_TEXT_LENGTH + 1];
+  SessionToken token;
+  uint32_t sink = 0;
+
+  auto start = std::chrono::steady_clock::now();
+  for (int n = 0; n < iterations; n++) {
+    generateSessionToken(token);
+    sink += formatSessionToken(token, text);
+  }
+  double generateSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+  start = std::chrono::steady_clock::now();
+  for (int n = 0; n < iterations; n++) {
+    sink += parseSessionToken(text, SESSION_TOKEN_TEXT_LENGTH, token);
+  }
+  double parseSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+  char message[128];
+  snprintf(message, sizeof(message), "generate+format %.0f tokens/s, parse %.0f tokens/s (%u)",
+           iterations / generateSeconds, iterations / parseSeconds, (unsigned)(sink & 1));
+  TEST_MESSAGE(message);
+  TEST_ASSERT_TRUE(generateSeconds < 5.0);
+  TEST_ASSERT_TRUE(parseSeconds < 5.0);
+}
+
+int main(int argc, char** argv) {
+  UNITY_BEGIN();
+  RUN_TEST(test_encode_known_vectors);
+  RUN_TEST(test_round_trip_all_lengths);
+  RUN_TEST(test_parse_rejects_bad_tokens);
+  RUN_TEST(test_token_distribution);
+  RUN_TEST(test_throughput);
+  return UNITY_END();
+}
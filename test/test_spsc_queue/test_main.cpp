@@ -0,0 +1,141 @@
+// Host-side tests for the task hand-off queue: pio test -e native
+//
+// The threads play the web task (producer) and the comm task (consumer).
+#include <unity.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <stdio.h>
+#include <thread>
+#include <vector>
+#include "Spsc_Queue.h"
+
+void setUp() {}
+void tearDown() {}
+
+struct Order {
+  uint32_t id;
+  uint8_t payload[27];
+};
+
+void test_fifo_full_and_wrap() {
+  SpscQueue<uint32_t, 4> queue;
+  uint32_t value;
+  TEST_ASSERT_TRUE(queue.empty());
+  TEST_ASSERT_FALSE(queue.pop(value));
+
+  // Go round the ring several times
+  uint32_t next = 0;
+  uint32_t expected = 0;
+  for (int round = 0; round < 10; round++) {
+    while (queue.push(next)) next++;
+    TEST_ASSERT_EQUAL(4, queue.count());
+    TEST_ASSERT_EQUAL(0, queue.space());
+    TEST_ASSERT_TRUE(queue.pop(value));
+    TEST_ASSERT_EQUAL(expected++, value);
+    TEST_ASSERT_TRUE(queue.pop(value));
+    TEST_ASSERT_EQUAL(expected++, value);
+    TEST_ASSERT_EQUAL(2, queue.space());
+  }
+  while (queue.pop(value)) TEST_ASSERT_EQUAL(expected++, value);
+  TEST_ASSERT_EQUAL(next, expected);
+  TEST_ASSERT_TRUE(queue.empty());
+}
+
+// Items cross threads intact and in order, with the queue often full
+void test_two_threads_keep_order() {
+  static SpscQueue<Order, 8> queue;
+  const uint32_t total = 100000;
+  std::atomic<uint32_t> corrupt(0);
+
+  std::thread consumer([&] {
+    Order order;
+    uint32_t expected = 0;
+    while (expected < total) {
+      if (!queue.pop(order)) {
+        // Let the producer in even on a single-core host
+        std::this_thread::sleep_for(std::chrono::microseconds(20));
+        continue;
+      }
+      if (order.id != expected) corrupt++;
+      for (uint8_t byte : order.payload) {
+        if (byte != (uint8_t)order.id) corrupt++;
+      }
+      expected++;
+    }
+  });
+
+  for (uint32_t id = 0; id < total; id++) {
+    Order order;
+    order.id = id;
+    std::fill(order.payload, order.payload + sizeof(order.payload), (uint8_t)id);
+    while (!queue.push(order)) std::this_thread::sleep_for(std::chrono::microseconds(20));
+  }
+  consumer.join();
+  TEST_ASSERT_EQUAL(0, corrupt.load());
+  TEST_ASSERT_TRUE(queue.empty());
+}
+
+// Stand-in for xTaskNotifyGive()/ulTaskNotifyTake()
+class Notification {
+  std::mutex mutex;
+  std::condition_variable cv;
+  bool pending = false;
+
+public:
+  void give() {
+    std::lock_guard<std::mutex> guard(mutex);
+    pending = true;
+    cv.notify_one();
+  }
+  void take() {
+    std::unique_lock<std::mutex> guard(mutex);
+    cv.wait(guard, [this] { return pending; });
+    pending = false;
+  }
+};
+
+// Push + notify wakes a sleeping consumer in microseconds; the old loop()
+// only looked every 10 ms
+void test_handoff_latency() {
+  typedef std::chrono::steady_clock Clock;
+  static SpscQueue<Clock::time_point, 16> queue;
+  Notification wake;
+  const int total = 2000;
+  std::vector<double> latencies;
+  latencies.reserve(total);
+
+  std::thread consumer([&] {
+    Clock::time_point sentAt;
+    while ((int)latencies.size() < total) {
+      wake.take();
+      while (queue.pop(sentAt)) {
+        latencies.push_back(std::chrono::duration<double, std::micro>(Clock::now() - sentAt).count());
+      }
+    }
+  });
+
+  for (int i = 0; i < total; i++) {
+    queue.push(Clock::now());
+    wake.give();
+    std::this_thread::sleep_for(std::chrono::microseconds(200));
+  }
+  consumer.join();
+
+  std::sort(latencies.begin(), latencies.end());
+  double p50 = latencies[total / 2];
+  double p99 = latencies[total * 99 / 100];
+  printf("Hand-off latency over %d orders: p50 %.1f us, p99 %.1f us, max %.1f us\n", total, p50, p99,
+         latencies.back());
+  TEST_ASSERT_TRUE(p50 < 10000.0);
+}
+
+int main(int argc, char** argv) {
+  UNITY_BEGIN();
+  RUN_TEST(test_fifo_full_and_wrap);
+  RUN_TEST(test_two_threads_keep_order);
+  RUN_TEST(test_handoff_latency);
+  return UNITY_END();
+}
@@ -0,0 +1,209 @@
+// Host-side simulator for interrupt-driven stepping: pio test -e native
+//
+// Plays the roles of the planner task and the timer interrupt on a virtual
+// microsecond clock, and checks where the step pulses land.
+#include <unity.h>
+#include <math.h>
+#include <random>
+#include <stdio.h>
+#include <vector>
+#include "Step_Queue.h"
+
+void setUp() {}
+void tearDown() {}
+
+// Step intervals of an AccelStepper move from rest to rest (Austin's
+// equations 13, 15 and 16, as in AccelStepper::computeNewSpeed)
+static std::vector<uint32_t> accelStepperProfile(long steps, float maxSpeed, float acceleration) {
+  std::vector<uint32_t> intervals;
+  float c0 = 0.676f * sqrtf(2.0f / acceleration) * 1000000.0f;
+  float cmin = 1000000.0f / maxSpeed;
+  float cn = c0;
+  long n = 0;
+  for (long done = 0; done < steps; done++) {
+    long remaining = steps - done;
+    float speed = n == 0 ? 0.0f : 1000000.0f / cn;
+    long stepsToStop = (long)(speed * speed / (2.0f * acceleration));
+    if (n > 0 && stepsToStop >= remaining) n = -stepsToStop;
+    if (n == 0) {
+      cn = c0;
+    } else {
+      cn = cn - (2.0f * cn) / (4.0f * n + 1);
+      if (cn < cmin) cn = cmin;
+    }
+    n++;
+    intervals.push_back((uint32_t)cn);
+  }
+  return intervals;
+}
+
+struct SimResult {
+  std::vector<uint32_t> pulses;       // time of every STEP pulse
+  std::vector<uint32_t> ideal;        // where they should be with no underruns
+  std::vector<bool> directionChanges;
+  uint32_t underruns;
+  long position;
+};
+
+// pollPeriod: how often the task gets to call fill(); latency: worst-case
+// interrupt entry delay
+static SimResult simulate(const std::vector<uint32_t>& intervals, const std::vector<bool>& forward,
+                          uint32_t pollPeriod, uint32_t latency, uint32_t seed = 1) {
+  static StepPulseEngine engine;
+  engine = StepPulseEngine();
+  std::mt19937 rng(seed);
+  std::uniform_int_distribution<uint32_t> jitter(0, latency);
+
+  SimResult result;
+  uint32_t idealTime = 0;
+  size_t planned = 0;
+  uint32_t now = 0;
+  uint32_t nextPoll = 0;
+  bool armed = false;
+  uint32_t alarm = 0;
+
+  while (planned < intervals.size() || engine.isRunning() || engine.queue.count() > 0) {
+    // Advance to whichever comes first: the task's next turn or the interrupt
+    uint32_t isrTime = alarm + jitter(rng);
+    if (armed && (int32_t)(isrTime - nextPoll) <= 0) {
+      now = isrTime;
+      StepPulse pulse;
+      uint32_t next;
+      bool more = engine.onAlarm(pulse, next);
+      result.pulses.push_back(now);
+      result.directionChanges.push_back(pulse.directionChanged);
+      armed = more;
+      if (more) {
+        uint32_t isrEnd = now + 3;   // pulse width and bookkeeping
+        alarm = (int32_t)(next - isrEnd) < 4 ? engine.late(isrEnd, 4) : next;
+      }
+      continue;
+    }
+
+    now = nextPoll;
+    while (planned < intervals.size() && engine.queue.space() > 0) {
+      idealTime += intervals[planned];
+      result.ideal.push_back(idealTime);
+      engine.queue.push(intervals[planned], forward.empty() || forward[planned]);
+      planned++;
+    }
+    engine.setPlanning(planned < intervals.size());
+    uint32_t first;
+    if (!armed && engine.start(now, first)) {
+      armed = true;
+      alarm = first;
+      // A restart times the next step from now; shift the ideal schedule to match
+      if (!result.pulses.empty()) {
+        uint32_t shift = first - result.ideal[result.pulses.size()];
+        for (size_t i = result.pulses.size(); i < result.ideal.size(); i++) result.ideal[i] += shift;
+        idealTime += shift;
+      }
+    }
+    nextPoll = now + pollPeriod;
+  }
+  result.underruns = engine.underrunCount();
+  result.position = engine.currentPosition();
+  return result;
+}
+
+void test_queue_fifo_and_wraparound() {
+  static StepQueue queue;
+  uint32_t interval;
+  bool forward;
+  TEST_ASSERT_FALSE(queue.pop(interval, forward));
+
+  uint32_t written = 0, read = 0;
+  for (int round = 0; round < 5; round++) {
+    while (queue.push(written, written & 1)) written++;
+    TEST_ASSERT_EQUAL(0, queue.space());
+    TEST_ASSERT_EQUAL(STEP_QUEUE_SIZE, queue.count());
+    for (int i = 0; i < STEP_QUEUE_SIZE / 2 + round; i++) {
+      TEST_ASSERT_TRUE(queue.pop(interval, forward));
+      TEST_ASSERT_EQUAL(read, interval);
+      TEST_ASSERT_EQUAL(read & 1, forward);
+      read++;
+    }
+  }
+  TEST_ASSERT_TRUE(queue.push(STEP_INTERVAL_MASK, true));
+}
+
+// The web server, serial and SD work only let the task in every 20 ms,
+// yet the pulses stay on the planned schedule
+void test_pulse_timing_independent_of_loop() {
+  const long steps = 20000;
+  std::vector<uint32_t> intervals = accelStepperProfile(steps, 5000.0f, 5000.0f);
+  SimResult sim = simulate(intervals, {}, 20000, 10);
+
+  TEST_ASSERT_EQUAL(steps, (long)sim.pulses.size());
+  TEST_ASSERT_EQUAL(steps, sim.position);
+  TEST_ASSERT_EQUAL(0, sim.underruns);
+
+  // Latency delays a pulse but never accumulates
+  uint32_t worst = 0;
+  for (size_t i = 0; i < sim.pulses.size(); i++) {
+    uint32_t error = sim.pulses[i] - sim.ideal[i];
+    TEST_ASSERT_TRUE((int32_t)error >= 0);
+    if (error > worst) worst = error;
+  }
+  TEST_ASSERT_TRUE(worst <= 10);
+
+  // Cruise rate reaches maxSpeed
+  uint32_t cruise = sim.pulses[steps / 2 + 1000] - sim.pulses[steps / 2];
+  float rate = 1000 * 1e6f / cruise;
+  TEST_ASSERT_FLOAT_WITHIN(50.0f, 5000.0f, rate);
+
+  // Polling run() from a loop that takes 1 ms per pass steps at most once a pass
+  uint32_t polledTime = 0, due = 0;
+  for (uint32_t interval : intervals) {
+    due = polledTime + interval;
+    polledTime = (due + 999) / 1000 * 1000;
+  }
+  char message[128];
+  snprintf(message, sizeof(message), "timer: %.2f s, worst error %u us; polled at 1 ms: %.2f s",
+           sim.pulses.back() / 1e6f, (unsigned)worst, polledTime / 1e6f);
+  TEST_MESSAGE(message);
+  TEST_ASSERT_TRUE(sim.pulses.back() < polledTime);
+}
+
+void test_underrun_pauses_without_losing_steps() {
+  const long steps = 5000;
+  std::vector<uint32_t> intervals = accelStepperProfile(steps, 5000.0f, 5000.0f);
+  // Queue holds ~51 ms of steps at full speed; a 100 ms gap must run it dry
+  SimResult sim = simulate(intervals, {}, 100000, 10);
+
+  TEST_ASSERT_TRUE(sim.underruns > 0);
+  TEST_ASSERT_EQUAL(steps, (long)sim.pulses.size());
+  TEST_ASSERT_EQUAL(steps, sim.position);
+}
+
+void test_direction_changes() {
+  std::vector<uint32_t> intervals(150, 500);
+  std::vector<bool> forward(150, true);
+  for (size_t i = 100; i < 150; i++) forward[i] = false;
+  SimResult sim = simulate(intervals, forward, 1000, 0);
+
+  TEST_ASSERT_EQUAL(50, sim.position);
+  for (size_t i = 0; i < sim.directionChanges.size(); i++) {
+    TEST_ASSERT_EQUAL(i == 0 || i == 100, sim.directionChanges[i]);
+  }
+}
+
+// Intervals shorter than the interrupt can re-arm for are stretched, not dropped
+void test_late_alarm_is_rescheduled() {
+  std::vector<uint32_t> intervals(1000, 2);
+  SimResult sim = simulate(intervals, {}, 500, 0);
+  TEST_ASSERT_EQUAL(1000, (long)sim.pulses.size());
+  for (size_t i = 1; i < sim.pulses.size(); i++) {
+    TEST_ASSERT_TRUE(sim.pulses[i] - sim.pulses[i - 1] >= 4);
+  }
+}
+
+int main(int argc, char** argv) {
+  UNITY_BEGIN();
+  RUN_TEST(test_queue_fifo_and_wraparound);
+  RUN_TEST(test_pulse_timing_independent_of_loop);
+  RUN_TEST(test_underrun_pauses_without_losing_steps);
+  RUN_TEST(test_direction_changes);
+  RUN_TEST(test_late_alarm_is_rescheduled);
+  return UNITY_END();
+}
@@ -0,0 +1,216 @@
+// Host-side tests for the web request metrics: pio test -e native
+//
+// Routes are registered through Metrics.on() on the AsyncWebServer stand-in
+// and driven with stubDispatch. Handlers advance stubMicros to "take" a
+// known time, so bucket placement and percentiles are exact.
+#include <unity.h>
+#include "Web_Metrics.h"
+
+static AsyncWebServer server(80);
+static uint8_t fastRoute, slowRoute, postRoute, streamRoute, missingRoute, idleRoute;
+static uint32_t nextDelay = 0;
+
+static uint8_t routeFor(const char* uri) {
+  MetricsRoute r;
+  for (uint8_t i = 0; Metrics.copyRoute(i, r); i++) {
+    if (strcmp(r.uri, uri) == 0) return i;
+  }
+  return METRICS_NO_ROUTE;
+}
+
+static MetricsRoute snapshot(uint8_t route) {
+  MetricsRoute r;
+  memset(&r, 0, sizeof(r));
+  Metrics.copyRoute(route, r);
+  return r;
+}
+
+static int dispatch(WebRequestMethodComposite method, const char* url, const String& body = String()) {
+  AsyncWebServerRequest request(method, url);
+  server.stubDispatch(request, body);
+  return request.stubCode();
+}
+
+static String renderMetrics(size_t chunk) {
+  MetricsTextStream stream(Metrics);
+  std::vector<uint8_t> buffer(chunk);
+  String text;
+  size_t n;
+  while ((n = stream.fill(buffer.data(), chunk)) > 0) text.concat((const char*)buffer.data(), n);
+  return text;
+}
+
+static bool hasLine(const String& text, const String& line) {
+  return text.startsWith(line + "\n") || text.indexOf("\n" + line + "\n") >= 0;
+}
+
+static void registerRoutes() {
+  Metrics.on(server, "/fast", HTTP_GET, [](AsyncWebServerRequest* request) {
+    stubMicros += nextDelay;
+    sendResponse(request, 200, "text/plain", "ok");
+  });
+  Metrics.on(server, "/slow", HTTP_GET, [](AsyncWebServerRequest* request) {
+    stubMicros += 30000;
+    sendResponse(request, 503, "text/plain", "busy");
+  });
+  Metrics.on(server, "/api/item", HTTP_POST, [](AsyncWebServerRequest* request) {
+    stubMicros += 50;
+    sendResponse(request, 201, "application/json", "{}");
+  }, nullptr, [](AsyncWebServerRequest* request, uint8_t* data, size_t len, size_t index, size_t total) {
+    stubMicros += 400;
+  });
+  Metrics.on(server, "/stream", HTTP_GET, [](AsyncWebServerRequest* request) {
+    sendMetrics(request);
+  });
+  Metrics.on(server, "^\\/api\\/items\\/([\\w\\-]+)$", HTTP_GET, [](AsyncWebServerRequest* request) {
+    sendRedirect(request, "/login.html");
+  });
+  Metrics.onNotFound(server, [](AsyncWebServerRequest* request) {
+    sendResponse(request, 404, "text/plain", "Not Found");
+  });
+  fastRoute = routeFor("/fast");
+  slowRoute = routeFor("/slow");
+  postRoute = routeFor("/api/item");
+  streamRoute = routeFor("/stream");
+  idleRoute = routeFor("^\\/api\\/items\\/([\\w\\-]+)$");
+  missingRoute = routeFor("(not found)");
+}
+
+void setUp() {
+  stubMicros = 1000000UL;
+  nextDelay = 0;
+  Metrics.reset();
+}
+void tearDown() {}
+
+void test_routes_are_registered_in_order() {
+  TEST_ASSERT_EQUAL(6, Metrics.count());
+  TEST_ASSERT_EQUAL(0, fastRoute);
+  TEST_ASSERT_EQUAL(5, missingRoute);
+  TEST_ASSERT_EQUAL_STRING("POST", WebMetrics::methodName(snapshot(postRoute).method));
+  TEST_ASSERT_EQUAL_STRING("ANY", WebMetrics::methodName(snapshot(missingRoute).method));
+}
+
+void test_handler_time_lands_in_buckets() {
+  const uint32_t delays[] = {50, 100, 101, 2000, 300000};
+  for (uint32_t d : delays) {
+    nextDelay = d;
+    TEST_ASSERT_EQUAL(200, dispatch(HTTP_GET, "/fast"));
+  }
+
+  MetricsRoute r = snapshot(fastRoute);
+  TEST_ASSERT_EQUAL(5, r.requests);
+  TEST_ASSERT_EQUAL(50 + 100 + 101 + 2000 + 300000, r.totalMicros);
+  TEST_ASSERT_EQUAL(300000, r.maxMicros);
+  TEST_ASSERT_EQUAL(2, r.buckets[0]);                     // <= 100 us, bound inclusive
+  TEST_ASSERT_EQUAL(1, r.buckets[1]);                     // <= 250 us
+  TEST_ASSERT_EQUAL(1, r.buckets[4]);                     // <= 2.5 ms
+  TEST_ASSERT_EQUAL(1, r.buckets[METRICS_BUCKETS - 1]);   // +Inf
+
+  TEST_ASSERT_EQUAL(250, WebMetrics::percentile(r, 50));
+  TEST_ASSERT_EQUAL(2500, WebMetrics::percentile(r, 80));
+  TEST_ASSERT_EQUAL(UINT32_MAX, WebMetrics::percentile(r, 99));
+}
+
+void test_responses_are_counted_by_status_class() {
+  dispatch(HTTP_GET, "/fast");
+  dispatch(HTTP_GET, "/slow");
+  dispatch(HTTP_GET, "/api/items/RX-1");
+  dispatch(HTTP_GET, "/nowhere");
+
+  TEST_ASSERT_EQUAL(1, snapshot(fastRoute).responses[0]);
+  TEST_ASSERT_EQUAL(2, snapshot(fastRoute).bytes);
+  TEST_ASSERT_EQUAL(1, snapshot(slowRoute).responses[3]);
+  TEST_ASSERT_EQUAL(1, snapshot(idleRoute).responses[1]);
+  TEST_ASSERT_EQUAL(1, snapshot(missingRoute).responses[2]);
+  TEST_ASSERT_EQUAL(1, snapshot(missingRoute).requests);
+
+  // Outside any handler there is no route to charge
+  Metrics.noteResponse(200, 10);
+  TEST_ASSERT_EQUAL(2, snapshot(fastRoute).bytes);
+}
+
+void test_body_time_is_added_to_its_request() {
+  TEST_ASSERT_EQUAL(201, dispatch(HTTP_POST, "/api/item", "{\"id\":1}"));
+  MetricsRoute r = snapshot(postRoute);
+  TEST_ASSERT_EQUAL(1, r.requests);
+  TEST_ASSERT_EQUAL(450, r.totalMicros);
+  TEST_ASSERT_EQUAL(0, r.bodyMicros);
+  TEST_ASSERT_EQUAL(1, r.buckets[2]);                     // <= 500 us
+}
+
+void test_streamed_bytes_are_charged_to_their_route() {
+  dispatch(HTTP_GET, "/fast");
+  AsyncWebServerRequest request(HTTP_GET, "/stream");
+  server.stubDispatch(request);
+  TEST_ASSERT_EQUAL(200, request.stubCode());
+
+  MetricsRoute r = snapshot(streamRoute);
+  TEST_ASSERT_EQUAL(1, r.responses[0]);
+  TEST_ASSERT_EQUAL(request.stubBody().length(), r.bytes);
+  TEST_ASSERT_TRUE(hasLine(request.stubBody(),
+                           "pharmassist_http_requests_total{method=\"GET\",route=\"/fast\"} 1"));
+}
+
+void test_text_format() {
+  nextDelay = 300;
+  dispatch(HTTP_GET, "/fast");
+  dispatch(HTTP_GET, "/api/items/RX-1");
+  stubHeapMaxAlloc = 90000;
+  Metrics.sampleHeap();
+  stubHeapMaxAlloc = 110000;
+  Metrics.observeUartQueue(48);
+  Metrics.observeUartQueue(0);
+
+  // One byte at a time must give the same text as whole chunks
+  String text = renderMetrics(1);
+  TEST_ASSERT_EQUAL_STRING(renderMetrics(1436).c_str(), text.c_str());
+
+  TEST_ASSERT_TRUE(text.startsWith("# TYPE pharmassist_http_requests_total counter\n"));
+  TEST_ASSERT_TRUE(hasLine(text, "pharmassist_http_requests_total{method=\"GET\",route=\"/fast\"} 1"));
+  TEST_ASSERT_TRUE(hasLine(text, "pharmassist_http_responses_total{method=\"GET\",route=\"/fast\",code=\"2xx\"} 1"));
+  TEST_ASSERT_TRUE(hasLine(text,
+    "pharmassist_http_responses_total{method=\"GET\",route=\"^\\\\/api\\\\/items\\\\/([\\\\w\\\\-]+)$\",code=\"3xx\"} 1"));
+  TEST_ASSERT_TRUE(hasLine(text, "# TYPE pharmassist_http_handler_us histogram"));
+  TEST_ASSERT_TRUE(hasLine(text, "pharmassist_http_handler_us_bucket{method=\"GET\",route=\"/fast\",le=\"250\"} 0"));
+  TEST_ASSERT_TRUE(hasLine(text, "pharmassist_http_handler_us_bucket{method=\"GET\",route=\"/fast\",le=\"500\"} 1"));
+  TEST_ASSERT_TRUE(hasLine(text, "pharmassist_http_handler_us_bucket{method=\"GET\",route=\"/fast\",le=\"+Inf\"} 1"));
+  TEST_ASSERT_TRUE(hasLine(text, "pharmassist_http_handler_us_sum{method=\"GET\",route=\"/fast\"} 300"));
+  TEST_ASSERT_TRUE(hasLine(text, "pharmassist_http_handler_us_count{method=\"GET\",route=\"/fast\"} 1"));
+  TEST_ASSERT_TRUE(hasLine(text, "pharmassist_heap_free_bytes 200000"));
+  TEST_ASSERT_TRUE(hasLine(text, "pharmassist_heap_largest_block_low_bytes 90000"));
+  TEST_ASSERT_TRUE(hasLine(text, "pharmassist_uart_tx_queue_bytes 0"));
+  TEST_ASSERT_TRUE(hasLine(text, "pharmassist_uart_tx_queue_high_bytes 48"));
+  TEST_ASSERT_TRUE(hasLine(text, "# TYPE pharmassist_sd_reads_total counter"));
+
+  // Routes nobody has called stay out of the output
+  TEST_ASSERT_EQUAL(-1, text.indexOf("route=\"/slow\""));
+  TEST_ASSERT_EQUAL(-1, text.indexOf("(not found)"));
+}
+
+void test_reset_clears_counters() {
+  dispatch(HTTP_GET, "/slow");
+  Metrics.observeUartQueue(64);
+  Metrics.observeUartQueue(8);
+  Metrics.reset();
+
+  MetricsRoute r = snapshot(slowRoute);
+  TEST_ASSERT_EQUAL(0, r.requests);
+  TEST_ASSERT_EQUAL(0, r.responses[3]);
+  TEST_ASSERT_EQUAL(0, r.maxMicros);
+  TEST_ASSERT_EQUAL(8, Metrics.getGauges().uartQueueHigh);
+  TEST_ASSERT_EQUAL(-1, renderMetrics(256).indexOf("pharmassist_http_requests_total{"));
+}
+
+int main(int argc, char** argv) {
+  registerRoutes();
+  UNITY_BEGIN();
+  RUN_TEST(test_routes_are_registered_in_order);
+  RUN_TEST(test_handler_time_lands_in_buckets);
+  RUN_TEST(test_responses_are_counted_by_status_class);
+  RUN_TEST(test_body_time_is_added_to_its_request);
+  RUN_TEST(test_streamed_bytes_are_charged_to_their_route);
+  RUN_TEST(test_text_format);
+  RUN_TEST(test_reset_clears_counters);
+  return UNITY_END();
+}
@@ -0,0 +1,166 @@
+// Host-side tests for the API session checks: pio test -e native
+//
+// Requests are the AsyncWebServerRequest stand-in from test/stubs, and time
+// is stubMicros, so session expiry can be played out without waiting.
+#include <unity.h>
+#include <chrono>
+#include <stdio.h>
+#include "Web_Session.h"
+
+void setUp() {
+  stubMicros = 0;
+  Sessions.begin(60000);
+  Sessions.clear();
+}
+void tearDown() {}
+
+static SessionToken makeToken(uint8_t seed) {
+  SessionToken token;
+  for (size_t i = 0; i < SESSION_TOKEN_SIZE; i++) token.bytes[i] = (uint8_t)(seed + i * 7);
+  return token;
+}
+
+static String tokenText(const SessionToken& token) {
+  char text[SESSION_TOKEN_TEXT_LENGTH + 1];
+  formatSessionToken(token, text);
+  return text;
+}
+
+static bool sameToken(const SessionToken& a, const SessionToken& b) {
+  return memcmp(a.bytes, b.bytes, SESSION_TOKEN_SIZE) == 0;
+}
+
+static bool isZero(const SessionToken& token) {
+  return sameToken(token, SessionToken{});
+}
+
+void test_token_from_cookie_and_bearer() {
+  SessionToken token = makeToken(1);
+  String text = tokenText(token);
+
+  AsyncWebServerRequest cookie;
+  cookie.stubHeader("Cookie", "theme=dark; session_token=" + text + "; lang=en");
+  TEST_ASSERT_TRUE(sameToken(token, getSessionToken(&cookie)));
+
+  AsyncWebServerRequest last;
+  last.stubHeader("cookie", "session_token=" + text);     // header names are case-insensitive
+  TEST_ASSERT_TRUE(sameToken(token, getSessionToken(&last)));
+
+  AsyncWebServerRequest bearer;
+  bearer.stubHeader("Authorization", "Bearer " + text);
+  TEST_ASSERT_TRUE(sameToken(token, getSessionToken(&bearer)));
+
+  // A bad cookie falls back to the Authorization header
+  AsyncWebServerRequest both;
+  both.stubHeader("Cookie", "session_token=garbage");
+  both.stubHeader("Authorization", "Bearer " + text);
+  TEST_ASSERT_TRUE(sameToken(token, getSessionToken(&both)));
+}
+
+void test_missing_or_malformed_token_is_zero() {
+  AsyncWebServerRequest none;
+  TEST_ASSERT_TRUE(isZero(getSessionToken(&none)));
+
+  String text = tokenText(makeToken(2));
+  const char* cookies[] = {
+    "session_token=",
+    "session_token=abc",
+    "other=1",
+  };
+  for (const char* value : cookies) {
+    AsyncWebServerRequest request;
+    request.stubHeader("Cookie", value);
+    TEST_ASSERT_TRUE(isZero(getSessionToken(&request)));
+  }
+
+  AsyncWebServerRequest basic;
+  basic.stubHeader("Authorization", "Basic " + text);
+  TEST_ASSERT_TRUE(isZero(getSessionToken(&basic)));
+
+  AsyncWebServerRequest longer;
+  longer.stubHeader("Cookie", "session_token=" + text + "x");
+  TEST_ASSERT_TRUE(isZero(getSessionToken(&longer)));
+}
+
+void test_validate_refreshes_and_expires() {
+  SessionToken token = makeToken(3);
+  TEST_ASSERT_TRUE(Sessions.create(token, "doctor1", "Dr. Sarah Johnson"));
+  TEST_ASSERT_EQUAL_STRING("doctor1", getCurrentUsername(token).c_str());
+
+  // Used every 40 s, the session outlives its 60 s timeout
+  for (int i = 0; i < 5; i++) {
+    stubMicros += 40000000UL;
+    Sessions.expire(millis());
+    TEST_ASSERT_TRUE(validateSession(token));
+  }
+
+  stubMicros += 61000000UL;
+  TEST_ASSERT_FALSE(validateSession(token));
+  TEST_ASSERT_EQUAL_STRING("", getCurrentUsername(token).c_str());
+  TEST_ASSERT_FALSE(validateSession(SessionToken{}));
+}
+
+// The checks wired into a route, the way main.cpp uses them
+void test_protected_route() {
+  AsyncWebServer server(80);
+  server.on("/api/session-info", HTTP_GET, [](AsyncWebServerRequest* request) {
+    SessionToken token = getSessionToken(request);
+    if (!validateSession(token)) {
+      request->send(401, "application/json", "{\"error\":\"Unauthorized\"}");
+      return;
+    }
+    request->send(200, "application/json", "{\"username\":\"" + getCurrentUsername(token) + "\"}");
+  });
+
+  SessionToken token = makeToken(4);
+  Sessions.create(token, "admin", "Dr. John Smith");
+
+  AsyncWebServerRequest anonymous(HTTP_GET, "/api/session-info");
+  TEST_ASSERT_TRUE(server.stubDispatch(anonymous));
+  TEST_ASSERT_EQUAL(401, anonymous.stubCode());
+
+  AsyncWebServerRequest signedIn(HTTP_GET, "/api/session-info");
+  signedIn.stubHeader("Cookie", "session_token=" + tokenText(token));
+  TEST_ASSERT_TRUE(server.stubDispatch(signedIn));
+  TEST_ASSERT_EQUAL(200, signedIn.stubCode());
+  TEST_ASSERT_EQUAL_STRING("{\"username\":\"admin\"}", signedIn.stubBody().c_str());
+
+  AsyncWebServerRequest post(HTTP_POST, "/api/session-info");
+  TEST_ASSERT_FALSE(server.stubDispatch(post));
+}
+
+// Cookie parse + lookup per request with a full session table
+void test_lookup_throughput() {
+  String cookies[SESSION_TABLE_CAPACITY];
+  for (size_t i = 0; i < SESSION_TABLE_CAPACITY; i++) {
+    SessionToken token = makeToken((uint8_t)(i * 3 + 5));
+    Sessions.create(token, "user", "User");
+    cookies[i] = "theme=dark; session_token=" + tokenText(token);
+  }
+  AsyncWebServerRequest requests[8];
+  for (size_t i = 0; i < 8; i++) requests[i].stubHeader("Cookie", cookies[i * 5]);
+
+  const int rounds = 200000;
+  size_t valid = 0;
+  auto start = std::chrono::steady_clock::now();
+  for (int i = 0; i < rounds; i++) {
+    if (validateSession(getSessionToken(&requests[i & 7]))) valid++;
+  }
+  double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+  TEST_ASSERT_EQUAL(rounds, valid);
+
+  char message[80];
+  snprintf(message, sizeof(message), "getSessionToken + validateSession: %.0f ns per request",
+           seconds * 1e9 / rounds);
+  TEST_MESSAGE(message);
+}
+
+int main(int argc, char** argv) {
+  UNITY_BEGIN();
+  RUN_TEST(test_token_from_cookie_and_bearer);
+  RUN_TEST(test_missing_or_malformed_token_is_zero);
+  RUN_TEST(test_validate_refreshes_and_expires);
+  RUN_TEST(test_protected_route);
+  RUN_TEST(test_lookup_throughput);
+  return UNITY_END();
+}